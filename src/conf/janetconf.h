@@ -37,10 +37,15 @@
 /* #define JANET_NO_THREADS */
 /* #define JANET_NO_FFI */
 /* #define JANET_NO_FFI_JIT */
+/* #define JANET_NO_GC_SLAB */
+/* #define JANET_NO_LAZY_IMAGE */
+/* #define JANET_NO_METHOD_CACHE */
+/* #define JANET_NO_SYMBOL_POOL */
 
 /* Other settings */
 /* #define JANET_DEBUG */
 /* #define JANET_PRF */
+/* #define JANET_JIT */
 /* #define JANET_NO_UTC_MKTIME */
 /* #define JANET_OUT_OF_MEMORY do { printf("janet out of memory\n"); exit(1); } while (0) */
 /* #define JANET_EXIT(msg) do { printf("C assert failed executing janet: %s\n", msg); exit(1); } while (0) */
@@ -52,6 +57,7 @@
 /* #define JANET_OS_NAME my-custom-os */
 /* #define JANET_ARCH_NAME pdp-8 */
 /* #define JANET_EV_NO_EPOLL */
+/* #define JANET_EV_NO_IO_URING */
 /* #define JANET_EV_NO_KQUEUE */
 /* #define JANET_NO_INTERPRETER_INTERRUPT */
 /* #define JANET_NO_IPV6 */
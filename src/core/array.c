@@ -75,6 +75,8 @@ JanetArray *janet_array_n(const Janet *elements, int32_t n) {
 void janet_array_ensure(JanetArray *array, int32_t capacity, int32_t growth) {
     Janet *newData;
     Janet *old = array->data;
+    /* Callers write into the array after ensuring capacity */
+    janet_gc_barrier(array);
     if (capacity <= array->capacity) return;
     int64_t new_capacity = ((int64_t) capacity) * growth;
     if (new_capacity > INT32_MAX) new_capacity = INT32_MAX;
@@ -173,6 +175,7 @@ JANET_CORE_FN(cfun_array_fill,
     janet_arity(argc, 1, 2);
     JanetArray *array = janet_getarray(argv, 0);
     Janet x = (argc == 2) ? argv[1] : janet_wrap_nil();
+    janet_gc_barrier(array);
     for (int32_t i = 0; i < array->count; i++) {
         array->data[i] = x;
     }
@@ -78,20 +78,30 @@ static const JanetInstructionDef janet_ops[] = {
     {"divf", JOP_DIVIDE_FLOOR},
     {"divim", JOP_DIVIDE_IMMEDIATE},
     {"eq", JOP_EQUALS},
+    {"eqbr", JOP_EQUALS_BRANCH},
     {"eqim", JOP_EQUALS_IMMEDIATE},
+    {"eqimbr", JOP_EQUALS_IMMEDIATE_BRANCH},
     {"err", JOP_ERROR},
     {"get", JOP_GET},
     {"geti", JOP_GET_INDEX},
+    {"getim", JOP_GET_IMMEDIATE},
     {"gt", JOP_GREATER_THAN},
+    {"gtbr", JOP_GREATER_THAN_BRANCH},
     {"gte", JOP_GREATER_THAN_EQUAL},
+    {"gtebr", JOP_GREATER_THAN_EQUAL_BRANCH},
     {"gtim", JOP_GREATER_THAN_IMMEDIATE},
+    {"gtimbr", JOP_GREATER_THAN_IMMEDIATE_BRANCH},
     {"in", JOP_IN},
+    {"inim", JOP_IN_IMMEDIATE},
     {"jmp", JOP_JUMP},
     {"jmpif", JOP_JUMP_IF},
     {"jmpni", JOP_JUMP_IF_NIL},
     {"jmpnn", JOP_JUMP_IF_NOT_NIL},
     {"jmpno", JOP_JUMP_IF_NOT},
     {"ldc", JOP_LOAD_CONSTANT},
+    {"ldccall", JOP_LOAD_CONSTANT_CALL},
+    {"ldcpush", JOP_LOAD_CONSTANT_PUSH},
+    {"ldctcall", JOP_LOAD_CONSTANT_TAILCALL},
     {"ldf", JOP_LOAD_FALSE},
     {"ldi", JOP_LOAD_INTEGER},
     {"ldn", JOP_LOAD_NIL},
@@ -100,8 +110,11 @@ static const JanetInstructionDef janet_ops[] = {
     {"ldu", JOP_LOAD_UPVALUE},
     {"len", JOP_LENGTH},
     {"lt", JOP_LESS_THAN},
+    {"ltbr", JOP_LESS_THAN_BRANCH},
     {"lte", JOP_LESS_THAN_EQUAL},
+    {"ltebr", JOP_LESS_THAN_EQUAL_BRANCH},
     {"ltim", JOP_LESS_THAN_IMMEDIATE},
+    {"ltimbr", JOP_LESS_THAN_IMMEDIATE_BRANCH},
     {"mkarr", JOP_MAKE_ARRAY},
     {"mkbtp", JOP_MAKE_BRACKET_TUPLE},
     {"mkbuf", JOP_MAKE_BUFFER},
@@ -115,7 +128,9 @@ static const JanetInstructionDef janet_ops[] = {
     {"mul", JOP_MULTIPLY},
     {"mulim", JOP_MULTIPLY_IMMEDIATE},
     {"neq", JOP_NOT_EQUALS},
+    {"neqbr", JOP_NOT_EQUALS_BRANCH},
     {"neqim", JOP_NOT_EQUALS_IMMEDIATE},
+    {"neqimbr", JOP_NOT_EQUALS_IMMEDIATE_BRANCH},
     {"next", JOP_NEXT},
     {"noop", JOP_NOOP},
     {"prop", JOP_PROPAGATE},
@@ -1024,6 +1039,7 @@ static Janet janet_disasm_defs(JanetFuncDef *def) {
 }
 
 Janet janet_disasm(JanetFuncDef *def) {
+    janet_funcdef_ensure(def);
     JanetTable *ret = janet_table(10);
     janet_table_put(ret, janet_ckeywordv("arity"), janet_disasm_arity(def));
     janet_table_put(ret, janet_ckeywordv("min-arity"), janet_disasm_min_arity(def));
@@ -1080,6 +1096,7 @@ JANET_CORE_FN(cfun_disasm,
     JanetFunction *f = janet_getfunction(argv, 0);
     if (argc == 2) {
         JanetKeyword kw = janet_getkeyword(argv, 1);
+        janet_funcdef_ensure(f->def);
         if (!janet_cstrcmp(kw, "arity")) return janet_disasm_arity(f->def);
         if (!janet_cstrcmp(kw, "min-arity")) return janet_disasm_min_arity(f->def);
         if (!janet_cstrcmp(kw, "max-arity")) return janet_disasm_max_arity(f->def);
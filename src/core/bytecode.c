@@ -106,7 +106,22 @@ enum JanetInstructionType janet_instructions[JOP_INSTRUCTION_COUNT] = {
     JINT_SSS, /* JOP_NEXT */
     JINT_SSS, /* JOP_NOT_EQUALS, */
     JINT_SSI, /* JOP_NOT_EQUALS_IMMEDIATE, */
-    JINT_SSS /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_CANCEL, */
+    JINT_SSI, /* JOP_GET_IMMEDIATE, */
+    JINT_SSI, /* JOP_IN_IMMEDIATE, */
+    JINT_SSS, /* JOP_LESS_THAN_BRANCH, */
+    JINT_SSS, /* JOP_LESS_THAN_EQUAL_BRANCH, */
+    JINT_SSI, /* JOP_LESS_THAN_IMMEDIATE_BRANCH, */
+    JINT_SSS, /* JOP_GREATER_THAN_BRANCH, */
+    JINT_SSS, /* JOP_GREATER_THAN_EQUAL_BRANCH, */
+    JINT_SSI, /* JOP_GREATER_THAN_IMMEDIATE_BRANCH, */
+    JINT_SSS, /* JOP_EQUALS_BRANCH, */
+    JINT_SSI, /* JOP_EQUALS_IMMEDIATE_BRANCH, */
+    JINT_SSS, /* JOP_NOT_EQUALS_BRANCH, */
+    JINT_SSI, /* JOP_NOT_EQUALS_IMMEDIATE_BRANCH, */
+    JINT_SC, /* JOP_LOAD_CONSTANT_PUSH, */
+    JINT_SC, /* JOP_LOAD_CONSTANT_CALL, */
+    JINT_SC /* JOP_LOAD_CONSTANT_TAILCALL, */
 };
 
 /* Remove all noops while preserving jumps and debugging information.
@@ -176,6 +191,159 @@ void janet_bytecode_remove_noops(JanetFuncDef *def) {
     janet_sfree(pc_map);
 }
 
+/* Operand fields of an instruction that name slots it reads. JANET_READ_STACK
+ * marks instructions that consume pushed arguments, which must never be
+ * removed even though they only write their D slot. */
+#define JANET_READ_A 0x1
+#define JANET_READ_B 0x2
+#define JANET_READ_C 0x4
+#define JANET_READ_D 0x8
+#define JANET_READ_E 0x10
+#define JANET_READ_STACK 0x20
+
+/* Get the operand fields that an instruction reads slots from. */
+static int janet_bytecode_reads(uint32_t instr) {
+    switch (instr & 0x7F) {
+
+        /* Group instructions my how they read from slots */
+
+        /* No reads or writes */
+        default:
+            janet_assert(0, "unhandled instruction");
+            return 0;
+        case JOP_JUMP:
+        case JOP_NOOP:
+        case JOP_RETURN_NIL:
+        /* Write A */
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_UPVALUE:
+        case JOP_CLOSURE:
+        case JOP_LOAD_CONSTANT_PUSH:
+        case JOP_LOAD_CONSTANT_CALL:
+        case JOP_LOAD_CONSTANT_TAILCALL:
+        /* Write D */
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_SELF:
+            return 0;
+        case JOP_MAKE_ARRAY:
+        case JOP_MAKE_BUFFER:
+        case JOP_MAKE_STRING:
+        case JOP_MAKE_STRUCT:
+        case JOP_MAKE_TABLE:
+        case JOP_MAKE_TUPLE:
+        case JOP_MAKE_BRACKET_TUPLE:
+            /* Reads from the stack, don't remove */
+            return JANET_READ_D | JANET_READ_STACK;
+
+        /* Read A */
+        case JOP_ERROR:
+        case JOP_TYPECHECK:
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+        case JOP_SET_UPVALUE:
+        /* Write E, Read A */
+        case JOP_MOVE_FAR:
+            return JANET_READ_A;
+
+        /* Read B */
+        case JOP_SIGNAL:
+        /* Write A, Read B */
+        case JOP_ADD_IMMEDIATE:
+        case JOP_SUBTRACT_IMMEDIATE:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_DIVIDE_IMMEDIATE:
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_GET_INDEX:
+        case JOP_GET_IMMEDIATE:
+        case JOP_IN_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE_BRANCH:
+        case JOP_LESS_THAN_IMMEDIATE_BRANCH:
+        case JOP_EQUALS_IMMEDIATE_BRANCH:
+        case JOP_NOT_EQUALS_IMMEDIATE_BRANCH:
+            return JANET_READ_B;
+
+        /* Read D */
+        case JOP_RETURN:
+        case JOP_PUSH:
+        case JOP_PUSH_ARRAY:
+        case JOP_TAILCALL:
+            return JANET_READ_D;
+
+        /* Write A, Read E */
+        case JOP_MOVE_NEAR:
+        case JOP_LENGTH:
+        case JOP_BNOT:
+        case JOP_CALL:
+            return JANET_READ_E;
+
+        /* Read A, B */
+        case JOP_PUT_INDEX:
+            return JANET_READ_A | JANET_READ_B;
+
+        /* Read A, E */
+        case JOP_PUSH_2:
+            return JANET_READ_A | JANET_READ_E;
+
+        /* Read B, C */
+        case JOP_PROPAGATE:
+        /* Write A, Read B and C */
+        case JOP_BAND:
+        case JOP_BOR:
+        case JOP_BXOR:
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE:
+        case JOP_DIVIDE_FLOOR:
+        case JOP_MODULO:
+        case JOP_REMAINDER:
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+        case JOP_GREATER_THAN:
+        case JOP_LESS_THAN:
+        case JOP_EQUALS:
+        case JOP_COMPARE:
+        case JOP_IN:
+        case JOP_GET:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_NOT_EQUALS:
+        case JOP_CANCEL:
+        case JOP_RESUME:
+        case JOP_NEXT:
+        case JOP_GREATER_THAN_BRANCH:
+        case JOP_LESS_THAN_BRANCH:
+        case JOP_EQUALS_BRANCH:
+        case JOP_GREATER_THAN_EQUAL_BRANCH:
+        case JOP_LESS_THAN_EQUAL_BRANCH:
+        case JOP_NOT_EQUALS_BRANCH:
+            return JANET_READ_B | JANET_READ_C;
+
+        /* Read A, B, C */
+        case JOP_PUT:
+        case JOP_PUSH_3:
+            return JANET_READ_A | JANET_READ_B | JANET_READ_C;
+    }
+}
+
+#define AA ((instr >> 8)  & 0xFF)
+#define BB ((instr >> 16) & 0xFF)
+#define CC (instr >> 24)
+#define DD (instr >> 8)
+#define EE (instr >> 16)
+
 /* Remove redundant loads, moves and other instructions if possible and convert them to
  * noops. Input is assumed valid bytecode. */
 void janet_bytecode_movopt(JanetFuncDef *def) {
@@ -197,146 +365,15 @@ void janet_bytecode_movopt(JanetFuncDef *def) {
             }
         }
 
-#define AA ((instr >> 8)  & 0xFF)
-#define BB ((instr >> 16) & 0xFF)
-#define CC (instr >> 24)
-#define DD (instr >> 8)
-#define EE (instr >> 16)
-
         /* Check reads and writes */
         for (int32_t i = 0; i < def->bytecode_length; i++) {
             uint32_t instr = def->bytecode[i];
-            switch (instr & 0x7F) {
-
-                /* Group instructions my how they read from slots */
-
-                /* No reads or writes */
-                default:
-                    janet_assert(0, "unhandled instruction");
-                case JOP_JUMP:
-                case JOP_NOOP:
-                case JOP_RETURN_NIL:
-                /* Write A */
-                case JOP_LOAD_INTEGER:
-                case JOP_LOAD_CONSTANT:
-                case JOP_LOAD_UPVALUE:
-                case JOP_CLOSURE:
-                /* Write D */
-                case JOP_LOAD_NIL:
-                case JOP_LOAD_TRUE:
-                case JOP_LOAD_FALSE:
-                case JOP_LOAD_SELF:
-                    break;
-                case JOP_MAKE_ARRAY:
-                case JOP_MAKE_BUFFER:
-                case JOP_MAKE_STRING:
-                case JOP_MAKE_STRUCT:
-                case JOP_MAKE_TABLE:
-                case JOP_MAKE_TUPLE:
-                case JOP_MAKE_BRACKET_TUPLE:
-                    /* Reads from the stack, don't remove */
-                    janetc_regalloc_touch(&ra, DD);
-                    break;
-
-                /* Read A */
-                case JOP_ERROR:
-                case JOP_TYPECHECK:
-                case JOP_JUMP_IF:
-                case JOP_JUMP_IF_NOT:
-                case JOP_JUMP_IF_NIL:
-                case JOP_JUMP_IF_NOT_NIL:
-                case JOP_SET_UPVALUE:
-                /* Write E, Read A */
-                case JOP_MOVE_FAR:
-                    janetc_regalloc_touch(&ra, AA);
-                    break;
-
-                /* Read B */
-                case JOP_SIGNAL:
-                /* Write A, Read B */
-                case JOP_ADD_IMMEDIATE:
-                case JOP_SUBTRACT_IMMEDIATE:
-                case JOP_MULTIPLY_IMMEDIATE:
-                case JOP_DIVIDE_IMMEDIATE:
-                case JOP_SHIFT_LEFT_IMMEDIATE:
-                case JOP_SHIFT_RIGHT_IMMEDIATE:
-                case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
-                case JOP_GREATER_THAN_IMMEDIATE:
-                case JOP_LESS_THAN_IMMEDIATE:
-                case JOP_EQUALS_IMMEDIATE:
-                case JOP_NOT_EQUALS_IMMEDIATE:
-                case JOP_GET_INDEX:
-                    janetc_regalloc_touch(&ra, BB);
-                    break;
-
-                /* Read D */
-                case JOP_RETURN:
-                case JOP_PUSH:
-                case JOP_PUSH_ARRAY:
-                case JOP_TAILCALL:
-                    janetc_regalloc_touch(&ra, DD);
-                    break;
-
-                /* Write A, Read E */
-                case JOP_MOVE_NEAR:
-                case JOP_LENGTH:
-                case JOP_BNOT:
-                case JOP_CALL:
-                    janetc_regalloc_touch(&ra, EE);
-                    break;
-
-                /* Read A, B */
-                case JOP_PUT_INDEX:
-                    janetc_regalloc_touch(&ra, AA);
-                    janetc_regalloc_touch(&ra, BB);
-                    break;
-
-                /* Read A, E */
-                case JOP_PUSH_2:
-                    janetc_regalloc_touch(&ra, AA);
-                    janetc_regalloc_touch(&ra, EE);
-                    break;
-
-                /* Read B, C */
-                case JOP_PROPAGATE:
-                /* Write A, Read B and C */
-                case JOP_BAND:
-                case JOP_BOR:
-                case JOP_BXOR:
-                case JOP_ADD:
-                case JOP_SUBTRACT:
-                case JOP_MULTIPLY:
-                case JOP_DIVIDE:
-                case JOP_DIVIDE_FLOOR:
-                case JOP_MODULO:
-                case JOP_REMAINDER:
-                case JOP_SHIFT_LEFT:
-                case JOP_SHIFT_RIGHT:
-                case JOP_SHIFT_RIGHT_UNSIGNED:
-                case JOP_GREATER_THAN:
-                case JOP_LESS_THAN:
-                case JOP_EQUALS:
-                case JOP_COMPARE:
-                case JOP_IN:
-                case JOP_GET:
-                case JOP_GREATER_THAN_EQUAL:
-                case JOP_LESS_THAN_EQUAL:
-                case JOP_NOT_EQUALS:
-                case JOP_CANCEL:
-                case JOP_RESUME:
-                case JOP_NEXT:
-                    janetc_regalloc_touch(&ra, BB);
-                    janetc_regalloc_touch(&ra, CC);
-                    break;
-
-                /* Read A, B, C */
-                case JOP_PUT:
-                case JOP_PUSH_3:
-                    janetc_regalloc_touch(&ra, AA);
-                    janetc_regalloc_touch(&ra, BB);
-                    janetc_regalloc_touch(&ra, CC);
-                    break;
-            }
+            int reads = janet_bytecode_reads(instr);
+            if (reads & JANET_READ_A) janetc_regalloc_touch(&ra, AA);
+            if (reads & JANET_READ_B) janetc_regalloc_touch(&ra, BB);
+            if (reads & JANET_READ_C) janetc_regalloc_touch(&ra, CC);
+            if (reads & JANET_READ_D) janetc_regalloc_touch(&ra, DD);
+            if (reads & JANET_READ_E) janetc_regalloc_touch(&ra, EE);
         }
 
         /* Iterate and set noops on instructions that make writes that no one ever reads.
@@ -374,6 +411,7 @@ void janet_bytecode_movopt(JanetFuncDef *def) {
                 case JOP_MOVE_NEAR:
                 /* Write A, Read B */
                 case JOP_GET_INDEX:
+                case JOP_GET_IMMEDIATE:
                 /* Write A */
                 case JOP_LOAD_INTEGER:
                 case JOP_LOAD_CONSTANT:
@@ -389,11 +427,237 @@ void janet_bytecode_movopt(JanetFuncDef *def) {
         }
 
         janetc_regalloc_deinit(&ra);
+    }
+}
+
+/* Mark the instructions that are the target of a jump. */
+static uint32_t *janet_bytecode_jump_targets(JanetFuncDef *def) {
+    size_t chunks = ((size_t) def->bytecode_length + 31) >> 5;
+    uint32_t *targets = janet_scalloc(chunks, sizeof(uint32_t));
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        int32_t target;
+        switch (instr & 0x7F) {
+            default:
+                continue;
+            case JOP_JUMP:
+                target = i + (((int32_t)instr) >> 8);
+                break;
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NOT_NIL:
+                target = i + (((int32_t)instr) >> 16);
+                break;
+        }
+        targets[target >> 5] |= 1U << (target & 31);
+    }
+    return targets;
+}
+
+/* Replace short instruction sequences with cheaper ones, converting the
+ * instructions that are no longer needed to noops. Input is assumed valid
+ * bytecode without superinstructions.
+ *
+ * - A near move whose destination is only read by the next instruction
+ *   is folded into that instruction, which reads the source instead.
+ * - Loading a small integer that is only used as the key of the next get
+ *   or in becomes a getim or inim. */
+void janet_bytecode_peephole(JanetFuncDef *def) {
+    if (def->bytecode_length < 2) return;
+    int32_t *readcount = janet_scalloc((size_t) def->slotcount, sizeof(int32_t));
+    uint32_t *targets = janet_bytecode_jump_targets(def);
+
+    /* Count the reads of every slot. Slots captured by closures count as
+     * read everywhere. */
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        int reads = janet_bytecode_reads(instr);
+        if (reads & JANET_READ_A) readcount[AA]++;
+        if (reads & JANET_READ_B) readcount[BB]++;
+        if (reads & JANET_READ_C) readcount[CC]++;
+        if (reads & JANET_READ_D) readcount[DD]++;
+        if (reads & JANET_READ_E) readcount[EE]++;
+    }
+    if (def->closure_bitset != NULL) {
+        for (int32_t i = 0; i < def->slotcount; i++) {
+            if (def->closure_bitset[i >> 5] & (1U << (i & 31))) {
+                readcount[i] = INT32_MAX;
+            }
+        }
+    }
+
+    for (int32_t i = 0; i + 1 < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        uint32_t next = def->bytecode[i + 1];
+        int32_t next_index = i + 1;
+        if (targets[next_index >> 5] & (1U << (next_index & 31))) continue;
+        int reads = janet_bytecode_reads(next);
+        if (reads & JANET_READ_STACK) continue;
+        switch (instr & 0x7F) {
+            default:
+                break;
+            case JOP_MOVE_NEAR: {
+                uint32_t dest = AA;
+                uint32_t src = EE;
+                if (dest == src) {
+                    def->bytecode[i] = JOP_NOOP;
+                    break;
+                }
+                /* Find the fields of next that read dest */
+                int32_t uses = 0;
+                uint32_t rewritten = next;
+                int fits = 1;
+                if ((reads & JANET_READ_A) && ((next >> 8) & 0xFF) == dest) {
+                    uses++;
+                    fits = fits && src <= 0xFF;
+                    rewritten = (rewritten & ~(0xFFU << 8)) | (src << 8);
+                }
+                if ((reads & JANET_READ_B) && ((next >> 16) & 0xFF) == dest) {
+                    uses++;
+                    fits = fits && src <= 0xFF;
+                    rewritten = (rewritten & ~(0xFFU << 16)) | (src << 16);
+                }
+                if ((reads & JANET_READ_C) && (next >> 24) == dest) {
+                    uses++;
+                    fits = fits && src <= 0xFF;
+                    rewritten = (rewritten & ~(0xFFU << 24)) | (src << 24);
+                }
+                if ((reads & JANET_READ_D) && (next >> 8) == dest) {
+                    uses++;
+                    rewritten = (rewritten & 0xFF) | (src << 8);
+                }
+                if ((reads & JANET_READ_E) && (next >> 16) == dest) {
+                    uses++;
+                    rewritten = (rewritten & 0xFFFF) | (src << 16);
+                }
+                if (uses == 0 || !fits || readcount[dest] != uses) break;
+                def->bytecode[i] = JOP_NOOP;
+                def->bytecode[i + 1] = rewritten;
+                readcount[dest] = 0;
+                readcount[src] += uses - 1;
+                break;
+            }
+            case JOP_LOAD_INTEGER: {
+                uint32_t dest = AA;
+                int32_t value = ((int32_t) instr) >> 16;
+                uint32_t op = next & 0x7F;
+                if (op != JOP_GET && op != JOP_IN) break;
+                if ((next >> 24) != dest || ((next >> 16) & 0xFF) == dest) break;
+                if (readcount[dest] != 1 || value < -128 || value > 127) break;
+                def->bytecode[i] = JOP_NOOP;
+                def->bytecode[i + 1] = (op == JOP_GET ? JOP_GET_IMMEDIATE : JOP_IN_IMMEDIATE) |
+                                       (next & 0xFFFF00) |
+                                       ((uint32_t)(value & 0xFF) << 24);
+                readcount[dest] = 0;
+                break;
+            }
+        }
+    }
+
+    janet_sfree(targets);
+    janet_sfree(readcount);
+}
+
 #undef AA
 #undef BB
 #undef CC
 #undef DD
 #undef EE
+
+/* Get the superinstruction that fuses instr with the instruction after it,
+ * or the opcode of instr if there is none. */
+static uint32_t janet_bytecode_fused_op(uint32_t instr, uint32_t next) {
+    uint32_t op = instr & 0x7F;
+    uint32_t nextop = next & 0x7F;
+    if (nextop == JOP_JUMP_IF || nextop == JOP_JUMP_IF_NOT) {
+        /* The branch must test the result of the comparison */
+        if (((instr >> 8) & 0xFF) != ((next >> 8) & 0xFF)) return op;
+        switch (op) {
+            default:
+                return op;
+            case JOP_LESS_THAN:
+                return JOP_LESS_THAN_BRANCH;
+            case JOP_LESS_THAN_EQUAL:
+                return JOP_LESS_THAN_EQUAL_BRANCH;
+            case JOP_LESS_THAN_IMMEDIATE:
+                return JOP_LESS_THAN_IMMEDIATE_BRANCH;
+            case JOP_GREATER_THAN:
+                return JOP_GREATER_THAN_BRANCH;
+            case JOP_GREATER_THAN_EQUAL:
+                return JOP_GREATER_THAN_EQUAL_BRANCH;
+            case JOP_GREATER_THAN_IMMEDIATE:
+                return JOP_GREATER_THAN_IMMEDIATE_BRANCH;
+            case JOP_EQUALS:
+                return JOP_EQUALS_BRANCH;
+            case JOP_EQUALS_IMMEDIATE:
+                return JOP_EQUALS_IMMEDIATE_BRANCH;
+            case JOP_NOT_EQUALS:
+                return JOP_NOT_EQUALS_BRANCH;
+            case JOP_NOT_EQUALS_IMMEDIATE:
+                return JOP_NOT_EQUALS_IMMEDIATE_BRANCH;
+        }
+    }
+    if (op == JOP_LOAD_CONSTANT) {
+        switch (nextop) {
+            default:
+                return op;
+            case JOP_PUSH:
+                return JOP_LOAD_CONSTANT_PUSH;
+            case JOP_CALL:
+                return JOP_LOAD_CONSTANT_CALL;
+            case JOP_TAILCALL:
+                return JOP_LOAD_CONSTANT_TAILCALL;
+        }
+    }
+    return op;
+}
+
+/* Get the instruction a superinstruction runs as before the next one. */
+static uint32_t janet_bytecode_unfused_op(uint32_t op) {
+    switch (op) {
+        default:
+            return op;
+        case JOP_LESS_THAN_BRANCH:
+            return JOP_LESS_THAN;
+        case JOP_LESS_THAN_EQUAL_BRANCH:
+            return JOP_LESS_THAN_EQUAL;
+        case JOP_LESS_THAN_IMMEDIATE_BRANCH:
+            return JOP_LESS_THAN_IMMEDIATE;
+        case JOP_GREATER_THAN_BRANCH:
+            return JOP_GREATER_THAN;
+        case JOP_GREATER_THAN_EQUAL_BRANCH:
+            return JOP_GREATER_THAN_EQUAL;
+        case JOP_GREATER_THAN_IMMEDIATE_BRANCH:
+            return JOP_GREATER_THAN_IMMEDIATE;
+        case JOP_EQUALS_BRANCH:
+            return JOP_EQUALS;
+        case JOP_EQUALS_IMMEDIATE_BRANCH:
+            return JOP_EQUALS_IMMEDIATE;
+        case JOP_NOT_EQUALS_BRANCH:
+            return JOP_NOT_EQUALS;
+        case JOP_NOT_EQUALS_IMMEDIATE_BRANCH:
+            return JOP_NOT_EQUALS_IMMEDIATE;
+        case JOP_LOAD_CONSTANT_PUSH:
+        case JOP_LOAD_CONSTANT_CALL:
+        case JOP_LOAD_CONSTANT_TAILCALL:
+            return JOP_LOAD_CONSTANT;
+    }
+}
+
+/* Turn pairs of instructions into superinstructions. A superinstruction
+ * replaces only the first instruction of its pair and leaves the second in
+ * place, so the bytecode keeps its length, jumps and debugging information,
+ * and the second instruction can still be jumped to on its own. Run after
+ * all passes that move or remove instructions. */
+void janet_bytecode_fuse(JanetFuncDef *def) {
+    for (int32_t i = 0; i + 1 < def->bytecode_length; i++) {
+        uint32_t instr = def->bytecode[i];
+        uint32_t op = janet_bytecode_fused_op(instr, def->bytecode[i + 1]);
+        if (op != (instr & 0x7F)) {
+            def->bytecode[i] = (instr & ~0x7FU) | op;
+            i++;
+        }
     }
 }
 
@@ -415,6 +679,14 @@ int janet_verify(JanetFuncDef *def) {
         if ((instr & 0x7F) >= JOP_INSTRUCTION_COUNT) {
             return 3;
         }
+        /* Superinstructions must be followed by the instruction they fuse with */
+        uint32_t op = instr & 0x7F;
+        uint32_t unfused = janet_bytecode_unfused_op(op);
+        if (unfused != op) {
+            if (i + 1 >= def->bytecode_length) return 10;
+            uint32_t pair = (instr & ~0x7FU) | unfused;
+            if (janet_bytecode_fused_op(pair, def->bytecode[i + 1]) != op) return 10;
+        }
         enum JanetInstructionType type = janet_instructions[instr & 0x7F];
         switch (type) {
             case JINT_0:
@@ -510,6 +782,10 @@ JanetFuncDef *janet_funcdef_alloc(void) {
     def->flags = 0;
     def->slotcount = 0;
     def->symbolmap = NULL;
+#ifdef JANET_JIT
+    def->jit = NULL;
+    def->jit_counter = 0;
+#endif
     def->arity = 0;
     def->min_arity = 0;
     def->max_arity = INT32_MAX;
@@ -454,16 +454,45 @@ JanetRange janet_getslice(int32_t argc, const Janet *argv) {
     return range;
 }
 
-Janet janet_dyn(const char *name) {
-    if (!janet_vm.fiber) {
-        if (!janet_vm.top_dyns) return janet_wrap_nil();
-        return janet_table_get(janet_vm.top_dyns, janet_ckeywordv(name));
+/* Look up a dynamic binding and remember the result in a cache entry. The
+ * entry is only filled if every table consulted can be watched. */
+static Janet dyn_cache_fill(JanetDynCacheEntry *e, JanetTable *env, Janet key, const char *cname) {
+    JanetTable *which = NULL;
+    Janet value = janet_table_get_ex(env, key, &which);
+    if (janet_table_watch(env, which)) {
+        e->env = env;
+        e->name = janet_unwrap_keyword(key);
+        e->cname = cname;
+        e->epoch = janet_vm.lookup_epoch;
+        e->value = value;
     }
-    if (janet_vm.fiber->env) {
-        return janet_table_get(janet_vm.fiber->env, janet_ckeywordv(name));
-    } else {
-        return janet_wrap_nil();
+    return value;
+}
+
+/* Get a dynamic binding from an environment table. Keyword keys go through
+ * the dynamic binding cache. */
+Janet janet_dyn_get(JanetTable *env, Janet key) {
+    if (!janet_checktype(key, JANET_KEYWORD)) return janet_table_get(env, key);
+    const uint8_t *name = janet_unwrap_keyword(key);
+    JanetDynCacheEntry *e = janet_vm.dyn_cache + (janet_string_hash(name) & (JANET_DYN_CACHE_SIZE - 1));
+    if (e->env == env && e->name == name && e->epoch == janet_vm.lookup_epoch) {
+        return e->value;
     }
+    return dyn_cache_fill(e, env, key, NULL);
+}
+
+Janet janet_dyn(const char *name) {
+    JanetTable *env = janet_vm.fiber ? janet_vm.fiber->env : janet_vm.top_dyns;
+    if (!env) return janet_wrap_nil();
+    /* Index on the address of the name to skip interning the keyword, then
+     * check the contents in case the memory now holds another name. */
+    uintptr_t h = (uintptr_t) name;
+    JanetDynCacheEntry *e = janet_vm.dyn_cache + ((h ^ (h >> 6)) & (JANET_DYN_CACHE_SIZE - 1));
+    if (e->cname == name && e->env == env && e->epoch == janet_vm.lookup_epoch &&
+            !strcmp(name, (const char *) e->name)) {
+        return e->value;
+    }
+    return dyn_cache_fill(e, env, janet_ckeywordv(name), name);
 }
 
 void janet_setdyn(const char *name, Janet value) {
@@ -599,6 +628,59 @@ JanetAtomicInt janet_atomic_load_relaxed(JanetAtomicInt volatile *x) {
 #endif
 }
 
+/* Sequentially consistent atomics for lock-free queues */
+
+JanetAtomicInt janet_atomic_add(JanetAtomicInt volatile *x, JanetAtomicInt delta) {
+#ifdef _MSC_VER
+    return _InterlockedExchangeAdd(x, delta) + delta;
+#elif defined(JANET_USE_STDATOMIC)
+    return atomic_fetch_add_explicit(x, delta, memory_order_seq_cst) + delta;
+#else
+    return __atomic_add_fetch(x, delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+JanetAtomicInt janet_atomic_exchange(JanetAtomicInt volatile *x, JanetAtomicInt value) {
+#ifdef _MSC_VER
+    return _InterlockedExchange(x, value);
+#elif defined(JANET_USE_STDATOMIC)
+    return atomic_exchange_explicit(x, value, memory_order_seq_cst);
+#else
+    return __atomic_exchange_n(x, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int janet_atomic_cas(JanetAtomicInt volatile *x, JanetAtomicInt expected, JanetAtomicInt desired) {
+#ifdef _MSC_VER
+    return _InterlockedCompareExchange(x, desired, expected) == expected;
+#elif defined(JANET_USE_STDATOMIC)
+    return atomic_compare_exchange_strong_explicit(x, &expected, desired,
+            memory_order_seq_cst, memory_order_seq_cst);
+#else
+    return __atomic_compare_exchange_n(x, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void janet_atomic_store(JanetAtomicInt volatile *x, JanetAtomicInt value) {
+#ifdef _MSC_VER
+    _InterlockedExchange(x, value);
+#elif defined(JANET_USE_STDATOMIC)
+    atomic_store_explicit(x, value, memory_order_release);
+#else
+    __atomic_store_n(x, value, __ATOMIC_RELEASE);
+#endif
+}
+
+void janet_atomic_fence(void) {
+#ifdef _MSC_VER
+    MemoryBarrier();
+#elif defined(JANET_USE_STDATOMIC)
+    atomic_thread_fence(memory_order_seq_cst);
+#else
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
 /* Some definitions for function-like macros */
 
 JANET_API JanetStructHead *(janet_struct_head)(JanetStruct st) {
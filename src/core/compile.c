@@ -1001,8 +1001,10 @@ JanetFuncDef *janetc_pop_funcdef(JanetCompiler *c) {
     janetc_popscope(c);
 
     /* Do basic optimization */
+    janet_bytecode_peephole(def);
     janet_bytecode_movopt(def);
     janet_bytecode_remove_noops(def);
+    janet_bytecode_fuse(def);
 
     return def;
 }
@@ -269,7 +269,9 @@ JanetSlot janetc_cslot(Janet x);
 JanetSlot janetc_resolve(JanetCompiler *c, const uint8_t *sym);
 
 /* Bytecode optimization */
+void janet_bytecode_peephole(JanetFuncDef *def);
 void janet_bytecode_movopt(JanetFuncDef *def);
 void janet_bytecode_remove_noops(JanetFuncDef *def);
+void janet_bytecode_fuse(JanetFuncDef *def);
 
 #endif
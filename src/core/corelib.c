@@ -27,6 +27,7 @@
 #include "compile.h"
 #include "state.h"
 #include "util.h"
+#include "symcache.h"
 #endif
 
 /* Generated bytes */
@@ -264,7 +265,7 @@ JANET_CORE_FN(janet_core_dyn,
     janet_arity(argc, 1, 2);
     Janet value;
     if (janet_vm.fiber->env) {
-        value = janet_table_get(janet_vm.fiber->env, argv[0]);
+        value = janet_dyn_get(janet_vm.fiber->env, argv[0]);
     } else {
         value = janet_wrap_nil();
     }
@@ -565,6 +566,45 @@ JANET_CORE_FN(janet_core_gcinterval,
     return janet_wrap_number((double) janet_vm.gc_interval);
 }
 
+JANET_CORE_FN(janet_core_gcsetgenerational,
+              "(gcsetgenerational enable)",
+              "Turn generational garbage collection on or off. When on, most automatic collections "
+              "only trace and free objects allocated since the previous collection, and a full "
+              "collection runs once the set of older objects has doubled in size. Native modules that "
+              "write references directly into arrays or tables must use `janet_gcbarrier` to work "
+              "with this mode, and with incremental collection (see `gcsetbudget`).") {
+    janet_fixarity(argc, 1);
+    janet_gcsetgenerational(janet_truthy(argv[0]));
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(janet_core_gcgenerational,
+              "(gcgenerational)",
+              "Returns true if generational garbage collection is turned on.") {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_boolean(janet_vm.gc_generational);
+}
+
+JANET_CORE_FN(janet_core_gcsetbudget,
+              "(gcsetbudget us)",
+              "Set the pause budget for garbage collection in microseconds. When non-zero, full "
+              "collections mark and sweep the heap incrementally in steps of about `us` microseconds "
+              "each, interleaved with the program. A budget of 0, the default, makes every collection "
+              "stop the world.") {
+    janet_fixarity(argc, 1);
+    janet_gcsetbudget(janet_getuinteger(argv, 0));
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(janet_core_gcbudget,
+              "(gcbudget)",
+              "Returns the pause budget for garbage collection in microseconds.") {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_number((double) janet_vm.gc_budget);
+}
+
 JANET_CORE_FN(janet_core_type,
               "(type x)",
               "Returns the type of `x` as a keyword. `x` is one of:\n\n"
@@ -1085,6 +1125,10 @@ static void janet_load_libs(JanetTable *env) {
         JANET_CORE_REG("gccollect", janet_core_gccollect),
         JANET_CORE_REG("gcsetinterval", janet_core_gcsetinterval),
         JANET_CORE_REG("gcinterval", janet_core_gcinterval),
+        JANET_CORE_REG("gcsetgenerational", janet_core_gcsetgenerational),
+        JANET_CORE_REG("gcgenerational", janet_core_gcgenerational),
+        JANET_CORE_REG("gcsetbudget", janet_core_gcsetbudget),
+        JANET_CORE_REG("gcbudget", janet_core_gcbudget),
         JANET_CORE_REG("type", janet_core_type),
         JANET_CORE_REG("hash", janet_core_hash),
         JANET_CORE_REG("getline", janet_core_getline),
@@ -1113,6 +1157,7 @@ static void janet_load_libs(JanetTable *env) {
     janet_lib_array(env);
     janet_lib_tuple(env);
     janet_lib_buffer(env);
+    janet_lib_rope(env);
     janet_lib_table(env);
     janet_lib_struct(env);
     janet_lib_fiber(env);
@@ -1331,13 +1376,17 @@ JanetTable *janet_core_env(JanetTable *replacements) {
         return janet_vm.core_env;
     }
 
+    /* Share the symbols and keywords of the core environment with other threads */
+    janet_symbol_pool_begin();
+
     JanetTable *dict = janet_core_lookup_table(replacements);
 
-    /* Unmarshal bytecode */
+    /* Unmarshal bytecode. The image has static storage, so function bodies
+     * can be decoded on their first call. */
     Janet marsh_out = janet_unmarshal(
                           janet_core_image,
                           janet_core_image_size,
-                          0,
+                          JANET_MARSHAL_LAZY,
                           dict,
                           NULL);
 
@@ -1361,6 +1410,7 @@ JanetTable *janet_core_env(JanetTable *replacements) {
         }
     }
 
+    janet_symbol_pool_end();
     return env;
 }
 
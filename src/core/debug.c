@@ -35,13 +35,16 @@
 
 /* Add a break point to a function */
 void janet_debug_break(JanetFuncDef *def, int32_t pc) {
+    janet_funcdef_ensure(def);
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
+    janet_jit_invalidate(def);
     def->bytecode[pc] |= 0x80;
 }
 
 /* Remove a break point from a function */
 void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
+    janet_funcdef_ensure(def);
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
     def->bytecode[pc] &= ~((uint32_t)0x80);
@@ -54,39 +57,49 @@ void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
 void janet_debug_find(
     JanetFuncDef **def_out, int32_t *pc_out,
     const uint8_t *source, int32_t sourceLine, int32_t sourceColumn) {
-    /* Scan the heap for right func def */
-    JanetGCObject *current = janet_vm.blocks;
+    /* Scan the heap for right func def, in both generations. Any blocks
+     * waiting for an incremental sweep are put back in the heap first. */
+    janet_gc_sweep_all();
+    JanetGCObject *lists[2] = { janet_vm.blocks, janet_vm.old_blocks };
     /* Keep track of the best source mapping we have seen so far */
     int32_t besti = -1;
     int32_t best_line = -1;
     int32_t best_column = -1;
     JanetFuncDef *best_def = NULL;
-    while (NULL != current) {
-        if ((current->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FUNCDEF) {
-            JanetFuncDef *def = (JanetFuncDef *)(current);
-            if (def->sourcemap &&
-                    def->source &&
-                    !janet_string_compare(source, def->source)) {
-                /* Correct source file, check mappings. The chosen
-                 * pc index is the instruction closest to the given line column, but
-                 * not after. */
-                int32_t i;
-                for (i = 0; i < def->bytecode_length; i++) {
-                    int32_t line = def->sourcemap[i].line;
-                    int32_t column = def->sourcemap[i].column;
-                    if (line <= sourceLine && line >= best_line) {
-                        if (column <= sourceColumn &&
-                                (line > best_line || column > best_column)) {
-                            best_line = line;
-                            best_column = column;
-                            besti = i;
-                            best_def = def;
+    for (int l = 0; l < 2; l++) {
+        JanetGCObject *current = lists[l];
+        while (NULL != current) {
+            if ((current->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FUNCDEF) {
+                JanetFuncDef *def = (JanetFuncDef *)(current);
+                if ((def->flags & JANET_FUNCDEF_FLAG_LAZY) &&
+                        def->source &&
+                        !janet_string_compare(source, def->source)) {
+                    janet_funcdef_ensure(def);
+                }
+                if (def->sourcemap &&
+                        def->source &&
+                        !janet_string_compare(source, def->source)) {
+                    /* Correct source file, check mappings. The chosen
+                     * pc index is the instruction closest to the given line column, but
+                     * not after. */
+                    int32_t i;
+                    for (i = 0; i < def->bytecode_length; i++) {
+                        int32_t line = def->sourcemap[i].line;
+                        int32_t column = def->sourcemap[i].column;
+                        if (line <= sourceLine && line >= best_line) {
+                            if (column <= sourceColumn &&
+                                    (line > best_line || column > best_column)) {
+                                best_line = line;
+                                best_column = column;
+                                besti = i;
+                                best_def = def;
+                            }
                         }
                     }
                 }
             }
+            current = current->data.next;
         }
-        current = current->data.next;
     }
     if (best_def) {
         *def_out = best_def;
@@ -49,14 +49,25 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #ifdef JANET_EV_EPOLL
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #endif
+#ifdef JANET_EV_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 #ifdef JANET_EV_KQUEUE
 #include <sys/event.h>
 #endif
+#ifdef JANET_LINUX
+#include <poll.h>
+#include <sys/sendfile.h>
+#endif
 #ifdef JANET_EV_POLL
 #include <poll.h>
 #endif
@@ -75,13 +86,23 @@ typedef struct {
     } mode;
 } JanetChannelPending;
 
+typedef struct JanetRingQueue JanetRingQueue;
+
 struct JanetChannel {
-    JanetQueue items;
+    JanetQueue items; /* For threaded channels, only items that did not fit in the ring */
     JanetQueue read_pending;
     JanetQueue write_pending;
     int32_t limit;
     int closed;
     int is_threaded;
+    int move_buffers;
+    /* Threaded channels with a limit keep items in a lock-free ring, so gives and takes
+     * that do not need to wait can skip the lock. count is the number of items in
+     * the ring and the overflow queue, and slow is nonzero whenever the lock must be
+     * taken: there are pending readers or writers, overflow items, or the channel is closed. */
+    JanetRingQueue *ring;
+    JanetAtomicInt count;
+    JanetAtomicInt slow;
 #ifdef JANET_WINDOWS
     CRITICAL_SECTION lock;
 #else
@@ -103,21 +124,24 @@ typedef struct {
     JanetThreadedCallback cb;
 } JanetSelfPipeEvent;
 
-/* Structure used to initialize threads in the thread pool
+/* Structure used to pass work to threads in the thread pool
  * (same head structure as self pipe event)*/
-typedef struct {
+typedef struct JanetEVThreadInit {
     JanetEVGenericMessage msg;
     JanetThreadedCallback cb;
     JanetThreadedSubroutine subr;
     JanetHandle write_pipe;
+    struct JanetEVThreadInit *next;
 } JanetEVThreadInit;
 
-/* Structure used to initialize threads that run timeouts */
-typedef struct {
-    double sec;
+/* A deadline that interrupts its vm when it expires, watched by the watchdog thread */
+typedef struct JanetWatchdogEntry {
+    JanetTimestamp when;
     JanetVM *vm;
-    JanetFiber *fiber;
-} JanetThreadedTimeout;
+    int fired;
+    struct JanetWatchdogEntry *next;
+    struct JanetWatchdogEntry *prev;
+} JanetWatchdogEntry;
 
 #define JANET_MAX_Q_CAPACITY 0x7FFFFFF
 
@@ -190,6 +214,102 @@ static int janet_q_pop(JanetQueue *q, void *out, size_t itemsize) {
     return 0;
 }
 
+/* Bounded lock-free queue for any number of producers and consumers (Dmitry Vyukov's
+ * bounded MPMC queue). Each cell carries a sequence number that tells a producer
+ * the cell is free for position pos when it equals pos, and tells a consumer
+ * the cell holds the item for pos when it equals pos + 1. */
+
+#define JANET_RQ_CELL_HEADER 8
+
+struct JanetRingQueue {
+    JanetAtomicInt enqueue_pos;
+    char pad0[64 - sizeof(JanetAtomicInt)];
+    JanetAtomicInt dequeue_pos;
+    char pad1[64 - sizeof(JanetAtomicInt)];
+    int32_t mask;
+    size_t itemsize;
+    size_t stride;
+    char *cells;
+};
+
+#define janet_rq_seq(rq, pos) ((JanetAtomicInt *)((rq)->cells + (rq)->stride * (size_t)((pos) & (rq)->mask)))
+#define janet_rq_item(rq, pos) ((void *)((rq)->cells + (rq)->stride * (size_t)((pos) & (rq)->mask) + JANET_RQ_CELL_HEADER))
+
+/* Capacity must be a power of 2 */
+static JanetRingQueue *janet_rq_new(int32_t capacity, size_t itemsize) {
+    JanetRingQueue *rq = janet_malloc(sizeof(JanetRingQueue));
+    if (NULL == rq) {
+        JANET_OUT_OF_MEMORY;
+    }
+    rq->mask = capacity - 1;
+    rq->itemsize = itemsize;
+    rq->stride = (JANET_RQ_CELL_HEADER + itemsize + 7) & ~((size_t) 7);
+    rq->cells = janet_malloc(rq->stride * (size_t) capacity);
+    if (NULL == rq->cells) {
+        JANET_OUT_OF_MEMORY;
+    }
+    for (int32_t i = 0; i < capacity; i++) {
+        *janet_rq_seq(rq, i) = i;
+    }
+    rq->enqueue_pos = 0;
+    rq->dequeue_pos = 0;
+    return rq;
+}
+
+static void janet_rq_free(JanetRingQueue *rq) {
+    janet_free(rq->cells);
+    janet_free(rq);
+}
+
+/* Returns 1 if the queue is full */
+static int janet_rq_push(JanetRingQueue *rq, const void *item) {
+    JanetAtomicInt pos = janet_atomic_load_relaxed(&rq->enqueue_pos);
+    for (;;) {
+        JanetAtomicInt seq = janet_atomic_load(janet_rq_seq(rq, pos));
+        int32_t diff = (int32_t)((uint32_t) seq - (uint32_t) pos);
+        if (diff == 0) {
+            if (janet_atomic_cas(&rq->enqueue_pos, pos, (JanetAtomicInt)((uint32_t) pos + 1))) break;
+            pos = janet_atomic_load_relaxed(&rq->enqueue_pos);
+        } else if (diff < 0) {
+            return 1;
+        } else {
+            pos = janet_atomic_load_relaxed(&rq->enqueue_pos);
+        }
+    }
+    memcpy(janet_rq_item(rq, pos), item, rq->itemsize);
+    janet_atomic_store(janet_rq_seq(rq, pos), (JanetAtomicInt)((uint32_t) pos + 1));
+    return 0;
+}
+
+/* Returns 1 if the queue is empty */
+static int janet_rq_pop(JanetRingQueue *rq, void *out) {
+    JanetAtomicInt pos = janet_atomic_load_relaxed(&rq->dequeue_pos);
+    for (;;) {
+        JanetAtomicInt seq = janet_atomic_load(janet_rq_seq(rq, pos));
+        int32_t diff = (int32_t)((uint32_t) seq - ((uint32_t) pos + 1));
+        if (diff == 0) {
+            if (janet_atomic_cas(&rq->dequeue_pos, pos, (JanetAtomicInt)((uint32_t) pos + 1))) break;
+            pos = janet_atomic_load_relaxed(&rq->dequeue_pos);
+        } else if (diff < 0) {
+            return 1;
+        } else {
+            pos = janet_atomic_load_relaxed(&rq->dequeue_pos);
+        }
+    }
+    memcpy(out, janet_rq_item(rq, pos), rq->itemsize);
+    janet_atomic_store(janet_rq_seq(rq, pos), (JanetAtomicInt)((uint32_t) pos + (uint32_t) rq->mask + 1));
+    return 0;
+}
+
+/* Look at the i-th item from the front without removing it. Only meaningful while no
+ * other thread uses the queue. Returns 1 if there is no such item. */
+static int janet_rq_peek(JanetRingQueue *rq, int32_t i, void *out) {
+    uint32_t pos = (uint32_t) janet_atomic_load(&rq->dequeue_pos) + (uint32_t) i;
+    if ((uint32_t) janet_atomic_load(janet_rq_seq(rq, pos)) != pos + 1) return 1;
+    memcpy(out, janet_rq_item(rq, pos), rq->itemsize);
+    return 0;
+}
+
 /* Get current timestamp (millisecond precision) */
 static JanetTimestamp ts_now(void);
 
@@ -202,65 +322,147 @@ static JanetTimestamp ts_delta(JanetTimestamp ts, double delta) {
     return ts;
 }
 
-/* Look at the next timeout value without removing it. */
-static int peek_timeout(JanetTimeout *out) {
-    if (janet_vm.tq_count == 0) return 0;
-    *out = janet_vm.tq[0];
-    return 1;
+/* Timeouts are kept in a hierarchical timing wheel so that adding or removing one
+ * is O(1) no matter how many are pending. A timeout lives on the lowest level whose
+ * slots are wide enough to hold it relative to the wheel's current time, and is moved
+ * down a level once the wheel reaches its slot. */
+
+/* Fallback for when ctz not available */
+#ifdef __GNUC__
+#define janet_wheel_ctz(x) __builtin_ctzll(x)
+#else
+static int janet_wheel_ctz(uint64_t x) {
+    int ret = 0;
+    while (!(x & 1)) {
+        ret++;
+        x >>= 1;
+    }
+    return ret;
 }
+#endif
 
-/* Remove the next timeout from the priority queue */
-static void pop_timeout(size_t index) {
-    if (janet_vm.tq_count <= index) return;
-    janet_vm.tq[index] = janet_vm.tq[--janet_vm.tq_count];
-    for (;;) {
-        size_t left = (index << 1) + 1;
-        size_t right = left + 1;
-        size_t smallest = index;
-        if (left < janet_vm.tq_count &&
-                (janet_vm.tq[left].when < janet_vm.tq[smallest].when))
-            smallest = left;
-        if (right < janet_vm.tq_count &&
-                (janet_vm.tq[right].when < janet_vm.tq[smallest].when))
-            smallest = right;
-        if (smallest == index) return;
-        JanetTimeout temp = janet_vm.tq[index];
-        janet_vm.tq[index] = janet_vm.tq[smallest];
-        janet_vm.tq[smallest] = temp;
-        index = smallest;
-    }
-}
-
-/* Add a timeout to the timeout min heap */
+static void janet_wheel_insert(JanetTimeout *to) {
+    JanetTimerWheel *tw = janet_vm.tq;
+    uint64_t elapsed = (uint64_t) tw->elapsed;
+    uint64_t when = (to->when < tw->elapsed) ? elapsed : (uint64_t) to->when;
+    int level = 0;
+    for (uint64_t diff = (elapsed ^ when) >> JANET_WHEEL_BITS; diff; diff >>= JANET_WHEEL_BITS) {
+        level++;
+    }
+    int slot = (int)((when >> (level * JANET_WHEEL_BITS)) & (JANET_WHEEL_SLOTS - 1));
+    JanetTimeout **head = &tw->slots[level][slot];
+    /* Append to the circular list so timeouts with the same deadline run in order */
+    if (NULL == *head) {
+        to->next = to;
+        to->prev = to;
+        *head = to;
+        tw->occupied[level] |= (uint64_t) 1 << slot;
+    } else {
+        to->next = *head;
+        to->prev = (*head)->prev;
+        to->prev->next = to;
+        (*head)->prev = to;
+    }
+    to->wheel_index = level * JANET_WHEEL_SLOTS + slot;
+}
+
+static void janet_wheel_remove(JanetTimeout *to) {
+    JanetTimerWheel *tw = janet_vm.tq;
+    int level = to->wheel_index / JANET_WHEEL_SLOTS;
+    int slot = to->wheel_index % JANET_WHEEL_SLOTS;
+    JanetTimeout **head = &tw->slots[level][slot];
+    if (to->next == to) {
+        *head = NULL;
+        tw->occupied[level] &= ~((uint64_t) 1 << slot);
+    } else {
+        to->prev->next = to->next;
+        to->next->prev = to->prev;
+        if (*head == to) *head = to->next;
+    }
+    to->wheel_index = -1;
+}
+
+/* Find the earliest occupied slot. No timeout in it expires before *start. Lower
+ * levels always expire before higher levels, and no occupied slot is behind the
+ * current time. */
+static int janet_wheel_next(int *level, int *slot, JanetTimestamp *start) {
+    JanetTimerWheel *tw = janet_vm.tq;
+    for (int i = 0; i < JANET_WHEEL_LEVELS; i++) {
+        if (!tw->occupied[i]) continue;
+        int shift = i * JANET_WHEEL_BITS;
+        int width = shift + JANET_WHEEL_BITS;
+        uint64_t base = (width >= 64) ? 0 : (((uint64_t) tw->elapsed >> width) << width);
+        *level = i;
+        *slot = janet_wheel_ctz(tw->occupied[i]);
+        *start = (JanetTimestamp)(base | ((uint64_t) *slot << shift));
+        return 1;
+    }
+    return 0;
+}
+
+/* Advance the wheel to now and take the next expired timeout out of it, or return NULL
+ * if there are none. Slots on higher levels are redistributed to lower levels as a whole. */
+static JanetTimeout *janet_wheel_pop_expired(JanetTimestamp now) {
+    JanetTimerWheel *tw = janet_vm.tq;
+    int level, slot;
+    JanetTimestamp start;
+    while (janet_wheel_next(&level, &slot, &start) && start <= now) {
+        tw->elapsed = start;
+        JanetTimeout *to = tw->slots[level][slot];
+        if (level == 0) {
+            janet_wheel_remove(to);
+            return to;
+        }
+        tw->slots[level][slot] = NULL;
+        tw->occupied[level] &= ~((uint64_t) 1 << slot);
+        to->prev->next = NULL;
+        while (NULL != to) {
+            JanetTimeout *next = to->next;
+            janet_wheel_insert(to);
+            to = next;
+        }
+    }
+    if (now > tw->elapsed) tw->elapsed = now;
+    return NULL;
+}
+
+/* Add a timeout to the timer wheel */
 static void add_timeout(JanetTimeout to) {
-    size_t oldcount = janet_vm.tq_count;
-    size_t newcount = oldcount + 1;
-    if (newcount > janet_vm.tq_capacity) {
-        size_t newcap = 2 * newcount;
-        JanetTimeout *tq = janet_realloc(janet_vm.tq, newcap * sizeof(JanetTimeout));
-        if (NULL == tq) {
+    JanetTimeout *node = janet_vm.tq_free;
+    if (NULL != node) {
+        janet_vm.tq_free = node->next;
+    } else {
+        node = janet_malloc(sizeof(JanetTimeout));
+        if (NULL == node) {
             JANET_OUT_OF_MEMORY;
         }
-        janet_vm.tq = tq;
-        janet_vm.tq_capacity = newcap;
     }
-    /* Append */
-    janet_vm.tq_count = (int32_t) newcount;
-    janet_vm.tq[oldcount] = to;
-    /* Heapify */
-    size_t index = oldcount;
-    while (index > 0) {
-        size_t parent = (index - 1) >> 1;
-        if (janet_vm.tq[parent].when <= janet_vm.tq[index].when) break;
-        /* Swap */
-        JanetTimeout tmp = janet_vm.tq[index];
-        janet_vm.tq[index] = janet_vm.tq[parent];
-        janet_vm.tq[parent] = tmp;
-        /* Next */
-        index = parent;
+    *node = to;
+    janet_wheel_insert(node);
+    janet_vm.tq_count++;
+    /* Remember timeouts for a single event so rescheduling the fiber can remove them */
+    if (NULL == to.curr_fiber) {
+        to.fiber->ev_timeout = node;
     }
 }
 
+static void janet_watchdog_cancel(void *entry);
+
+/* Remove a timeout from the timer wheel if it is still there and recycle it */
+static void remove_timeout(JanetTimeout *to) {
+    if (to->wheel_index >= 0) janet_wheel_remove(to);
+    if (to->fiber->ev_timeout == to) to->fiber->ev_timeout = NULL;
+    if (NULL != to->watchdog) janet_watchdog_cancel(to->watchdog);
+    janet_vm.tq_count--;
+    to->next = janet_vm.tq_free;
+    janet_vm.tq_free = to;
+}
+
+#ifdef JANET_EV_IO_URING
+static void janet_uring_arm(JanetFiber *fiber);
+static void janet_uring_flush(void);
+#endif
+
 void janet_async_end(JanetFiber *fiber) {
     if (fiber->ev_callback) {
         if (fiber->ev_stream->read_fiber == fiber) {
@@ -269,6 +471,9 @@ void janet_async_end(JanetFiber *fiber) {
         if (fiber->ev_stream->write_fiber == fiber) {
             fiber->ev_stream->write_fiber = NULL;
         }
+#ifdef JANET_EV_IO_URING
+        janet_ev_uring_detach(fiber);
+#endif
         fiber->ev_callback(fiber, JANET_ASYNC_EVENT_DEINIT);
         janet_gcunroot(janet_wrap_abstract(fiber->ev_stream));
         fiber->ev_callback = NULL;
@@ -279,6 +484,13 @@ void janet_async_end(JanetFiber *fiber) {
             }
             janet_ev_dec_refcount();
         }
+#ifdef JANET_EV_IO_URING
+        else {
+            /* The cancelled request owns the state until the kernel is done with it */
+            fiber->flags &= ~JANET_FIBER_EV_FLAG_IN_FLIGHT;
+            fiber->ev_state = NULL;
+        }
+#endif
     }
 }
 
@@ -304,6 +516,9 @@ void janet_async_start_fiber(JanetFiber *fiber, JanetStream *stream, JanetAsyncM
     janet_gcroot(janet_wrap_abstract(stream));
     fiber->ev_state = state;
     callback(fiber, JANET_ASYNC_EVENT_INIT);
+#ifdef JANET_EV_IO_URING
+    janet_uring_arm(fiber);
+#endif
 }
 
 void janet_async_start(JanetStream *stream, JanetAsyncMode mode, JanetEVCallback callback, void *state) {
@@ -368,6 +583,10 @@ static void janet_stream_close_impl(JanetStream *stream) {
     }
 #else
     if (stream->handle != -1) {
+#ifdef JANET_EV_IO_URING
+        /* Pending requests keep the file open, so make sure they are canceled first */
+        janet_uring_flush();
+#endif
         if (canclose) close(stream->handle);
         stream->handle = -1;
 #ifdef JANET_EV_POLL
@@ -517,6 +736,9 @@ static void janet_schedule_general(JanetFiber *fiber, Janet value, JanetSignal s
         Janet task_element = janet_wrap_fiber(fiber);
         janet_table_put(&janet_vm.active_tasks, task_element, janet_wrap_true());
     }
+    if (NULL != fiber->ev_timeout) {
+        remove_timeout(fiber->ev_timeout);
+    }
     JanetTask t = { fiber, value, sig, ++fiber->sched_id };
     fiber->gc.flags |= JANET_FIBER_FLAG_ROOT;
     if (sig == JANET_SIGNAL_ERROR) fiber->gc.flags |= JANET_FIBER_EV_FLAG_CANCELED;
@@ -565,10 +787,20 @@ void janet_ev_mark(void) {
     }
 
     /* Pending timeouts */
-    for (size_t i = 0; i < janet_vm.tq_count; i++) {
-        janet_mark(janet_wrap_fiber(janet_vm.tq[i].fiber));
-        if (janet_vm.tq[i].curr_fiber != NULL) {
-            janet_mark(janet_wrap_fiber(janet_vm.tq[i].curr_fiber));
+    for (int level = 0; level < JANET_WHEEL_LEVELS; level++) {
+        uint64_t occupied = janet_vm.tq->occupied[level];
+        while (occupied) {
+            int slot = janet_wheel_ctz(occupied);
+            occupied &= occupied - 1;
+            JanetTimeout *head = janet_vm.tq->slots[level][slot];
+            JanetTimeout *to = head;
+            do {
+                janet_mark(janet_wrap_fiber(to->fiber));
+                if (to->curr_fiber != NULL) {
+                    janet_mark(janet_wrap_fiber(to->curr_fiber));
+                }
+                to = to->next;
+            } while (to != head);
         }
     }
 }
@@ -591,9 +823,14 @@ static Janet make_supervisor_event(const char *name, JanetFiber *fiber, int thre
 /* Common init code */
 void janet_ev_init_common(void) {
     janet_q_init(&janet_vm.spawn);
-    janet_vm.tq = NULL;
+    janet_vm.tq = janet_malloc(sizeof(JanetTimerWheel));
+    if (NULL == janet_vm.tq) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memset(janet_vm.tq, 0, sizeof(JanetTimerWheel));
+    janet_vm.tq->elapsed = ts_now();
     janet_vm.tq_count = 0;
-    janet_vm.tq_capacity = 0;
+    janet_vm.tq_free = NULL;
     janet_table_init_raw(&janet_vm.threaded_abstracts, 0);
     janet_table_init_raw(&janet_vm.active_tasks, 0);
     janet_table_init_raw(&janet_vm.signal_handlers, 0);
@@ -604,42 +841,30 @@ void janet_ev_init_common(void) {
 #endif
 }
 
-#ifdef JANET_WINDOWS
-static VOID CALLBACK janet_timeout_stop(ULONG_PTR ptr) {
-    UNREFERENCED_PARAMETER(ptr);
-    ExitThread(0);
-}
-#elif JANET_ANDROID
-static void janet_timeout_stop(int sig_num) {
-    if (sig_num == SIGUSR1) {
-        pthread_exit(0);
-    }
-}
-#endif
-
-static void handle_timeout_worker(JanetTimeout to, int cancel) {
-    if (!to.has_worker) return;
-#ifdef JANET_WINDOWS
-    QueueUserAPC(janet_timeout_stop, to.worker, 0);
-    WaitForSingleObject(to.worker, INFINITE);
-    CloseHandle(to.worker);
-#else
-#ifdef JANET_ANDROID
-    if (cancel) janet_assert(!pthread_kill(to.worker, SIGUSR1), "pthread_kill");
-#else
-    if (cancel) janet_assert(!pthread_cancel(to.worker), "pthread_cancel");
-#endif
-    void *res = NULL;
-    janet_assert(!pthread_join(to.worker, &res), "pthread_join");
-#endif
-}
-
 /* Common deinit code */
 void janet_ev_deinit_common(void) {
-    JanetTimeout to;
-    while (peek_timeout(&to)) {
-        handle_timeout_worker(to, 1);
-        pop_timeout(0);
+    /* Fibers have already been collected, so free pending timeouts without
+     * touching the fibers they point to. */
+    for (int level = 0; level < JANET_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < JANET_WHEEL_SLOTS; slot++) {
+            JanetTimeout *head = janet_vm.tq->slots[level][slot];
+            if (NULL == head) continue;
+            head->prev->next = NULL;
+            while (NULL != head) {
+                JanetTimeout *next = head->next;
+                if (NULL != head->watchdog) janet_watchdog_cancel(head->watchdog);
+                janet_free(head);
+                head = next;
+            }
+            janet_vm.tq->slots[level][slot] = NULL;
+        }
+        janet_vm.tq->occupied[level] = 0;
+    }
+    janet_vm.tq_count = 0;
+    while (NULL != janet_vm.tq_free) {
+        JanetTimeout *next = janet_vm.tq_free->next;
+        janet_free(janet_vm.tq_free);
+        janet_vm.tq_free = next;
     }
     janet_q_deinit(&janet_vm.spawn);
     janet_free(janet_vm.tq);
@@ -666,7 +891,7 @@ void janet_addtimeout(double sec) {
     to.curr_fiber = NULL;
     to.sched_id = fiber->sched_id;
     to.is_error = 1;
-    to.has_worker = 0;
+    to.watchdog = NULL;
     add_timeout(to);
 }
 
@@ -679,7 +904,7 @@ void janet_addtimeout_nil(double sec) {
     to.curr_fiber = NULL;
     to.sched_id = fiber->sched_id;
     to.is_error = 0;
-    to.has_worker = 0;
+    to.watchdog = NULL;
     add_timeout(to);
 }
 
@@ -688,41 +913,167 @@ static void janet_timeout_cb(JanetEVGenericMessage msg) {
     janet_interpreter_interrupt_handled(&janet_vm);
 }
 
+/*
+ * Deadline watchdog
+ *
+ * Deadlines that should interrupt a busy vm are watched by a single thread shared by
+ * every vm in the process. It is started with the first such deadline and sleeps until
+ * the earliest pending one expires.
+ */
+
 #ifdef JANET_WINDOWS
-static DWORD WINAPI janet_timeout_body(LPVOID ptr) {
-    JanetThreadedTimeout tto = *(JanetThreadedTimeout *)ptr;
-    janet_free(ptr);
-    SleepEx((DWORD)(tto.sec * 1000), TRUE);
-    janet_interpreter_interrupt(tto.vm);
-    JanetEVGenericMessage msg = {0};
-    janet_ev_post_event(tto.vm, janet_timeout_cb, msg);
+static SRWLOCK janet_watchdog_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE janet_watchdog_cond = CONDITION_VARIABLE_INIT;
+#define janet_watchdog_acquire() AcquireSRWLockExclusive(&janet_watchdog_lock)
+#define janet_watchdog_release() ReleaseSRWLockExclusive(&janet_watchdog_lock)
+#define janet_watchdog_wait() SleepConditionVariableSRW(&janet_watchdog_cond, &janet_watchdog_lock, INFINITE, 0)
+#define janet_watchdog_broadcast() WakeAllConditionVariable(&janet_watchdog_cond)
+#else
+static pthread_mutex_t janet_watchdog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t janet_watchdog_cond = PTHREAD_COND_INITIALIZER;
+#define janet_watchdog_acquire() pthread_mutex_lock(&janet_watchdog_lock)
+#define janet_watchdog_release() pthread_mutex_unlock(&janet_watchdog_lock)
+#define janet_watchdog_wait() pthread_cond_wait(&janet_watchdog_cond, &janet_watchdog_lock)
+#define janet_watchdog_broadcast() pthread_cond_broadcast(&janet_watchdog_cond)
+#endif
+
+/* Longest the watchdog sleeps before checking the time again, in milliseconds */
+#define JANET_WATCHDOG_MAX_WAIT 3600000
+
+/* Protected by janet_watchdog_lock */
+static struct {
+    JanetWatchdogEntry *head;
+    JanetWatchdogEntry *firing;
+    int running;
+} janet_watchdog = {
+    NULL, NULL, 0
+};
+
+/* Wait for at most ms milliseconds. Must hold janet_watchdog_lock. */
+static void janet_watchdog_timedwait(int64_t ms) {
+    if (ms > JANET_WATCHDOG_MAX_WAIT) ms = JANET_WATCHDOG_MAX_WAIT;
+#ifdef JANET_WINDOWS
+    SleepConditionVariableSRW(&janet_watchdog_cond, &janet_watchdog_lock, (DWORD) ms, 0);
+#else
+    struct timespec ts;
+    janet_assert(-1 != clock_gettime(CLOCK_REALTIME, &ts), "failed to get time");
+    ts.tv_sec += (time_t)(ms / 1000);
+    ts.tv_nsec += (long)((ms % 1000) * 1000000);
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&janet_watchdog_cond, &janet_watchdog_lock, &ts);
+#endif
+}
+
+static void janet_watchdog_unlink(JanetWatchdogEntry *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        janet_watchdog.head = entry->next;
+    }
+    if (entry->next) entry->next->prev = entry->prev;
+}
+
+/* Interrupt vms whose deadlines expire. Entries are only read while they are firing,
+ * and janet_watchdog_cancel waits for that to finish before freeing one. */
+static void janet_watchdog_run(void) {
+    janet_watchdog_acquire();
+    for (;;) {
+        JanetWatchdogEntry *next = janet_watchdog.head;
+        for (JanetWatchdogEntry *entry = next; entry != NULL; entry = entry->next) {
+            if (entry->when < next->when) next = entry;
+        }
+        if (NULL == next) {
+            janet_watchdog_wait();
+            continue;
+        }
+        JanetTimestamp now = ts_now();
+        if (next->when > now) {
+            janet_watchdog_timedwait(next->when - now);
+            continue;
+        }
+        janet_watchdog_unlink(next);
+        next->fired = 1;
+        janet_watchdog.firing = next;
+        janet_watchdog_release();
+        janet_interpreter_interrupt(next->vm);
+        JanetEVGenericMessage msg = {0};
+        janet_ev_post_event(next->vm, janet_timeout_cb, msg);
+        janet_watchdog_acquire();
+        janet_watchdog.firing = NULL;
+        janet_watchdog_broadcast();
+    }
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_watchdog_body(LPVOID ptr) {
+    (void) ptr;
+    janet_watchdog_run();
     return 0;
 }
 #else
-static void *janet_timeout_body(void *ptr) {
-#ifdef JANET_ANDROID
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    sigemptyset(&action.sa_mask);
-    action.sa_flags = 0;
-    action.sa_handler = &janet_timeout_stop;
-    sigaction(SIGUSR1, &action, NULL);
-#endif
-    JanetThreadedTimeout tto = *(JanetThreadedTimeout *)ptr;
-    janet_free(ptr);
-    struct timespec ts;
-    ts.tv_sec = (time_t) tto.sec;
-    ts.tv_nsec = (tto.sec <= UINT32_MAX)
-                 ? (long)((tto.sec - ((uint32_t)tto.sec)) * 1000000000)
-                 : 0;
-    nanosleep(&ts, &ts);
-    janet_interpreter_interrupt(tto.vm);
-    JanetEVGenericMessage msg = {0};
-    janet_ev_post_event(tto.vm, janet_timeout_cb, msg);
+static void *janet_watchdog_body(void *ptr) {
+    (void) ptr;
+    janet_watchdog_run();
     return NULL;
 }
 #endif
 
+/* Interrupt the current vm at the timestamp when, unless canceled first */
+static JanetWatchdogEntry *janet_watchdog_add(JanetTimestamp when) {
+    JanetWatchdogEntry *entry = janet_malloc(sizeof(JanetWatchdogEntry));
+    if (NULL == entry) {
+        JANET_OUT_OF_MEMORY;
+    }
+    entry->when = when;
+    entry->vm = &janet_vm;
+    entry->fired = 0;
+    entry->prev = NULL;
+    janet_watchdog_acquire();
+    if (!janet_watchdog.running) {
+#ifdef JANET_WINDOWS
+        HANDLE thread_handle = CreateThread(NULL, 0, janet_watchdog_body, NULL, 0, NULL);
+        if (NULL == thread_handle) {
+            janet_watchdog_release();
+            janet_free(entry);
+            janet_panic("failed to create thread");
+        }
+        CloseHandle(thread_handle); /* detach from thread */
+#else
+        pthread_t watchdog;
+        int err = pthread_create(&watchdog, &janet_vm.new_thread_attr, janet_watchdog_body, NULL);
+        if (err) {
+            janet_watchdog_release();
+            janet_free(entry);
+            janet_panicf("%s", janet_strerror(err));
+        }
+#endif
+        janet_watchdog.running = 1;
+    }
+    entry->next = janet_watchdog.head;
+    if (entry->next) entry->next->prev = entry;
+    janet_watchdog.head = entry;
+    janet_watchdog_broadcast();
+    janet_watchdog_release();
+    return entry;
+}
+
+/* Stop watching a deadline and free it. If it is being fired, wait until it is done. */
+static void janet_watchdog_cancel(void *ptr) {
+    JanetWatchdogEntry *entry = ptr;
+    janet_watchdog_acquire();
+    if (entry->fired) {
+        while (janet_watchdog.firing == entry) {
+            janet_watchdog_wait();
+        }
+    } else {
+        janet_watchdog_unlink(entry);
+    }
+    janet_watchdog_release();
+    janet_free(entry);
+}
 
 void janet_ev_inc_refcount(void) {
     janet_atomic_inc(&janet_vm.listener_count);
@@ -740,9 +1091,59 @@ static inline int janet_chan_is_threaded(JanetChannel *chan) {
     return chan->is_threaded;
 }
 
+/* Marks a buffer whose memory was moved into a threaded channel rather than marshalled */
+#define JANET_CHAN_MOVED_BUFFER 0x20000
+
+/* Copy a string into memory owned by the channel. The receiving thread
+ * adopts the block as is, keeping the hash already computed. */
+static Janet janet_chan_pack_string(const uint8_t *str) {
+    int32_t len = janet_string_length(str);
+    JanetStringHead *head = janet_malloc(sizeof(JanetStringHead) + (size_t) len + 1);
+    if (NULL == head) {
+        JANET_OUT_OF_MEMORY;
+    }
+    head->gc.flags = JANET_MEM_DISABLED;
+    head->gc.data.next = NULL;
+    head->length = len;
+    head->hash = janet_string_hash(str);
+    uint8_t *data = (uint8_t *) head->data;
+    safe_memcpy(data, str, len);
+    data[len] = 0;
+    return janet_wrap_string(data);
+}
+
+/* Take the memory of a buffer, leaving the original empty. */
+static Janet janet_chan_pack_moved_buffer(JanetBuffer *src) {
+    JanetBuffer *buf = janet_malloc(sizeof(JanetBuffer));
+    uint8_t *fresh = janet_malloc(4);
+    if (NULL == buf || NULL == fresh) {
+        JANET_OUT_OF_MEMORY;
+    }
+    buf->gc.flags = JANET_MEM_DISABLED | JANET_CHAN_MOVED_BUFFER;
+    buf->gc.data.next = NULL;
+    buf->count = src->count;
+    buf->capacity = src->capacity;
+    buf->data = src->data;
+    src->count = 0;
+    src->capacity = 4;
+    src->data = fresh;
+    return janet_wrap_buffer(buf);
+}
+
 static int janet_chan_pack(JanetChannel *chan, Janet *x) {
     if (!janet_chan_is_threaded(chan)) return 0;
     switch (janet_type(*x)) {
+        case JANET_STRING:
+            *x = janet_chan_pack_string(janet_unwrap_string(*x));
+            return 0;
+        case JANET_BUFFER: {
+            JanetBuffer *src = janet_unwrap_buffer(*x);
+            if (chan->move_buffers && !(src->gc.flags & JANET_BUFFER_FLAG_NO_REALLOC)) {
+                *x = janet_chan_pack_moved_buffer(src);
+                return 0;
+            }
+        }
+        /* fallthrough */
         default: {
             JanetBuffer *buf = janet_malloc(sizeof(JanetBuffer));
             if (NULL == buf) {
@@ -767,8 +1168,28 @@ static int janet_chan_unpack(JanetChannel *chan, Janet *x, int is_cleanup) {
     switch (janet_type(*x)) {
         default:
             return 1;
+        case JANET_STRING: {
+            JanetStringHead *head = janet_string_head(janet_unwrap_string(*x));
+            if (is_cleanup) {
+                janet_free(head);
+                *x = janet_wrap_nil();
+            } else {
+                janet_gcadopt(JANET_MEMORY_STRING, head, sizeof(JanetStringHead) + (size_t) head->length + 1);
+            }
+            return 0;
+        }
         case JANET_BUFFER: {
             JanetBuffer *buf = janet_unwrap_buffer(*x);
+            if (buf->gc.flags & JANET_CHAN_MOVED_BUFFER) {
+                if (is_cleanup) {
+                    janet_free(buf->data);
+                    janet_free(buf);
+                    *x = janet_wrap_nil();
+                } else {
+                    janet_gcadopt(JANET_MEMORY_BUFFER, buf, sizeof(JanetBuffer) + (size_t) buf->capacity);
+                }
+                return 0;
+            }
             int flags = is_cleanup ? (JANET_MARSHAL_UNSAFE | JANET_MARSHAL_DECREF) : JANET_MARSHAL_UNSAFE;
             *x = janet_unmarshal(buf->data, buf->count, flags, NULL, NULL);
             janet_buffer_deinit(buf);
@@ -784,10 +1205,20 @@ static int janet_chan_unpack(JanetChannel *chan, Janet *x, int is_cleanup) {
     }
 }
 
+/* Larger threaded channels only use the locked queue */
+#define JANET_CHAN_RING_MAX 0x1000
+
 static void janet_chan_init(JanetChannel *chan, int32_t limit, int threaded) {
     chan->limit = limit;
     chan->closed = 0;
     chan->is_threaded = threaded;
+    chan->move_buffers = 0;
+    chan->ring = NULL;
+    chan->count = 0;
+    chan->slow = 0;
+    if (threaded && limit > 0 && limit <= JANET_CHAN_RING_MAX) {
+        chan->ring = janet_rq_new(janet_tablen(limit), sizeof(Janet));
+    }
     janet_q_init(&chan->items);
     janet_q_init(&chan->read_pending);
     janet_q_init(&chan->write_pending);
@@ -804,15 +1235,73 @@ static void janet_chan_unlock(JanetChannel *chan) {
     janet_os_mutex_unlock((JanetOSMutex *) &chan->lock);
 }
 
+static int32_t janet_chan_count(JanetChannel *chan) {
+    if (janet_chan_is_threaded(chan)) {
+        return (int32_t) janet_atomic_load(&chan->count);
+    }
+    return janet_q_count(&chan->items);
+}
+
+/* Add an item to a locked channel. For threaded channels, the caller has already counted it.
+ * Returns 1 on overflow. */
+static int janet_chan_store_item(JanetChannel *chan, Janet x) {
+    if (janet_chan_is_threaded(chan)) {
+        /* Once items overflow the ring, keep adding to the overflow queue to stay in order */
+        if (NULL != chan->ring && janet_q_count(&chan->items) == 0 && !janet_rq_push(chan->ring, &x)) {
+            return 0;
+        }
+        if (janet_q_push(&chan->items, &x, sizeof(Janet))) return 1;
+        janet_atomic_add(&chan->slow, 1);
+        return 0;
+    }
+    return janet_q_push(&chan->items, &x, sizeof(Janet));
+}
+
+/* Remove an item from a locked channel. Returns 1 if there are no items. */
+static int janet_chan_take_item(JanetChannel *chan, Janet *x) {
+    if (janet_chan_is_threaded(chan)) {
+        if (NULL != chan->ring && !janet_rq_pop(chan->ring, x)) {
+            janet_atomic_add(&chan->count, -1);
+            return 0;
+        }
+        if (janet_q_pop(&chan->items, x, sizeof(Janet))) return 1;
+        janet_atomic_add(&chan->count, -1);
+        janet_atomic_add(&chan->slow, -1);
+        return 0;
+    }
+    return janet_q_pop(&chan->items, x, sizeof(Janet));
+}
+
+/* Pop a pending reader or writer from a locked channel. Returns 1 if there are none. */
+static int janet_chan_pop_pending(JanetChannel *chan, JanetQueue *q, JanetChannelPending *out) {
+    if (janet_q_pop(q, out, sizeof(JanetChannelPending))) return 1;
+    if (janet_chan_is_threaded(chan)) {
+        janet_atomic_add(&chan->slow, -1);
+    }
+    return 0;
+}
+
+/* Called with the lock held before a fiber starts waiting on a threaded channel, and
+ * before the final check that it must wait. A lock-free give or take that runs
+ * concurrently either sees the channel is slow, and takes the lock to wake the
+ * waiter, or is seen by the final check. */
+static void janet_chan_announce_wait(JanetChannel *chan) {
+    janet_atomic_add(&chan->slow, 1);
+    janet_atomic_fence();
+}
+
 static void janet_chan_deinit(JanetChannel *chan) {
     if (janet_chan_is_threaded(chan)) {
         Janet item;
         janet_chan_lock(chan);
         janet_q_deinit(&chan->read_pending);
         janet_q_deinit(&chan->write_pending);
-        while (!janet_q_pop(&chan->items, &item, sizeof(item))) {
+        while (!janet_chan_take_item(chan, &item)) {
             janet_chan_unpack(chan, &item, 1);
         }
+        if (NULL != chan->ring) {
+            janet_rq_free(chan->ring);
+        }
         janet_q_deinit(&chan->items);
         janet_chan_unlock(chan);
     } else {
@@ -856,6 +1345,8 @@ static int janet_chanat_mark(void *p, size_t s) {
     JanetChannel *chan = p;
     janet_chanat_mark_fq(&chan->read_pending);
     janet_chanat_mark_fq(&chan->write_pending);
+    /* Items in threaded channels are packed and hold no references into the heap */
+    if (janet_chan_is_threaded(chan)) return 0;
     JanetQueue *items = &chan->items;
     Janet *data = chan->items.data;
     if (items->head <= items->tail) {
@@ -892,6 +1383,19 @@ static Janet make_close_result(JanetChannel *channel) {
     return janet_wrap_tuple(janet_tuple_end(tup));
 }
 
+static void janet_thread_chan_cb(JanetEVGenericMessage msg);
+
+/* Wake a fiber waiting on a threaded channel, possibly on another thread */
+static void janet_chan_post(JanetChannel *channel, JanetChannelPending *pending, int mode, Janet x) {
+    JanetEVGenericMessage msg;
+    msg.tag = mode;
+    msg.fiber = pending->fiber;
+    msg.argi = (int32_t) pending->sched_id;
+    msg.argp = channel;
+    msg.argj = x;
+    janet_ev_post_event(pending->thread, janet_thread_chan_cb, msg);
+}
+
 /* Callback to use for scheduling a fiber from another thread. */
 static void janet_thread_chan_cb(JanetEVGenericMessage msg) {
     uint32_t sched_id = (uint32_t) msg.argi;
@@ -920,27 +1424,13 @@ static void janet_thread_chan_cb(JanetEVGenericMessage msg) {
         int is_read = (mode == JANET_CP_MODE_CHOICE_READ) || (mode == JANET_CP_MODE_READ);
         if (is_read) {
             JanetChannelPending reader;
-            if (!janet_q_pop(&channel->read_pending, &reader, sizeof(reader))) {
-                JanetVM *vm = reader.thread;
-                JanetEVGenericMessage msg;
-                msg.tag = reader.mode;
-                msg.fiber = reader.fiber;
-                msg.argi = (int32_t) reader.sched_id;
-                msg.argp = channel;
-                msg.argj = x;
-                janet_ev_post_event(vm, janet_thread_chan_cb, msg);
+            if (!janet_chan_pop_pending(channel, &channel->read_pending, &reader)) {
+                janet_chan_post(channel, &reader, reader.mode, x);
             }
         } else {
             JanetChannelPending writer;
-            if (!janet_q_pop(&channel->write_pending, &writer, sizeof(writer))) {
-                JanetVM *vm = writer.thread;
-                JanetEVGenericMessage msg;
-                msg.tag = writer.mode;
-                msg.fiber = writer.fiber;
-                msg.argi = (int32_t) writer.sched_id;
-                msg.argp = channel;
-                msg.argj = janet_wrap_nil();
-                janet_ev_post_event(vm, janet_thread_chan_cb, msg);
+            if (!janet_chan_pop_pending(channel, &channel->write_pending, &writer)) {
+                janet_chan_post(channel, &writer, writer.mode, janet_wrap_nil());
             }
         }
     }
@@ -949,22 +1439,24 @@ static void janet_thread_chan_cb(JanetEVGenericMessage msg) {
 
 /* Push a value to a channel, and return 1 if channel should block, zero otherwise.
  * If the push would block, will add to the write_pending queue in the channel.
- * Handles both threaded and unthreaded channels. */
-static int janet_channel_push_with_lock(JanetChannel *channel, Janet x, int mode) {
+ * Handles both threaded and unthreaded channels. The value may already be packed
+ * by a lock-free attempt that found no room in the ring. */
+static int janet_channel_push_with_lock(JanetChannel *channel, Janet x, int mode, int is_packed) {
     JanetChannelPending reader;
     int is_empty;
-    if (janet_chan_pack(channel, &x)) {
-        janet_chan_unlock(channel);
-        janet_panicf("failed to pack value for channel: %v", x);
-    }
     if (channel->closed) {
         janet_chan_unlock(channel);
+        if (is_packed) janet_chan_unpack(channel, &x, 1);
         janet_panic("cannot write to closed channel");
     }
+    if (!is_packed && janet_chan_pack(channel, &x)) {
+        janet_chan_unlock(channel);
+        janet_panicf("failed to pack value for channel: %v", x);
+    }
     int is_threaded = janet_chan_is_threaded(channel);
     if (is_threaded) {
         /* don't dereference fiber from another thread */
-        is_empty = janet_q_pop(&channel->read_pending, &reader, sizeof(reader));
+        is_empty = janet_chan_pop_pending(channel, &channel->read_pending, &reader);
     } else {
         do {
             is_empty = janet_q_pop(&channel->read_pending, &reader, sizeof(reader));
@@ -972,15 +1464,33 @@ static int janet_channel_push_with_lock(JanetChannel *channel, Janet x, int mode
     }
     if (is_empty) {
         /* No pending reader */
-        if (janet_q_push(&channel->items, &x, sizeof(Janet))) {
+        int32_t count = 0;
+        if (is_threaded) {
+            count = (int32_t) janet_atomic_add(&channel->count, 1);
+        }
+        if (janet_chan_store_item(channel, x)) {
+            if (is_threaded) janet_atomic_add(&channel->count, -1);
             janet_chan_unlock(channel);
             janet_panicf("channel overflow: %v", x);
-        } else if (janet_q_count(&channel->items) > channel->limit) {
+        }
+        if (!is_threaded) {
+            count = janet_q_count(&channel->items);
+        }
+        if (count > channel->limit) {
             /* No root fiber, we are in completion on a root fiber. Don't block. */
             if (mode == 2) {
                 janet_chan_unlock(channel);
                 return 1;
             }
+            if (is_threaded) {
+                janet_chan_announce_wait(channel);
+                if (janet_atomic_load(&channel->count) <= channel->limit) {
+                    /* A lock-free take made room in the meantime */
+                    janet_atomic_add(&channel->slow, -1);
+                    janet_chan_unlock(channel);
+                    return 0;
+                }
+            }
             /* Pushed successfully, but should block. */
             JanetChannelPending pending;
             pending.thread = &janet_vm;
@@ -997,14 +1507,7 @@ static int janet_channel_push_with_lock(JanetChannel *channel, Janet x, int mode
     } else {
         /* Pending reader */
         if (is_threaded) {
-            JanetVM *vm = reader.thread;
-            JanetEVGenericMessage msg;
-            msg.tag = reader.mode;
-            msg.fiber = reader.fiber;
-            msg.argi = (int32_t) reader.sched_id;
-            msg.argp = channel;
-            msg.argj = x;
-            janet_ev_post_event(vm, janet_thread_chan_cb, msg);
+            janet_chan_post(channel, &reader, reader.mode, x);
         } else {
             if (reader.mode == JANET_CP_MODE_CHOICE_READ) {
                 janet_schedule(reader.fiber, make_read_result(channel, x));
@@ -1017,27 +1520,107 @@ static int janet_channel_push_with_lock(JanetChannel *channel, Janet x, int mode
     return 0;
 }
 
+/* Hand items in a locked threaded channel to pending readers, and wake a pending
+ * writer if wake_writer is set. Used after lock-free gives and takes that raced
+ * with a fiber starting to wait. */
+static void janet_chan_wake_pending(JanetChannel *channel, int wake_writer) {
+    JanetChannelPending pending;
+    Janet x;
+    while (janet_q_count(&channel->read_pending) > 0 && !janet_chan_take_item(channel, &x)) {
+        janet_chan_pop_pending(channel, &channel->read_pending, &pending);
+        janet_chan_post(channel, &pending, pending.mode, x);
+    }
+    if (wake_writer && !janet_chan_pop_pending(channel, &channel->write_pending, &pending)) {
+        janet_chan_post(channel, &pending, pending.mode, janet_wrap_nil());
+    }
+}
+
+/* Give a packed value to a threaded channel without locking. Returns 1 if the
+ * channel is full, in which case the locked path must be taken. */
+static int janet_channel_push_fast(JanetChannel *channel, Janet x) {
+    JanetAtomicInt count;
+    do {
+        count = janet_atomic_load(&channel->count);
+        if (count >= channel->limit) return 1;
+    } while (!janet_atomic_cas(&channel->count, count, count + 1));
+    if (janet_rq_push(channel->ring, &x)) {
+        janet_atomic_add(&channel->count, -1);
+        return 1;
+    }
+    janet_atomic_fence();
+    if (janet_atomic_load(&channel->slow)) {
+        janet_chan_lock(channel);
+        janet_chan_wake_pending(channel, 0);
+        janet_chan_unlock(channel);
+    }
+    return 0;
+}
+
 static int janet_channel_push(JanetChannel *channel, Janet x, int mode) {
+    /* Values are packed before the lock-free attempt, which can still fall back to
+     * the lock and find the channel closed. Moving a buffer empties it, so buffers
+     * given to moving channels go through the lock, where they are only moved after
+     * the closed check. */
+    if (NULL != channel->ring && !janet_atomic_load(&channel->slow) &&
+            !(channel->move_buffers && janet_checktype(x, JANET_BUFFER))) {
+        if (janet_chan_pack(channel, &x)) {
+            janet_panicf("failed to pack value for channel: %v", x);
+        }
+        if (!janet_channel_push_fast(channel, x)) return 0;
+        janet_chan_lock(channel);
+        return janet_channel_push_with_lock(channel, x, mode, 1);
+    }
     janet_chan_lock(channel);
-    return janet_channel_push_with_lock(channel, x, mode);
+    return janet_channel_push_with_lock(channel, x, mode, 0);
+}
+
+/* Finish taking an item from a locked channel, waking a pending writer. */
+static int janet_channel_popped(JanetChannel *channel, Janet *item) {
+    JanetChannelPending writer;
+    janet_assert(!janet_chan_unpack(channel, item, 0), "bad channel packing");
+    if (!janet_chan_pop_pending(channel, &channel->write_pending, &writer)) {
+        /* Pending writer */
+        if (janet_chan_is_threaded(channel)) {
+            janet_chan_post(channel, &writer, writer.mode, janet_wrap_nil());
+        } else {
+            if (writer.mode == JANET_CP_MODE_CHOICE_WRITE) {
+                janet_schedule(writer.fiber, make_write_result(channel));
+            } else {
+                janet_schedule(writer.fiber, janet_wrap_abstract(channel));
+            }
+        }
+    }
+    janet_chan_unlock(channel);
+    return 1;
 }
 
 /* Pop from a channel - returns 1 if item was obtained, 0 otherwise. The item
  * is returned by reference. If the pop would block, will add to the read_pending
  * queue in the channel. */
 static int janet_channel_pop_with_lock(JanetChannel *channel, Janet *item, int is_choice) {
-    JanetChannelPending writer;
     if (channel->closed) {
         janet_chan_unlock(channel);
         *item = janet_wrap_nil();
         return 1;
     }
     int is_threaded = janet_chan_is_threaded(channel);
-    if (janet_q_pop(&channel->items, item, sizeof(Janet))) {
+    if (janet_chan_take_item(channel, item)) {
         /* Queue empty */
-        if (is_choice == 2) return 0; // Skip pending read
-        JanetChannelPending pending;
-        pending.thread = &janet_vm;
+        if (is_choice == 2) {
+            /* Skip pending read */
+            janet_chan_unlock(channel);
+            return 0;
+        }
+        if (is_threaded) {
+            janet_chan_announce_wait(channel);
+            if (!janet_chan_take_item(channel, item)) {
+                /* A lock-free give got in first */
+                janet_atomic_add(&channel->slow, -1);
+                return janet_channel_popped(channel, item);
+            }
+        }
+        JanetChannelPending pending;
+        pending.thread = &janet_vm;
         pending.fiber = janet_vm.root_fiber,
         pending.sched_id = janet_vm.root_fiber->sched_id;
         pending.mode = is_choice ? JANET_CP_MODE_CHOICE_READ : JANET_CP_MODE_READ;
@@ -1048,31 +1631,27 @@ static int janet_channel_pop_with_lock(JanetChannel *channel, Janet *item, int i
         }
         return 0;
     }
-    janet_assert(!janet_chan_unpack(channel, item, 0), "bad channel packing");
-    if (!janet_q_pop(&channel->write_pending, &writer, sizeof(writer))) {
-        /* Pending writer */
-        if (is_threaded) {
-            JanetVM *vm = writer.thread;
-            JanetEVGenericMessage msg;
-            msg.tag = writer.mode;
-            msg.fiber = writer.fiber;
-            msg.argi = (int32_t) writer.sched_id;
-            msg.argp = channel;
-            msg.argj = janet_wrap_nil();
-            janet_ev_post_event(vm, janet_thread_chan_cb, msg);
-        } else {
-            if (writer.mode == JANET_CP_MODE_CHOICE_WRITE) {
-                janet_schedule(writer.fiber, make_write_result(channel));
-            } else {
-                janet_schedule(writer.fiber, janet_wrap_abstract(channel));
-            }
-        }
+    return janet_channel_popped(channel, item);
+}
+
+/* Take from a threaded channel without locking. Returns 1 if there was nothing to take. */
+static int janet_channel_pop_fast(JanetChannel *channel, Janet *item) {
+    if (janet_rq_pop(channel->ring, item)) return 1;
+    janet_atomic_add(&channel->count, -1);
+    janet_atomic_fence();
+    if (janet_atomic_load(&channel->slow)) {
+        janet_chan_lock(channel);
+        janet_chan_wake_pending(channel, 1);
+        janet_chan_unlock(channel);
     }
-    janet_chan_unlock(channel);
-    return 1;
+    janet_assert(!janet_chan_unpack(channel, item, 0), "bad channel packing");
+    return 0;
 }
 
 static int janet_channel_pop(JanetChannel *channel, Janet *item, int is_choice) {
+    if (NULL != channel->ring && !janet_atomic_load(&channel->slow)) {
+        if (!janet_channel_pop_fast(channel, item)) return 1;
+    }
     janet_chan_lock(channel);
     return janet_channel_pop_with_lock(channel, item, is_choice);
 }
@@ -1147,20 +1726,79 @@ JANET_CORE_FN(cfun_channel_pop,
     janet_await();
 }
 
-static void chan_unlock_args(const Janet *argv, int32_t n) {
-    for (int32_t i = 0; i < n; i++) {
-        int32_t len;
-        const Janet *data;
-        JanetChannel *chan;
-        if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
-            chan = janet_getchannel(data, 0);
-        } else {
-            chan = janet_getchannel(argv, i);
-        }
+static JanetChannel *chan_choice_channel(const Janet *argv, int32_t i) {
+    int32_t len;
+    const Janet *data;
+    if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
+        return janet_getchannel(data, 0);
+    }
+    return janet_getchannel(argv, i);
+}
+
+/* Give up on waiting for a threaded channel that ev/select announced a wait on. */
+static void chan_choice_unannounce(JanetChannel *chan) {
+    if (janet_chan_is_threaded(chan)) {
+        janet_atomic_add(&chan->slow, -1);
+    }
+}
+
+/* Unlock the channels of clauses start to end - 1, which ev/select has checked
+ * but not waited on. */
+static void chan_unlock_args(const Janet *argv, int32_t start, int32_t end) {
+    for (int32_t i = start; i < end; i++) {
+        JanetChannel *chan = chan_choice_channel(argv, i);
+        chan_choice_unannounce(chan);
         janet_chan_unlock(chan);
     }
 }
 
+/* Check for a fiber waiting to read from a locked channel. Readers of a local
+ * channel that have been resumed or canceled since they started waiting are
+ * dropped, as janet_channel_push_with_lock would skip them. */
+static int janet_chan_has_reader(JanetChannel *chan) {
+    if (!janet_chan_is_threaded(chan)) {
+        JanetChannelPending reader;
+        int32_t n = janet_q_count(&chan->read_pending);
+        for (int32_t i = 0; i < n; i++) {
+            janet_q_pop(&chan->read_pending, &reader, sizeof(reader));
+            if (reader.sched_id == reader.fiber->sched_id) {
+                janet_q_push(&chan->read_pending, &reader, sizeof(reader));
+            }
+        }
+    }
+    return janet_q_count(&chan->read_pending) > 0;
+}
+
+/* Wait on a clause of ev/select, then unlock its channel. The channel has been
+ * locked since ev/select found it open and not ready, and lock-free gives and
+ * takes on it have been sent through the lock since then, so nothing can have
+ * changed. Unlike janet_channel_push_with_lock and janet_channel_pop_with_lock,
+ * this never completes the operation on the spot. Like them, a write stores its
+ * item right away. Returns 1 if the item could not be stored. */
+static int chan_choice_wait(JanetChannel *chan, int is_write, Janet x) {
+    int is_threaded = janet_chan_is_threaded(chan);
+    if (is_write) {
+        if (janet_chan_pack(chan, &x)) return 1;
+        if (is_threaded) janet_atomic_add(&chan->count, 1);
+        if (janet_chan_store_item(chan, x)) {
+            if (is_threaded) janet_atomic_add(&chan->count, -1);
+            janet_chan_unpack(chan, &x, 1);
+            return 1;
+        }
+    }
+    JanetChannelPending pending;
+    pending.thread = &janet_vm;
+    pending.fiber = janet_vm.root_fiber;
+    pending.sched_id = janet_vm.root_fiber->sched_id;
+    pending.mode = is_write ? JANET_CP_MODE_CHOICE_WRITE : JANET_CP_MODE_CHOICE_READ;
+    janet_q_push(is_write ? &chan->write_pending : &chan->read_pending, &pending, sizeof(pending));
+    janet_chan_unlock(chan);
+    if (is_threaded) {
+        janet_gcroot(janet_wrap_fiber(pending.fiber));
+    }
+    return 0;
+}
+
 JANET_CORE_FN(cfun_channel_choice,
               "(ev/select & clauses)",
               "Block until the first of several channel operations occur. Returns a "
@@ -1181,35 +1819,41 @@ JANET_CORE_FN(cfun_channel_choice,
         janet_panic("cannot select from channel inside janet_call");
     }
 
-    /* Check channels for immediate reads and writes */
+    /* Check channels for immediate reads and writes. Each channel stays locked
+     * until ev/select returns or waits on it. Threaded channels also announce the
+     * wait before the check, so that lock-free operations racing with it either
+     * are seen by the check or take the lock and wake the waiting fiber. */
     for (int32_t i = 0; i < argc; i++) {
+        JanetChannel *chan = chan_choice_channel(argv, i);
+        janet_chan_lock(chan);
+        if (chan->closed) {
+            janet_chan_unlock(chan);
+            chan_unlock_args(argv, 0, i);
+            return make_close_result(chan);
+        }
+        if (janet_chan_is_threaded(chan)) {
+            janet_chan_announce_wait(chan);
+        }
         if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
             /* Write */
-            JanetChannel *chan = janet_getchannel(data, 0);
-            janet_chan_lock(chan);
-            if (chan->closed) {
-                janet_chan_unlock(chan);
-                chan_unlock_args(argv, i);
-                return make_close_result(chan);
-            }
-            if (janet_q_count(&chan->items) < chan->limit) {
-                janet_channel_push_with_lock(chan, data[1], 1);
-                chan_unlock_args(argv, i);
+            if (janet_chan_count(chan) < chan->limit || janet_chan_has_reader(chan)) {
+                Janet x = data[1];
+                if (janet_chan_pack(chan, &x)) {
+                    chan_unlock_args(argv, 0, i + 1);
+                    janet_panicf("failed to pack value for channel: %v", data[1]);
+                }
+                janet_channel_push_with_lock(chan, x, 1, 1);
+                chan_choice_unannounce(chan);
+                chan_unlock_args(argv, 0, i);
                 return make_write_result(chan);
             }
         } else {
             /* Read */
-            JanetChannel *chan = janet_getchannel(argv, i);
-            janet_chan_lock(chan);
-            if (chan->closed) {
-                janet_chan_unlock(chan);
-                chan_unlock_args(argv, i);
-                return make_close_result(chan);
-            }
-            if (chan->items.head != chan->items.tail) {
-                Janet item;
-                janet_channel_pop_with_lock(chan, &item, 1);
-                chan_unlock_args(argv, i);
+            Janet item;
+            if (!janet_chan_take_item(chan, &item)) {
+                janet_channel_popped(chan, &item);
+                chan_choice_unannounce(chan);
+                chan_unlock_args(argv, 0, i);
                 return make_read_result(chan, item);
             }
         }
@@ -1217,15 +1861,13 @@ JANET_CORE_FN(cfun_channel_choice,
 
     /* Wait for all readers or writers */
     for (int32_t i = 0; i < argc; i++) {
-        if (janet_indexed_view(argv[i], &data, &len) && len == 2) {
-            /* Write */
-            JanetChannel *chan = janet_getchannel(data, 0);
-            janet_channel_push_with_lock(chan, data[1], 1);
-        } else {
-            /* Read */
-            Janet item;
-            JanetChannel *chan = janet_getchannel(argv, i);
-            janet_channel_pop_with_lock(chan, &item, 1);
+        JanetChannel *chan = chan_choice_channel(argv, i);
+        int is_write = janet_indexed_view(argv[i], &data, &len) && len == 2;
+        if (chan_choice_wait(chan, is_write, is_write ? data[1] : janet_wrap_nil())) {
+            chan_choice_unannounce(chan);
+            janet_chan_unlock(chan);
+            chan_unlock_args(argv, i + 1, argc);
+            janet_panicf("failed to pack value for channel: %v", data[1]);
         }
     }
 
@@ -1238,7 +1880,7 @@ JANET_CORE_FN(cfun_channel_full,
     janet_fixarity(argc, 1);
     JanetChannel *channel = janet_getchannel(argv, 0);
     janet_chan_lock(channel);
-    Janet ret = janet_wrap_boolean(janet_q_count(&channel->items) >= channel->limit);
+    Janet ret = janet_wrap_boolean(janet_chan_count(channel) >= channel->limit);
     janet_chan_unlock(channel);
     return ret;
 }
@@ -1260,7 +1902,7 @@ JANET_CORE_FN(cfun_channel_count,
     janet_fixarity(argc, 1);
     JanetChannel *channel = janet_getchannel(argv, 0);
     janet_chan_lock(channel);
-    Janet ret = janet_wrap_integer(janet_q_count(&channel->items));
+    Janet ret = janet_wrap_integer(janet_chan_count(channel));
     janet_chan_unlock(channel);
     return ret;
 }
@@ -1294,13 +1936,21 @@ JANET_CORE_FN(cfun_channel_new,
 }
 
 JANET_CORE_FN(cfun_channel_new_threaded,
-              "(ev/thread-chan &opt limit)",
+              "(ev/thread-chan &opt limit flags)",
               "Create a threaded channel. A threaded channel is a channel that can be shared between threads and "
-              "used to communicate between any number of operating system threads.") {
-    janet_arity(argc, 0, 1);
+              "used to communicate between any number of operating system threads. Strings are copied across "
+              "directly, and other values are marshalled. `flags` is a keyword of the following flags:\n\n"
+              "* :m - move buffers instead of copying them. A buffer written to the channel hands its memory to "
+              "the reader and is left empty.") {
+    janet_arity(argc, 0, 2);
     int32_t limit = janet_optnat(argv, argc, 0, 0);
+    uint64_t flags = 0;
+    if (argc >= 2) {
+        flags = janet_getflags(argv, 1, "m");
+    }
     JanetChannel *tchan = janet_abstract_threaded(&janet_channel_type, sizeof(JanetChannel));
     janet_chan_init(tchan, limit, 1);
+    tchan->move_buffers = (flags & 1) ? 1 : 0;
     return janet_wrap_abstract(tchan);
 }
 
@@ -1313,8 +1963,12 @@ JANET_CORE_FN(cfun_channel_close,
     janet_chan_lock(channel);
     if (!channel->closed) {
         channel->closed = 1;
+        if (janet_chan_is_threaded(channel)) {
+            /* Send all later gives and takes through the lock */
+            janet_atomic_add(&channel->slow, 1);
+        }
         JanetChannelPending writer;
-        while (!janet_q_pop(&channel->write_pending, &writer, sizeof(writer))) {
+        while (!janet_chan_pop_pending(channel, &channel->write_pending, &writer)) {
             if (writer.thread != &janet_vm) {
                 JanetVM *vm = writer.thread;
                 JanetEVGenericMessage msg;
@@ -1335,7 +1989,7 @@ JANET_CORE_FN(cfun_channel_close,
             }
         }
         JanetChannelPending reader;
-        while (!janet_q_pop(&channel->read_pending, &reader, sizeof(reader))) {
+        while (!janet_chan_pop_pending(channel, &channel->read_pending, &reader)) {
             if (reader.thread != &janet_vm) {
                 JanetVM *vm = reader.thread;
                 JanetEVGenericMessage msg;
@@ -1389,8 +2043,17 @@ static void janet_chanat_marshal(void *p, JanetMarshalContext *ctx) {
     janet_marshal_abstract(ctx, channel);
     janet_marshal_byte(ctx, channel->closed);
     janet_marshal_int(ctx, channel->limit);
-    int32_t count = janet_q_count(&channel->items);
+    int32_t ring_count = 0;
+    Janet x;
+    if (NULL != channel->ring) {
+        while (!janet_rq_peek(channel->ring, ring_count, &x)) ring_count++;
+    }
+    int32_t count = ring_count + janet_q_count(&channel->items);
     janet_marshal_int(ctx, count);
+    for (int32_t i = 0; i < ring_count; i++) {
+        janet_rq_peek(channel->ring, i, &x);
+        janet_marshal_janet(ctx, x);
+    }
     JanetQueue *items = &channel->items;
     Janet *data = channel->items.data;
     if (items->head <= items->tail) {
@@ -1452,10 +2115,11 @@ int janet_loop_done(void) {
 
 JanetFiber *janet_loop1(void) {
     /* Schedule expired timers */
-    JanetTimeout to;
+    JanetTimeout *node;
     JanetTimestamp now = ts_now();
-    while (peek_timeout(&to) && to.when <= now) {
-        pop_timeout(0);
+    while (NULL != (node = janet_wheel_pop_expired(now))) {
+        JanetTimeout to = *node;
+        remove_timeout(node);
         if (to.curr_fiber != NULL) {
             if (janet_fiber_can_resume(to.curr_fiber)) {
                 janet_cancel(to.fiber, janet_cstringv("deadline expired"));
@@ -1470,7 +2134,6 @@ JanetFiber *janet_loop1(void) {
                 }
             }
         }
-        handle_timeout_worker(to, 0);
     }
 
     /* Run scheduled fibers unless interrupts need to be handled. */
@@ -1511,28 +2174,30 @@ JanetFiber *janet_loop1(void) {
 
     /* Poll for events */
     if (janet_vm.tq_count || janet_atomic_load(&janet_vm.listener_count)) {
-        JanetTimeout to;
-        memset(&to, 0, sizeof(to));
-        int has_timeout;
-        /* Drop timeouts that are no longer needed */
-        while ((has_timeout = peek_timeout(&to))) {
-            if (to.curr_fiber != NULL) {
-                if (!janet_fiber_can_resume(to.curr_fiber)) {
-                    pop_timeout(0);
-                    janet_table_remove(&janet_vm.active_tasks, janet_wrap_fiber(to.curr_fiber));
-                    handle_timeout_worker(to, 1);
+        int has_timeout = 0;
+        int level, slot;
+        JanetTimestamp when = 0;
+        /* Drop timeouts that are no longer needed from the front of the wheel.
+         * Wake up at the start of the earliest slot, timeouts on higher levels
+         * get moved down on the next iteration. */
+        while (janet_wheel_next(&level, &slot, &when)) {
+            JanetTimeout *to = janet_vm.tq->slots[level][slot];
+            if (to->curr_fiber != NULL) {
+                if (!janet_fiber_can_resume(to->curr_fiber)) {
+                    janet_table_remove(&janet_vm.active_tasks, janet_wrap_fiber(to->curr_fiber));
+                    remove_timeout(to);
                     continue;
                 }
-            } else if (to.fiber->sched_id != to.sched_id) {
-                pop_timeout(0);
-                handle_timeout_worker(to, 1);
+            } else if (to->fiber->sched_id != to->sched_id) {
+                remove_timeout(to);
                 continue;
             }
+            has_timeout = 1;
             break;
         }
         /* Run polling implementation only if pending timeouts or pending events */
         if (janet_vm.tq_count || janet_atomic_load(&janet_vm.listener_count)) {
-            janet_loop1_impl(has_timeout, to.when);
+            janet_loop1_impl(has_timeout, when);
         }
     }
 
@@ -1571,10 +2236,25 @@ void janet_loop(void) {
 
 #else
 
+#define JANET_EV_POSTED_CAPACITY 1024
+
 static void janet_ev_setup_selfpipe(void) {
     if (janet_make_pipe(janet_vm.selfpipe, 1)) {
         JANET_EXIT("failed to initialize self pipe in event loop");
     }
+    janet_vm.posted = janet_rq_new(JANET_EV_POSTED_CAPACITY, sizeof(JanetSelfPipeEvent));
+    janet_vm.posted_signaled = 0;
+}
+
+/* Run all events posted to this thread's queue. Clear the signal first so
+ * that any event posted after this point writes a new wakeup. */
+static void janet_ev_run_posted(void) {
+    JanetSelfPipeEvent event;
+    janet_atomic_exchange(&janet_vm.posted_signaled, 0);
+    while (!janet_rq_pop(janet_vm.posted, &event)) {
+        event.cb(event.msg);
+        janet_ev_dec_refcount();
+    }
 }
 
 /* Handle events from the self pipe inside the event loop */
@@ -1589,6 +2269,8 @@ recur:
         if (NULL != response.cb) {
             response.cb(response.msg);
             janet_ev_dec_refcount();
+        } else {
+            janet_ev_run_posted();
         }
         goto recur;
     }
@@ -1597,6 +2279,8 @@ recur:
 static void janet_ev_cleanup_selfpipe(void) {
     close(janet_vm.selfpipe[0]);
     close(janet_vm.selfpipe[1]);
+    janet_rq_free(janet_vm.posted);
+    janet_vm.posted = NULL;
 }
 
 #endif
@@ -1696,8 +2380,400 @@ static JanetTimestamp ts_now(void) {
     return res;
 }
 
+#ifdef JANET_EV_IO_URING
+
+/*
+ * io_uring backend. Used instead of epoll when the kernel supports it. Streams
+ * are not registered anywhere - a fiber waiting on a stream either submits a one
+ * shot poll request for readiness, or submits the operation itself (read, recv,
+ * write, send, accept) and is resumed with the result. The self-pipe is watched
+ * with a poll request as well, and timeouts are passed directly to io_uring_enter,
+ * so each turn of the event loop is a single system call.
+ */
+
+#define JANET_URING_ENTRIES 256
+
+typedef enum {
+    JANET_URING_POLL,
+    JANET_URING_OP,
+    JANET_URING_SELFPIPE
+} JanetUringKind;
+
+typedef struct JanetUringReq JanetUringReq;
+struct JanetUringReq {
+    JanetUringKind kind;
+    uint8_t opcode;
+    JanetFiber *fiber; /* NULL once the fiber stops waiting on the request */
+    void *state; /* Operation state, owned by the request once detached */
+    int32_t *res;
+    Janet pinned; /* Memory the kernel uses for the request, rooted until it completes */
+    JanetUringReq *next;
+    JanetUringReq *prev;
+};
+
+struct JanetRing {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail; /* Local tail, published to the kernel on enter */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    size_t op_count;
+    JanetUringReq selfpipe;
+    JanetUringReq *reqs;
+    JanetUringReq *free_reqs;
+};
+
+static pthread_once_t janet_uring_env_once = PTHREAD_ONCE_INIT;
+static int janet_uring_env_disabled = 0;
+
+static void janet_uring_check_env(void) {
+    const char *backend = getenv("JANET_EV_BACKEND");
+    janet_uring_env_disabled = (NULL != backend) && !strcmp(backend, "epoll");
+}
+
+static int janet_uring_enter(struct JanetRing *ring, unsigned wait_nr, struct __kernel_timespec *ts) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t) ts;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (wait_nr) flags |= IORING_ENTER_GETEVENTS;
+    int status;
+    do {
+        status = (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+    } while (status == -1 && errno == EINTR && !wait_nr);
+    return status;
+}
+
+static void janet_uring_flush(void) {
+    struct JanetRing *ring = janet_vm.ring;
+    if (NULL != ring && ring->sqe_tail != *ring->sq_tail) {
+        janet_uring_enter(ring, 0, NULL);
+    }
+}
+
+/* Get the next free submission entry, flushing the queue to the kernel if needed */
+static struct io_uring_sqe *janet_uring_sqe(struct JanetRing *ring) {
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        janet_uring_enter(ring, 0, NULL);
+        if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            JANET_EXIT("io_uring submission queue is full");
+        }
+    }
+    struct io_uring_sqe *sqe = ring->sqes + (ring->sqe_tail & ring->sq_mask);
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static JanetUringReq *janet_uring_req(struct JanetRing *ring, JanetUringKind kind, JanetFiber *fiber) {
+    JanetUringReq *req = ring->free_reqs;
+    if (NULL != req) {
+        ring->free_reqs = req->next;
+    } else {
+        req = janet_malloc(sizeof(JanetUringReq));
+        if (NULL == req) {
+            JANET_OUT_OF_MEMORY;
+        }
+    }
+    req->kind = kind;
+    req->opcode = 0;
+    req->fiber = fiber;
+    req->state = NULL;
+    req->res = NULL;
+    req->pinned = janet_wrap_nil();
+    req->prev = NULL;
+    req->next = ring->reqs;
+    if (ring->reqs) ring->reqs->prev = req;
+    ring->reqs = req;
+    return req;
+}
+
+static void janet_uring_release(struct JanetRing *ring, JanetUringReq *req) {
+    if (!janet_checktype(req->pinned, JANET_NIL)) {
+        janet_gcunroot(req->pinned);
+        req->pinned = janet_wrap_nil();
+    }
+    if (req->prev) req->prev->next = req->next;
+    else ring->reqs = req->next;
+    if (req->next) req->next->prev = req->prev;
+    req->next = ring->free_reqs;
+    ring->free_reqs = req;
+}
+
+static void janet_uring_poll(struct JanetRing *ring, JanetUringReq *req, int fd, uint32_t events) {
+    struct io_uring_sqe *sqe = janet_uring_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->poll32_events = events;
+    sqe->user_data = (uint64_t)(uintptr_t) req;
+}
+
+/* Wait for readiness on behalf of a fiber that is still waiting on its stream
+ * but has no request in flight. */
+static void janet_uring_arm(JanetFiber *fiber) {
+    struct JanetRing *ring = janet_vm.ring;
+    if (NULL == ring || NULL == fiber->ev_callback || NULL != fiber->ev_request) return;
+    JanetStream *stream = fiber->ev_stream;
+    if (stream->flags & JANET_STREAM_CLOSED) return;
+    uint32_t events = 0;
+    if (stream->read_fiber == fiber) events |= POLLIN;
+    if (stream->write_fiber == fiber) events |= POLLOUT;
+    if (!events) return;
+    JanetUringReq *req = janet_uring_req(ring, JANET_URING_POLL, fiber);
+    fiber->ev_request = req;
+    janet_uring_poll(ring, req, stream->handle, events);
+}
+
+void janet_ev_uring_detach(JanetFiber *fiber) {
+    JanetUringReq *req = fiber->ev_request;
+    if (NULL == req) return;
+    fiber->ev_request = NULL;
+    req->fiber = NULL;
+    struct io_uring_sqe *sqe = janet_uring_sqe(janet_vm.ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t) req;
+    sqe->user_data = 0;
+}
+
+/* Keep x alive until the request the fiber just prepared completes, even if the
+ * fiber stops waiting on it first. */
+static void janet_ev_uring_pin(JanetFiber *fiber, Janet x) {
+    JanetUringReq *req = fiber->ev_request;
+    req->pinned = x;
+    janet_gcroot(x);
+}
+
+int janet_ev_uring_enabled(void) {
+    return NULL != janet_vm.ring;
+}
+
+struct io_uring_sqe *janet_ev_uring_prep(JanetFiber *fiber, uint8_t opcode, int fd, int32_t *res) {
+    struct JanetRing *ring = janet_vm.ring;
+    janet_assert(NULL == fiber->ev_request, "double io_uring request on fiber");
+    JanetUringReq *req = janet_uring_req(ring, JANET_URING_OP, fiber);
+    req->opcode = opcode;
+    req->state = fiber->ev_state;
+    req->res = res;
+    ring->op_count++;
+    fiber->ev_request = req;
+    fiber->flags |= JANET_FIBER_EV_FLAG_IN_FLIGHT;
+    struct io_uring_sqe *sqe = janet_uring_sqe(ring);
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uint64_t)(uintptr_t) req;
+    return sqe;
+}
+
+static void janet_uring_complete(struct JanetRing *ring, JanetUringReq *req, int32_t res) {
+    JanetFiber *fiber = req->fiber;
+    switch (req->kind) {
+        case JANET_URING_SELFPIPE:
+            janet_ev_handle_selfpipe();
+            janet_uring_poll(ring, req, janet_vm.selfpipe[0], POLLIN);
+            return;
+        case JANET_URING_OP:
+            ring->op_count--;
+            if (NULL == fiber) {
+                /* Nobody is waiting on this anymore */
+                if (req->opcode == IORING_OP_ACCEPT && res >= 0) close(res);
+                janet_free(req->state);
+                janet_ev_dec_refcount();
+                janet_uring_release(ring, req);
+                return;
+            }
+            /* Store the result before the request can be reused */
+            *req->res = res;
+            janet_uring_release(ring, req);
+            fiber->ev_request = NULL;
+            fiber->flags &= ~JANET_FIBER_EV_FLAG_IN_FLIGHT;
+            fiber->ev_callback(fiber, res >= 0 ? JANET_ASYNC_EVENT_COMPLETE : JANET_ASYNC_EVENT_FAILED);
+            break;
+        case JANET_URING_POLL: {
+            janet_uring_release(ring, req);
+            if (NULL == fiber) return;
+            fiber->ev_request = NULL;
+            JanetStream *stream = fiber->ev_stream;
+            int mask = res < 0 ? POLLERR : res;
+            if (stream->read_fiber == fiber) {
+                if (fiber->ev_callback && (mask & POLLIN)) {
+                    fiber->ev_callback(fiber, JANET_ASYNC_EVENT_READ);
+                }
+                if (fiber->ev_callback && (mask & POLLERR)) {
+                    fiber->ev_callback(fiber, JANET_ASYNC_EVENT_ERR);
+                }
+                if (fiber->ev_callback && (mask & POLLHUP)) {
+                    fiber->ev_callback(fiber, JANET_ASYNC_EVENT_HUP);
+                }
+            }
+            if (stream->write_fiber == fiber) {
+                if (fiber->ev_callback && (mask & POLLOUT)) {
+                    fiber->ev_callback(fiber, JANET_ASYNC_EVENT_WRITE);
+                }
+                if (fiber->ev_callback && (mask & POLLERR)) {
+                    fiber->ev_callback(fiber, JANET_ASYNC_EVENT_ERR);
+                }
+                if (fiber->ev_callback && (mask & POLLHUP)) {
+                    fiber->ev_callback(fiber, JANET_ASYNC_EVENT_HUP);
+                }
+            }
+            break;
+        }
+    }
+    JanetStream *stream = fiber->ev_stream;
+    janet_uring_arm(fiber);
+    janet_stream_checktoclose(stream);
+}
+
+static void janet_uring_loop1(struct JanetRing *ring, int has_timeout, JanetTimestamp timeout) {
+    struct __kernel_timespec ts, *tsp = NULL;
+    if (has_timeout) {
+        JanetTimestamp now = ts_now();
+        JanetTimestamp wait = timeout > now ? timeout - now : 0;
+        ts.tv_sec = wait / 1000;
+        ts.tv_nsec = (wait % 1000) * 1000000;
+        tsp = &ts;
+    }
+
+    /* Submit pending requests and wait for at least one completion */
+    if (-1 == janet_uring_enter(ring, 1, tsp)) {
+        if (errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+            JANET_EXIT("failed to poll events");
+        }
+    }
+
+    /* Step state machines. Completions posted while handling these are left for the next turn. */
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = ring->cqes + (head & ring->cq_mask);
+        JanetUringReq *req = (JanetUringReq *)(uintptr_t) cqe->user_data;
+        int32_t res = cqe->res;
+        __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        if (NULL != req) janet_uring_complete(ring, req, res);
+    }
+}
+
+static struct JanetRing *janet_uring_init(void) {
+    pthread_once(&janet_uring_env_once, janet_uring_check_env);
+    if (janet_uring_env_disabled) return NULL;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, JANET_URING_ENTRIES, &params);
+    if (fd < 0) return NULL;
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return NULL;
+    }
+    struct JanetRing *ring = janet_malloc(sizeof(struct JanetRing));
+    if (NULL == ring) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memset(ring, 0, sizeof(struct JanetRing));
+    ring->fd = fd;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+        if (ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_size);
+        if (ring->cq_ptr != MAP_FAILED) munmap(ring->cq_ptr, ring->cq_size);
+        if (sqes != MAP_FAILED) munmap(sqes, ring->sqes_size);
+        close(fd);
+        janet_free(ring);
+        return NULL;
+    }
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sqes = sqes;
+    ring->sqe_tail = *ring->sq_tail;
+    /* Submission entries are always used in order, so the index array is the identity */
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < ring->sq_entries; i++) array[i] = i;
+    ring->selfpipe.kind = JANET_URING_SELFPIPE;
+    janet_uring_poll(ring, &ring->selfpipe, janet_vm.selfpipe[0], POLLIN);
+    return ring;
+}
+
+static void janet_uring_deinit(struct JanetRing *ring) {
+    /* Cancel operations still in flight and give the kernel a moment to finish
+     * with their buffers. Anything that does not complete in time is leaked. */
+    for (JanetUringReq *req = ring->reqs; NULL != req; req = req->next) {
+        if (req->kind != JANET_URING_OP) continue;
+        struct io_uring_sqe *sqe = janet_uring_sqe(ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t) req;
+    }
+    while (ring->op_count) {
+        struct __kernel_timespec ts = {0, 100000000};
+        if (-1 == janet_uring_enter(ring, 1, &ts) && errno != EINTR) break;
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = ring->cqes + (head & ring->cq_mask);
+            JanetUringReq *req = (JanetUringReq *)(uintptr_t) cqe->user_data;
+            if (NULL != req && req->kind == JANET_URING_OP) {
+                if (req->opcode == IORING_OP_ACCEPT && cqe->res >= 0) close(cqe->res);
+                janet_free(req->state);
+                ring->op_count--;
+                janet_uring_release(ring, req);
+            }
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+        }
+    }
+    close(ring->fd);
+    munmap(ring->sq_ptr, ring->sq_size);
+    munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sqes, ring->sqes_size);
+    JanetUringReq *req = ring->reqs;
+    while (NULL != req) {
+        JanetUringReq *next = req->next;
+        if (req->kind != JANET_URING_OP) janet_free(req);
+        req = next;
+    }
+    req = ring->free_reqs;
+    while (NULL != req) {
+        JanetUringReq *next = req->next;
+        janet_free(req);
+        req = next;
+    }
+    janet_free(ring);
+}
+
+#endif
+
 /* Wait for the next event */
 static void janet_register_stream_impl(JanetStream *stream, int mod, int edge_trigger) {
+#ifdef JANET_EV_IO_URING
+    if (NULL != janet_vm.ring) return;
+#endif
     struct epoll_event ev;
     ev.events = edge_trigger ? EPOLLET : 0;
     if (stream->flags & (JANET_STREAM_READABLE | JANET_STREAM_ACCEPTABLE)) ev.events |= EPOLLIN;
@@ -1733,6 +2809,12 @@ void janet_stream_level_triggered(JanetStream *stream) {
 
 #define JANET_EPOLL_MAX_EVENTS 64
 void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
+#ifdef JANET_EV_IO_URING
+    if (NULL != janet_vm.ring) {
+        janet_uring_loop1(janet_vm.ring, has_timeout, timeout);
+        return;
+    }
+#endif
     struct itimerspec its;
     if (janet_vm.timer_enabled || has_timeout) {
         memset(&its, 0, sizeof(its));
@@ -1799,6 +2881,15 @@ void janet_loop1_impl(int has_timeout, JanetTimestamp timeout) {
 void janet_ev_init(void) {
     janet_ev_init_common();
     janet_ev_setup_selfpipe();
+#ifdef JANET_EV_IO_URING
+    janet_vm.ring = janet_uring_init();
+    if (NULL != janet_vm.ring) {
+        janet_vm.epoll = -1;
+        janet_vm.timerfd = -1;
+        janet_vm.timer_enabled = 0;
+        return;
+    }
+#endif
     janet_vm.epoll = epoll_create1(EPOLL_CLOEXEC);
     janet_vm.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
     janet_vm.timer_enabled = 0;
@@ -1817,8 +2908,16 @@ error:
 
 void janet_ev_deinit(void) {
     janet_ev_deinit_common();
-    close(janet_vm.epoll);
-    close(janet_vm.timerfd);
+#ifdef JANET_EV_IO_URING
+    if (NULL != janet_vm.ring) {
+        janet_uring_deinit(janet_vm.ring);
+        janet_vm.ring = NULL;
+    } else
+#endif
+    {
+        close(janet_vm.epoll);
+        close(janet_vm.timerfd);
+    }
     janet_ev_cleanup_selfpipe();
     janet_vm.epoll = 0;
 }
@@ -2172,6 +3271,13 @@ void janet_ev_post_event(JanetVM *vm, JanetCallback cb, JanetEVGenericMessage ms
     memset(&event, 0, sizeof(event));
     event.msg = msg;
     event.cb = cb;
+    if (NULL != vm->posted && !janet_rq_push(vm->posted, &event)) {
+        /* Only the first event since the loop last ran its queue needs to wake it.
+         * The wakeup is an event with no callback. */
+        if (janet_atomic_exchange(&vm->posted_signaled, 1)) return;
+        memset(&event, 0, sizeof(event));
+    }
+    /* If the queue is full, send the event itself through the pipe */
     int fd = vm->selfpipe[1];
     /* handle a bit of back pressure before giving up. */
     int tries = 4;
@@ -2190,28 +3296,61 @@ void janet_ev_post_event(JanetVM *vm, JanetCallback cb, JanetEVGenericMessage ms
 
 /*
  * Threaded calls
+ *
+ * Threaded calls run on a pool of worker threads shared by every vm in the process.
+ * Workers that finish a call wait for more work, up to max_idle of them. When no worker
+ * is idle, a new one is started, unless there are already max_workers workers
+ * (0 for no limit), in which case the call is queued.
  */
 
 #ifdef JANET_WINDOWS
-static DWORD WINAPI janet_thread_body(LPVOID ptr) {
-    JanetEVThreadInit *init = (JanetEVThreadInit *)ptr;
-    JanetEVGenericMessage msg = init->msg;
-    JanetThreadedSubroutine subr = init->subr;
-    JanetThreadedCallback cb = init->cb;
+static SRWLOCK janet_pool_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE janet_pool_cond = CONDITION_VARIABLE_INIT;
+#define janet_pool_acquire() AcquireSRWLockExclusive(&janet_pool_lock)
+#define janet_pool_release() ReleaseSRWLockExclusive(&janet_pool_lock)
+#define janet_pool_wait() SleepConditionVariableSRW(&janet_pool_cond, &janet_pool_lock, INFINITE, 0)
+#define janet_pool_signal() WakeConditionVariable(&janet_pool_cond)
+#define janet_pool_broadcast() WakeAllConditionVariable(&janet_pool_cond)
+#else
+static pthread_mutex_t janet_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t janet_pool_cond = PTHREAD_COND_INITIALIZER;
+#define janet_pool_acquire() pthread_mutex_lock(&janet_pool_lock)
+#define janet_pool_release() pthread_mutex_unlock(&janet_pool_lock)
+#define janet_pool_wait() pthread_cond_wait(&janet_pool_cond, &janet_pool_lock)
+#define janet_pool_signal() pthread_cond_signal(&janet_pool_cond)
+#define janet_pool_broadcast() pthread_cond_broadcast(&janet_pool_cond)
+#endif
+
+#define JANET_POOL_DEFAULT_MAX_IDLE 8
+
+/* Protected by janet_pool_lock */
+static struct {
+    JanetEVThreadInit *head;
+    JanetEVThreadInit *tail;
+    int32_t queued;
+    int32_t workers;
+    int32_t idle;
+    int32_t busy;
+    int32_t max_idle;
+    int32_t max_workers;
+    uint64_t spawned;
+    uint64_t completed;
+} janet_pool = {
+    NULL, NULL, 0, 0, 0, 0, JANET_POOL_DEFAULT_MAX_IDLE, 0, 0, 0
+};
+
+/* Run one threaded call and send the result back to its event loop */
+static void janet_pool_run(JanetEVThreadInit *init) {
+#ifdef JANET_WINDOWS
     JanetHandle iocp = init->write_pipe;
     /* Reuse memory from thread init for returning data */
-    init->msg = subr(msg);
-    init->cb = cb;
+    init->msg = init->subr(init->msg);
     janet_assert(PostQueuedCompletionStatus(iocp,
                                             sizeof(JanetSelfPipeEvent),
                                             0,
                                             (LPOVERLAPPED) init),
                  "failed to post completion event");
-    return 0;
-}
 #else
-static void *janet_thread_body(void *ptr) {
-    JanetEVThreadInit *init = (JanetEVThreadInit *)ptr;
     JanetEVGenericMessage msg = init->msg;
     JanetThreadedSubroutine subr = init->subr;
     JanetThreadedCallback cb = init->cb;
@@ -2232,10 +3371,77 @@ static void *janet_thread_body(void *ptr) {
         sleep(1);
         tries--;
     }
+#endif
+}
+
+static void janet_thread_cooldown(void);
+
+/* Take queued calls until there are no more, then wait for more work.
+ * Exit if enough other workers are idle, or the pool is over its limit. */
+static void janet_pool_worker(void) {
+    janet_pool_acquire();
+    for (;;) {
+        if (janet_pool.max_workers > 0 && janet_pool.workers > janet_pool.max_workers) {
+            janet_pool.workers--;
+            janet_pool_release();
+            janet_thread_cooldown();
+            return;
+        }
+        if (NULL == janet_pool.head) {
+            if (janet_pool.idle >= janet_pool.max_idle) {
+                janet_pool.workers--;
+                janet_pool_release();
+                janet_thread_cooldown();
+                return;
+            }
+            janet_pool.idle++;
+            janet_pool_wait();
+            janet_pool.idle--;
+            continue;
+        }
+        JanetEVThreadInit *init = janet_pool.head;
+        janet_pool.head = init->next;
+        if (NULL == janet_pool.head) janet_pool.tail = NULL;
+        janet_pool.queued--;
+        janet_pool.busy++;
+        janet_pool_release();
+        janet_pool_run(init);
+        janet_pool_acquire();
+        janet_pool.busy--;
+        janet_pool.completed++;
+    }
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_thread_body(LPVOID ptr) {
+    (void) ptr;
+    janet_pool_worker();
+    return 0;
+}
+#else
+static void *janet_thread_body(void *ptr) {
+    (void) ptr;
+    janet_pool_worker();
     return NULL;
 }
 #endif
 
+/* Start a new worker. Must hold janet_pool_lock. Returns 0 on success, else an error code. */
+static int janet_pool_spawn(void) {
+#ifdef JANET_WINDOWS
+    HANDLE thread_handle = CreateThread(NULL, 0, janet_thread_body, NULL, 0, NULL);
+    if (NULL == thread_handle) return (int) GetLastError();
+    CloseHandle(thread_handle); /* detach from thread */
+#else
+    pthread_t worker;
+    int err = pthread_create(&worker, &janet_vm.new_thread_attr, janet_thread_body, NULL);
+    if (err) return err;
+#endif
+    janet_pool.workers++;
+    janet_pool.spawned++;
+    return 0;
+}
+
 void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage arguments, JanetThreadedCallback cb) {
     JanetEVThreadInit *init = janet_malloc(sizeof(JanetEVThreadInit));
     if (NULL == init) {
@@ -2244,25 +3450,38 @@ void janet_ev_threaded_call(JanetThreadedSubroutine fp, JanetEVGenericMessage ar
     init->msg = arguments;
     init->subr = fp;
     init->cb = cb;
-
+    init->next = NULL;
 #ifdef JANET_WINDOWS
     init->write_pipe = janet_vm.iocp;
-    HANDLE thread_handle = CreateThread(NULL, 0, janet_thread_body, init, 0, NULL);
-    if (NULL == thread_handle) {
-        janet_free(init);
-        janet_panic("failed to create thread");
-    }
-    CloseHandle(thread_handle); /* detach from thread */
 #else
     init->write_pipe = janet_vm.selfpipe[1];
-    pthread_t waiter_thread;
-    int err = pthread_create(&waiter_thread, &janet_vm.new_thread_attr, janet_thread_body, init);
-    if (err) {
-        janet_free(init);
-        janet_panicf("%s", janet_strerror(err));
-    }
 #endif
 
+    janet_pool_acquire();
+    /* Idle workers that were already woken up count as idle until they run */
+    if (janet_pool.idle <= janet_pool.queued &&
+            (janet_pool.max_workers <= 0 || janet_pool.workers < janet_pool.max_workers)) {
+        int err = janet_pool_spawn();
+        if (err && janet_pool.workers == 0) {
+            janet_pool_release();
+            janet_free(init);
+#ifdef JANET_WINDOWS
+            janet_panic("failed to create thread");
+#else
+            janet_panicf("%s", janet_strerror(err));
+#endif
+        }
+    }
+    if (NULL == janet_pool.tail) {
+        janet_pool.head = init;
+    } else {
+        janet_pool.tail->next = init;
+    }
+    janet_pool.tail = init;
+    janet_pool.queued++;
+    janet_pool_signal();
+    janet_pool_release();
+
     /* Increment ev refcount so we don't quit while waiting for a subprocess */
     janet_ev_inc_refcount();
 }
@@ -2398,8 +3617,30 @@ typedef struct {
     JanetBuffer *buf;
     int is_chunk;
     JanetReadMode mode;
+#ifdef JANET_EV_IO_URING
+    int32_t uring_res;
+    int32_t uring_len; /* 0 if reads wait for readiness instead */
+    uint8_t uring_buf[];
+#endif
 } StateRead;
 
+#ifdef JANET_EV_IO_URING
+#define JANET_EV_URING_BUFSIZE 0x10000
+static void ev_read_uring_submit(JanetFiber *fiber, StateRead *state) {
+    int32_t len = state->bytes_left < state->uring_len ? state->bytes_left : state->uring_len;
+    struct io_uring_sqe *sqe;
+    if (state->mode == JANET_ASYNC_READMODE_RECV) {
+        sqe = janet_ev_uring_prep(fiber, IORING_OP_RECV, fiber->ev_stream->handle, &state->uring_res);
+        sqe->msg_flags = (uint32_t) state->flags;
+    } else {
+        sqe = janet_ev_uring_prep(fiber, IORING_OP_READ, fiber->ev_stream->handle, &state->uring_res);
+        sqe->off = (uint64_t) -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t) state->uring_buf;
+    sqe->len = (uint32_t) len;
+}
+#endif
+
 void ev_callback_read(JanetFiber *fiber, JanetAsyncEvent event) {
     JanetStream *stream = fiber->ev_stream;
     StateRead *state = (StateRead *) fiber->ev_state;
@@ -2489,6 +3730,42 @@ void ev_callback_read(JanetFiber *fiber, JanetAsyncEvent event) {
         }
         break;
 #else
+#ifdef JANET_EV_IO_URING
+        case JANET_ASYNC_EVENT_FAILED:
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            /* Called when a submitted read finished */
+            int32_t nread = state->uring_res;
+            if (nread < 0) {
+                if (nread == -EAGAIN || nread == -EINTR) {
+                    /* Wait for readiness and read in place instead */
+                    state->uring_len = 0;
+                    break;
+                }
+                if (nread != -EPIPE) {
+                    errno = -nread;
+                    janet_cancel(fiber, janet_ev_lasterr());
+                    janet_async_end(fiber);
+                    break;
+                }
+                nread = 0;
+            }
+            state->bytes_read += nread;
+            if (state->bytes_read == 0) {
+                janet_schedule(fiber, janet_wrap_nil());
+                janet_async_end(fiber);
+                break;
+            }
+            janet_buffer_push_bytes(state->buf, state->uring_buf, nread);
+            state->bytes_left -= nread;
+            if (!state->is_chunk || state->bytes_left == 0 || nread == 0) {
+                janet_schedule(fiber, janet_wrap_buffer(state->buf));
+                janet_async_end(fiber);
+                break;
+            }
+            ev_read_uring_submit(fiber, state);
+            break;
+        }
+#endif
         case JANET_ASYNC_EVENT_ERR: {
             if (state->bytes_read) {
                 janet_schedule(fiber, janet_wrap_buffer(state->buf));
@@ -2504,6 +3781,12 @@ void ev_callback_read(JanetFiber *fiber, JanetAsyncEvent event) {
         case JANET_ASYNC_EVENT_HUP:
         case JANET_ASYNC_EVENT_INIT:
         case JANET_ASYNC_EVENT_READ: {
+#ifdef JANET_EV_IO_URING
+            if (event == JANET_ASYNC_EVENT_INIT && state->uring_len) {
+                ev_read_uring_submit(fiber, state);
+                break;
+            }
+#endif
             JanetBuffer *buffer = state->buf;
             int32_t bytes_left = state->bytes_left;
             int32_t read_limit = state->is_chunk ? (bytes_left > 4096 ? 4096 : bytes_left) : bytes_left;
@@ -2582,7 +3865,18 @@ void ev_callback_read(JanetFiber *fiber, JanetAsyncEvent event) {
 }
 
 static JANET_NO_RETURN void janet_ev_read_generic(JanetStream *stream, JanetBuffer *buf, int32_t nbytes, int is_chunked, JanetReadMode mode, int flags) {
+#ifdef JANET_EV_IO_URING
+    /* Reads complete into a buffer owned by the state, as the kernel may still
+     * write to it after the fiber has been canceled. */
+    int32_t uring_len = 0;
+    if (janet_ev_uring_enabled() && mode != JANET_ASYNC_READMODE_RECVFROM) {
+        uring_len = nbytes > JANET_EV_URING_BUFSIZE ? JANET_EV_URING_BUFSIZE : nbytes;
+    }
+    StateRead *state = janet_malloc(sizeof(StateRead) + uring_len);
+    state->uring_len = uring_len;
+#else
     StateRead *state = janet_malloc(sizeof(StateRead));
+#endif
     state->is_chunk = is_chunked;
     state->buf = buf;
     state->bytes_left = nbytes;
@@ -2624,6 +3918,12 @@ typedef enum {
     JANET_ASYNC_WRITEMODE_SENDTO
 } JanetWriteMode;
 
+typedef enum {
+    JANET_ASYNC_WRITESRC_STRING,
+    JANET_ASYNC_WRITESRC_BUFFER,
+    JANET_ASYNC_WRITESRC_ROPE
+} JanetWriteSource;
+
 typedef struct {
 #ifdef JANET_WINDOWS
     OVERLAPPED overlapped;
@@ -2634,16 +3934,141 @@ typedef struct {
 #else
     int flags;
     int32_t start;
+    int32_t chunk; /* Rope chunk that start is an offset into */
 #endif
     union {
         JanetBuffer *buf;
         const uint8_t *str;
+        JanetRope *rope;
     } src;
-    int is_buffer;
+    JanetWriteSource kind;
     JanetWriteMode mode;
     void *dest_abst;
+#ifdef JANET_EV_IO_URING
+    int32_t uring_res;
+    int uring; /* 0 if writes wait for readiness instead */
+    int32_t uring_cap; /* Size of uring_buf */
+    uint8_t uring_buf[]; /* Copy of the next chunk of a buffer being written */
+#endif
 } StateWrite;
 
+#ifdef JANET_EV_IO_URING
+/* Submit a write of the rest of a string or buffer. Strings never change, so the
+ * kernel reads them in place and the request keeps them alive. Buffers can be
+ * resized or collected while the kernel still reads, so each write copies the
+ * next chunk of the buffer. Returns 0 if there is nothing left to write. */
+static int ev_write_uring_submit(JanetFiber *fiber, StateWrite *state) {
+    const uint8_t *bytes;
+    int32_t len;
+    if (state->kind == JANET_ASYNC_WRITESRC_BUFFER) {
+        JanetBuffer *buffer = state->src.buf;
+        if (state->start >= buffer->count) return 0;
+        len = buffer->count - state->start;
+        if (len > state->uring_cap) len = state->uring_cap;
+        memcpy(state->uring_buf, buffer->data + state->start, len);
+        bytes = state->uring_buf;
+    } else {
+        if (state->start >= janet_string_length(state->src.str)) return 0;
+        len = janet_string_length(state->src.str) - state->start;
+        bytes = state->src.str + state->start;
+    }
+    struct io_uring_sqe *sqe;
+    if (state->mode == JANET_ASYNC_WRITEMODE_SEND) {
+        sqe = janet_ev_uring_prep(fiber, IORING_OP_SEND, fiber->ev_stream->handle, &state->uring_res);
+        sqe->msg_flags = (uint32_t) state->flags;
+    } else {
+        sqe = janet_ev_uring_prep(fiber, IORING_OP_WRITE, fiber->ev_stream->handle, &state->uring_res);
+        sqe->off = (uint64_t) -1;
+    }
+    sqe->addr = (uint64_t)(uintptr_t) bytes;
+    sqe->len = (uint32_t) len;
+    if (state->kind == JANET_ASYNC_WRITESRC_STRING) {
+        janet_ev_uring_pin(fiber, janet_wrap_string(state->src.str));
+    }
+    return 1;
+}
+#endif
+
+#ifndef JANET_WINDOWS
+
+/* Most chunks of a rope written with one system call */
+#define JANET_ROPE_IOV 64
+
+/* Write the chunks of a rope with scatter/gather I/O until the stream would block */
+static void ev_write_rope(JanetFiber *fiber, StateWrite *state) {
+    JanetStream *stream = fiber->ev_stream;
+    JanetRope *rope = state->src.rope;
+    for (;;) {
+        struct iovec iov[JANET_ROPE_IOV];
+        int niov = 0;
+        size_t total = 0;
+        int32_t offset = state->start;
+        for (int32_t i = state->chunk; i < rope->count && niov < JANET_ROPE_IOV; i++) {
+            const uint8_t *bytes = NULL;
+            int32_t len = 0;
+            janet_bytes_view(rope->chunks[i], &bytes, &len);
+            if (len > offset) {
+                iov[niov].iov_base = (void *)(bytes + offset);
+                iov[niov].iov_len = (size_t)(len - offset);
+                total += iov[niov].iov_len;
+                niov++;
+            }
+            offset = 0;
+        }
+        if (niov == 0) {
+            janet_schedule(fiber, janet_wrap_nil());
+            janet_async_end(fiber);
+            return;
+        }
+        ssize_t nwrote;
+        do {
+#ifdef JANET_NET
+            if (state->mode == JANET_ASYNC_WRITEMODE_SEND) {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = niov;
+                nwrote = sendmsg(stream->handle, &msg, state->flags);
+            } else
+#endif
+            {
+                nwrote = writev(stream->handle, iov, niov);
+            }
+        } while (nwrote == -1 && errno == EINTR);
+        if (nwrote == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            janet_cancel(fiber, janet_ev_lasterr());
+            janet_async_end(fiber);
+            return;
+        }
+        if (nwrote == 0) {
+            janet_cancel(fiber, janet_cstringv("disconnect"));
+            janet_async_end(fiber);
+            return;
+        }
+        /* Skip the chunks that were written */
+        int partial = (size_t) nwrote < total;
+        while (nwrote > 0 && state->chunk < rope->count) {
+            const uint8_t *bytes = NULL;
+            int32_t len = 0;
+            janet_bytes_view(rope->chunks[state->chunk], &bytes, &len);
+            /* A referenced buffer may have shrunk below what was already written */
+            ssize_t left = len > state->start ? (ssize_t)(len - state->start) : 0;
+            if (nwrote < left) {
+                state->start += (int32_t) nwrote;
+                break;
+            }
+            nwrote -= left;
+            state->chunk++;
+            state->start = 0;
+        }
+        /* Wait until the stream is writable again */
+        if (partial) return;
+    }
+}
+
+#endif
+
 void ev_callback_write(JanetFiber *fiber, JanetAsyncEvent event) {
     JanetStream *stream = fiber->ev_stream;
     StateWrite *state = (StateWrite *) fiber->ev_state;
@@ -2651,9 +4076,13 @@ void ev_callback_write(JanetFiber *fiber, JanetAsyncEvent event) {
         default:
             break;
         case JANET_ASYNC_EVENT_MARK: {
-            janet_mark(state->is_buffer
-                       ? janet_wrap_buffer(state->src.buf)
-                       : janet_wrap_string(state->src.str));
+            if (state->kind == JANET_ASYNC_WRITESRC_BUFFER) {
+                janet_mark(janet_wrap_buffer(state->src.buf));
+            } else if (state->kind == JANET_ASYNC_WRITESRC_ROPE) {
+                janet_mark(janet_wrap_abstract(state->src.rope));
+            } else {
+                janet_mark(janet_wrap_string(state->src.str));
+            }
             if (state->mode == JANET_ASYNC_WRITEMODE_SENDTO) {
                 janet_mark(janet_wrap_abstract(state->dest_abst));
             }
@@ -2683,14 +4112,23 @@ void ev_callback_write(JanetFiber *fiber, JanetAsyncEvent event) {
             /* Begin write */
             int32_t len;
             const uint8_t *bytes;
-            if (state->is_buffer) {
+            if (state->kind == JANET_ASYNC_WRITESRC_ROPE) {
+                /* If rope, convert to string. */
+                JanetBuffer *buffer = janet_buffer(0);
+                janet_rope_flatten(state->src.rope, buffer);
+                JanetString str = janet_string(buffer->data, buffer->count);
+                bytes = str;
+                len = buffer->count;
+                state->kind = JANET_ASYNC_WRITESRC_STRING;
+                state->src.str = str;
+            } else if (state->kind == JANET_ASYNC_WRITESRC_BUFFER) {
                 /* If buffer, convert to string. */
                 /* TODO - be more efficient about this */
                 JanetBuffer *buffer = state->src.buf;
                 JanetString str = janet_string(buffer->data, buffer->count);
                 bytes = str;
                 len = buffer->count;
-                state->is_buffer = 0;
+                state->kind = JANET_ASYNC_WRITESRC_STRING;
                 state->src.str = str;
             } else {
                 bytes = state->src.str;
@@ -2745,6 +4183,35 @@ void ev_callback_write(JanetFiber *fiber, JanetAsyncEvent event) {
         }
         break;
 #else
+#ifdef JANET_EV_IO_URING
+        case JANET_ASYNC_EVENT_FAILED:
+        case JANET_ASYNC_EVENT_COMPLETE: {
+            /* Called when a submitted write finished */
+            int32_t nwrote = state->uring_res;
+            if (nwrote < 0) {
+                if (nwrote == -EAGAIN || nwrote == -EINTR) {
+                    /* Wait for readiness and write in place instead */
+                    state->uring = 0;
+                    break;
+                }
+                errno = -nwrote;
+                janet_cancel(fiber, janet_ev_lasterr());
+                janet_async_end(fiber);
+                break;
+            }
+            if (nwrote == 0) {
+                janet_cancel(fiber, janet_cstringv("disconnect"));
+                janet_async_end(fiber);
+                break;
+            }
+            state->start += nwrote;
+            if (!ev_write_uring_submit(fiber, state)) {
+                janet_schedule(fiber, janet_wrap_nil());
+                janet_async_end(fiber);
+            }
+            break;
+        }
+#endif
         case JANET_ASYNC_EVENT_ERR:
             janet_cancel(fiber, janet_cstringv("stream err"));
             janet_async_end(fiber);
@@ -2754,11 +4221,21 @@ void ev_callback_write(JanetFiber *fiber, JanetAsyncEvent event) {
             janet_async_end(fiber);
             break;
         case JANET_ASYNC_EVENT_INIT:
+#ifdef JANET_EV_IO_URING
+            if (state->uring && ev_write_uring_submit(fiber, state)) {
+                break;
+            }
+#endif
+        /* fallthrough */
         case JANET_ASYNC_EVENT_WRITE: {
+            if (state->kind == JANET_ASYNC_WRITESRC_ROPE) {
+                ev_write_rope(fiber, state);
+                break;
+            }
             int32_t start, len;
             const uint8_t *bytes;
             start = state->start;
-            if (state->is_buffer) {
+            if (state->kind == JANET_ASYNC_WRITESRC_BUFFER) {
                 JanetBuffer *buffer = state->src.buf;
                 bytes = buffer->data;
                 len = buffer->count;
@@ -2818,9 +4295,23 @@ void ev_callback_write(JanetFiber *fiber, JanetAsyncEvent event) {
     }
 }
 
-static JANET_NO_RETURN void janet_ev_write_generic(JanetStream *stream, void *buf, void *dest_abst, JanetWriteMode mode, int is_buffer, int flags) {
+static JANET_NO_RETURN void janet_ev_write_generic(JanetStream *stream, void *buf, void *dest_abst, JanetWriteMode mode, JanetWriteSource kind, int flags) {
+#ifdef JANET_EV_IO_URING
+    /* Ropes are written in place with writev, and sendto waits for readiness */
+    int uring = janet_ev_uring_enabled() && mode != JANET_ASYNC_WRITEMODE_SENDTO &&
+                kind != JANET_ASYNC_WRITESRC_ROPE;
+    int32_t uring_cap = 0;
+    if (uring && kind == JANET_ASYNC_WRITESRC_BUFFER) {
+        int32_t count = ((JanetBuffer *) buf)->count;
+        uring_cap = count > JANET_EV_URING_BUFSIZE ? JANET_EV_URING_BUFSIZE : count;
+    }
+    StateWrite *state = janet_malloc(sizeof(StateWrite) + uring_cap);
+    state->uring = uring;
+    state->uring_cap = uring_cap;
+#else
     StateWrite *state = janet_malloc(sizeof(StateWrite));
-    state->is_buffer = is_buffer;
+#endif
+    state->kind = kind;
     state->src.buf = buf;
     state->dest_abst = dest_abst;
     state->mode = mode;
@@ -2829,36 +4320,167 @@ static JANET_NO_RETURN void janet_ev_write_generic(JanetStream *stream, void *bu
 #else
     state->flags = flags;
     state->start = 0;
+    state->chunk = 0;
 #endif
     janet_async_start(stream, JANET_ASYNC_LISTEN_WRITE, ev_callback_write, state);
 }
 
 JANET_NO_RETURN void janet_ev_write_buffer(JanetStream *stream, JanetBuffer *buf) {
-    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_WRITE, 1, 0);
+    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_ASYNC_WRITESRC_BUFFER, 0);
 }
 
 JANET_NO_RETURN void janet_ev_write_string(JanetStream *stream, JanetString str) {
-    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_WRITE, 0, 0);
+    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_ASYNC_WRITESRC_STRING, 0);
+}
+
+JANET_NO_RETURN void janet_ev_write_rope(JanetStream *stream, JanetRope *rope) {
+    janet_ev_write_generic(stream, rope, NULL, JANET_ASYNC_WRITEMODE_WRITE, JANET_ASYNC_WRITESRC_ROPE, 0);
 }
 
 #ifdef JANET_NET
 JANET_NO_RETURN void janet_ev_send_buffer(JanetStream *stream, JanetBuffer *buf, int flags) {
-    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_SEND, 1, flags);
+    janet_ev_write_generic(stream, buf, NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_ASYNC_WRITESRC_BUFFER, flags);
 }
 
 JANET_NO_RETURN void janet_ev_send_string(JanetStream *stream, JanetString str, int flags) {
-    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_SEND, 0, flags);
+    janet_ev_write_generic(stream, (void *) str, NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_ASYNC_WRITESRC_STRING, flags);
+}
+
+JANET_NO_RETURN void janet_ev_send_rope(JanetStream *stream, JanetRope *rope, int flags) {
+    janet_ev_write_generic(stream, rope, NULL, JANET_ASYNC_WRITEMODE_SEND, JANET_ASYNC_WRITESRC_ROPE, flags);
 }
 
 JANET_NO_RETURN void janet_ev_sendto_buffer(JanetStream *stream, JanetBuffer *buf, void *dest, int flags) {
-    janet_ev_write_generic(stream, buf, dest, JANET_ASYNC_WRITEMODE_SENDTO, 1, flags);
+    janet_ev_write_generic(stream, buf, dest, JANET_ASYNC_WRITEMODE_SENDTO, JANET_ASYNC_WRITESRC_BUFFER, flags);
 }
 
 JANET_NO_RETURN void janet_ev_sendto_string(JanetStream *stream, JanetString str, void *dest, int flags) {
-    janet_ev_write_generic(stream, (void *) str, dest, JANET_ASYNC_WRITEMODE_SENDTO, 0, flags);
+    janet_ev_write_generic(stream, (void *) str, dest, JANET_ASYNC_WRITEMODE_SENDTO, JANET_ASYNC_WRITESRC_STRING, flags);
 }
 #endif
 
+/*
+ * State machine for sendfile/splice
+ */
+
+#ifdef JANET_LINUX
+
+typedef struct {
+    JanetStream *src;
+    JanetStream *dest;
+    int64_t offset; /* -1 to use and update the file position of src */
+    int64_t bytes_left; /* -1 to transfer until end of stream */
+    int64_t total;
+    int is_splice;
+} StateTransfer;
+
+/* Wait on a different stream, without ending the async operation */
+static void ev_transfer_wait(JanetFiber *fiber, JanetStream *stream, JanetAsyncMode mode) {
+    JanetStream *old = fiber->ev_stream;
+    if (old->read_fiber == fiber) old->read_fiber = NULL;
+    if (old->write_fiber == fiber) old->write_fiber = NULL;
+#ifdef JANET_EV_IO_URING
+    janet_ev_uring_detach(fiber);
+#endif
+    if (old != stream) {
+        janet_gcunroot(janet_wrap_abstract(old));
+        janet_gcroot(janet_wrap_abstract(stream));
+        fiber->ev_stream = stream;
+    }
+    if (mode & JANET_ASYNC_LISTEN_READ) stream->read_fiber = fiber;
+    if (mode & JANET_ASYNC_LISTEN_WRITE) stream->write_fiber = fiber;
+}
+
+void ev_callback_transfer(JanetFiber *fiber, JanetAsyncEvent event) {
+    StateTransfer *state = (StateTransfer *) fiber->ev_state;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_abstract(state->src));
+            janet_mark(janet_wrap_abstract(state->dest));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(fiber, janet_cstringv("stream closed"));
+            janet_async_end(fiber);
+            break;
+        case JANET_ASYNC_EVENT_INIT:
+        case JANET_ASYNC_EVENT_ERR:
+        case JANET_ASYNC_EVENT_HUP:
+        case JANET_ASYNC_EVENT_READ:
+        case JANET_ASYNC_EVENT_WRITE: {
+            int retries = 0;
+            while (state->bytes_left != 0) {
+                size_t chunk = 0x7ffff000;
+                if (state->bytes_left > 0 && (uint64_t) state->bytes_left < chunk) chunk = (size_t) state->bytes_left;
+                off_t off = (off_t) state->offset;
+                off_t *offp = state->offset < 0 ? NULL : &off;
+                ssize_t n;
+                if (state->is_splice) {
+                    n = splice(state->src->handle, offp, state->dest->handle, NULL, chunk,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                } else {
+                    n = sendfile(state->dest->handle, state->src->handle, offp, chunk);
+                }
+                if (n == -1) {
+                    if (errno == EINTR) continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        janet_cancel(fiber, janet_ev_lasterr());
+                        janet_async_end(fiber);
+                        return;
+                    }
+                    /* Find out which side is blocking, and wait on that one. With edge
+                     * triggered streams, waiting on a side that is already ready would
+                     * never wake, so retry a few times if both sides look ready. */
+                    struct pollfd fds[2];
+                    fds[0].fd = state->src->handle;
+                    fds[0].events = POLLIN;
+                    fds[1].fd = state->dest->handle;
+                    fds[1].events = POLLOUT;
+                    fds[0].revents = fds[1].revents = 0;
+                    poll(fds, 2, 0);
+                    if (!fds[1].revents) {
+                        ev_transfer_wait(fiber, state->dest, JANET_ASYNC_LISTEN_WRITE);
+                        return;
+                    }
+                    if (!fds[0].revents) {
+                        ev_transfer_wait(fiber, state->src, JANET_ASYNC_LISTEN_READ);
+                        return;
+                    }
+                    if (++retries > 16) {
+                        ev_transfer_wait(fiber, state->dest, JANET_ASYNC_LISTEN_WRITE);
+                        return;
+                    }
+                    continue;
+                }
+                if (n == 0) break; /* End of stream */
+                if (state->offset >= 0) state->offset += n;
+                if (state->bytes_left > 0) state->bytes_left -= n;
+                state->total += n;
+            }
+            janet_schedule(fiber, janet_wrap_number((double) state->total));
+            janet_async_end(fiber);
+            break;
+        }
+    }
+}
+
+static JANET_NO_RETURN void janet_ev_transfer(JanetStream *dest, JanetStream *src, int64_t nbytes, int64_t offset, int is_splice) {
+    StateTransfer *state = janet_malloc(sizeof(StateTransfer));
+    if (NULL == state) {
+        JANET_OUT_OF_MEMORY;
+    }
+    state->src = src;
+    state->dest = dest;
+    state->offset = offset;
+    state->bytes_left = nbytes;
+    state->total = 0;
+    state->is_splice = is_splice;
+    janet_async_start(dest, JANET_ASYNC_LISTEN_WRITE, ev_callback_transfer, state);
+}
+
+#endif
+
 /* For a pipe ID */
 #ifdef JANET_WINDOWS
 static volatile long PipeSerialNumber;
@@ -2983,7 +4605,411 @@ JANET_CORE_FN(cfun_ev_go,
     return janet_wrap_fiber(fiber);
 }
 
+/*
+ * Thread snapshots
+ *
+ * A snapshot is an environment marshalled once into an image that threads started
+ * by ev/thread load instead of having everything they use copied to them. Values
+ * found in the environment are then sent to those threads by name. Pool workers
+ * keep the vm that loaded a snapshot for later threads with the same snapshot.
+ * Each of those threads gets its own copies of the bindings it could change in
+ * place, and shares the rest of the loaded image, functions included. Threads
+ * that ask to share a warm vm share everything, and a vm they have used is not
+ * handed to threads that did not ask.
+ */
+
+/* The marshalled environment, shared by all threads */
+typedef struct {
+    uint8_t *bytes; /* Abstract registry followed by the environment */
+    size_t len;
+    JanetCFunRegistry *registry;
+    size_t registry_count;
+    void **threaded; /* Threaded abstracts in the image, each holding a reference */
+    int32_t threaded_count;
+} JanetThreadImage;
+
+/* One thread's handle on an image, with lookup tables for the environment
+ * the image was made from or loaded into in this thread. */
+typedef struct {
+    JanetThreadImage *image;
+    JanetTable *env;
+    JanetTable *forward;
+    JanetTable *reverse;
+    JanetTable *copied;
+    JanetTable *copies;
+} JanetThreadSnapshot;
+
+/* The snapshot loaded by this pool worker, if any */
+static JANET_THREAD_LOCAL JanetThreadSnapshot *janet_warm_snapshot = NULL;
+
+/* Whether a thread that shares the warm vm has run on it */
+static JANET_THREAD_LOCAL int janet_warm_shared = 0;
+
+/* Drop a reference to a threaded abstract held outside of any heap */
+static void janet_threaded_release(void *abst) {
+    if (0 == janet_abstract_decref(abst)) {
+        JanetAbstractHead *head = janet_abstract_head(abst);
+        if (head->type->gc) {
+            janet_assert(!head->type->gc(head->data, head->size), "finalizer failed");
+        }
+        janet_free(head);
+    }
+}
+
+static int janet_thread_image_gc(void *p, size_t size) {
+    (void) size;
+    JanetThreadImage *image = (JanetThreadImage *) p;
+    for (int32_t i = 0; i < image->threaded_count; i++) {
+        janet_threaded_release(image->threaded[i]);
+    }
+    janet_free(image->threaded);
+    janet_free(image->bytes);
+    janet_free(image->registry);
+    return 0;
+}
+
+static const JanetAbstractType janet_thread_image_type = {
+    "core/thread-image",
+    janet_thread_image_gc,
+    JANET_ATEND_GC
+};
+
+static int janet_thread_snapshot_mark(void *p, size_t size) {
+    (void) size;
+    JanetThreadSnapshot *snapshot = (JanetThreadSnapshot *) p;
+    if (NULL != snapshot->image) janet_mark(janet_wrap_abstract(snapshot->image));
+    if (NULL != snapshot->env) janet_mark(janet_wrap_table(snapshot->env));
+    if (NULL != snapshot->forward) janet_mark(janet_wrap_table(snapshot->forward));
+    if (NULL != snapshot->reverse) janet_mark(janet_wrap_table(snapshot->reverse));
+    if (NULL != snapshot->copied) janet_mark(janet_wrap_table(snapshot->copied));
+    if (NULL != snapshot->copies) janet_mark(janet_wrap_table(snapshot->copies));
+    return 0;
+}
+
+static void janet_thread_snapshot_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetThreadSnapshot *snapshot = (JanetThreadSnapshot *) p;
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot marshal thread snapshot in safe mode");
+    }
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_janet(ctx, janet_wrap_abstract(snapshot->image));
+}
+
+static void *janet_thread_snapshot_unmarshal(JanetMarshalContext *ctx) {
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot unmarshal thread snapshot in safe mode");
+    }
+    JanetThreadSnapshot *snapshot = janet_unmarshal_abstract(ctx, sizeof(JanetThreadSnapshot));
+    memset(snapshot, 0, sizeof(JanetThreadSnapshot));
+    Janet image = janet_unmarshal_janet(ctx);
+    if (!janet_checkabstract(image, &janet_thread_image_type)) {
+        janet_panic("expected thread image");
+    }
+    snapshot->image = janet_unwrap_abstract(image);
+    return snapshot;
+}
+
+static const JanetAbstractType janet_thread_snapshot_type = {
+    "core/thread-snapshot",
+    NULL,
+    janet_thread_snapshot_mark,
+    NULL,
+    NULL,
+    janet_thread_snapshot_marshal,
+    janet_thread_snapshot_unmarshal,
+    JANET_ATEND_UNMARSHAL
+};
+
+/* Forward lookup from names to values in the snapshot environment, for unmarshalling */
+static JanetTable *janet_thread_snapshot_forward(JanetThreadSnapshot *snapshot) {
+    if (NULL == snapshot->forward) {
+        snapshot->forward = janet_env_lookup(snapshot->env);
+    }
+    return snapshot->forward;
+}
+
+/* Reverse lookup from values to names, for marshalling. NULL if this thread has no
+ * environment for the snapshot, in which case everything is copied. */
+static JanetTable *janet_thread_snapshot_reverse(JanetThreadSnapshot *snapshot) {
+    if (NULL == snapshot->env) {
+        if (NULL != janet_warm_snapshot && janet_warm_snapshot->image == snapshot->image) {
+            return janet_thread_snapshot_reverse(janet_warm_snapshot);
+        }
+        return NULL;
+    }
+    if (NULL == snapshot->reverse) {
+        JanetTable *forward = janet_thread_snapshot_forward(snapshot);
+        JanetTable *reverse = janet_table(forward->count);
+        for (int32_t i = 0; i < forward->capacity; i++) {
+            JanetKV *kv = forward->data + i;
+            if (!janet_checktype(kv->key, JANET_NIL) && !janet_checktype(kv->value, JANET_NIL)) {
+                janet_table_put(reverse, kv->value, kv->key);
+            }
+        }
+        snapshot->reverse = reverse;
+    }
+    return snapshot->reverse;
+}
+
+/* The value of a binding, and the key it is under */
+static Janet janet_thread_binding_value(JanetTable *binding, Janet *key) {
+    *key = janet_ckeywordv("value");
+    Janet value = janet_table_get(binding, *key);
+    if (janet_checktype(value, JANET_NIL)) {
+        *key = janet_ckeywordv("ref");
+        value = janet_table_get(binding, *key);
+    }
+    return value;
+}
+
+/* Bindings of the loaded snapshot that a thread could change in place, by name.
+ * Those are vars, and tables, arrays and buffers. */
+static JanetTable *janet_thread_snapshot_copied(JanetThreadSnapshot *snapshot) {
+    if (NULL == snapshot->copied) {
+        JanetTable *copied = janet_table(0);
+        for (JanetTable *env = snapshot->env; NULL != env; env = env->proto) {
+            for (int32_t i = 0; i < env->capacity; i++) {
+                JanetKV *kv = env->data + i;
+                if (!janet_checktype(kv->key, JANET_SYMBOL) || !janet_checktype(kv->value, JANET_TABLE)) continue;
+                /* Skip shadowed bindings */
+                Janet binding = janet_table_get(snapshot->env, kv->key);
+                if (!janet_checktype(binding, JANET_TABLE) ||
+                        janet_unwrap_table(binding) != janet_unwrap_table(kv->value)) continue;
+                Janet key;
+                switch (janet_type(janet_thread_binding_value(janet_unwrap_table(binding), &key))) {
+                    default:
+                        break;
+                    case JANET_TABLE:
+                    case JANET_ARRAY:
+                    case JANET_BUFFER:
+                        janet_table_put(copied, kv->key, binding);
+                        break;
+                }
+            }
+        }
+        snapshot->copied = copied;
+    }
+    return snapshot->copied;
+}
+
+/* A shallow copy of a table, array or buffer */
+static Janet janet_thread_snapshot_copy(Janet x) {
+    switch (janet_type(x)) {
+        default:
+            return x;
+        case JANET_TABLE:
+            return janet_wrap_table(janet_table_clone(janet_unwrap_table(x)));
+        case JANET_ARRAY: {
+            JanetArray *array = janet_unwrap_array(x);
+            return janet_wrap_array(janet_array_n(array->data, array->count));
+        }
+        case JANET_BUFFER: {
+            JanetBuffer *buffer = janet_unwrap_buffer(x);
+            JanetBuffer *copy = janet_buffer(buffer->count);
+            janet_buffer_push_bytes(copy, buffer->data, buffer->count);
+            return janet_wrap_buffer(copy);
+        }
+    }
+}
+
+/* Set a copy made by janet_thread_snapshot_copy back to the value it was made from */
+static void janet_thread_snapshot_reset(Janet copy, Janet x) {
+    switch (janet_type(x)) {
+        default:
+            break;
+        case JANET_TABLE:
+            janet_table_reset(janet_unwrap_table(copy), janet_unwrap_table(x));
+            break;
+        case JANET_ARRAY: {
+            JanetArray *array = janet_unwrap_array(copy);
+            JanetArray *from = janet_unwrap_array(x);
+            janet_gc_barrier(array);
+            janet_array_ensure(array, from->count, 1);
+            safe_memcpy(array->data, from->data, from->count * sizeof(Janet));
+            array->count = from->count;
+            break;
+        }
+        case JANET_BUFFER: {
+            JanetBuffer *buffer = janet_unwrap_buffer(copy);
+            JanetBuffer *from = janet_unwrap_buffer(x);
+            buffer->count = 0;
+            janet_buffer_push_bytes(buffer, from->data, from->count);
+            break;
+        }
+    }
+}
+
+/* The copy of x kept by the loaded snapshot, set back to x, or else a new copy.
+ * Threads on a pool worker run one after the other, so the copies left by one
+ * thread can be reset for the next one instead of being made again. */
+static Janet janet_thread_snapshot_recopy(JanetThreadSnapshot *snapshot, Janet x) {
+    if (NULL == snapshot->copies) snapshot->copies = janet_table(0);
+    Janet copy = janet_table_get(snapshot->copies, x);
+    if (janet_checktype(copy, JANET_NIL)) {
+        copy = janet_thread_snapshot_copy(x);
+        janet_table_put(snapshot->copies, x, copy);
+    } else {
+        janet_thread_snapshot_reset(copy, x);
+    }
+    return copy;
+}
+
+/* Make the environment for a thread on the loaded snapshot, with its own copies
+ * of the bindings it could change in place. Sets forward to a lookup that sends
+ * values by name to those copies. Copies are shallow, and functions from the
+ * snapshot still see the values the snapshot was loaded with. */
+static JanetTable *janet_thread_snapshot_fork(JanetThreadSnapshot *snapshot, JanetTable **forward) {
+    JanetTable *copied = janet_thread_snapshot_copied(snapshot);
+    JanetTable *env = janet_table(copied->count);
+    JanetTable *lookup = janet_table(copied->count);
+    env->proto = snapshot->env;
+    lookup->proto = janet_thread_snapshot_forward(snapshot);
+    for (int32_t i = 0; i < copied->capacity; i++) {
+        JanetKV *kv = copied->data + i;
+        if (janet_checktype(kv->key, JANET_NIL)) continue;
+        JanetTable *binding = janet_unwrap_table(janet_thread_snapshot_recopy(snapshot, kv->value));
+        Janet key;
+        Janet value = janet_thread_binding_value(binding, &key);
+        /* Names for the same value get the same copy */
+        Janet copy = janet_thread_snapshot_recopy(snapshot, value);
+        janet_table_put(binding, key, copy);
+        janet_table_put(env, kv->key, janet_wrap_table(binding));
+        janet_table_put(lookup, kv->key, copy);
+    }
+    *forward = lookup;
+    return env;
+}
+
+/* Load an image into a new vm and keep it for later threads. Takes over the
+ * reference to the image held by the thread message. */
+static void janet_thread_warmup(JanetThreadImage *image) {
+    janet_table_put(&janet_vm.threaded_abstracts, janet_wrap_abstract(image), janet_wrap_false());
+    janet_vm.registry = janet_malloc(image->registry_count * sizeof(JanetCFunRegistry) + 1);
+    if (NULL == janet_vm.registry) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(janet_vm.registry, image->registry, image->registry_count * sizeof(JanetCFunRegistry));
+    janet_vm.registry_count = image->registry_count;
+    janet_vm.registry_cap = image->registry_count;
+    janet_vm.registry_dirty = 1;
+    /* The image keeps its own references to threaded abstracts for other threads */
+    const int flags = JANET_MARSHAL_UNSAFE | JANET_MARSHAL_LAZY | JANET_MARSHAL_INCREF;
+    const uint8_t *nextbytes = image->bytes;
+    const uint8_t *endbytes = image->bytes + image->len;
+    Janet aregv = janet_unmarshal(nextbytes, endbytes - nextbytes, flags, NULL, &nextbytes);
+    if (!janet_checktype(aregv, JANET_TABLE)) janet_panic("expected table for abstract registry");
+    janet_vm.abstract_registry = janet_unwrap_table(aregv);
+    janet_gcroot(aregv);
+    Janet envv = janet_unmarshal(nextbytes, endbytes - nextbytes, flags, NULL, &nextbytes);
+    if (!janet_checktype(envv, JANET_TABLE)) janet_panic("expected table for snapshot environment");
+    JanetThreadSnapshot *snapshot = janet_abstract(&janet_thread_snapshot_type, sizeof(JanetThreadSnapshot));
+    memset(snapshot, 0, sizeof(JanetThreadSnapshot));
+    snapshot->image = image;
+    snapshot->env = janet_unwrap_table(envv);
+    janet_gcroot(janet_wrap_abstract(snapshot));
+    janet_warm_snapshot = snapshot;
+    janet_warm_shared = 0;
+}
+
+/* Free the vm kept by this pool worker */
+static void janet_thread_cooldown(void) {
+    if (NULL != janet_warm_snapshot) {
+        janet_warm_snapshot = NULL;
+        janet_warm_shared = 0;
+        janet_deinit();
+    }
+}
+
+/* Marshal an environment into a new image */
+static JanetThreadSnapshot *janet_thread_snapshot_new(JanetTable *env) {
+    JanetBuffer *buffer = janet_buffer(0);
+    janet_marshal(buffer, janet_wrap_table(janet_vm.abstract_registry), NULL, JANET_MARSHAL_UNSAFE);
+    int32_t threaded_count = 0;
+    void **threaded = janet_marshal_threaded(buffer, janet_wrap_table(env), NULL,
+                      JANET_MARSHAL_UNSAFE | JANET_MARSHAL_LAZY, &threaded_count);
+    JanetThreadImage *image = janet_abstract_threaded(&janet_thread_image_type, sizeof(JanetThreadImage));
+    image->threaded = threaded;
+    image->threaded_count = threaded_count;
+    image->len = (size_t) buffer->count;
+    image->bytes = janet_malloc(image->len);
+    image->registry_count = janet_vm.registry_count;
+    image->registry = janet_malloc(janet_vm.registry_count * sizeof(JanetCFunRegistry) + 1);
+    if (NULL == image->bytes || NULL == image->registry) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(image->bytes, buffer->data, image->len);
+    memcpy(image->registry, janet_vm.registry, janet_vm.registry_count * sizeof(JanetCFunRegistry));
+    JanetThreadSnapshot *snapshot = janet_abstract(&janet_thread_snapshot_type, sizeof(JanetThreadSnapshot));
+    memset(snapshot, 0, sizeof(JanetThreadSnapshot));
+    snapshot->image = image;
+    snapshot->env = env;
+    /* Names must resolve to what was marshalled, not to later definitions */
+    janet_thread_snapshot_reverse(snapshot);
+    return snapshot;
+}
+
+JANET_CORE_FN(cfun_ev_thread_snapshot,
+              "(ev/thread-snapshot &opt env)",
+              "Marshal `env`, by default the current environment, along with everything it references, "
+              "such as the core library and loaded modules, into a snapshot that threads can start from. "
+              "Threads started by `ev/thread`, `ev/do-thread`, and `ev/spawn-thread` while `*thread-snapshot*` "
+              "is set to a snapshot load it instead of having every value they use copied to them. "
+              "Each thread runs in a new environment table whose prototype is the loaded copy of `env`, "
+              "and values found in `env` are sent to the thread by name, so the thread sees them "
+              "as they were when the snapshot was made. Pool threads keep the snapshot loaded for later "
+              "threads, and each thread gets its own copies of the vars, tables, arrays and buffers bound in "
+              "`env`, while functions and everything else are shared. Threads started with the `:w` flag of "
+              "`ev/thread` share those copies too, so they start a little faster, but see any changes made "
+              "by each other. Returns the snapshot.") {
+    janet_arity(argc, 0, 1);
+    JanetTable *env = (argc > 0) ? janet_gettable(argv, 0) : janet_vm.fiber->env;
+    if (NULL == env) env = janet_core_env(NULL);
+    return janet_wrap_abstract(janet_thread_snapshot_new(env));
+}
+
+#define JANET_THREAD_WARM_FLAG 0x10
 #define JANET_THREAD_SUPERVISOR_FLAG 0x100
+#define JANET_THREAD_SNAPSHOT_FLAG 0x200
+
+/* Make the fiber for the main function or fiber of a new thread */
+static JanetFiber *janet_thread_main_fiber(Janet fiberv, Janet value) {
+    if (janet_checktype(fiberv, JANET_FIBER)) return janet_unwrap_fiber(fiberv);
+    if (!janet_checktype(fiberv, JANET_FUNCTION)) {
+        janet_panicf("expected function or fiber, got %v", fiberv);
+    }
+    JanetFunction *func = janet_unwrap_function(fiberv);
+    JanetFiber *fiber = janet_fiber(func, 64, func->def->min_arity, &value);
+    if (fiber == NULL) {
+        janet_panicf("thread function must accept 0 or 1 arguments");
+    }
+    fiber->flags |=
+        JANET_FIBER_MASK_ERROR |
+        JANET_FIBER_MASK_USER0 |
+        JANET_FIBER_MASK_USER1 |
+        JANET_FIBER_MASK_USER2 |
+        JANET_FIBER_MASK_USER3 |
+        JANET_FIBER_MASK_USER4;
+    return fiber;
+}
+
+/* Run a fiber in env, or else in a new environment on top of the loaded
+ * snapshot, which keeps definitions made by the fiber out of the snapshot */
+static void janet_thread_snapshot_env(JanetFiber *fiber, JanetTable *env) {
+    if (NULL == fiber->env) {
+        if (NULL == env) {
+            env = janet_table(0);
+            env->proto = janet_warm_snapshot->env;
+        }
+        fiber->env = env;
+    }
+}
+
+/* Read the image pointer at the start of a thread message */
+static JanetThreadImage *janet_thread_message_image(JanetBuffer *buffer) {
+    JanetThreadImage *image;
+    memcpy(&image, buffer->data, sizeof(image));
+    return image;
+}
 
 /* For ev/thread - Run an interpreter in the new thread. */
 static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
@@ -2992,14 +5018,35 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
     const uint8_t *endbytes = nextbytes + buffer->count;
     uint32_t flags = args.tag;
     args.tag = 0;
-    janet_init();
+    if ((flags & JANET_THREAD_SNAPSHOT_FLAG) &&
+            NULL != janet_warm_snapshot &&
+            janet_warm_snapshot->image == janet_thread_message_image(buffer) &&
+            ((flags & JANET_THREAD_WARM_FLAG) || !janet_warm_shared)) {
+        /* Reuse the vm from the last snapshot thread, which already holds a reference */
+        janet_abstract_decref(janet_warm_snapshot->image);
+    } else {
+        janet_thread_cooldown();
+        janet_init();
+    }
+    janet_vm.user = NULL;
     janet_vm.sandbox_flags = (uint32_t) args.argi;
     JanetTryState tstate;
     JanetSignal signal = janet_try(&tstate);
     if (!signal) {
 
-        /* Set abstract registry */
-        if (!(flags & 0x2)) {
+        /* Load snapshot, or set abstract registry */
+        JanetTable *reg = NULL;
+        JanetTable *env = NULL;
+        if (flags & JANET_THREAD_SNAPSHOT_FLAG) {
+            if (NULL == janet_warm_snapshot) janet_thread_warmup(janet_thread_message_image(buffer));
+            nextbytes += sizeof(JanetThreadImage *);
+            if (flags & JANET_THREAD_WARM_FLAG) {
+                janet_warm_shared = 1;
+                reg = janet_thread_snapshot_forward(janet_warm_snapshot);
+            } else {
+                env = janet_thread_snapshot_fork(janet_warm_snapshot, &reg);
+            }
+        } else if (!(flags & 0x2)) {
             Janet aregv = janet_unmarshal(nextbytes, endbytes - nextbytes,
                                           JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
             if (!janet_checktype(aregv, JANET_TABLE)) janet_panic("expected table for abstract registry");
@@ -3017,7 +5064,7 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
         }
 
         /* Set cfunction registry */
-        if (!(flags & 0x4)) {
+        if (!(flags & (JANET_THREAD_SNAPSHOT_FLAG | 0x4))) {
             uint32_t count1;
             memcpy(&count1, nextbytes, sizeof(count1));
             size_t count = (size_t) count1;
@@ -3038,29 +5085,11 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
         }
 
         Janet fiberv = janet_unmarshal(nextbytes, endbytes - nextbytes,
-                                       JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+                                       JANET_MARSHAL_UNSAFE, reg, &nextbytes);
         Janet value = janet_unmarshal(nextbytes, endbytes - nextbytes,
-                                      JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
-        JanetFiber *fiber;
-        if (!janet_checktype(fiberv, JANET_FIBER)) {
-            if (!janet_checktype(fiberv, JANET_FUNCTION)) {
-                janet_panicf("expected function or fiber, got %v", fiberv);
-            }
-            JanetFunction *func = janet_unwrap_function(fiberv);
-            fiber = janet_fiber(func, 64, func->def->min_arity, &value);
-            if (fiber == NULL) {
-                janet_panicf("thread function must accept 0 or 1 arguments");
-            }
-            fiber->flags |=
-                JANET_FIBER_MASK_ERROR |
-                JANET_FIBER_MASK_USER0 |
-                JANET_FIBER_MASK_USER1 |
-                JANET_FIBER_MASK_USER2 |
-                JANET_FIBER_MASK_USER3 |
-                JANET_FIBER_MASK_USER4;
-        } else {
-            fiber = janet_unwrap_fiber(fiberv);
-        }
+                                      JANET_MARSHAL_UNSAFE, reg, &nextbytes);
+        JanetFiber *fiber = janet_thread_main_fiber(fiberv, value);
+        if (flags & JANET_THREAD_SNAPSHOT_FLAG) janet_thread_snapshot_env(fiber, env);
         if (flags & 0x8) {
             if (NULL == fiber->env) fiber->env = janet_table(0);
             janet_table_put(fiber->env, janet_ckeywordv("task-id"), value);
@@ -3096,7 +5125,10 @@ static JanetEVGenericMessage janet_go_thread_subr(JanetEVGenericMessage args) {
     janet_restore(&tstate);
     janet_buffer_deinit(buffer);
     janet_free(buffer);
-    janet_deinit();
+    /* Keep the vm for later snapshot threads */
+    if (NULL == janet_warm_snapshot) {
+        janet_deinit();
+    }
     return args;
 }
 
@@ -3111,16 +5143,27 @@ JANET_CORE_FN(cfun_ev_thread,
               "* `:n` - return immediately\n"
               "* `:t` - set the task-id of the new thread to value. The task-id is passed in messages to the supervisor channel.\n"
               "* `:a` - don't copy abstract registry to new thread (performance optimization)\n"
-              "* `:c` - don't copy cfunction registry to new thread (performance optimization)") {
+              "* `:c` - don't copy cfunction registry to new thread (performance optimization)\n"
+              "* `:w` - with a thread snapshot, share the bindings of the snapshot kept by a pool thread with earlier "
+              "and later `:w` threads instead of getting copies of them. Changes those threads make are seen by each other.\n\n"
+              "If `*thread-snapshot*` is set to a snapshot from `ev/thread-snapshot`, the new thread starts from "
+              "that snapshot and the `:a` and `:c` flags have no effect.") {
     janet_arity(argc, 1, 4);
     Janet value = argc >= 2 ? argv[1] : janet_wrap_nil();
     if (!janet_checktype(argv[0], JANET_FUNCTION)) janet_getfiber(argv, 0);
     uint64_t flags = 0;
     if (argc >= 3) {
-        flags = janet_getflags(argv, 2, "nact");
+        flags = janet_getflags(argv, 2, "nactw");
     }
     void *supervisor = janet_optabstract(argv, argc, 3, &janet_channel_type, janet_vm.root_fiber->supervisor_channel);
     if (NULL != supervisor) flags |= JANET_THREAD_SUPERVISOR_FLAG;
+    JanetThreadSnapshot *snapshot = NULL;
+    Janet snapshotv = janet_dyn("thread-snapshot");
+    if (!janet_checktype(snapshotv, JANET_NIL)) {
+        snapshot = janet_checkabstract(snapshotv, &janet_thread_snapshot_type);
+        if (NULL == snapshot) janet_panicf("expected thread snapshot for *thread-snapshot*, got %v", snapshotv);
+        flags |= JANET_THREAD_SNAPSHOT_FLAG;
+    }
 
     /* Marshal arguments for the new thread. */
     JanetBuffer *buffer = janet_malloc(sizeof(JanetBuffer));
@@ -3128,20 +5171,26 @@ JANET_CORE_FN(cfun_ev_thread,
         JANET_OUT_OF_MEMORY;
     }
     janet_buffer_init(buffer, 0);
-    if (!(flags & 0x2)) {
+    JanetTable *rreg = NULL;
+    if (NULL != snapshot) {
+        /* Reference is taken once marshalling can no longer fail */
+        janet_buffer_push_bytes(buffer, (uint8_t *) &snapshot->image, sizeof(snapshot->image));
+        rreg = janet_thread_snapshot_reverse(snapshot);
+    } else if (!(flags & 0x2)) {
         janet_marshal(buffer, janet_wrap_table(janet_vm.abstract_registry), NULL, JANET_MARSHAL_UNSAFE);
     }
     if (flags & JANET_THREAD_SUPERVISOR_FLAG) {
         janet_marshal(buffer, janet_wrap_abstract(supervisor), NULL, JANET_MARSHAL_UNSAFE);
     }
-    if (!(flags & 0x4)) {
+    if (NULL == snapshot && !(flags & 0x4)) {
         janet_assert(janet_vm.registry_count <= INT32_MAX, "assert failed size check");
         uint32_t temp = (uint32_t) janet_vm.registry_count;
         janet_buffer_push_bytes(buffer, (uint8_t *) &temp, sizeof(temp));
         janet_buffer_push_bytes(buffer, (uint8_t *) janet_vm.registry, (int32_t) janet_vm.registry_count * sizeof(JanetCFunRegistry));
     }
-    janet_marshal(buffer, argv[0], NULL, JANET_MARSHAL_UNSAFE);
-    janet_marshal(buffer, value, NULL, JANET_MARSHAL_UNSAFE);
+    janet_marshal(buffer, argv[0], rreg, JANET_MARSHAL_UNSAFE);
+    janet_marshal(buffer, value, rreg, JANET_MARSHAL_UNSAFE);
+    if (NULL != snapshot) janet_abstract_incref(snapshot->image);
     if (flags & 0x1) {
         /* Return immediately */
         JanetEVGenericMessage arguments;
@@ -3157,6 +5206,487 @@ JANET_CORE_FN(cfun_ev_thread,
     }
 }
 
+JANET_CORE_FN(cfun_ev_set_thread_pool,
+              "(ev/set-thread-pool max-idle &opt max-workers)",
+              "Configure the pool of operating system threads that runs `ev/thread`, `os/shell`, `os/proc-wait`, "
+              "and other blocking calls. Up to `max-idle` threads are kept waiting for more work after finishing a call. "
+              "If `max-workers` is positive, at most that many threads are started, and extra calls wait in a queue. "
+              "Calls that run for a long time, such as threads started with `ev/thread`, hold a thread until they are done, "
+              "so a small `max-workers` can make other calls wait indefinitely. By default, `max-idle` is 8 and there is no "
+              "limit on workers. The pool is shared by all threads in the process. Returns nil.") {
+    janet_arity(argc, 1, 2);
+    int32_t max_idle = janet_getnat(argv, 0);
+    int32_t max_workers = janet_optnat(argv, argc, 1, 0);
+    janet_pool_acquire();
+    janet_pool.max_idle = max_idle;
+    janet_pool.max_workers = max_workers;
+    /* Start workers for calls queued under a lower limit */
+    int32_t needed = janet_pool.queued - janet_pool.idle;
+    while (needed-- > 0 && (max_workers <= 0 || janet_pool.workers < max_workers)) {
+        if (janet_pool_spawn()) break;
+    }
+    /* Let extra idle workers exit */
+    janet_pool_broadcast();
+    janet_pool_release();
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(cfun_ev_thread_pool,
+              "(ev/thread-pool)",
+              "Get information about the thread pool used for blocking calls as a struct with the following keys:\n\n"
+              "* :workers - number of threads in the pool\n"
+              "* :busy - number of threads running a call\n"
+              "* :idle - number of threads waiting for work\n"
+              "* :queued - number of calls waiting for a thread\n"
+              "* :max-idle and :max-workers - settings from `ev/set-thread-pool`\n"
+              "* :spawned - total number of threads started\n"
+              "* :completed - total number of calls completed") {
+    janet_fixarity(argc, 0);
+    (void) argv;
+    janet_pool_acquire();
+    int32_t workers = janet_pool.workers;
+    int32_t busy = janet_pool.busy;
+    int32_t idle = janet_pool.idle;
+    int32_t queued = janet_pool.queued;
+    int32_t max_idle = janet_pool.max_idle;
+    int32_t max_workers = janet_pool.max_workers;
+    double spawned = (double) janet_pool.spawned;
+    double completed = (double) janet_pool.completed;
+    janet_pool_release();
+    JanetKV *st = janet_struct_begin(8);
+    janet_struct_put(st, janet_ckeywordv("workers"), janet_wrap_integer(workers));
+    janet_struct_put(st, janet_ckeywordv("busy"), janet_wrap_integer(busy));
+    janet_struct_put(st, janet_ckeywordv("idle"), janet_wrap_integer(idle));
+    janet_struct_put(st, janet_ckeywordv("queued"), janet_wrap_integer(queued));
+    janet_struct_put(st, janet_ckeywordv("max-idle"), janet_wrap_integer(max_idle));
+    janet_struct_put(st, janet_ckeywordv("max-workers"), janet_wrap_integer(max_workers));
+    janet_struct_put(st, janet_ckeywordv("spawned"), janet_wrap_number(spawned));
+    janet_struct_put(st, janet_ckeywordv("completed"), janet_wrap_number(completed));
+    return janet_wrap_struct(janet_struct_end(st));
+}
+
+/*
+ * Fiber pools
+ *
+ * A fiber pool runs tasks as fibers on worker threads that each have their own vm and
+ * event loop, so many fibers share a few threads and the threads can run on separate
+ * cores. Every worker loads the same thread snapshot once, and tasks are functions or
+ * fibers marshalled against it. Each worker has a deque of tasks. Tasks started by a
+ * worker go on the back of its own deque, and other tasks are dealt out to the workers in
+ * turn. A worker starts tasks from the back of its own deque, and once that is empty,
+ * steals from the front of the others.
+ */
+
+typedef struct JanetFiberPool JanetFiberPool;
+
+typedef struct {
+    JanetFiberPool *pool;
+    JanetOSMutex *lock;
+    JanetBuffer **tasks; /* Ring of marshalled tasks, capacity is a power of 2 */
+    int32_t head;
+    int32_t count;
+    int32_t capacity;
+    JanetVM *vm; /* Set while the worker is running, protected by lock */
+    JanetAtomicInt waiting; /* Blocked in the event loop with nothing to run */
+} JanetFiberPoolWorker;
+
+struct JanetFiberPool {
+    JanetThreadImage *image;
+    JanetFiberPoolWorker *workers;
+    int32_t worker_count;
+    uint32_t sandbox_flags;
+    JanetAtomicInt queued;
+    JanetAtomicInt next;
+    JanetAtomicInt closed;
+};
+
+/* A vm's handle on a pool, with the snapshot used to marshal tasks from that vm */
+typedef struct {
+    JanetFiberPool *pool;
+    JanetThreadSnapshot *snapshot;
+} JanetFiberPoolHandle;
+
+/* The pool worker running on this thread, if any */
+static JANET_THREAD_LOCAL JanetFiberPoolWorker *janet_current_pool_worker = NULL;
+
+static int janet_fiber_pool_state_gc(void *p, size_t size) {
+    (void) size;
+    JanetFiberPool *pool = (JanetFiberPool *) p;
+    for (int32_t i = 0; i < pool->worker_count; i++) {
+        JanetFiberPoolWorker *w = pool->workers + i;
+        /* Only left over if workers failed to start */
+        for (int32_t j = 0; j < w->count; j++) {
+            JanetBuffer *task = w->tasks[(w->head + j) & (w->capacity - 1)];
+            janet_buffer_deinit(task);
+            janet_free(task);
+        }
+        janet_free(w->tasks);
+        janet_os_mutex_deinit(w->lock);
+        janet_free(w->lock);
+    }
+    janet_free(pool->workers);
+    janet_threaded_release(pool->image);
+    return 0;
+}
+
+static const JanetAbstractType janet_fiber_pool_state_type = {
+    "core/fiber-pool-state",
+    janet_fiber_pool_state_gc,
+    JANET_ATEND_GC
+};
+
+static int janet_fiber_pool_mark(void *p, size_t size) {
+    (void) size;
+    JanetFiberPoolHandle *handle = (JanetFiberPoolHandle *) p;
+    if (NULL != handle->pool) janet_mark(janet_wrap_abstract(handle->pool));
+    if (NULL != handle->snapshot) janet_mark(janet_wrap_abstract(handle->snapshot));
+    return 0;
+}
+
+static void janet_fiber_pool_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetFiberPoolHandle *handle = (JanetFiberPoolHandle *) p;
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot marshal fiber pool in safe mode");
+    }
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_janet(ctx, janet_wrap_abstract(handle->pool));
+    janet_marshal_janet(ctx, janet_wrap_abstract(handle->snapshot));
+}
+
+static void *janet_fiber_pool_unmarshal(JanetMarshalContext *ctx) {
+    if (!(ctx->flags & JANET_MARSHAL_UNSAFE)) {
+        janet_panic("cannot unmarshal fiber pool in safe mode");
+    }
+    JanetFiberPoolHandle *handle = janet_unmarshal_abstract(ctx, sizeof(JanetFiberPoolHandle));
+    memset(handle, 0, sizeof(JanetFiberPoolHandle));
+    Janet pool = janet_unmarshal_janet(ctx);
+    if (!janet_checkabstract(pool, &janet_fiber_pool_state_type)) {
+        janet_panic("expected fiber pool state");
+    }
+    handle->pool = janet_unwrap_abstract(pool);
+    Janet snapshot = janet_unmarshal_janet(ctx);
+    if (!janet_checkabstract(snapshot, &janet_thread_snapshot_type)) {
+        janet_panic("expected thread snapshot");
+    }
+    handle->snapshot = janet_unwrap_abstract(snapshot);
+    return handle;
+}
+
+static size_t janet_fiber_pool_length(void *p, size_t len) {
+    (void) len;
+    JanetFiberPoolHandle *handle = (JanetFiberPoolHandle *) p;
+    return (size_t) handle->pool->worker_count;
+}
+
+static const JanetAbstractType janet_fiber_pool_type = {
+    "core/fiber-pool",
+    NULL,
+    janet_fiber_pool_mark,
+    NULL,
+    NULL,
+    janet_fiber_pool_marshal,
+    janet_fiber_pool_unmarshal,
+    NULL, /* tostring */
+    NULL, /* compare */
+    NULL, /* hash */
+    NULL, /* next */
+    NULL, /* call */
+    janet_fiber_pool_length,
+    JANET_ATEND_LENGTH
+};
+
+static void janet_fiber_pool_wake_cb(JanetEVGenericMessage msg) {
+    (void) msg;
+}
+
+/* Wake a worker if it is waiting for work. Returns 1 if it was woken. */
+static int janet_fiber_pool_wake(JanetFiberPoolWorker *w) {
+    if (!janet_atomic_load(&w->waiting)) return 0;
+    int woken = 0;
+    janet_os_mutex_lock(w->lock);
+    if (NULL != w->vm && janet_atomic_exchange(&w->waiting, 0)) {
+        JanetEVGenericMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        janet_ev_post_event(w->vm, janet_fiber_pool_wake_cb, msg);
+        woken = 1;
+    }
+    janet_os_mutex_unlock(w->lock);
+    return woken;
+}
+
+static void janet_fiber_pool_push(JanetFiberPool *pool, JanetBuffer *task) {
+    int32_t n = pool->worker_count;
+    int32_t target;
+    if (NULL != janet_current_pool_worker && janet_current_pool_worker->pool == pool) {
+        target = (int32_t)(janet_current_pool_worker - pool->workers);
+    } else {
+        target = (int32_t)((uint32_t) janet_atomic_inc(&pool->next) % (uint32_t) n);
+    }
+    JanetFiberPoolWorker *w = pool->workers + target;
+    janet_os_mutex_lock(w->lock);
+    if (w->count == w->capacity) {
+        int32_t newcap = w->capacity ? 2 * w->capacity : 16;
+        JanetBuffer **tasks = janet_malloc(newcap * sizeof(JanetBuffer *));
+        if (NULL == tasks) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < w->count; i++) {
+            tasks[i] = w->tasks[(w->head + i) & (w->capacity - 1)];
+        }
+        janet_free(w->tasks);
+        w->tasks = tasks;
+        w->head = 0;
+        w->capacity = newcap;
+    }
+    w->tasks[(w->head + w->count) & (w->capacity - 1)] = task;
+    w->count++;
+    janet_os_mutex_unlock(w->lock);
+    janet_atomic_inc(&pool->queued);
+    janet_atomic_fence();
+    /* Wake the worker that got the task, or else another one to steal it */
+    for (int32_t i = 0; i < n; i++) {
+        if (janet_fiber_pool_wake(pool->workers + (target + i) % n)) break;
+    }
+}
+
+/* Take the newest task of a worker's own deque, or steal the oldest task of another */
+static JanetBuffer *janet_fiber_pool_take(JanetFiberPool *pool, JanetFiberPoolWorker *self) {
+    if (janet_atomic_load(&pool->queued) <= 0) return NULL;
+    int32_t n = pool->worker_count;
+    int32_t start = (int32_t)(self - pool->workers);
+    for (int32_t i = 0; i < n; i++) {
+        JanetFiberPoolWorker *w = pool->workers + (start + i) % n;
+        JanetBuffer *task = NULL;
+        janet_os_mutex_lock(w->lock);
+        if (w->count > 0) {
+            w->count--;
+            if (w == self) {
+                task = w->tasks[(w->head + w->count) & (w->capacity - 1)];
+            } else {
+                task = w->tasks[w->head];
+                w->head = (w->head + 1) & (w->capacity - 1);
+            }
+        }
+        janet_os_mutex_unlock(w->lock);
+        if (NULL != task) {
+            janet_atomic_dec(&pool->queued);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/* Unmarshal a task and schedule its fiber */
+static void janet_fiber_pool_start(JanetBuffer *task) {
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        JanetTable *reg = janet_thread_snapshot_forward(janet_warm_snapshot);
+        const uint8_t *nextbytes = task->data;
+        const uint8_t *endbytes = nextbytes + task->count;
+        Janet fiberv = janet_unmarshal(nextbytes, endbytes - nextbytes, JANET_MARSHAL_UNSAFE, reg, &nextbytes);
+        Janet value = janet_unmarshal(nextbytes, endbytes - nextbytes, JANET_MARSHAL_UNSAFE, reg, &nextbytes);
+        Janet supervisor = janet_unmarshal(nextbytes, endbytes - nextbytes, JANET_MARSHAL_UNSAFE, NULL, &nextbytes);
+        JanetFiber *fiber = janet_thread_main_fiber(fiberv, value);
+        janet_thread_snapshot_env(fiber, NULL);
+        fiber->supervisor_channel = janet_checktype(supervisor, JANET_NIL) ? NULL : janet_unwrap_abstract(supervisor);
+        janet_schedule(fiber, value);
+    } else {
+        janet_eprintf("fiber pool task failed to start: %v\n", tstate.payload);
+    }
+    janet_restore(&tstate);
+    janet_buffer_deinit(task);
+    janet_free(task);
+}
+
+/* Run the event loop once, keeping it waiting even with nothing pending so that
+ * a new task can wake it up */
+static void janet_fiber_pool_wait(JanetFiberPool *pool, JanetFiberPoolWorker *w) {
+    janet_atomic_store(&w->waiting, 1);
+    janet_atomic_fence();
+    if (janet_atomic_load(&pool->queued) <= 0 && !janet_atomic_load(&pool->closed)) {
+        janet_ev_inc_refcount();
+        JanetFiber *interrupted_fiber = janet_loop1();
+        janet_ev_dec_refcount();
+        if (NULL != interrupted_fiber) {
+            janet_schedule(interrupted_fiber, janet_wrap_nil());
+        }
+    }
+    janet_atomic_exchange(&w->waiting, 0);
+}
+
+static void janet_fiber_pool_run(JanetFiberPoolWorker *w) {
+    JanetFiberPool *pool = w->pool;
+    janet_init();
+    janet_vm.sandbox_flags = pool->sandbox_flags;
+    janet_current_pool_worker = w;
+    JanetTryState tstate;
+    JanetSignal signal = janet_try(&tstate);
+    if (!signal) {
+        janet_abstract_incref(pool->image);
+        janet_thread_warmup(pool->image);
+    } else {
+        janet_eprintf("fiber pool worker failed to start: %v\n", tstate.payload);
+    }
+    janet_restore(&tstate);
+    if (!signal) {
+        janet_os_mutex_lock(w->lock);
+        w->vm = janet_local_vm();
+        janet_os_mutex_unlock(w->lock);
+        for (;;) {
+            /* Start a task whenever no fiber is ready to run */
+            if (janet_vm.spawn.head == janet_vm.spawn.tail) {
+                JanetBuffer *task = janet_fiber_pool_take(pool, w);
+                if (NULL != task) {
+                    janet_fiber_pool_start(task);
+                    continue;
+                }
+                if (!janet_atomic_load(&pool->closed)) {
+                    janet_fiber_pool_wait(pool, w);
+                    continue;
+                }
+                if (janet_loop_done()) break;
+            }
+            JanetFiber *interrupted_fiber = janet_loop1();
+            if (NULL != interrupted_fiber) {
+                janet_schedule(interrupted_fiber, janet_wrap_nil());
+            }
+        }
+        janet_os_mutex_lock(w->lock);
+        w->vm = NULL;
+        janet_os_mutex_unlock(w->lock);
+    }
+    janet_current_pool_worker = NULL;
+    janet_warm_snapshot = NULL;
+    janet_deinit();
+    janet_threaded_release(pool);
+}
+
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_fiber_pool_thread(LPVOID ptr) {
+    janet_fiber_pool_run((JanetFiberPoolWorker *) ptr);
+    return 0;
+}
+#else
+static void *janet_fiber_pool_thread(void *ptr) {
+    janet_fiber_pool_run((JanetFiberPoolWorker *) ptr);
+    return NULL;
+}
+#endif
+
+/* Stop taking tasks and let waiting workers exit */
+static void janet_fiber_pool_close(JanetFiberPool *pool) {
+    janet_atomic_store(&pool->closed, 1);
+    janet_atomic_fence();
+    for (int32_t i = 0; i < pool->worker_count; i++) {
+        janet_fiber_pool_wake(pool->workers + i);
+    }
+}
+
+JANET_CORE_FN(cfun_ev_pool,
+              "(ev/pool workers)",
+              "Start a fiber pool with `workers` operating system threads, each running its own event loop. "
+              "Tasks are started on the pool with `ev/pool-go` or `ev/pool-map`, and run as fibers on whichever "
+              "worker gets to them first. Every worker loads the snapshot in `*thread-snapshot*` when the pool "
+              "is made, or else a snapshot of the root environment, and each task runs in a new environment on top of it. "
+              "Workers keep running until `ev/pool-close` is called. Returns the pool.") {
+    janet_fixarity(argc, 1);
+    int32_t worker_count = janet_getnat(argv, 0);
+    if (worker_count < 1) janet_panic("expected at least one worker");
+    JanetThreadSnapshot *snapshot;
+    Janet snapshotv = janet_dyn("thread-snapshot");
+    if (janet_checktype(snapshotv, JANET_NIL)) {
+        snapshot = janet_thread_snapshot_new(janet_core_env(NULL));
+    } else {
+        snapshot = janet_checkabstract(snapshotv, &janet_thread_snapshot_type);
+        if (NULL == snapshot) janet_panicf("expected thread snapshot for *thread-snapshot*, got %v", snapshotv);
+    }
+    JanetFiberPool *pool = janet_abstract_threaded(&janet_fiber_pool_state_type, sizeof(JanetFiberPool));
+    memset(pool, 0, sizeof(JanetFiberPool));
+    pool->workers = janet_malloc(worker_count * sizeof(JanetFiberPoolWorker));
+    if (NULL == pool->workers) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memset(pool->workers, 0, worker_count * sizeof(JanetFiberPoolWorker));
+    for (int32_t i = 0; i < worker_count; i++) {
+        JanetFiberPoolWorker *w = pool->workers + i;
+        w->pool = pool;
+        w->lock = janet_malloc(janet_os_mutex_size());
+        if (NULL == w->lock) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_os_mutex_init(w->lock);
+    }
+    pool->worker_count = worker_count;
+    pool->image = snapshot->image;
+    janet_abstract_incref(pool->image);
+    pool->sandbox_flags = janet_vm.sandbox_flags;
+    JanetFiberPoolHandle *handle = janet_abstract(&janet_fiber_pool_type, sizeof(JanetFiberPoolHandle));
+    handle->pool = pool;
+    handle->snapshot = snapshot;
+    for (int32_t i = 0; i < worker_count; i++) {
+        /* Each worker holds a reference to the pool until it exits */
+        janet_abstract_incref(pool);
+#ifdef JANET_WINDOWS
+        HANDLE thread_handle = CreateThread(NULL, 0, janet_fiber_pool_thread, pool->workers + i, 0, NULL);
+        int err = (NULL == thread_handle);
+        if (!err) CloseHandle(thread_handle);
+#else
+        pthread_t worker;
+        int err = pthread_create(&worker, &janet_vm.new_thread_attr, janet_fiber_pool_thread, pool->workers + i);
+#endif
+        if (err) {
+            janet_abstract_decref(pool);
+            janet_fiber_pool_close(pool);
+#ifdef JANET_WINDOWS
+            janet_panic("failed to create thread");
+#else
+            janet_panicf("%s", janet_strerror(err));
+#endif
+        }
+    }
+    return janet_wrap_abstract(handle);
+}
+
+JANET_CORE_FN(cfun_ev_pool_go,
+              "(ev/pool-go pool main &opt value supervisor)",
+              "Run `main` in a new fiber on a worker of the fiber pool `pool`, optionally passing `value` "
+              "to resume with. Like with `ev/thread`, `main` can be a function or a fiber, and is marshalled to the worker "
+              "along with `value`. Values found in the pool's snapshot are sent by name. If `supervisor` is given, it must "
+              "be a threaded channel, and is the supervisor channel of the new fiber. Returns nil immediately.") {
+    janet_arity(argc, 2, 4);
+    JanetFiberPoolHandle *handle = janet_getabstract(argv, 0, &janet_fiber_pool_type);
+    JanetFiberPool *pool = handle->pool;
+    if (janet_atomic_load(&pool->closed)) janet_panic("fiber pool is closed");
+    if (!janet_checktype(argv[1], JANET_FUNCTION)) janet_getfiber(argv, 1);
+    Janet value = argc >= 3 ? argv[2] : janet_wrap_nil();
+    JanetChannel *supervisor = janet_optabstract(argv, argc, 3, &janet_channel_type, NULL);
+    if (NULL != supervisor && !supervisor->is_threaded) {
+        janet_panic("supervisor of a fiber pool task must be a threaded channel");
+    }
+    JanetTable *rreg = janet_thread_snapshot_reverse(handle->snapshot);
+    JanetBuffer *task = janet_malloc(sizeof(JanetBuffer));
+    if (NULL == task) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_buffer_init(task, 0);
+    janet_marshal(task, argv[1], rreg, JANET_MARSHAL_UNSAFE);
+    janet_marshal(task, value, rreg, JANET_MARSHAL_UNSAFE);
+    janet_marshal(task, supervisor ? janet_wrap_abstract(supervisor) : janet_wrap_nil(), NULL, JANET_MARSHAL_UNSAFE);
+    janet_fiber_pool_push(pool, task);
+    return janet_wrap_nil();
+}
+
+JANET_CORE_FN(cfun_ev_pool_close,
+              "(ev/pool-close pool)",
+              "Stop accepting tasks on the fiber pool `pool`. Workers exit once the queued tasks, "
+              "and the fibers they started, are done. Returns nil.") {
+    janet_fixarity(argc, 1);
+    JanetFiberPoolHandle *handle = janet_getabstract(argv, 0, &janet_fiber_pool_type);
+    janet_fiber_pool_close(handle->pool);
+    return janet_wrap_nil();
+}
+
 JANET_CORE_FN(cfun_ev_give_supervisor,
               "(ev/give-supervisor tag & payload)",
               "Send a message to the current supervisor channel if there is one. The message will be a "
@@ -3180,7 +5710,7 @@ JANET_NO_RETURN void janet_sleep_await(double sec) {
     to.is_error = 0;
     to.sched_id = to.fiber->sched_id;
     to.curr_fiber = NULL;
-    to.has_worker = 0;
+    to.watchdog = NULL;
     add_timeout(to);
     janet_await();
 }
@@ -3200,8 +5730,8 @@ JANET_CORE_FN(cfun_ev_deadline,
               "`tocheck` fiber is resumable. `sec` is a number that can have a fractional part. "
               "`tocancel` defaults to `(fiber/root)`, but if specified, must be a task (root "
               "fiber). `tocheck` defaults to `(fiber/current)`, but if specified, must be a fiber. "
-              "Returns `tocancel` immediately. If `interrupt?` is set to true, will create a "
-              "background thread to try to interrupt the VM if the timeout expires.") {
+              "Returns `tocancel` immediately. If `interrupt?` is set to true, a background "
+              "thread shared by all deadlines will try to interrupt the VM if the timeout expires.") {
     janet_arity(argc, 1, 4);
     double sec = janet_getnumber(argv, 0);
     sec = (sec < 0) ? 0 : sec;
@@ -3214,36 +5744,7 @@ JANET_CORE_FN(cfun_ev_deadline,
     to.curr_fiber = tocheck;
     to.is_error = 0;
     to.sched_id = to.fiber->sched_id;
-    if (use_interrupt) {
-#ifdef JANET_ANDROID
-        janet_sandbox_assert(JANET_SANDBOX_SIGNAL);
-#endif
-        JanetThreadedTimeout *tto = janet_malloc(sizeof(JanetThreadedTimeout));
-        if (NULL == tto) {
-            JANET_OUT_OF_MEMORY;
-        }
-        tto->sec = sec;
-        tto->vm = &janet_vm;
-        tto->fiber = tocheck;
-#ifdef JANET_WINDOWS
-        HANDLE worker = CreateThread(NULL, 0, janet_timeout_body, tto, 0, NULL);
-        if (NULL == worker) {
-            janet_free(tto);
-            janet_panic("failed to create thread");
-        }
-#else
-        pthread_t worker;
-        int err = pthread_create(&worker, NULL, janet_timeout_body, tto);
-        if (err) {
-            janet_free(tto);
-            janet_panicf("%s", janet_strerror(err));
-        }
-#endif
-        to.has_worker = 1;
-        to.worker = worker;
-    } else {
-        to.has_worker = 0;
-    }
+    to.watchdog = use_interrupt ? janet_watchdog_add(to.when) : NULL;
     add_timeout(to);
     return janet_wrap_fiber(tocancel);
 }
@@ -3307,13 +5808,18 @@ JANET_CORE_FN(janet_cfun_stream_chunk,
 JANET_CORE_FN(janet_cfun_stream_write,
               "(ev/write stream data &opt timeout)",
               "Write data to a stream, suspending the current fiber until the write "
-              "completes. Takes an optional timeout in seconds, after which will return nil. "
+              "completes. Data can be a string, buffer, or rope. "
+              "Takes an optional timeout in seconds, after which will return nil. "
               "Returns nil, or raises an error if the write failed.") {
     janet_arity(argc, 2, 3);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_WRITABLE);
     double to = janet_optnumber(argv, argc, 2, INFINITY);
-    if (janet_checktype(argv[1], JANET_BUFFER)) {
+    JanetRope *rope = janet_checkabstract(argv[1], &janet_rope_type);
+    if (NULL != rope) {
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_write_rope(stream, rope);
+    } else if (janet_checktype(argv[1], JANET_BUFFER)) {
         if (to != INFINITY) janet_addtimeout(to);
         janet_ev_write_buffer(stream, janet_getbuffer(argv, 1));
     } else {
@@ -3323,6 +5829,48 @@ JANET_CORE_FN(janet_cfun_stream_write,
     }
 }
 
+#ifdef JANET_LINUX
+
+static Janet ev_transfer_cfun(int32_t argc, Janet *argv, int is_splice) {
+    janet_arity(argc, 2, 5);
+    JanetStream *dest = janet_getabstract(argv, 0, &janet_stream_type);
+    JanetStream *src = janet_getabstract(argv, 1, &janet_stream_type);
+    janet_stream_flags(dest, JANET_STREAM_WRITABLE);
+    janet_stream_flags(src, JANET_STREAM_READABLE);
+    int64_t nbytes = -1;
+    if (argc > 2 && !janet_checktype(argv[2], JANET_NIL) && !janet_keyeq(argv[2], "all")) {
+        nbytes = janet_getinteger64(argv, 2);
+        if (nbytes < 0) janet_panicf("expected non-negative byte count, got %v", argv[2]);
+    }
+    int64_t offset = -1;
+    if (argc > 3 && !janet_checktype(argv[3], JANET_NIL)) {
+        offset = janet_getinteger64(argv, 3);
+        if (offset < 0) janet_panicf("expected non-negative offset, got %v", argv[3]);
+    }
+    double to = janet_optnumber(argv, argc, 4, INFINITY);
+    if (to != INFINITY) janet_addtimeout(to);
+    janet_ev_transfer(dest, src, nbytes, offset, is_splice);
+}
+
+JANET_CORE_FN(janet_cfun_stream_sendfile,
+              "(ev/sendfile dest src &opt nbytes offset timeout)",
+              "Copy up to `nbytes` bytes from the stream `src`, usually a file from `os/open`, to the stream `dest`, "
+              "usually a socket, without copying the data through user space. If `nbytes` is nil or :all, copy until the "
+              "end of `src`. If `offset` is given, read from that position in `src` without changing its file position. "
+              "Suspends the current fiber until the transfer completes. Takes an optional timeout in seconds, after which "
+              "will raise an error. Returns the number of bytes copied.") {
+    return ev_transfer_cfun(argc, argv, 0);
+}
+
+JANET_CORE_FN(janet_cfun_stream_splice,
+              "(ev/splice dest src &opt nbytes offset timeout)",
+              "Move up to `nbytes` bytes from the stream `src` to the stream `dest` inside the kernel. One of the two "
+              "streams must be a pipe, such as one end of `os/pipe`. Otherwise the same as `ev/sendfile`.") {
+    return ev_transfer_cfun(argc, argv, 1);
+}
+
+#endif
+
 static int mutexgc(void *p, size_t size) {
     (void) size;
     janet_os_mutex_deinit(p);
@@ -3509,6 +6057,12 @@ void janet_lib_ev(JanetTable *env) {
         JANET_CORE_REG("ev/chan-close", cfun_channel_close),
         JANET_CORE_REG("ev/go", cfun_ev_go),
         JANET_CORE_REG("ev/thread", cfun_ev_thread),
+        JANET_CORE_REG("ev/thread-snapshot", cfun_ev_thread_snapshot),
+        JANET_CORE_REG("ev/pool", cfun_ev_pool),
+        JANET_CORE_REG("ev/pool-go", cfun_ev_pool_go),
+        JANET_CORE_REG("ev/pool-close", cfun_ev_pool_close),
+        JANET_CORE_REG("ev/set-thread-pool", cfun_ev_set_thread_pool),
+        JANET_CORE_REG("ev/thread-pool", cfun_ev_thread_pool),
         JANET_CORE_REG("ev/give-supervisor", cfun_ev_give_supervisor),
         JANET_CORE_REG("ev/sleep", cfun_ev_sleep),
         JANET_CORE_REG("ev/deadline", cfun_ev_deadline),
@@ -3517,6 +6071,10 @@ void janet_lib_ev(JanetTable *env) {
         JANET_CORE_REG("ev/read", janet_cfun_stream_read),
         JANET_CORE_REG("ev/chunk", janet_cfun_stream_chunk),
         JANET_CORE_REG("ev/write", janet_cfun_stream_write),
+#ifdef JANET_LINUX
+        JANET_CORE_REG("ev/sendfile", janet_cfun_stream_sendfile),
+        JANET_CORE_REG("ev/splice", janet_cfun_stream_splice),
+#endif
         JANET_CORE_REG("ev/lock", janet_cfun_mutex),
         JANET_CORE_REG("ev/acquire-lock", janet_cfun_mutex_acquire),
         JANET_CORE_REG("ev/release-lock", janet_cfun_mutex_release),
@@ -3535,6 +6093,8 @@ void janet_lib_ev(JanetTable *env) {
     janet_register_abstract_type(&janet_channel_type);
     janet_register_abstract_type(&janet_mutex_type);
     janet_register_abstract_type(&janet_rwlock_type);
+    janet_register_abstract_type(&janet_thread_snapshot_type);
+    janet_register_abstract_type(&janet_fiber_pool_type);
 }
 
 #endif
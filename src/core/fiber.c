@@ -44,6 +44,8 @@ static void fiber_reset(JanetFiber *fiber) {
     fiber->ev_state = NULL;
     fiber->ev_stream = NULL;
     fiber->supervisor_channel = NULL;
+    fiber->ev_timeout = NULL;
+    fiber->ev_request = NULL;
 #endif
     janet_fiber_set_status(fiber, JANET_STATUS_NEW);
 }
@@ -202,6 +204,10 @@ int janet_fiber_funcframe(JanetFiber *fiber, JanetFunction *func) {
     if (next_arity < func->def->min_arity) return 1;
     if (next_arity > func->def->max_arity) return 1;
 
+    /* Decode the body of a function from a lazy image on its first call */
+    janet_funcdef_ensure(func->def);
+    janet_jit_tick(func->def);
+
     if (fiber->capacity < nextstacktop) {
         janet_fiber_setcapacity(fiber, 2 * nextstacktop);
 #ifdef JANET_DEBUG
@@ -275,6 +281,7 @@ static void janet_env_detach(JanetFuncEnv *env) {
                 }
             }
         }
+        janet_gc_barrier(env);
         env->offset = 0;
         env->as.values = vmem;
     }
@@ -338,6 +345,10 @@ int janet_fiber_funcframe_tail(JanetFiber *fiber, JanetFunction *func) {
     if (next_arity < func->def->min_arity) return 1;
     if (next_arity > func->def->max_arity) return 1;
 
+    /* Decode the body of a function from a lazy image on its first call */
+    janet_funcdef_ensure(func->def);
+    janet_jit_tick(func->def);
+
     if (fiber->capacity < nextstacktop) {
         janet_fiber_setcapacity(fiber, 2 * nextstacktop);
 #ifdef JANET_DEBUG
@@ -43,10 +43,55 @@ static void janet_mark_buffer(JanetBuffer *buffer);
 static void janet_mark_string(const uint8_t *str);
 static void janet_mark_fiber(JanetFiber *fiber);
 static void janet_mark_abstract(void *adata);
+static int janet_check_liveref(Janet x);
+
+/* Minimum number of old blocks before a major collection is forced in
+ * generational mode */
+#define JANET_GC_OLD_MIN 4096
+
+/* Number of marking steps between checks of the pause budget */
+#define JANET_GC_STEP_CHECK 64
+
+/* Fraction of the gc interval to allocate between incremental collection steps */
+#define JANET_GC_STEP_DIVISOR 8
+
+/* Phases of an incremental collection */
+#define JANET_GC_IDLE 0
+#define JANET_GC_MARKING 1
+#define JANET_GC_SWEEPING 2
 
 /* Local state that is only temporary for gc */
 static JANET_THREAD_LOCAL uint32_t depth = JANET_RECURSION_GUARD;
-static JANET_THREAD_LOCAL size_t orig_rootcount;
+
+/* Grow one of the gc work lists to hold at least newcount items */
+static void *janet_gc_grow(void *data, size_t *capacity, size_t newcount, size_t itemsize) {
+    if (newcount > *capacity) {
+        size_t newcap = 2 * newcount;
+        data = janet_realloc(data, itemsize * newcap);
+        if (NULL == data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        *capacity = newcap;
+    }
+    return data;
+}
+
+/* Values that still need to be traced */
+static void janet_gc_push_gray(Janet x) {
+    size_t newcount = janet_vm.gc_gray_count + 1;
+    janet_vm.gc_gray = janet_gc_grow(janet_vm.gc_gray, &janet_vm.gc_gray_capacity, newcount, sizeof(Janet));
+    janet_vm.gc_gray[janet_vm.gc_gray_count] = x;
+    janet_vm.gc_gray_count = newcount;
+}
+
+/* Blocks mutated without a write barrier that must be traced again
+ * at the end of an incremental mark */
+static void janet_gc_push_rescan(JanetGCObject *mem) {
+    size_t newcount = janet_vm.gc_rescan_count + 1;
+    janet_vm.gc_rescan = janet_gc_grow(janet_vm.gc_rescan, &janet_vm.gc_rescan_capacity, newcount, sizeof(JanetGCObject *));
+    janet_vm.gc_rescan[janet_vm.gc_rescan_count] = mem;
+    janet_vm.gc_rescan_count = newcount;
+}
 
 /* Hint to the GC that we may need to collect */
 void janet_gcpressure(size_t s) {
@@ -91,13 +136,16 @@ void janet_mark(Janet x) {
                 break;
         }
         depth++;
-    } else {
-        janet_gcroot(x);
+    } else if (!janet_check_liveref(x)) {
+        janet_gc_push_gray(x);
     }
 }
 
 static void janet_mark_string(const uint8_t *str) {
-    janet_gc_mark(janet_string_head(str));
+    /* Pooled symbols are shared between threads and always marked,
+     * so only write the flag when it is not set. */
+    JanetStringHead *head = janet_string_head(str);
+    if (!janet_gc_reachable(head)) janet_gc_mark(head);
 }
 
 static void janet_mark_buffer(JanetBuffer *buffer) {
@@ -117,6 +165,8 @@ static void janet_mark_abstract(void *adata) {
         return;
     janet_gc_mark(janet_abstract_head(adata));
     if (janet_abstract_head(adata)->type->gcmark) {
+        if (janet_vm.gc_cycle == JANET_GC_MARKING)
+            janet_gc_push_rescan(&janet_abstract_head(adata)->gc);
         janet_abstract_head(adata)->type->gcmark(adata, janet_abstract_size(adata));
     }
 }
@@ -242,6 +292,10 @@ static void janet_mark_funcdef(JanetFuncDef *def) {
             janet_mark_string(def->symbolmap[i].symbol);
         }
     }
+#ifdef JANET_LAZY_IMAGE
+    if (def->flags & JANET_FUNCDEF_FLAG_LAZY)
+        janet_mark(janet_funcdef_lazy_owner(def));
+#endif
 
 }
 
@@ -268,6 +322,8 @@ recur:
     if (janet_gc_reachable(fiber))
         return;
     janet_gc_mark(fiber);
+    if (janet_vm.gc_cycle == JANET_GC_MARKING)
+        janet_gc_push_rescan(&fiber->gc);
 
     janet_mark(fiber->last_value);
 
@@ -328,10 +384,14 @@ static void janet_deinit_block(JanetGCObject *mem) {
         case JANET_MEMORY_TABLE_WEAKK:
         case JANET_MEMORY_TABLE_WEAKV:
         case JANET_MEMORY_TABLE_WEAKKV:
+            janet_table_touch(mem);
             janet_free(((JanetTable *) mem)->data);
             break;
         case JANET_MEMORY_FIBER: {
             JanetFiber *f = (JanetFiber *)mem;
+#ifdef JANET_EV_IO_URING
+            janet_ev_uring_detach(f);
+#endif
 #ifdef JANET_EV
             if (f->ev_state && !(f->flags & JANET_FIBER_EV_FLAG_IN_FLIGHT)) {
                 janet_ev_dec_refcount();
@@ -360,6 +420,10 @@ static void janet_deinit_block(JanetGCObject *mem) {
         case JANET_MEMORY_FUNCDEF: {
             JanetFuncDef *def = (JanetFuncDef *)mem;
             /* TODO - get this all with one alloc and one free */
+#ifdef JANET_LAZY_IMAGE
+            if (def->flags & JANET_FUNCDEF_FLAG_LAZY)
+                janet_funcdef_lazy_forget(def);
+#endif
             janet_free(def->defs);
             janet_free(def->environments);
             janet_free(def->constants);
@@ -367,11 +431,197 @@ static void janet_deinit_block(JanetGCObject *mem) {
             janet_free(def->sourcemap);
             janet_free(def->closure_bitset);
             janet_free(def->symbolmap);
+#ifdef JANET_METHOD_CACHE
+            janet_method_cache_forget(def);
+#endif
+#ifdef JANET_JIT
+            janet_jit_free(def);
+#endif
         }
         break;
     }
 }
 
+#ifdef JANET_GC_SLAB
+
+/* Small gc objects are carved out of fixed size pages, with one size class
+ * for each multiple of JANET_SLAB_GRAIN up to JANET_SLAB_MAX bytes. Pages are
+ * aligned to their size, so a block can find its page with a mask. Each page
+ * hands out slots from its free list first, and then by bumping a pointer
+ * into untouched memory. Pages are taken from larger chunks obtained with
+ * janet_malloc, and chunks are released once all of their pages are empty. */
+
+#define JANET_SLAB_GRAIN 16
+#define JANET_SLAB_MAX (JANET_SLAB_GRAIN * JANET_SLAB_CLASSES)
+#define JANET_SLAB_PAGE_SIZE 0x4000
+#define JANET_SLAB_CHUNK_PAGES 32
+
+struct JanetSlabPage {
+    JanetSlabPage *next;
+    JanetSlabPage *prev;
+    JanetSlabChunk *chunk;
+    JanetGCObject *free_list;
+    char *bump;
+    uint32_t slot_size;
+    uint32_t live;
+    uint32_t capacity;
+};
+
+struct JanetSlabChunk {
+    JanetSlabChunk *next;
+    JanetSlabChunk *prev;
+    void *raw;
+    uint32_t free_pages;
+};
+
+/* Keep slots aligned to the grain */
+#define JANET_SLAB_HEADER_SIZE \
+    ((sizeof(JanetSlabPage) + JANET_SLAB_GRAIN - 1) & ~((size_t) JANET_SLAB_GRAIN - 1))
+
+#define janet_slab_page_of(mem) \
+    ((JanetSlabPage *)((uintptr_t)(mem) & ~((uintptr_t) JANET_SLAB_PAGE_SIZE - 1)))
+
+static void janet_slab_link(JanetSlabPage **list, JanetSlabPage *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (NULL != *list) (*list)->prev = page;
+    *list = page;
+}
+
+static void janet_slab_unlink(JanetSlabPage **list, JanetSlabPage *page) {
+    if (NULL != page->prev) {
+        page->prev->next = page->next;
+    } else {
+        *list = page->next;
+    }
+    if (NULL != page->next) page->next->prev = page->prev;
+    page->next = NULL;
+    page->prev = NULL;
+}
+
+static void janet_slab_newchunk(void) {
+    JanetSlabChunk *chunk = janet_malloc(sizeof(JanetSlabChunk));
+    if (NULL == chunk) {
+        JANET_OUT_OF_MEMORY;
+    }
+    /* Over allocate by one page so we can align pages to their size */
+    chunk->raw = janet_malloc((size_t) JANET_SLAB_PAGE_SIZE * (JANET_SLAB_CHUNK_PAGES + 1));
+    if (NULL == chunk->raw) {
+        JANET_OUT_OF_MEMORY;
+    }
+    chunk->free_pages = JANET_SLAB_CHUNK_PAGES;
+    chunk->prev = NULL;
+    chunk->next = janet_vm.slab_chunks;
+    if (NULL != chunk->next) chunk->next->prev = chunk;
+    janet_vm.slab_chunks = chunk;
+    uintptr_t base = ((uintptr_t) chunk->raw + JANET_SLAB_PAGE_SIZE - 1) & ~((uintptr_t) JANET_SLAB_PAGE_SIZE - 1);
+    for (int i = 0; i < JANET_SLAB_CHUNK_PAGES; i++) {
+        JanetSlabPage *page = (JanetSlabPage *)(base + (uintptr_t) i * JANET_SLAB_PAGE_SIZE);
+        page->chunk = chunk;
+        janet_slab_link(&janet_vm.slab_free_pages, page);
+    }
+}
+
+static void janet_slab_freechunk(JanetSlabChunk *chunk) {
+    uintptr_t base = ((uintptr_t) chunk->raw + JANET_SLAB_PAGE_SIZE - 1) & ~((uintptr_t) JANET_SLAB_PAGE_SIZE - 1);
+    for (int i = 0; i < JANET_SLAB_CHUNK_PAGES; i++) {
+        JanetSlabPage *page = (JanetSlabPage *)(base + (uintptr_t) i * JANET_SLAB_PAGE_SIZE);
+        janet_slab_unlink(&janet_vm.slab_free_pages, page);
+    }
+    if (NULL != chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        janet_vm.slab_chunks = chunk->next;
+    }
+    if (NULL != chunk->next) chunk->next->prev = chunk->prev;
+    janet_free(chunk->raw);
+    janet_free(chunk);
+}
+
+static JanetSlabPage *janet_slab_newpage(uint32_t sc) {
+    if (NULL == janet_vm.slab_free_pages) {
+        janet_slab_newchunk();
+    }
+    JanetSlabPage *page = janet_vm.slab_free_pages;
+    janet_slab_unlink(&janet_vm.slab_free_pages, page);
+    page->chunk->free_pages--;
+    page->free_list = NULL;
+    page->bump = (char *) page + JANET_SLAB_HEADER_SIZE;
+    page->slot_size = (sc + 1) * JANET_SLAB_GRAIN;
+    page->live = 0;
+    page->capacity = (uint32_t)((JANET_SLAB_PAGE_SIZE - JANET_SLAB_HEADER_SIZE) / page->slot_size);
+    janet_slab_link(janet_vm.slab_pages + sc, page);
+    return page;
+}
+
+static JanetGCObject *janet_slab_alloc(size_t size) {
+    uint32_t sc = (uint32_t)((size - 1) / JANET_SLAB_GRAIN);
+    JanetSlabPage *page = janet_vm.slab_pages[sc];
+    if (NULL == page) {
+        page = janet_slab_newpage(sc);
+    }
+    JanetGCObject *mem = page->free_list;
+    if (NULL != mem) {
+        page->free_list = mem->data.next;
+    } else {
+        mem = (JanetGCObject *) page->bump;
+        page->bump += page->slot_size;
+    }
+    /* Full pages are not kept in the class list */
+    if (++page->live == page->capacity) {
+        janet_slab_unlink(janet_vm.slab_pages + sc, page);
+    }
+    return mem;
+}
+
+static void janet_slab_free(JanetGCObject *mem) {
+    JanetSlabPage *page = janet_slab_page_of(mem);
+    uint32_t sc = page->slot_size / JANET_SLAB_GRAIN - 1;
+    if (page->live == page->capacity) {
+        janet_slab_link(janet_vm.slab_pages + sc, page);
+    }
+    mem->data.next = page->free_list;
+    page->free_list = mem;
+    /* Return empty pages, but keep the last page of a class around
+     * to avoid thrashing when a class is repeatedly filled and emptied. */
+    if (--page->live == 0 && (NULL != page->next || NULL != page->prev)) {
+        janet_slab_unlink(janet_vm.slab_pages + sc, page);
+        janet_slab_link(&janet_vm.slab_free_pages, page);
+        if (++page->chunk->free_pages == JANET_SLAB_CHUNK_PAGES) {
+            janet_slab_freechunk(page->chunk);
+        }
+    }
+}
+
+/* Release all slab memory at once */
+static void janet_slab_deinit(void) {
+    JanetSlabChunk *chunk = janet_vm.slab_chunks;
+    while (NULL != chunk) {
+        JanetSlabChunk *next = chunk->next;
+        janet_free(chunk->raw);
+        janet_free(chunk);
+        chunk = next;
+    }
+    janet_vm.slab_chunks = NULL;
+    janet_vm.slab_free_pages = NULL;
+    for (int i = 0; i < JANET_SLAB_CLASSES; i++) {
+        janet_vm.slab_pages[i] = NULL;
+    }
+}
+
+#endif
+
+/* Free the memory of a single gc block */
+static void janet_gc_free(JanetGCObject *mem) {
+#ifdef JANET_GC_SLAB
+    if (mem->flags & JANET_MEM_SLAB) {
+        janet_slab_free(mem);
+        return;
+    }
+#endif
+    janet_free(mem);
+}
+
 /* Check that a value x has been visited in the mark phase */
 static int janet_check_liveref(Janet x) {
     switch (janet_type(x)) {
@@ -396,10 +646,187 @@ static int janet_check_liveref(Janet x) {
     }
 }
 
-/* Iterate over all allocated memory, and free memory that is not
- * marked as reachable. Flip the gc color flag for next sweep. */
-void janet_sweep() {
+/* Objects that are mutated without going through a write barrier. These
+ * stay in the remembered set for as long as they are in the old generation. */
+static int janet_gc_always_remembered(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return 0;
+        case JANET_MEMORY_FIBER:
+            return 1;
+        case JANET_MEMORY_ABSTRACT:
+            return NULL != ((JanetAbstractHead *) mem)->type->gcmark;
+    }
+}
+
+static void janet_gc_push_block(JanetGCObject *mem) {
+    size_t newcount = janet_vm.gc_remembered_count + 1;
+    janet_vm.gc_remembered = janet_gc_grow(janet_vm.gc_remembered, &janet_vm.gc_remembered_capacity,
+                                           newcount, sizeof(JanetGCObject *));
+    janet_vm.gc_remembered[janet_vm.gc_remembered_count] = mem;
+    janet_vm.gc_remembered_count = newcount;
+}
+
+static void janet_gc_push_remembered(JanetGCObject *mem) {
+    mem->flags |= JANET_MEM_REMEMBERED;
+    janet_gc_push_block(mem);
+}
+
+/* Pick which blocks the write barrier catches. During an incremental mark,
+ * that is every block already traced. In generational mode, it is old blocks
+ * not yet in the remembered set, or while an incremental sweep is promoting
+ * blocks, any block not yet in the remembered set. A zero mask never matches. */
+static void janet_gc_update_barrier(void) {
+    if (janet_vm.gc_cycle == JANET_GC_MARKING) {
+        janet_vm.gc_barrier_mask = JANET_MEM_REACHABLE;
+        janet_vm.gc_barrier_match = JANET_MEM_REACHABLE;
+    } else if (janet_vm.gc_generational && janet_vm.gc_cycle == JANET_GC_SWEEPING) {
+        janet_vm.gc_barrier_mask = JANET_MEM_REMEMBERED;
+        janet_vm.gc_barrier_match = 0;
+    } else if (janet_vm.gc_generational) {
+        janet_vm.gc_barrier_mask = JANET_MEM_OLD | JANET_MEM_REMEMBERED;
+        janet_vm.gc_barrier_match = JANET_MEM_OLD;
+    } else {
+        janet_vm.gc_barrier_mask = 0;
+        janet_vm.gc_barrier_match = 1;
+    }
+}
+
+/* Slow path of the write barrier. An old object is about to reference
+ * objects that may be young, so trace it again in the next minor collection.
+ * During an incremental mark, an already traced object is about to reference
+ * objects that may not be traced yet, so turn it gray again. During an
+ * incremental mark the remembered vector only holds such blocks. */
+void janet_gc_remember(JanetGCObject *mem) {
+    if (janet_vm.gc_mark_phase) return;
+    if (janet_vm.gc_cycle == JANET_GC_MARKING) {
+        mem->flags &= ~JANET_MEM_REACHABLE;
+        janet_gc_push_block(mem);
+    } else {
+        janet_gc_push_remembered(mem);
+    }
+}
+
+void janet_gcbarrier(void *mem) {
+    janet_gc_barrier(mem);
+}
+
+/* Move a surviving block to the old generation. Old blocks keep their
+ * reachable flag until the next major collection. */
+static void janet_gc_promote(JanetGCObject *mem) {
+    if (!(mem->flags & JANET_MEM_OLD)) {
+        mem->flags |= JANET_MEM_OLD;
+        janet_vm.gc_old_count++;
+    }
+    if (!(mem->flags & JANET_MEM_REMEMBERED) && janet_gc_always_remembered(mem)) {
+        janet_gc_push_remembered(mem);
+    }
+}
+
+/* Trace the children of a remembered old block again */
+static void janet_gc_remark(JanetGCObject *mem) {
+    mem->flags &= ~JANET_MEM_REACHABLE;
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            janet_gc_mark(mem);
+            break;
+        case JANET_MEMORY_ARRAY:
+        case JANET_MEMORY_ARRAY_WEAK:
+            janet_mark_array((JanetArray *) mem);
+            break;
+        case JANET_MEMORY_TABLE:
+        case JANET_MEMORY_TABLE_WEAKK:
+        case JANET_MEMORY_TABLE_WEAKV:
+        case JANET_MEMORY_TABLE_WEAKKV:
+            janet_mark_table((JanetTable *) mem);
+            break;
+        case JANET_MEMORY_FIBER:
+            janet_mark_fiber((JanetFiber *) mem);
+            break;
+        case JANET_MEMORY_FUNCENV:
+            janet_mark_funcenv((JanetFuncEnv *) mem);
+            break;
+        case JANET_MEMORY_FUNCDEF:
+            janet_mark_funcdef((JanetFuncDef *) mem);
+            break;
+        case JANET_MEMORY_ABSTRACT:
+            janet_mark_abstract(((JanetAbstractHead *) mem)->data);
+            break;
+    }
+}
+
+/* Drop everything from the remembered set except the blocks that
+ * are always remembered. */
+static void janet_gc_trim_remembered(void) {
+    size_t j = 0;
+    for (size_t i = 0; i < janet_vm.gc_remembered_count; i++) {
+        JanetGCObject *mem = janet_vm.gc_remembered[i];
+        if (janet_gc_always_remembered(mem)) {
+            janet_vm.gc_remembered[j++] = mem;
+        } else {
+            mem->flags &= ~JANET_MEM_REMEMBERED;
+        }
+    }
+    janet_vm.gc_remembered_count = j;
+}
+
+/* Forget the sticky marks and remembered set of the old generation
+ * so that a full collection can trace everything again. */
+static void janet_gc_unmark_old(void) {
+    for (size_t i = 0; i < janet_vm.gc_remembered_count; i++) {
+        janet_vm.gc_remembered[i]->flags &= ~JANET_MEM_REMEMBERED;
+    }
+    janet_vm.gc_remembered_count = 0;
+    JanetGCObject *current = janet_vm.old_blocks;
+    while (NULL != current) {
+        current->flags &= ~JANET_MEM_REACHABLE;
+        current = current->data.next;
+    }
+    current = janet_vm.weak_blocks;
+    while (NULL != current) {
+        current->flags &= ~JANET_MEM_REACHABLE;
+        current = current->data.next;
+    }
+}
+
+/* Free unreachable blocks in a block list. If promote is set, surviving
+ * blocks are moved to the old generation. */
+static void janet_sweep_list(void **list, int promote) {
     JanetGCObject *previous = NULL;
+    JanetGCObject *current = *list;
+    JanetGCObject *next;
+    while (NULL != current) {
+        next = current->data.next;
+        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            previous = current;
+            if (promote) {
+                janet_gc_promote(current);
+            } else {
+                current->flags &= ~JANET_MEM_REACHABLE;
+            }
+        } else {
+            janet_vm.block_count--;
+            if (current->flags & JANET_MEM_OLD) janet_vm.gc_old_count--;
+            janet_deinit_block(current);
+            if (NULL != previous) {
+                previous->data.next = next;
+            } else {
+                *list = next;
+            }
+            janet_gc_free(current);
+        }
+        current = next;
+    }
+    /* Survivors of the young generation are spliced onto the old list */
+    if (promote && NULL != previous && list == &janet_vm.blocks) {
+        previous->data.next = janet_vm.old_blocks;
+        janet_vm.old_blocks = janet_vm.blocks;
+        janet_vm.blocks = NULL;
+    }
+}
+
+/* Drop references to unreachable values from weak tables and arrays */
+static void janet_sweep_weak_refs(void) {
     JanetGCObject *current = janet_vm.weak_blocks;
     JanetGCObject *next;
 
@@ -426,62 +853,17 @@ void janet_sweep() {
                     int drop = 0;
                     if (check_keys && !janet_check_liveref(kvs->key)) drop = 1;
                     if (check_values && !janet_check_liveref(kvs->value)) drop = 1;
-                    if (drop) {
-                        /* Inlined from janet_table_remove without search */
-                        table->count--;
-                        table->deleted++;
-                        kvs->key = janet_wrap_nil();
-                        kvs->value = janet_wrap_false();
-                    }
+                    if (drop) janet_table_tombstone(table, kvs);
                     kvs++;
                 }
             }
         }
         current = next;
     }
+}
 
-    /* Sweep weak heap to free blocks */
-    previous = NULL;
-    current = janet_vm.weak_blocks;
-    while (NULL != current) {
-        next = current->data.next;
-        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
-            previous = current;
-            current->flags &= ~JANET_MEM_REACHABLE;
-        } else {
-            janet_vm.block_count--;
-            janet_deinit_block(current);
-            if (NULL != previous) {
-                previous->data.next = next;
-            } else {
-                janet_vm.weak_blocks = next;
-            }
-            janet_free(current);
-        }
-        current = next;
-    }
-
-    /* Sweep main heap to free blocks */
-    previous = NULL;
-    current = janet_vm.blocks;
-    while (NULL != current) {
-        next = current->data.next;
-        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
-            previous = current;
-            current->flags &= ~JANET_MEM_REACHABLE;
-        } else {
-            janet_vm.block_count--;
-            janet_deinit_block(current);
-            if (NULL != previous) {
-                previous->data.next = next;
-            } else {
-                janet_vm.blocks = next;
-            }
-            janet_free(current);
-        }
-        current = next;
-    }
-
+/* Release threaded abstract types that were not visited during marking */
+static void janet_sweep_threaded(int minor) {
 #ifdef JANET_EV
     /* Sweep threaded abstract types for references to decrement */
     JanetKV *items = janet_vm.threaded_abstracts.data;
@@ -494,8 +876,9 @@ void janet_sweep() {
              * then 0, the item will be collected. This ensures that only one interpreter
              * will clean up the threaded abstract. */
 
-            /* If not visited... */
-            if (!janet_truthy(items[i].value)) {
+            /* If not visited... A minor collection does not visit the old
+             * generation, so it cannot tell if a reference is dead. */
+            if (!minor && !janet_truthy(items[i].value)) {
                 void *abst = janet_unwrap_abstract(items[i].key);
                 if (0 == janet_abstract_decref(abst)) {
                     /* Run finalizer */
@@ -508,36 +891,50 @@ void janet_sweep() {
                 }
 
                 /* Mark as tombstone in place */
-                items[i].key = janet_wrap_nil();
-                items[i].value = janet_wrap_false();
-                janet_vm.threaded_abstracts.deleted++;
-                janet_vm.threaded_abstracts.count--;
+                janet_table_tombstone(&janet_vm.threaded_abstracts, items + i);
             }
 
             /* Reset for next sweep */
             items[i].value = janet_wrap_false();
         }
     }
+#else
+    (void) minor;
 #endif
 }
 
-/* Allocate some memory that is tracked for garbage collection */
-void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
-    JanetGCObject *mem;
+static void janet_sweep_impl(int minor) {
+    int generational = janet_vm.gc_generational;
 
-    /* Make sure everything is inited */
-    janet_assert(NULL != janet_vm.cache, "please initialize janet before use");
-    mem = janet_malloc(size);
+    janet_sweep_weak_refs();
 
-    /* Check for bad malloc */
-    if (NULL == mem) {
-        JANET_OUT_OF_MEMORY;
+    /* Sweep weak heap to free blocks. Weak blocks of both generations
+     * share one list. */
+    janet_sweep_list(&janet_vm.weak_blocks, generational);
+
+    /* Sweep old heap to free blocks */
+    if (!minor) {
+        janet_sweep_list(&janet_vm.old_blocks, generational);
     }
 
-    /* Configure block */
-    mem->flags = type;
+    /* Sweep main heap to free blocks */
+    janet_sweep_list(&janet_vm.blocks, generational);
+
+    janet_sweep_threaded(minor);
+
+    if (minor) {
+        janet_gc_trim_remembered();
+    }
+}
+
+/* Iterate over all allocated memory, and free memory that is not
+ * marked as reachable. Flip the gc color flag for next sweep. */
+void janet_sweep(void) {
+    janet_sweep_impl(0);
+}
 
-    /* Prepend block to heap list */
+/* Prepend block to heap list */
+static void janet_gc_link(JanetGCObject *mem, enum JanetMemoryType type, size_t size) {
     janet_vm.next_collection += size;
     if (type < JANET_MEMORY_TABLE_WEAKK) {
         /* normal heap */
@@ -549,10 +946,44 @@ void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
         janet_vm.weak_blocks = mem;
     }
     janet_vm.block_count++;
+}
+
+/* Allocate some memory that is tracked for garbage collection */
+void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
+    JanetGCObject *mem;
+
+    /* Make sure everything is inited */
+    janet_assert(NULL != janet_vm.cache, "please initialize janet before use");
+#ifdef JANET_GC_SLAB
+    if (size <= JANET_SLAB_MAX) {
+        mem = janet_slab_alloc(size);
+        mem->flags = type | JANET_MEM_SLAB;
+    } else
+#endif
+    {
+        mem = janet_malloc(size);
+
+        /* Check for bad malloc */
+        if (NULL == mem) {
+            JANET_OUT_OF_MEMORY;
+        }
 
+        /* Configure block */
+        mem->flags = type;
+    }
+
+    janet_gc_link(mem, type, size);
     return (void *)mem;
 }
 
+/* Adopt a block allocated outside of the collector */
+void janet_gcadopt(enum JanetMemoryType type, void *mem, size_t size) {
+    janet_assert(NULL != janet_vm.cache, "please initialize janet before use");
+    JanetGCObject *block = (JanetGCObject *) mem;
+    block->flags = type;
+    janet_gc_link(block, type, size);
+}
+
 static void free_one_scratch(JanetScratch *s) {
     if (NULL != s->finalize) {
         s->finalize((char *) s->mem);
@@ -573,37 +1004,298 @@ static JanetScratch *janet_mem2scratch(void *mem) {
     return s - 1;
 }
 
-/* Run garbage collection */
-void janet_collect(void) {
-    uint32_t i;
+/* Mark everything directly reachable from the vm */
+static void janet_gc_mark_roots(void) {
+#ifdef JANET_EV
+    janet_ev_mark();
+#endif
+    janet_mark_fiber(janet_vm.root_fiber);
+    for (size_t i = 0; i < janet_vm.root_count; i++)
+        janet_mark(janet_vm.roots[i]);
+}
+
+/* Trace everything left in the gray stack */
+static void janet_gc_drain_gray(void) {
+    while (janet_vm.gc_gray_count) {
+        Janet x = janet_vm.gc_gray[--janet_vm.gc_gray_count];
+        janet_mark(x);
+    }
+}
+
+/* Check if more than budget microseconds have passed since start */
+static int janet_gc_overbudget(const struct timespec *start, uint32_t budget) {
+    struct timespec now;
+    janet_gettime(&now, JANET_TIME_MONOTONIC);
+    int64_t elapsed = (int64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+                      (now.tv_nsec - start->tv_nsec) / 1000;
+    return elapsed >= (int64_t) budget;
+}
+
+/* Trace gray values and blocks until there are none left or the budget (in
+ * microseconds) runs out. A budget of 0 means no limit. */
+static void janet_gc_mark_step(uint32_t budget) {
+    struct timespec start;
+    uint32_t steps = 0;
+    if (budget) janet_gettime(&start, JANET_TIME_MONOTONIC);
+    for (;;) {
+        if (janet_vm.gc_remembered_count) {
+            janet_gc_remark(janet_vm.gc_remembered[--janet_vm.gc_remembered_count]);
+        } else if (janet_vm.gc_gray_count) {
+            Janet x = janet_vm.gc_gray[--janet_vm.gc_gray_count];
+            janet_mark(x);
+        } else {
+            return;
+        }
+        if (budget && ++steps % JANET_GC_STEP_CHECK == 0 && janet_gc_overbudget(&start, budget)) {
+            return;
+        }
+    }
+}
+
+/* Free unreachable blocks detached at the end of an incremental mark until
+ * there are none left or the budget runs out. Surviving blocks go back to
+ * the heap, or the old generation in generational mode. Returns 1 when
+ * there is nothing left to sweep. */
+static int janet_gc_sweep_step(uint32_t budget) {
+    struct timespec start;
+    uint32_t steps = 0;
+    int generational = janet_vm.gc_generational;
+    void **lists[2] = { &janet_vm.sweep_blocks, &janet_vm.sweep_old_blocks };
+    if (budget) janet_gettime(&start, JANET_TIME_MONOTONIC);
+    for (int i = 0; i < 2; i++) {
+        while (NULL != *lists[i]) {
+            JanetGCObject *current = *lists[i];
+            *lists[i] = current->data.next;
+            if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+                if (generational) {
+                    janet_gc_promote(current);
+                    current->data.next = janet_vm.old_blocks;
+                    janet_vm.old_blocks = current;
+                } else {
+                    current->flags &= ~JANET_MEM_REACHABLE;
+                    current->data.next = janet_vm.blocks;
+                    janet_vm.blocks = current;
+                }
+            } else {
+                janet_vm.block_count--;
+                if (current->flags & JANET_MEM_OLD) janet_vm.gc_old_count--;
+                janet_deinit_block(current);
+                janet_gc_free(current);
+            }
+            if (budget && ++steps % JANET_GC_STEP_CHECK == 0 && janet_gc_overbudget(&start, budget)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Run garbage collection. A minor collection only traces and sweeps
+ * the young generation, using the remembered set to find references
+ * from old blocks. */
+static void janet_collect_impl(int minor) {
+    size_t i;
     if (janet_vm.gc_suspend) return;
     depth = JANET_RECURSION_GUARD;
+    if (janet_vm.gc_generational && !minor) {
+        janet_gc_unmark_old();
+    }
     janet_vm.gc_mark_phase = 1;
     /* Try to prevent many major collections back to back.
      * A full collection will take O(janet_vm.block_count) time.
      * If we have a large heap, make sure our interval is not too
      * small so we won't make many collections over it. This is just a
-     * heuristic for automatically changing the gc interval */
-    if (janet_vm.block_count * 8 > janet_vm.gc_interval) {
+     * heuristic for automatically changing the gc interval. The
+     * generational collector relies on a separate old generation limit. */
+    if (!janet_vm.gc_generational && janet_vm.block_count * 8 > janet_vm.gc_interval) {
         janet_vm.gc_interval = janet_vm.block_count * sizeof(JanetGCObject);
     }
-    orig_rootcount = janet_vm.root_count;
-#ifdef JANET_EV
-    janet_ev_mark();
-#endif
-    janet_mark_fiber(janet_vm.root_fiber);
-    for (i = 0; i < orig_rootcount; i++)
-        janet_mark(janet_vm.roots[i]);
-    while (orig_rootcount < janet_vm.root_count) {
-        Janet x = janet_vm.roots[--janet_vm.root_count];
-        janet_mark(x);
+    janet_gc_mark_roots();
+    if (minor) {
+        for (i = 0; i < janet_vm.gc_remembered_count; i++)
+            janet_gc_remark(janet_vm.gc_remembered[i]);
     }
+    janet_gc_drain_gray();
     janet_vm.gc_mark_phase = 0;
-    janet_sweep();
+    janet_sweep_impl(minor);
+    if (janet_vm.gc_generational && !minor) {
+        janet_vm.gc_old_limit = 2 * janet_vm.gc_old_count + JANET_GC_OLD_MIN;
+    }
     janet_vm.next_collection = 0;
     janet_free_all_scratch();
 }
 
+/* Begin an incremental collection. Marking and sweeping are spread over
+ * several steps that each run for about the pause budget, and are
+ * interleaved with the program. The write barrier turns traced blocks gray
+ * again when they are mutated while marking. */
+static void janet_gc_begin_cycle(void) {
+    if (janet_vm.gc_generational) {
+        janet_gc_unmark_old();
+    }
+    /* Same interval heuristic as a stop-the-world collection */
+    if (!janet_vm.gc_generational && janet_vm.block_count * 8 > janet_vm.gc_interval) {
+        janet_vm.gc_interval = janet_vm.block_count * sizeof(JanetGCObject);
+    }
+    janet_vm.gc_cycle = JANET_GC_MARKING;
+    janet_gc_update_barrier();
+    janet_vm.gc_mark_phase = 1;
+    depth = 1;
+    janet_gc_mark_roots();
+    janet_gc_mark_step(janet_vm.gc_budget);
+    janet_vm.gc_mark_phase = 0;
+    janet_vm.next_collection = janet_vm.gc_interval - janet_vm.gc_interval / JANET_GC_STEP_DIVISOR;
+}
+
+/* Finish marking with a short stop-the-world pause. Fibers and abstract
+ * types are mutated without a write barrier, so the ones already traced
+ * are traced again along with the roots. Weak references are then
+ * dropped, and the heap is detached to be swept incrementally. */
+static void janet_gc_finish_mark(void) {
+    janet_vm.gc_mark_phase = 1;
+    depth = JANET_RECURSION_GUARD;
+    for (size_t i = 0; i < janet_vm.gc_rescan_count; i++) {
+        JanetGCObject *mem = janet_vm.gc_rescan[i];
+        mem->flags &= ~JANET_MEM_REACHABLE;
+        janet_gc_push_block(mem);
+    }
+    janet_vm.gc_rescan_count = 0;
+    janet_gc_mark_roots();
+    janet_gc_mark_step(0);
+    janet_vm.gc_rescan_count = 0;
+    janet_vm.gc_mark_phase = 0;
+    janet_sweep_weak_refs();
+    janet_sweep_list(&janet_vm.weak_blocks, janet_vm.gc_generational);
+    janet_sweep_threaded(0);
+    janet_vm.sweep_blocks = janet_vm.blocks;
+    janet_vm.sweep_old_blocks = janet_vm.old_blocks;
+    janet_vm.blocks = NULL;
+    janet_vm.old_blocks = NULL;
+    janet_vm.gc_cycle = JANET_GC_SWEEPING;
+    janet_gc_update_barrier();
+    janet_free_all_scratch();
+}
+
+/* End the incremental collection once everything is swept */
+static void janet_gc_finish_sweep(void) {
+    janet_vm.gc_cycle = JANET_GC_IDLE;
+    janet_gc_update_barrier();
+    if (janet_vm.gc_generational) {
+        janet_vm.gc_old_limit = 2 * janet_vm.gc_old_count + JANET_GC_OLD_MIN;
+    }
+    janet_vm.next_collection = 0;
+}
+
+/* Run one step of the incremental collection */
+static void janet_gc_cycle_step(void) {
+    if (janet_vm.gc_cycle == JANET_GC_SWEEPING) {
+        if (janet_gc_sweep_step(janet_vm.gc_budget)) {
+            janet_gc_finish_sweep();
+            return;
+        }
+    } else if (janet_vm.gc_gray_count == 0 && janet_vm.gc_remembered_count == 0) {
+        janet_gc_finish_mark();
+    } else {
+        janet_vm.gc_mark_phase = 1;
+        depth = 1;
+        janet_gc_mark_step(janet_vm.gc_budget);
+        janet_vm.gc_mark_phase = 0;
+    }
+    janet_vm.next_collection = janet_vm.gc_interval - janet_vm.gc_interval / JANET_GC_STEP_DIVISOR;
+}
+
+/* Stop an incremental collection in progress. Marks may keep garbage alive
+ * that died during the cycle, so they are dropped, while a sweep is simply
+ * completed. */
+static void janet_gc_stop_cycle(void) {
+    if (janet_vm.gc_cycle == JANET_GC_SWEEPING) {
+        janet_gc_sweep_step(0);
+        janet_gc_finish_sweep();
+    } else if (janet_vm.gc_cycle == JANET_GC_MARKING) {
+        void *lists[3] = { janet_vm.blocks, janet_vm.old_blocks, janet_vm.weak_blocks };
+        for (int i = 0; i < 3; i++) {
+            JanetGCObject *current = lists[i];
+            while (NULL != current) {
+                current->flags &= ~JANET_MEM_REACHABLE;
+                current = current->data.next;
+            }
+        }
+        janet_vm.gc_gray_count = 0;
+        janet_vm.gc_remembered_count = 0;
+        janet_vm.gc_rescan_count = 0;
+        janet_vm.gc_cycle = JANET_GC_IDLE;
+        janet_gc_update_barrier();
+    }
+}
+
+/* Complete any incremental sweep in progress so that all blocks are
+ * in the heap lists again */
+void janet_gc_sweep_all(void) {
+    if (janet_vm.gc_cycle == JANET_GC_SWEEPING) {
+        janet_gc_stop_cycle();
+    }
+}
+
+/* Run a full garbage collection */
+void janet_collect(void) {
+    if (janet_vm.gc_suspend) return;
+    janet_gc_stop_cycle();
+    janet_collect_impl(0);
+}
+
+/* Run the kind of collection the current gc settings call for. In
+ * generational mode, this is a minor collection until the old generation
+ * outgrows its limit. With a pause budget set, full collections
+ * are incremental. */
+void janet_collect_auto(void) {
+    if (janet_vm.gc_suspend) return;
+    if (janet_vm.gc_cycle) {
+        janet_gc_cycle_step();
+        return;
+    }
+    int minor = janet_vm.gc_generational && janet_vm.gc_old_count < janet_vm.gc_old_limit;
+    if (!minor && janet_vm.gc_budget) {
+        janet_gc_begin_cycle();
+        return;
+    }
+    janet_collect_impl(minor);
+}
+
+/* Set the pause budget for incremental collection in microseconds. A
+ * budget of 0 makes every collection stop the world. */
+void janet_gcsetbudget(uint32_t budget) {
+    janet_vm.gc_budget = budget;
+}
+
+/* Turn generational collection on or off */
+void janet_gcsetgenerational(int enable) {
+    enable = !!enable;
+    if (enable == janet_vm.gc_generational) return;
+    janet_gc_stop_cycle();
+    if (!enable) {
+        /* Return all blocks to a single generation */
+        janet_gc_unmark_old();
+        JanetGCObject *current = janet_vm.old_blocks;
+        while (NULL != current) {
+            JanetGCObject *next = current->data.next;
+            current->flags &= ~JANET_MEM_OLD;
+            current->data.next = janet_vm.blocks;
+            janet_vm.blocks = current;
+            current = next;
+        }
+        janet_vm.old_blocks = NULL;
+        current = janet_vm.weak_blocks;
+        while (NULL != current) {
+            current->flags &= ~JANET_MEM_OLD;
+            current = current->data.next;
+        }
+        janet_vm.gc_old_count = 0;
+    }
+    janet_vm.gc_old_limit = JANET_GC_OLD_MIN;
+    janet_vm.gc_generational = enable;
+    janet_gc_update_barrier();
+}
+
 /* Add a root value to the GC. This prevents the GC from removing a value
  * and all of its children. If gcroot is called on a value n times, unroot
  * must also be called n times to remove it as a gc root. */
@@ -682,14 +1374,49 @@ void janet_clear_memory(void) {
         }
     }
 #endif
-    JanetGCObject *current = janet_vm.blocks;
-    while (NULL != current) {
-        janet_deinit_block(current);
-        JanetGCObject *next = current->data.next;
-        janet_free(current);
-        current = next;
+    void **lists[4] = {
+        &janet_vm.blocks, &janet_vm.old_blocks,
+        &janet_vm.sweep_blocks, &janet_vm.sweep_old_blocks
+    };
+    for (int i = 0; i < 4; i++) {
+        JanetGCObject *current = *lists[i];
+        while (NULL != current) {
+            janet_deinit_block(current);
+            JanetGCObject *next = current->data.next;
+#ifdef JANET_GC_SLAB
+            /* Slab memory is released all at once below */
+            if (!(current->flags & JANET_MEM_SLAB))
+#endif
+                janet_free(current);
+            current = next;
+        }
+        *lists[i] = NULL;
     }
-    janet_vm.blocks = NULL;
+    janet_free(janet_vm.gc_remembered);
+    janet_vm.gc_remembered = NULL;
+    janet_vm.gc_remembered_count = 0;
+    janet_vm.gc_remembered_capacity = 0;
+    janet_free(janet_vm.gc_gray);
+    janet_vm.gc_gray = NULL;
+    janet_vm.gc_gray_count = 0;
+    janet_vm.gc_gray_capacity = 0;
+    janet_free(janet_vm.gc_rescan);
+    janet_vm.gc_rescan = NULL;
+    janet_vm.gc_rescan_count = 0;
+    janet_vm.gc_rescan_capacity = 0;
+    janet_vm.gc_cycle = JANET_GC_IDLE;
+#ifdef JANET_GC_SLAB
+    janet_slab_deinit();
+#endif
+#ifdef JANET_LAZY_IMAGE
+    janet_lazy_defs_deinit();
+#endif
+#ifdef JANET_METHOD_CACHE
+    janet_method_caches_deinit();
+#endif
+#ifdef JANET_JIT
+    janet_jit_deinit();
+#endif
     janet_free_all_scratch();
     janet_free(janet_vm.scratch_mem);
 }
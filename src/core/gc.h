@@ -34,6 +34,17 @@
 #define JANET_MEM_TYPEBITS 0xFF
 #define JANET_MEM_REACHABLE 0x100
 #define JANET_MEM_DISABLED 0x200
+#define JANET_MEM_SLAB 0x400
+#define JANET_MEM_OLD 0x800
+#define JANET_MEM_REMEMBERED 0x1000
+#define JANET_MEM_SHARED 0x2000
+
+/* Set on tables that a cached method or dynamic binding lookup depends on.
+ * Changing or freeing such a table invalidates every lookup cache. */
+#define JANET_TABLE_FLAG_WATCHED 0x20000
+#define janet_table_touch(t) do { \
+    if (janet_gc_header(t)->flags & JANET_TABLE_FLAG_WATCHED) janet_vm.lookup_epoch++; \
+} while (0)
 
 #define janet_gc_settype(m, t) ((janet_gc_header(m)->flags |= (0xFF & (t))))
 #define janet_gc_type(m) (janet_gc_header(m)->flags & 0xFF)
@@ -41,6 +52,15 @@
 #define janet_gc_mark(m) (janet_gc_header(m)->flags |= JANET_MEM_REACHABLE)
 #define janet_gc_reachable(m) (janet_gc_header(m)->flags & JANET_MEM_REACHABLE)
 
+/* Write barrier for the generational and incremental collectors. Must be used
+ * before storing references into an array, table, or closure environment that may
+ * already be in the old generation or already traced by an incremental mark.
+ * The flags checked depend on the collector mode, see janet_gc_update_barrier. */
+#define janet_gc_barrier(m) do { \
+    if ((janet_gc_header(m)->flags & janet_vm.gc_barrier_mask) == janet_vm.gc_barrier_match) \
+        janet_gc_remember(janet_gc_header(m)); \
+} while (0)
+
 /* Memory types for the GC. Different from JanetType to include funcenv and funcdef. */
 enum JanetMemoryType {
     JANET_MEMORY_NONE,
@@ -67,4 +87,12 @@ enum JanetMemoryType {
  * and then call when janet_enablegc when it is initialized and reachable by the gc (on the JANET stack) */
 void *janet_gcalloc(enum JanetMemoryType type, size_t size);
 
+/* Take ownership of a fully initialized block that was allocated with janet_malloc,
+ * possibly on another thread. The block is then collected like any other. */
+void janet_gcadopt(enum JanetMemoryType type, void *mem, size_t size);
+
+void janet_gc_remember(JanetGCObject *mem);
+void janet_collect_auto(void);
+void janet_gc_sweep_all(void);
+
 #endif
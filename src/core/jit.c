@@ -0,0 +1,1489 @@
+/*
+* Copyright (c) 2025 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "state.h"
+#include "gc.h"
+#include "fiber.h"
+#include "util.h"
+#include "vector.h"
+#endif
+
+/* A baseline JIT for x86-64. Each instruction of a hot function is translated
+ * on its own into a fixed template of machine code. Slots stay in the fiber's
+ * stack, so the machine code can hand over to the interpreter before any
+ * instruction. It does that whenever it meets something it does not handle:
+ * an instruction that may signal or needs a collection first, a value of an
+ * unexpected type, or a pending interrupt on a loop back edge. The interpreter
+ * then runs the same instruction again with its full semantics, including
+ * any error.
+ *
+ * Instructions whose fast path is too large to emit inline call a small C
+ * helper that returns non-zero when the interpreter should take over. Pushes,
+ * and indexing tuples and arrays, are inline. Calls are made from machine
+ * code too, see jit_call.
+ *
+ * Registers while running machine code:
+ * rbx - the stack of the current frame
+ * r12 - pointer to janet_vm.auto_suspend
+ * r13 - smallest nanboxed value that is not a number
+ * r14 - the current fiber */
+
+#ifdef JANET_JIT
+
+#ifndef JANET_WINDOWS
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <math.h>
+
+#define JIT_A(i) ((int32_t)(((i) >> 8) & 0xFF))
+#define JIT_B(i) ((int32_t)(((i) >> 16) & 0xFF))
+#define JIT_C(i) ((int32_t)((i) >> 24))
+#define JIT_D(i) ((int32_t)((i) >> 8))
+#define JIT_E(i) ((int32_t)((i) >> 16))
+#define JIT_CS(i) (((int32_t)(i)) >> 24)
+#define JIT_DS(i) (((int32_t)(i)) >> 8)
+#define JIT_ES(i) (((int32_t)(i)) >> 16)
+
+/* x86 condition codes */
+#define JIT_ALWAYS (-1)
+#define JIT_CC_AE 0x3
+#define JIT_CC_E 0x4
+#define JIT_CC_NE 0x5
+#define JIT_CC_BE 0x6
+#define JIT_CC_A 0x7
+#define JIT_CC_P 0xA
+#define JIT_CC_L 0xC
+#define JIT_CC_G 0xF
+
+/* x86 registers */
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RSI 6
+
+typedef int (*JitHelper)(Janet *stack, uint32_t instr);
+typedef int32_t (*JitFn)(Janet *stack, const uint8_t *entry, volatile JanetAtomicInt *suspend, JanetFiber *fiber);
+
+typedef struct {
+    int32_t at; /* Offset of the rel32 operand */
+    int32_t pc; /* Instruction to jump to, or the bytecode length to restore */
+    int exit; /* Go back to the interpreter even if pc has machine code */
+} JitFixup;
+
+typedef struct {
+    uint8_t *code;
+    JitFixup *fixups;
+} JitState;
+
+/* Forward jumps within one instruction to a common place */
+typedef struct {
+    int32_t at[12];
+    int count;
+} JitLabel;
+
+/*
+ * Helpers for instructions with larger fast paths. Each returns 0 after doing
+ * exactly what the interpreter would, or 1 without side effects if the
+ * interpreter should run the instruction instead.
+ */
+
+/* Equality of two values, or -1 if it might run other code */
+static int jit_equal_values(Janet x, Janet y) {
+    if (janet_checktype(x, JANET_NUMBER) && janet_checktype(y, JANET_NUMBER))
+        return janet_unwrap_number(x) == janet_unwrap_number(y);
+    if (janet_checktype(x, JANET_ABSTRACT) || janet_checktype(y, JANET_ABSTRACT)) return -1;
+    return janet_equals(x, y);
+}
+
+static int jit_equals(Janet *stack, uint32_t instr) {
+    int eq = jit_equal_values(stack[JIT_B(instr)], stack[JIT_C(instr)]);
+    if (eq < 0) return 1;
+    stack[JIT_A(instr)] = janet_wrap_boolean(eq);
+    return 0;
+}
+
+static int jit_not_equals(Janet *stack, uint32_t instr) {
+    int eq = jit_equal_values(stack[JIT_B(instr)], stack[JIT_C(instr)]);
+    if (eq < 0) return 1;
+    stack[JIT_A(instr)] = janet_wrap_boolean(!eq);
+    return 0;
+}
+
+static int jit_divide_floor(Janet *stack, uint32_t instr) {
+    Janet x = stack[JIT_B(instr)];
+    Janet y = stack[JIT_C(instr)];
+    if (!janet_checktype(x, JANET_NUMBER) || !janet_checktype(y, JANET_NUMBER)) return 1;
+    stack[JIT_A(instr)] = janet_wrap_number(floor(janet_unwrap_number(x) / janet_unwrap_number(y)));
+    return 0;
+}
+
+static int jit_modulo(Janet *stack, uint32_t instr) {
+    Janet x = stack[JIT_B(instr)];
+    Janet y = stack[JIT_C(instr)];
+    if (!janet_checktype(x, JANET_NUMBER) || !janet_checktype(y, JANET_NUMBER)) return 1;
+    double x1 = janet_unwrap_number(x);
+    double x2 = janet_unwrap_number(y);
+    stack[JIT_A(instr)] = janet_wrap_number(x2 == 0 ? x1 : x1 - x2 * floor(x1 / x2));
+    return 0;
+}
+
+static int jit_remainder(Janet *stack, uint32_t instr) {
+    Janet x = stack[JIT_B(instr)];
+    Janet y = stack[JIT_C(instr)];
+    if (!janet_checktype(x, JANET_NUMBER) || !janet_checktype(y, JANET_NUMBER)) return 1;
+    stack[JIT_A(instr)] = janet_wrap_number(fmod(janet_unwrap_number(x), janet_unwrap_number(y)));
+    return 0;
+}
+
+#define JIT_BITOP(name, op, type1, rangecheck) \
+static int name(Janet *stack, uint32_t instr) { \
+    Janet x = stack[JIT_B(instr)]; \
+    Janet y = stack[JIT_C(instr)]; \
+    if (!janet_checktype(x, JANET_NUMBER) || !janet_checktype(y, JANET_NUMBER)) return 1; \
+    double y1 = janet_unwrap_number(x); \
+    double y2 = janet_unwrap_number(y); \
+    if (!rangecheck(y1) || !janet_checkintrange(y2)) return 1; \
+    type1 x1 = (type1) y1; \
+    int32_t x2 = (int32_t) y2; \
+    stack[JIT_A(instr)] = janet_wrap_number((type1) (x1 op x2)); \
+    return 0; \
+}
+#define JIT_BITOP_IMMEDIATE(name, op, type1, rangecheck) \
+static int name(Janet *stack, uint32_t instr) { \
+    Janet x = stack[JIT_B(instr)]; \
+    if (!janet_checktype(x, JANET_NUMBER)) return 1; \
+    double y1 = janet_unwrap_number(x); \
+    if (!rangecheck(y1)) return 1; \
+    type1 x1 = (type1) y1; \
+    stack[JIT_A(instr)] = janet_wrap_number((type1) (x1 op JIT_CS(instr))); \
+    return 0; \
+}
+JIT_BITOP(jit_band, &, int32_t, janet_checkintrange)
+JIT_BITOP(jit_bor, |, int32_t, janet_checkintrange)
+JIT_BITOP(jit_bxor, ^, int32_t, janet_checkintrange)
+JIT_BITOP(jit_shift_left, <<, int32_t, janet_checkintrange)
+JIT_BITOP(jit_shift_right, >>, int32_t, janet_checkintrange)
+JIT_BITOP(jit_shift_right_unsigned, >>, uint32_t, janet_checkuintrange)
+JIT_BITOP_IMMEDIATE(jit_shift_left_immediate, <<, int32_t, janet_checkintrange)
+JIT_BITOP_IMMEDIATE(jit_shift_right_immediate, >>, int32_t, janet_checkintrange)
+JIT_BITOP_IMMEDIATE(jit_shift_right_unsigned_immediate, >>, uint32_t, janet_checkuintrange)
+#undef JIT_BITOP
+#undef JIT_BITOP_IMMEDIATE
+
+static int jit_bnot(Janet *stack, uint32_t instr) {
+    Janet x = stack[JIT_E(instr)];
+    if (!janet_checktype(x, JANET_NUMBER)) return 1;
+    stack[JIT_A(instr)] = janet_wrap_integer(~janet_unwrap_integer(x));
+    return 0;
+}
+
+/* Index an array or tuple. Returns 0 if the key is not an index in range. */
+static int jit_index(Janet ds, Janet key, Janet *out) {
+    if (!janet_checktype(key, JANET_NUMBER)) return 0;
+    double d = janet_unwrap_number(key);
+    if (!(d >= 0 && d < INT32_MAX)) return 0;
+    int32_t index = (int32_t) d;
+    if ((double) index != d) return 0;
+    if (janet_checktype(ds, JANET_ARRAY)) {
+        JanetArray *array = janet_unwrap_array(ds);
+        if (index >= array->count) return 0;
+        *out = array->data[index];
+        return 1;
+    }
+    if (janet_checktype(ds, JANET_TUPLE)) {
+        const Janet *tuple = janet_unwrap_tuple(ds);
+        if (index >= janet_tuple_length(tuple)) return 0;
+        *out = tuple[index];
+        return 1;
+    }
+    return 0;
+}
+
+/* janet_get cannot fail, but abstract types and fibers may run other code. */
+static int jit_get_key(Janet *stack, uint32_t instr, Janet key) {
+    Janet ds = stack[JIT_B(instr)];
+    if (jit_index(ds, key, stack + JIT_A(instr))) return 0;
+    if (janet_checktype(ds, JANET_ABSTRACT) || janet_checktype(ds, JANET_FIBER)) return 1;
+    stack[JIT_A(instr)] = janet_get(ds, key);
+    return 0;
+}
+
+/* janet_in fails on missing indices, leave those to the interpreter. */
+static int jit_in_value(Janet ds, Janet key, Janet *out) {
+    if (jit_index(ds, key, out)) return 0;
+    switch (janet_type(ds)) {
+        default:
+            return 1;
+        case JANET_TABLE:
+        case JANET_STRUCT:
+            break;
+        case JANET_BUFFER:
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_KEYWORD:
+            if (!janet_checkint(key)) return 1;
+            int32_t index = janet_unwrap_integer(key);
+            if (index < 0 || index >= janet_length(ds)) return 1;
+            break;
+    }
+    *out = janet_in(ds, key);
+    return 0;
+}
+
+static int jit_in_key(Janet *stack, uint32_t instr, Janet key) {
+    return jit_in_value(stack[JIT_B(instr)], key, stack + JIT_A(instr));
+}
+
+static int jit_get(Janet *stack, uint32_t instr) {
+    return jit_get_key(stack, instr, stack[JIT_C(instr)]);
+}
+
+static int jit_in(Janet *stack, uint32_t instr) {
+    return jit_in_key(stack, instr, stack[JIT_C(instr)]);
+}
+
+static int jit_get_immediate(Janet *stack, uint32_t instr) {
+    return jit_get_key(stack, instr, janet_wrap_integer(JIT_CS(instr)));
+}
+
+static int jit_in_immediate(Janet *stack, uint32_t instr) {
+    return jit_in_key(stack, instr, janet_wrap_integer(JIT_CS(instr)));
+}
+
+static int jit_get_index(Janet *stack, uint32_t instr) {
+    Janet ds = stack[JIT_B(instr)];
+    switch (janet_type(ds)) {
+        default:
+            return 1;
+        case JANET_ARRAY:
+        case JANET_TUPLE:
+        case JANET_BUFFER:
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_KEYWORD:
+        case JANET_TABLE:
+        case JANET_STRUCT:
+            break;
+    }
+    stack[JIT_A(instr)] = janet_getindex(ds, JIT_C(instr));
+    return 0;
+}
+
+static int jit_length(Janet *stack, uint32_t instr) {
+    Janet x = stack[JIT_E(instr)];
+    switch (janet_type(x)) {
+        default:
+            return 1;
+        case JANET_ARRAY:
+        case JANET_TUPLE:
+        case JANET_BUFFER:
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_KEYWORD:
+        case JANET_TABLE:
+        case JANET_STRUCT:
+            break;
+    }
+    stack[JIT_A(instr)] = janet_lengthv(x);
+    return 0;
+}
+
+/* Only puts that neither fail nor grow an array. A table put may allocate, so
+ * it is left to the interpreter when a collection is due. */
+static int jit_put(Janet *stack, uint32_t instr) {
+    Janet ds = stack[JIT_A(instr)];
+    Janet key = stack[JIT_B(instr)];
+    Janet old;
+    if (janet_checktype(ds, JANET_ARRAY)) {
+        if (!jit_index(ds, key, &old)) return 1;
+        JanetArray *array = janet_unwrap_array(ds);
+        janet_gc_barrier(array);
+        array->data[janet_unwrap_integer(key)] = stack[JIT_C(instr)];
+    } else if (janet_checktype(ds, JANET_TABLE)) {
+        if (janet_vm.next_collection >= janet_vm.gc_interval) return 1;
+        janet_table_put(janet_unwrap_table(ds), key, stack[JIT_C(instr)]);
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+static int jit_load_self(Janet *stack, uint32_t instr) {
+    stack[JIT_D(instr)] = janet_wrap_function(janet_stack_frame(stack)->func);
+    return 0;
+}
+
+/* The interpreter asserts that upvalue indices are valid */
+static JanetFuncEnv *jit_upvalue_env(Janet *stack, uint32_t instr) {
+    JanetFunction *func = janet_stack_frame(stack)->func;
+    if (func->def->environments_length <= JIT_B(instr)) return NULL;
+    JanetFuncEnv *env = func->envs[JIT_B(instr)];
+    if (env->length <= JIT_C(instr) || !janet_env_valid(env)) return NULL;
+    return env;
+}
+
+static int jit_load_upvalue(Janet *stack, uint32_t instr) {
+    JanetFuncEnv *env = jit_upvalue_env(stack, instr);
+    if (NULL == env) return 1;
+    if (env->offset > 0) {
+        stack[JIT_A(instr)] = env->as.fiber->data[env->offset + JIT_C(instr)];
+    } else {
+        stack[JIT_A(instr)] = env->as.values[JIT_C(instr)];
+    }
+    return 0;
+}
+
+static int jit_set_upvalue(Janet *stack, uint32_t instr) {
+    JanetFuncEnv *env = jit_upvalue_env(stack, instr);
+    if (NULL == env) return 1;
+    if (env->offset > 0) {
+        env->as.fiber->data[env->offset + JIT_C(instr)] = stack[JIT_A(instr)];
+    } else {
+        janet_gc_barrier(env);
+        env->as.values[JIT_C(instr)] = stack[JIT_A(instr)];
+    }
+    return 0;
+}
+
+/* Machine code may call into machine code, as deep as half the C recursion
+ * limit. Deeper calls go through the interpreter. */
+#ifndef JANET_JIT_MAX_DEPTH
+#define JANET_JIT_MAX_DEPTH (JANET_RECURSION_GUARD / 2)
+#endif
+
+/* Finish a call of a compiled function whose machine code stopped at next,
+ * from the CALL instruction instr. Returns as the interpreter would if it
+ * stopped at a return, else leaves the callee to the interpreter. */
+static int jit_finish_call(JanetFiber *fiber, JanetFunction *func, int32_t next, Janet *stack, uint32_t instr) {
+    if (next < 0) return 2;
+    Janet *callee_stack = fiber->data + fiber->frame;
+    uint32_t ret = func->def->bytecode[next];
+    Janet retval;
+    switch (ret & 0x7F) {
+        default:
+            janet_stack_frame(callee_stack)->pc = func->def->bytecode + next;
+            return 2;
+        case JOP_RETURN:
+            retval = callee_stack[JIT_D(ret)];
+            break;
+        case JOP_RETURN_NIL:
+            retval = janet_wrap_nil();
+            break;
+    }
+    janet_fiber_popframe(fiber);
+    fiber->data[fiber->frame + JIT_A(instr)] = retval;
+    if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect_auto();
+    if (fiber->data + fiber->frame == stack) return 0;
+    janet_stack_frame(fiber->data + fiber->frame)->pc++;
+    return 2;
+}
+
+/* Calls that machine code can make itself. Calling a data structure with one
+ * argument, as in (xs i), looks the argument up in it. C functions, and
+ * functions with machine code for their first instruction, are called as the
+ * interpreter would, after the machine code has saved pc in the frame for
+ * errors and signals. Unwinding machine code frames with longjmp is fine
+ * everywhere but on Windows. A call can leave the fiber's stack somewhere
+ * else, or a new frame for the interpreter to run. Then all frames are saved
+ * and the result is 2, to go on in the interpreter from the top frame. */
+static int jit_call(Janet *stack, uint32_t instr) {
+    JanetFiber *fiber = janet_vm.fiber;
+    Janet callee = stack[JIT_E(instr)];
+#ifndef JANET_NO_INTERPRETER_INTERRUPT
+    if (janet_atomic_load_relaxed(&janet_vm.auto_suspend)) return 1;
+#endif
+    if (fiber->stacktop > fiber->maxstack) return 1;
+    int32_t argc = fiber->stacktop - fiber->stackstart;
+    switch (janet_type(callee)) {
+        default:
+            return 1;
+#ifndef JANET_WINDOWS
+        case JANET_FUNCTION: {
+            JanetFunction *func = janet_unwrap_function(callee);
+            JanetJit *jit = func->def->jit;
+            if (NULL == jit || !jit->entries[0]) return 1;
+            if (func->gc.flags & JANET_FUNCFLAG_TRACE) return 1;
+            if (janet_vm.stackn >= JANET_JIT_MAX_DEPTH) return 1;
+            if (janet_fiber_funcframe(fiber, func)) return 1;
+            if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect_auto();
+            janet_vm.stackn++;
+            int32_t next = janet_jit_run(jit, fiber->data + fiber->frame, 0);
+            janet_vm.stackn--;
+            return jit_finish_call(fiber, func, next, stack, instr);
+        }
+        case JANET_CFUNCTION: {
+            JanetCFunction cfun = janet_unwrap_cfunction(callee);
+            janet_fiber_cframe(fiber, cfun);
+            Janet ret = cfun(argc, fiber->data + fiber->frame);
+            janet_fiber_popframe(fiber);
+            fiber->data[fiber->frame + JIT_A(instr)] = ret;
+            if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect_auto();
+            if (fiber->data + fiber->frame == stack) return 0;
+            janet_stack_frame(fiber->data + fiber->frame)->pc++;
+            return 2;
+        }
+#endif
+        case JANET_ARRAY:
+        case JANET_TUPLE:
+        case JANET_TABLE:
+        case JANET_STRUCT:
+        case JANET_STRING:
+        case JANET_BUFFER:
+            break;
+    }
+    if (argc != 1) return 1;
+    if (jit_in_value(callee, fiber->data[fiber->stackstart], stack + JIT_A(instr))) return 1;
+    fiber->stacktop = fiber->stackstart;
+    return 0;
+}
+
+/* Constructors from the values pushed for the next frame. They allocate, so
+ * they are left to the interpreter when a collection is due. */
+static int jit_make_array(Janet *stack, uint32_t instr) {
+    JanetFiber *fiber = janet_vm.fiber;
+    if (janet_vm.next_collection >= janet_vm.gc_interval) return 1;
+    int32_t count = fiber->stacktop - fiber->stackstart;
+    stack[JIT_D(instr)] = janet_wrap_array(janet_array_n(fiber->data + fiber->stackstart, count));
+    fiber->stacktop = fiber->stackstart;
+    return 0;
+}
+
+static int jit_make_tuple(Janet *stack, uint32_t instr) {
+    JanetFiber *fiber = janet_vm.fiber;
+    if (janet_vm.next_collection >= janet_vm.gc_interval) return 1;
+    int32_t count = fiber->stacktop - fiber->stackstart;
+    const Janet *tup = janet_tuple_n(fiber->data + fiber->stackstart, count);
+    if ((instr & 0x7F) == JOP_MAKE_BRACKET_TUPLE)
+        janet_tuple_flag(tup) |= JANET_TUPLE_FLAG_BRACKETCTOR;
+    stack[JIT_D(instr)] = janet_wrap_tuple(tup);
+    fiber->stacktop = fiber->stackstart;
+    return 0;
+}
+
+static int jit_make_table(Janet *stack, uint32_t instr) {
+    JanetFiber *fiber = janet_vm.fiber;
+    if (janet_vm.next_collection >= janet_vm.gc_interval) return 1;
+    int32_t count = fiber->stacktop - fiber->stackstart;
+    if (count & 1) return 1;
+    Janet *mem = fiber->data + fiber->stackstart;
+    JanetTable *table = janet_table(count / 2);
+    for (int32_t i = 0; i < count; i += 2)
+        janet_table_put(table, mem[i], mem[i + 1]);
+    stack[JIT_D(instr)] = janet_wrap_table(table);
+    fiber->stacktop = fiber->stackstart;
+    return 0;
+}
+
+static int jit_make_struct(Janet *stack, uint32_t instr) {
+    JanetFiber *fiber = janet_vm.fiber;
+    if (janet_vm.next_collection >= janet_vm.gc_interval) return 1;
+    int32_t count = fiber->stacktop - fiber->stackstart;
+    if (count & 1) return 1;
+    Janet *mem = fiber->data + fiber->stackstart;
+    JanetKV *st = janet_struct_begin(count / 2);
+    for (int32_t i = 0; i < count; i += 2)
+        janet_struct_put(st, mem[i], mem[i + 1]);
+    stack[JIT_D(instr)] = janet_wrap_struct(janet_struct_end(st));
+    fiber->stacktop = fiber->stackstart;
+    return 0;
+}
+
+/* janet_next cannot fail or run other code for these types */
+static int jit_next(Janet *stack, uint32_t instr) {
+    Janet ds = stack[JIT_B(instr)];
+    switch (janet_type(ds)) {
+        default:
+            return 1;
+        case JANET_ARRAY:
+        case JANET_TUPLE:
+        case JANET_TABLE:
+        case JANET_STRUCT:
+            break;
+    }
+    stack[JIT_A(instr)] = janet_next_impl(ds, stack[JIT_C(instr)], 1);
+    return 0;
+}
+
+static JitHelper jit_helper(uint32_t instr) {
+    switch (instr & 0x7F) {
+        default:
+            return NULL;
+        case JOP_EQUALS:
+        case JOP_EQUALS_BRANCH:
+            return jit_equals;
+        case JOP_NOT_EQUALS:
+        case JOP_NOT_EQUALS_BRANCH:
+            return jit_not_equals;
+        case JOP_DIVIDE_FLOOR:
+            return jit_divide_floor;
+        case JOP_MODULO:
+            return jit_modulo;
+        case JOP_REMAINDER:
+            return jit_remainder;
+        case JOP_BAND:
+            return jit_band;
+        case JOP_BOR:
+            return jit_bor;
+        case JOP_BXOR:
+            return jit_bxor;
+        case JOP_BNOT:
+            return jit_bnot;
+        case JOP_SHIFT_LEFT:
+            return jit_shift_left;
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+            return jit_shift_left_immediate;
+        case JOP_SHIFT_RIGHT:
+            return jit_shift_right;
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+            return jit_shift_right_immediate;
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+            return jit_shift_right_unsigned;
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+            return jit_shift_right_unsigned_immediate;
+        case JOP_GET:
+            return jit_get;
+        case JOP_IN:
+            return jit_in;
+        case JOP_GET_IMMEDIATE:
+            return jit_get_immediate;
+        case JOP_IN_IMMEDIATE:
+            return jit_in_immediate;
+        case JOP_GET_INDEX:
+            return jit_get_index;
+        case JOP_LENGTH:
+            return jit_length;
+        case JOP_PUT:
+            return jit_put;
+        case JOP_LOAD_SELF:
+            return jit_load_self;
+        case JOP_LOAD_UPVALUE:
+            return jit_load_upvalue;
+        case JOP_SET_UPVALUE:
+            return jit_set_upvalue;
+        case JOP_NEXT:
+            return jit_next;
+        case JOP_MAKE_ARRAY:
+            return jit_make_array;
+        case JOP_MAKE_TUPLE:
+        case JOP_MAKE_BRACKET_TUPLE:
+            return jit_make_tuple;
+        case JOP_MAKE_TABLE:
+            return jit_make_table;
+        case JOP_MAKE_STRUCT:
+            return jit_make_struct;
+    }
+}
+
+/*
+ * Emitting machine code
+ */
+
+static void jit_byte(JitState *s, uint8_t b) {
+    janet_v_push(s->code, b);
+}
+
+static void jit_bytes(JitState *s, const char *bytes, int n) {
+    for (int i = 0; i < n; i++) jit_byte(s, (uint8_t) bytes[i]);
+}
+
+static void jit_u32(JitState *s, uint32_t x) {
+    for (int i = 0; i < 4; i++) jit_byte(s, (uint8_t)(x >> (8 * i)));
+}
+
+static void jit_u64(JitState *s, uint64_t x) {
+    for (int i = 0; i < 8; i++) jit_byte(s, (uint8_t)(x >> (8 * i)));
+}
+
+static int32_t jit_here(JitState *s) {
+    return janet_v_count(s->code);
+}
+
+/* ModRM byte and displacement for [rbx + 8 * slot] */
+static void jit_slot(JitState *s, int reg, int32_t slot) {
+    int32_t disp = slot * 8;
+    if (disp < 128) {
+        jit_byte(s, (uint8_t)(0x43 | (reg << 3)));
+        jit_byte(s, (uint8_t) disp);
+    } else {
+        jit_byte(s, (uint8_t)(0x83 | (reg << 3)));
+        jit_u32(s, (uint32_t) disp);
+    }
+}
+
+/* mov reg, [rbx + 8 * slot] */
+static void jit_load(JitState *s, int reg, int32_t slot) {
+    jit_bytes(s, "\x48\x8B", 2);
+    jit_slot(s, reg, slot);
+}
+
+/* mov [rbx + 8 * slot], reg */
+static void jit_store(JitState *s, int reg, int32_t slot) {
+    jit_bytes(s, "\x48\x89", 2);
+    jit_slot(s, reg, slot);
+}
+
+/* An SSE instruction with xmm and [rbx + 8 * slot] operands */
+static void jit_sse_slot(JitState *s, uint8_t prefix, uint8_t op, int xmm, int32_t slot) {
+    jit_byte(s, prefix);
+    jit_byte(s, 0x0F);
+    jit_byte(s, op);
+    jit_slot(s, xmm, slot);
+}
+
+/* An SSE instruction with two xmm operands */
+static void jit_sse_reg(JitState *s, uint8_t prefix, uint8_t op, int dest, int src) {
+    jit_byte(s, prefix);
+    jit_byte(s, 0x0F);
+    jit_byte(s, op);
+    jit_byte(s, (uint8_t)(0xC0 | (dest << 3) | src));
+}
+
+/* mov rax/rcx, imm64 */
+static void jit_imm64(JitState *s, int reg, uint64_t x) {
+    jit_byte(s, 0x48);
+    jit_byte(s, (uint8_t)(0xB8 + reg));
+    jit_u64(s, x);
+}
+
+/* Load a small integer into an xmm register as a double */
+static void jit_imm_double(JitState *s, int xmm, int32_t x) {
+    jit_byte(s, 0xB8); /* mov eax, imm32 */
+    jit_u32(s, (uint32_t) x);
+    jit_sse_reg(s, 0xF2, 0x2A, xmm, JIT_RAX); /* cvtsi2sd xmm, eax */
+}
+
+/* Jump to the code for instruction pc, or to the interpreter at pc */
+static void jit_jump(JitState *s, int cc, int32_t pc, int exit) {
+    if (cc == JIT_ALWAYS) {
+        jit_byte(s, 0xE9);
+    } else {
+        jit_byte(s, 0x0F);
+        jit_byte(s, (uint8_t)(0x80 | cc));
+    }
+    JitFixup fixup;
+    fixup.at = jit_here(s);
+    fixup.pc = pc;
+    fixup.exit = exit;
+    janet_v_push(s->fixups, fixup);
+    jit_u32(s, 0);
+}
+
+/* Short forward jump, patched with jit_land */
+static int32_t jit_skip(JitState *s, int cc) {
+    jit_byte(s, cc == JIT_ALWAYS ? 0xEB : (uint8_t)(0x70 | cc));
+    jit_byte(s, 0);
+    return jit_here(s) - 1;
+}
+
+static void jit_land(JitState *s, int32_t at) {
+    s->code[at] = (uint8_t)(jit_here(s) - at - 1);
+}
+
+/* Forward jump to a label, patched with jit_place */
+static void jit_goto(JitState *s, JitLabel *label, int cc) {
+    jit_byte(s, 0x0F);
+    jit_byte(s, (uint8_t)(0x80 | cc));
+    label->at[label->count++] = jit_here(s);
+    jit_u32(s, 0);
+}
+
+static void jit_place(JitState *s, JitLabel *label) {
+    for (int i = 0; i < label->count; i++) {
+        int32_t at = label->at[i];
+        uint32_t rel = (uint32_t)(jit_here(s) - at - 4);
+        for (int b = 0; b < 4; b++) s->code[at + b] = (uint8_t)(rel >> (8 * b));
+    }
+}
+
+/* Jump for the branch instruction at pc. Backward jumps check for
+ * interrupts first, and leave them to the interpreter. */
+static void jit_branch(JitState *s, int cc, int32_t pc, int32_t target) {
+    if (target > pc) {
+        jit_jump(s, cc, target, 0);
+        return;
+    }
+    int32_t skip = 0;
+    if (cc != JIT_ALWAYS) skip = jit_skip(s, cc ^ 1);
+#ifndef JANET_NO_INTERPRETER_INTERRUPT
+    jit_bytes(s, "\x41\x83\x3C\x24\x00", 5); /* cmp dword [r12], 0 */
+    jit_jump(s, JIT_CC_NE, pc, 1);
+#endif
+    jit_jump(s, JIT_ALWAYS, target, 0);
+    if (cc != JIT_ALWAYS) jit_land(s, skip);
+}
+
+/* Exit at pc unless the value in rax or rdx is a number */
+static void jit_guard_number(JitState *s, int reg, int32_t pc) {
+    jit_byte(s, 0x4C);
+    jit_byte(s, 0x39);
+    jit_byte(s, (uint8_t)(0xE8 | reg)); /* cmp reg, r13 */
+    jit_jump(s, JIT_CC_AE, pc, 1);
+}
+
+/* Store the boolean in al to a slot */
+static void jit_store_boolean(JitState *s, int32_t slot) {
+    jit_bytes(s, "\x0F\xB6\xC0", 3); /* movzx eax, al */
+    jit_imm64(s, JIT_RCX, janet_u64(janet_wrap_false()));
+    jit_bytes(s, "\x48\x09\xC8", 3); /* or rax, rcx */
+    jit_store(s, JIT_RAX, slot);
+}
+
+/* Put the tag of the value in rax into edx and compare it with the tag of type */
+static void jit_tag_compare(JitState *s, JanetType type) {
+    jit_bytes(s, "\x48\x89\xC2", 3); /* mov rdx, rax */
+    jit_bytes(s, "\x48\xC1\xEA\x2F", 4); /* shr rdx, 47 */
+    jit_bytes(s, "\x81\xFA", 2); /* cmp edx, imm32 */
+    jit_u32(s, (uint32_t) janet_nanbox_lowtag(type));
+}
+
+static void jit_helper_invoke(JitState *s, JitHelper helper, uint32_t instr) {
+#ifdef JANET_WINDOWS
+    jit_bytes(s, "\x48\x89\xD9", 3); /* mov rcx, rbx */
+    jit_byte(s, 0xBA); /* mov edx, imm32 */
+#else
+    jit_bytes(s, "\x48\x89\xDF", 3); /* mov rdi, rbx */
+    jit_byte(s, 0xBE); /* mov esi, imm32 */
+#endif
+    jit_u32(s, instr);
+    jit_imm64(s, JIT_RAX, (uint64_t)(uintptr_t) helper);
+    jit_bytes(s, "\xFF\xD0", 2); /* call rax */
+}
+
+static void jit_helper_call(JitState *s, JitHelper helper, uint32_t instr, int32_t pc) {
+    jit_helper_invoke(s, helper, instr);
+    jit_bytes(s, "\x85\xC0", 2); /* test eax, eax */
+    jit_jump(s, JIT_CC_NE, pc, 1);
+}
+
+/* An instruction with a register and a field of the fiber in r14. The rex
+ * prefix is 0x41 for 32 bit operands and 0x49 for 64 bit ones. */
+static void jit_fiber_field(JitState *s, uint8_t rex, uint8_t op, int reg, size_t offset) {
+    jit_byte(s, rex);
+    jit_byte(s, op);
+    jit_byte(s, (uint8_t)(0x46 | (reg << 3)));
+    jit_byte(s, (uint8_t) offset);
+}
+
+/* Push slots for the next call. Growing the fiber's stack would move the
+ * frame, so that is left to the interpreter. */
+static void jit_push(JitState *s, const int32_t *slots, int n, int32_t pc) {
+    jit_fiber_field(s, 0x41, 0x8B, JIT_RAX, offsetof(JanetFiber, stacktop)); /* mov eax, [r14 + stacktop] */
+    jit_fiber_field(s, 0x41, 0x8B, JIT_RCX, offsetof(JanetFiber, capacity)); /* mov ecx, [r14 + capacity] */
+    jit_bytes(s, "\x29\xC1", 2); /* sub ecx, eax */
+    jit_bytes(s, "\x83\xF9", 2); /* cmp ecx, imm8 */
+    jit_byte(s, (uint8_t) n);
+    jit_jump(s, JIT_CC_L, pc, 1);
+    jit_fiber_field(s, 0x49, 0x8B, JIT_RDX, offsetof(JanetFiber, data)); /* mov rdx, [r14 + data] */
+    for (int i = 0; i < n; i++) {
+        jit_load(s, JIT_RCX, slots[i]);
+        jit_bytes(s, "\x48\x89\x4C\xC2", 4); /* mov [rdx + 8 * rax + disp8], rcx */
+        jit_byte(s, (uint8_t)(8 * i));
+    }
+    jit_bytes(s, "\x83\xC0", 2); /* add eax, imm8 */
+    jit_byte(s, (uint8_t) n);
+    jit_fiber_field(s, 0x41, 0x89, JIT_RAX, offsetof(JanetFiber, stacktop)); /* mov [r14 + stacktop], eax */
+}
+
+/* Load the tuple or array in a slot, with its elements in rdx and its length
+ * in ecx. Other values go to label. */
+static void jit_indexed(JitState *s, int32_t slot, JitLabel *label) {
+    jit_load(s, JIT_RAX, slot);
+    jit_tag_compare(s, JANET_TUPLE);
+    int32_t not_tuple = jit_skip(s, JIT_CC_NE);
+    jit_bytes(s, "\x48\xC1\xE0\x11\x48\xC1\xE8\x11", 8); /* shl rax, 17; shr rax, 17 */
+    jit_bytes(s, "\x8B\x48", 2); /* mov ecx, [rax + disp8] */
+    jit_byte(s, (uint8_t)((int32_t) offsetof(JanetTupleHead, length) - (int32_t) offsetof(JanetTupleHead, data)));
+    jit_bytes(s, "\x48\x89\xC2", 3); /* mov rdx, rax */
+    int32_t tuple = jit_skip(s, JIT_ALWAYS);
+    jit_land(s, not_tuple);
+    jit_bytes(s, "\x81\xFA", 2); /* cmp edx, imm32 */
+    jit_u32(s, (uint32_t) janet_nanbox_lowtag(JANET_ARRAY));
+    jit_goto(s, label, JIT_CC_NE);
+    jit_bytes(s, "\x48\xC1\xE0\x11\x48\xC1\xE8\x11", 8); /* shl rax, 17; shr rax, 17 */
+    jit_bytes(s, "\x8B\x48", 2); /* mov ecx, [rax + disp8] */
+    jit_byte(s, (uint8_t) offsetof(JanetArray, count));
+    jit_bytes(s, "\x48\x8B\x50", 3); /* mov rdx, [rax + disp8] */
+    jit_byte(s, (uint8_t) offsetof(JanetArray, data));
+    jit_land(s, tuple);
+}
+
+/* Convert the value in rax to an int32_t in eax if it is one, else go to label */
+static void jit_integer(JitState *s, JitLabel *label) {
+    jit_bytes(s, "\x4C\x39\xE8", 3); /* cmp rax, r13 */
+    jit_goto(s, label, JIT_CC_AE);
+    jit_bytes(s, "\x66\x48\x0F\x6E\xC0", 5); /* movq xmm0, rax */
+    jit_bytes(s, "\xF2\x0F\x2C\xC0", 4); /* cvttsd2si eax, xmm0 */
+    jit_sse_reg(s, 0xF2, 0x2A, 1, JIT_RAX); /* cvtsi2sd xmm1, eax */
+    jit_sse_reg(s, 0x66, 0x2E, 0, 1); /* ucomisd xmm0, xmm1 */
+    jit_goto(s, label, JIT_CC_NE);
+    jit_goto(s, label, JIT_CC_P);
+}
+
+/* Call a tuple or array with one argument in range, as in (xs i), the way
+ * the interpreter would. Anything else goes to label. */
+static void jit_call_indexed(JitState *s, uint32_t instr, JitLabel *label) {
+#ifndef JANET_NO_INTERPRETER_INTERRUPT
+    jit_bytes(s, "\x41\x83\x3C\x24\x00", 5); /* cmp dword [r12], 0 */
+    jit_goto(s, label, JIT_CC_NE);
+#endif
+    jit_indexed(s, JIT_E(instr), label);
+    jit_fiber_field(s, 0x41, 0x8B, JIT_RAX, offsetof(JanetFiber, stacktop)); /* mov eax, [r14 + stacktop] */
+    jit_fiber_field(s, 0x41, 0x3B, JIT_RAX, offsetof(JanetFiber, maxstack)); /* cmp eax, [r14 + maxstack] */
+    jit_goto(s, label, JIT_CC_G);
+    jit_fiber_field(s, 0x41, 0x2B, JIT_RAX, offsetof(JanetFiber, stackstart)); /* sub eax, [r14 + stackstart] */
+    jit_bytes(s, "\x83\xF8\x01", 3); /* cmp eax, 1 */
+    jit_goto(s, label, JIT_CC_NE);
+    jit_fiber_field(s, 0x41, 0x8B, JIT_RAX, offsetof(JanetFiber, stackstart)); /* mov eax, [r14 + stackstart] */
+    jit_fiber_field(s, 0x49, 0x8B, JIT_RSI, offsetof(JanetFiber, data)); /* mov rsi, [r14 + data] */
+    jit_bytes(s, "\x48\x8B\x04\xC6", 4); /* mov rax, [rsi + 8 * rax] */
+    jit_integer(s, label);
+    jit_bytes(s, "\x39\xC8", 2); /* cmp eax, ecx */
+    jit_goto(s, label, JIT_CC_AE);
+    jit_bytes(s, "\x48\x8B\x04\xC2", 4); /* mov rax, [rdx + 8 * rax] */
+    jit_store(s, JIT_RAX, JIT_A(instr));
+    jit_fiber_field(s, 0x41, 0x8B, JIT_RAX, offsetof(JanetFiber, stackstart)); /* mov eax, [r14 + stackstart] */
+    jit_fiber_field(s, 0x41, 0x89, JIT_RAX, offsetof(JanetFiber, stacktop)); /* mov [r14 + stacktop], eax */
+}
+
+/* Instructions on tuples and arrays, inline for in range indices. Anything
+ * else calls the helper. */
+static int jit_indexed_instruction(JitState *s, uint32_t instr, int32_t pc) {
+    JitLabel slow;
+    slow.count = 0;
+    int32_t index = -1;
+    switch (instr & 0x7F) {
+        default:
+            return 0;
+        case JOP_GET_INDEX:
+            index = JIT_C(instr);
+            break;
+        case JOP_GET_IMMEDIATE:
+        case JOP_IN_IMMEDIATE:
+            index = JIT_CS(instr);
+            if (index < 0) return 0;
+            break;
+        case JOP_GET:
+        case JOP_IN:
+        case JOP_NEXT:
+        case JOP_LENGTH:
+            break;
+    }
+    if ((instr & 0x7F) == JOP_LENGTH) {
+        jit_indexed(s, JIT_E(instr), &slow);
+        jit_sse_reg(s, 0xF2, 0x2A, 0, JIT_RCX); /* cvtsi2sd xmm0, ecx */
+        jit_sse_slot(s, 0xF2, 0x11, 0, JIT_A(instr)); /* movsd [a], xmm0 */
+    } else if ((instr & 0x7F) == JOP_NEXT) {
+        /* The index after the key, or nil at the end */
+        jit_indexed(s, JIT_B(instr), &slow);
+        jit_load(s, JIT_RAX, JIT_C(instr));
+        jit_tag_compare(s, JANET_NIL);
+        int32_t not_nil = jit_skip(s, JIT_CC_NE);
+        jit_bytes(s, "\x31\xC0", 2); /* xor eax, eax */
+        int32_t first = jit_skip(s, JIT_ALWAYS);
+        jit_land(s, not_nil);
+        jit_integer(s, &slow);
+        jit_bytes(s, "\xFF\xC0", 2); /* inc eax */
+        jit_land(s, first);
+        jit_bytes(s, "\x39\xC8", 2); /* cmp eax, ecx */
+        int32_t end = jit_skip(s, JIT_CC_AE);
+        jit_sse_reg(s, 0xF2, 0x2A, 0, JIT_RAX); /* cvtsi2sd xmm0, eax */
+        jit_sse_slot(s, 0xF2, 0x11, 0, JIT_A(instr)); /* movsd [a], xmm0 */
+        int32_t done = jit_skip(s, JIT_ALWAYS);
+        jit_land(s, end);
+        jit_imm64(s, JIT_RAX, janet_u64(janet_wrap_nil()));
+        jit_store(s, JIT_RAX, JIT_A(instr));
+        jit_land(s, done);
+    } else if (index >= 0) {
+        jit_indexed(s, JIT_B(instr), &slow);
+        jit_bytes(s, "\x81\xF9", 2); /* cmp ecx, imm32 */
+        jit_u32(s, (uint32_t) index);
+        jit_goto(s, &slow, JIT_CC_BE);
+        jit_bytes(s, "\x48\x8B\x82", 3); /* mov rax, [rdx + disp32] */
+        jit_u32(s, (uint32_t)(8 * index));
+        jit_store(s, JIT_RAX, JIT_A(instr));
+    } else {
+        jit_indexed(s, JIT_B(instr), &slow);
+        jit_load(s, JIT_RAX, JIT_C(instr));
+        jit_integer(s, &slow);
+        jit_bytes(s, "\x39\xC8", 2); /* cmp eax, ecx */
+        jit_goto(s, &slow, JIT_CC_AE);
+        jit_bytes(s, "\x48\x8B\x04\xC2", 4); /* mov rax, [rdx + 8 * rax] */
+        jit_store(s, JIT_RAX, JIT_A(instr));
+    }
+    int32_t done = jit_skip(s, JIT_ALWAYS);
+    jit_place(s, &slow);
+    jit_helper_call(s, jit_helper(instr), instr, pc);
+    jit_land(s, done);
+    return 1;
+}
+
+/* Compare two numbers and store the result. Leaves the boolean in al. */
+static void jit_compare(JitState *s, uint32_t instr, int32_t pc) {
+    int32_t b = JIT_B(instr);
+    int immediate = 0;
+    int swap = 0;
+    int cc = JIT_CC_A;
+    int eq = 0;
+    switch (instr & 0x7F) {
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_LESS_THAN_IMMEDIATE_BRANCH:
+            immediate = 1;
+        /* fallthrough */
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_BRANCH:
+            swap = 1;
+            break;
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_LESS_THAN_EQUAL_BRANCH:
+            swap = 1;
+            cc = JIT_CC_AE;
+            break;
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE_BRANCH:
+            immediate = 1;
+            break;
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_GREATER_THAN_EQUAL_BRANCH:
+            cc = JIT_CC_AE;
+            break;
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE_BRANCH:
+            immediate = 1;
+            eq = 1;
+            break;
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE_BRANCH:
+            immediate = 1;
+            eq = 2;
+            break;
+    }
+    jit_load(s, JIT_RAX, b);
+    jit_guard_number(s, JIT_RAX, pc);
+    if (!immediate) {
+        jit_load(s, JIT_RDX, JIT_C(instr));
+        jit_guard_number(s, JIT_RDX, pc);
+    }
+    jit_sse_slot(s, 0xF2, 0x10, 0, b); /* movsd xmm0, [b] */
+    if (immediate) {
+        jit_imm_double(s, 1, JIT_CS(instr));
+    } else {
+        jit_sse_slot(s, 0xF2, 0x10, 1, JIT_C(instr)); /* movsd xmm1, [c] */
+    }
+    /* ucomisd leaves CF set for unordered operands, so "above" and
+     * "above or equal" are false when either operand is NaN. */
+    if (swap) {
+        jit_sse_reg(s, 0x66, 0x2E, 1, 0); /* ucomisd xmm1, xmm0 */
+    } else {
+        jit_sse_reg(s, 0x66, 0x2E, 0, 1); /* ucomisd xmm0, xmm1 */
+    }
+    if (eq == 1) {
+        jit_bytes(s, "\x0F\x94\xC0", 3); /* sete al */
+        jit_bytes(s, "\x0F\x9B\xC1", 3); /* setnp cl */
+        jit_bytes(s, "\x20\xC8", 2); /* and al, cl */
+    } else if (eq == 2) {
+        jit_bytes(s, "\x0F\x95\xC0", 3); /* setne al */
+        jit_bytes(s, "\x0F\x9A\xC1", 3); /* setp cl */
+        jit_bytes(s, "\x08\xC8", 2); /* or al, cl */
+    } else {
+        jit_byte(s, 0x0F);
+        jit_byte(s, (uint8_t)(0x90 | cc));
+        jit_byte(s, 0xC0); /* setcc al */
+    }
+    jit_store_boolean(s, JIT_A(instr));
+}
+
+static void jit_arith(JitState *s, uint32_t instr, int32_t pc, uint8_t op, int immediate) {
+    int32_t b = JIT_B(instr);
+    jit_load(s, JIT_RAX, b);
+    jit_guard_number(s, JIT_RAX, pc);
+    if (immediate) {
+        jit_imm_double(s, 1, JIT_CS(instr));
+        jit_sse_slot(s, 0xF2, 0x10, 0, b); /* movsd xmm0, [b] */
+        jit_sse_reg(s, 0xF2, op, 0, 1); /* op xmm0, xmm1 */
+    } else {
+        jit_load(s, JIT_RDX, JIT_C(instr));
+        jit_guard_number(s, JIT_RDX, pc);
+        jit_sse_slot(s, 0xF2, 0x10, 0, b); /* movsd xmm0, [b] */
+        jit_sse_slot(s, 0xF2, op, 0, JIT_C(instr)); /* op xmm0, [c] */
+    }
+    jit_sse_slot(s, 0xF2, 0x11, 0, JIT_A(instr)); /* movsd [a], xmm0 */
+}
+
+/* Jumps on the truthiness of the value in rax. Goes to target if truthy
+ * equals when_truthy, else falls through. */
+static void jit_truthy_branch(JitState *s, int32_t pc, int32_t target, int when_truthy) {
+    jit_tag_compare(s, JANET_NIL);
+    int32_t is_nil = jit_skip(s, JIT_CC_E);
+    jit_bytes(s, "\x81\xFA", 2); /* cmp edx, imm32 */
+    jit_u32(s, (uint32_t) janet_nanbox_lowtag(JANET_BOOLEAN));
+    int32_t not_boolean = jit_skip(s, JIT_CC_NE);
+    jit_bytes(s, "\xA8\x01", 2); /* test al, 1 */
+    if (when_truthy) {
+        int32_t is_false = jit_skip(s, JIT_CC_E);
+        jit_land(s, not_boolean);
+        jit_branch(s, JIT_ALWAYS, pc, target);
+        jit_land(s, is_nil);
+        jit_land(s, is_false);
+    } else {
+        int32_t is_true = jit_skip(s, JIT_CC_NE);
+        jit_land(s, is_nil);
+        jit_branch(s, JIT_ALWAYS, pc, target);
+        jit_land(s, not_boolean);
+        jit_land(s, is_true);
+    }
+}
+
+static int jit_is_compare(uint32_t op) {
+    switch (op) {
+        default:
+            return 0;
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+            return 1;
+        case JOP_LESS_THAN_BRANCH:
+        case JOP_LESS_THAN_EQUAL_BRANCH:
+        case JOP_LESS_THAN_IMMEDIATE_BRANCH:
+        case JOP_GREATER_THAN_BRANCH:
+        case JOP_GREATER_THAN_EQUAL_BRANCH:
+        case JOP_GREATER_THAN_IMMEDIATE_BRANCH:
+        case JOP_EQUALS_IMMEDIATE_BRANCH:
+        case JOP_NOT_EQUALS_IMMEDIATE_BRANCH:
+            return 2;
+    }
+}
+
+/* Emit machine code for one instruction. Returns 0 if the instruction is not
+ * supported, in which case nothing was emitted. */
+static int jit_instruction(JitState *s, JanetFuncDef *def, int32_t pc) {
+    uint32_t instr = def->bytecode[pc];
+    uint32_t op = instr & 0x7F;
+    if (op == JOP_CALL) {
+        /* Save pc in the frame like vm_commit, then exit before the call if
+         * the helper returns 1, or restore from the fiber if it returns 2. */
+        JitLabel slow;
+        slow.count = 0;
+        jit_call_indexed(s, instr, &slow);
+        int32_t done = jit_skip(s, JIT_ALWAYS);
+        jit_place(s, &slow);
+        int32_t disp = (int32_t) offsetof(JanetStackFrame, pc) - JANET_FRAME_SIZE * (int32_t) sizeof(Janet);
+        jit_imm64(s, JIT_RAX, (uint64_t)(uintptr_t)(def->bytecode + pc));
+        jit_bytes(s, "\x48\x89\x43", 3); /* mov [rbx + disp8], rax */
+        jit_byte(s, (uint8_t) disp);
+        jit_helper_invoke(s, jit_call, instr);
+        jit_bytes(s, "\x83\xF8\x01", 3); /* cmp eax, 1 */
+        jit_jump(s, JIT_CC_E, pc, 1);
+        jit_jump(s, JIT_CC_A, def->bytecode_length, 1);
+        jit_land(s, done);
+        return 1;
+    }
+    if (op == JOP_PUSH || op == JOP_PUSH_2 || op == JOP_PUSH_3) {
+        int32_t slots[3];
+        int n = 1;
+        if (op == JOP_PUSH) {
+            slots[0] = JIT_D(instr);
+        } else if (op == JOP_PUSH_2) {
+            slots[0] = JIT_A(instr);
+            slots[1] = JIT_E(instr);
+            n = 2;
+        } else {
+            slots[0] = JIT_A(instr);
+            slots[1] = JIT_B(instr);
+            slots[2] = JIT_C(instr);
+            n = 3;
+        }
+        jit_push(s, slots, n, pc);
+        return 1;
+    }
+    if (jit_indexed_instruction(s, instr, pc)) return 1;
+    JitHelper helper = jit_helper(instr);
+    if (helper) {
+        jit_helper_call(s, helper, instr, pc);
+        return 1;
+    }
+    int compare = jit_is_compare(op);
+    if (compare) {
+        jit_compare(s, instr, pc);
+        if (compare == 2) {
+            /* Take the branch of the following jump straight from al */
+            uint32_t next = def->bytecode[pc + 1];
+            int32_t target = pc + 1 + JIT_ES(next);
+            jit_bytes(s, "\xA8\x01", 2); /* test al, 1 */
+            jit_branch(s, (next & 0x7F) == JOP_JUMP_IF ? JIT_CC_NE : JIT_CC_E, pc + 1, target);
+            jit_jump(s, JIT_ALWAYS, pc + 2, 0);
+        }
+        return 1;
+    }
+    switch (op) {
+        default:
+            return 0;
+        case JOP_NOOP:
+            return 1;
+        case JOP_MOVE_NEAR:
+            jit_load(s, JIT_RAX, JIT_E(instr));
+            jit_store(s, JIT_RAX, JIT_A(instr));
+            return 1;
+        case JOP_MOVE_FAR:
+            jit_load(s, JIT_RAX, JIT_A(instr));
+            jit_store(s, JIT_RAX, JIT_E(instr));
+            return 1;
+        case JOP_LOAD_NIL:
+            jit_imm64(s, JIT_RAX, janet_u64(janet_wrap_nil()));
+            jit_store(s, JIT_RAX, JIT_D(instr));
+            return 1;
+        case JOP_LOAD_TRUE:
+            jit_imm64(s, JIT_RAX, janet_u64(janet_wrap_true()));
+            jit_store(s, JIT_RAX, JIT_D(instr));
+            return 1;
+        case JOP_LOAD_FALSE:
+            jit_imm64(s, JIT_RAX, janet_u64(janet_wrap_false()));
+            jit_store(s, JIT_RAX, JIT_D(instr));
+            return 1;
+        case JOP_LOAD_INTEGER:
+            jit_imm64(s, JIT_RAX, janet_u64(janet_wrap_integer(JIT_ES(instr))));
+            jit_store(s, JIT_RAX, JIT_A(instr));
+            return 1;
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_CONSTANT_PUSH:
+        case JOP_LOAD_CONSTANT_CALL:
+        case JOP_LOAD_CONSTANT_TAILCALL:
+            /* The constant lives as long as the funcdef that owns this code */
+            jit_imm64(s, JIT_RAX, janet_u64(def->constants[JIT_E(instr)]));
+            jit_store(s, JIT_RAX, JIT_A(instr));
+            return 1;
+        case JOP_ADD:
+            jit_arith(s, instr, pc, 0x58, 0);
+            return 1;
+        case JOP_ADD_IMMEDIATE:
+            jit_arith(s, instr, pc, 0x58, 1);
+            return 1;
+        case JOP_SUBTRACT:
+            jit_arith(s, instr, pc, 0x5C, 0);
+            return 1;
+        case JOP_SUBTRACT_IMMEDIATE:
+            jit_arith(s, instr, pc, 0x5C, 1);
+            return 1;
+        case JOP_MULTIPLY:
+            jit_arith(s, instr, pc, 0x59, 0);
+            return 1;
+        case JOP_MULTIPLY_IMMEDIATE:
+            jit_arith(s, instr, pc, 0x59, 1);
+            return 1;
+        case JOP_DIVIDE:
+            jit_arith(s, instr, pc, 0x5E, 0);
+            return 1;
+        case JOP_DIVIDE_IMMEDIATE:
+            jit_arith(s, instr, pc, 0x5E, 1);
+            return 1;
+        case JOP_JUMP:
+            jit_branch(s, JIT_ALWAYS, pc, pc + JIT_DS(instr));
+            return 1;
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+            jit_load(s, JIT_RAX, JIT_A(instr));
+            jit_truthy_branch(s, pc, pc + JIT_ES(instr), op == JOP_JUMP_IF);
+            return 1;
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            jit_load(s, JIT_RAX, JIT_A(instr));
+            jit_tag_compare(s, JANET_NIL);
+            jit_branch(s, op == JOP_JUMP_IF_NIL ? JIT_CC_E : JIT_CC_NE, pc, pc + JIT_ES(instr));
+            return 1;
+    }
+}
+
+/*
+ * Executable memory
+ */
+
+static size_t jit_page_size(void) {
+#ifdef JANET_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t) info.dwPageSize;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t) size : 4096;
+#endif
+}
+
+static uint8_t *jit_map(const uint8_t *code, size_t len, size_t *size_out) {
+    size_t page = jit_page_size();
+    size_t size = (len + page - 1) & ~(page - 1);
+#ifdef JANET_WINDOWS
+    uint8_t *mem = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (NULL == mem) return NULL;
+    memcpy(mem, code, len);
+    DWORD old = 0;
+    if (!VirtualProtect(mem, size, PAGE_EXECUTE_READ, &old)) {
+        VirtualFree(mem, 0, MEM_RELEASE);
+        return NULL;
+    }
+#else
+#if defined(MAP_ANONYMOUS)
+    void *mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#elif defined(MAP_ANON)
+    void *mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+#else
+    void *mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, -1, 0);
+#endif
+    if (MAP_FAILED == mem) return NULL;
+    memcpy(mem, code, len);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) == -1) {
+        munmap(mem, size);
+        return NULL;
+    }
+#endif
+    *size_out = size;
+    return (uint8_t *) mem;
+}
+
+static void jit_unmap(uint8_t *mem, size_t size) {
+#ifdef JANET_WINDOWS
+    (void) size;
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, size);
+#endif
+}
+
+/*
+ * Compiling funcdefs
+ */
+
+/* Each trip into machine code and back costs about as much as interpreting a
+ * few instructions. The interpreter only enters where at least this many
+ * instructions, or a loop, run before the first exit. */
+#ifndef JANET_JIT_MIN_RUN
+#define JANET_JIT_MIN_RUN 8
+#endif
+
+/* How many instructions run natively from each pc, following fallthrough and
+ * forward jumps, up to JANET_JIT_MIN_RUN. A backward jump is a loop, which is
+ * always worth entering. Forward branches are assumed not taken, and calls are
+ * assumed to be made from machine code. */
+static void jit_runs(JanetFuncDef *def, const int32_t *offsets, int32_t *runs) {
+    int32_t len = def->bytecode_length;
+    runs[len] = 0;
+    for (int32_t i = len - 1; i >= 0; i--) {
+        uint32_t instr = def->bytecode[i];
+        int32_t run = 0;
+        if ((instr & 0x7F) == JOP_RETURN || (instr & 0x7F) == JOP_RETURN_NIL) {
+            /* A return finishes a call from machine code */
+            run = 1;
+        } else if (offsets[i]) {
+            int32_t target = i + 1;
+            switch (instr & 0x7F) {
+                case JOP_JUMP:
+                    target = i + JIT_DS(instr);
+                    break;
+                case JOP_JUMP_IF:
+                case JOP_JUMP_IF_NOT:
+                case JOP_JUMP_IF_NIL:
+                case JOP_JUMP_IF_NOT_NIL:
+                    if (JIT_ES(instr) <= 0) target = i + JIT_ES(instr);
+                    break;
+            }
+            if (jit_is_compare(instr & 0x7F) == 2) {
+                /* The jump that follows is part of this instruction */
+                uint32_t next = def->bytecode[i + 1];
+                target = JIT_ES(next) <= 0 ? i + 1 + JIT_ES(next) : i + 2;
+            }
+            run = target <= i ? JANET_JIT_MIN_RUN : 1 + runs[target];
+            if (run > JANET_JIT_MIN_RUN) run = JANET_JIT_MIN_RUN;
+        }
+        runs[i] = run;
+    }
+}
+
+void janet_jit_compile(JanetFuncDef *def) {
+    int32_t len = def->bytecode_length;
+    /* Stay interpreted while there are breakpoints, and check again later */
+    for (int32_t i = 0; i < len; i++) {
+        if (def->bytecode[i] & 0x80) {
+            def->jit_counter = 0;
+            return;
+        }
+    }
+    def->jit_counter = -1;
+
+    JitState s;
+    s.code = NULL;
+    s.fixups = NULL;
+    int32_t *offsets = janet_smalloc(sizeof(int32_t) * (size_t)(len + 1));
+    int32_t *entries = janet_smalloc(sizeof(int32_t) * (size_t)(len + 1));
+    int32_t *stubs = janet_smalloc(sizeof(int32_t) * (size_t)(len + 1));
+
+    /* Prologue. Entered with the stack, the first instruction to run, a
+     * pointer to the interrupt flag, and the fiber. */
+    jit_byte(&s, 0x53); /* push rbx */
+    jit_bytes(&s, "\x41\x54", 2); /* push r12 */
+    jit_bytes(&s, "\x41\x55", 2); /* push r13 */
+    jit_bytes(&s, "\x41\x56", 2); /* push r14 */
+#ifdef JANET_WINDOWS
+    jit_bytes(&s, "\x48\x83\xEC\x28", 4); /* sub rsp, 40 */
+    jit_bytes(&s, "\x48\x89\xCB", 3); /* mov rbx, rcx */
+    jit_bytes(&s, "\x4D\x89\xC4", 3); /* mov r12, r8 */
+    jit_bytes(&s, "\x4D\x89\xCE", 3); /* mov r14, r9 */
+    jit_bytes(&s, "\x49\xBD", 2); /* mov r13, imm64 */
+    jit_u64(&s, janet_nanbox_tag(JANET_NUMBER + 1));
+    jit_bytes(&s, "\xFF\xE2", 2); /* jmp rdx */
+#else
+    jit_bytes(&s, "\x48\x83\xEC\x08", 4); /* sub rsp, 8 */
+    jit_bytes(&s, "\x48\x89\xFB", 3); /* mov rbx, rdi */
+    jit_bytes(&s, "\x49\x89\xD4", 3); /* mov r12, rdx */
+    jit_bytes(&s, "\x49\x89\xCE", 3); /* mov r14, rcx */
+    jit_bytes(&s, "\x49\xBD", 2); /* mov r13, imm64 */
+    jit_u64(&s, janet_nanbox_tag(JANET_NUMBER + 1));
+    jit_bytes(&s, "\xFF\xE6", 2); /* jmp rsi */
+#endif
+
+    for (int32_t i = 0; i < len; i++) {
+        offsets[i] = jit_here(&s);
+        stubs[i] = 0;
+        if (!jit_instruction(&s, def, i)) {
+            offsets[i] = 0;
+            jit_jump(&s, JIT_ALWAYS, i, 1);
+        }
+    }
+    offsets[len] = 0;
+    stubs[len] = 0;
+
+    /* Functions that would mostly bounce between the interpreter and machine
+     * code stay interpreted */
+    int32_t compiled = 0;
+    jit_runs(def, offsets, entries);
+    for (int32_t i = 0; i < len; i++) {
+        if (entries[i] >= JANET_JIT_MIN_RUN) {
+            entries[i] = offsets[i];
+            compiled++;
+        } else {
+            entries[i] = 0;
+        }
+    }
+
+    /* Exits back to the interpreter */
+    int32_t epilogue = 0;
+    for (int32_t i = 0; i < janet_v_count(s.fixups); i++) {
+        JitFixup *fixup = s.fixups + i;
+        if (fixup->exit || !offsets[fixup->pc]) {
+            if (!stubs[fixup->pc]) {
+                stubs[fixup->pc] = jit_here(&s);
+                jit_byte(&s, 0xB8); /* mov eax, imm32 */
+                jit_u32(&s, (uint32_t)(fixup->pc == len ? -1 : fixup->pc));
+                if (epilogue) {
+                    jit_byte(&s, 0xE9); /* jmp rel32 */
+                    jit_u32(&s, (uint32_t)(epilogue - jit_here(&s) - 4));
+                } else {
+                    epilogue = jit_here(&s);
+#ifdef JANET_WINDOWS
+                    jit_bytes(&s, "\x48\x83\xC4\x28", 4); /* add rsp, 40 */
+#else
+                    jit_bytes(&s, "\x48\x83\xC4\x08", 4); /* add rsp, 8 */
+#endif
+                    jit_bytes(&s, "\x41\x5E", 2); /* pop r14 */
+                    jit_bytes(&s, "\x41\x5D", 2); /* pop r13 */
+                    jit_bytes(&s, "\x41\x5C", 2); /* pop r12 */
+                    jit_byte(&s, 0x5B); /* pop rbx */
+                    jit_byte(&s, 0xC3); /* ret */
+                }
+            }
+        }
+    }
+    for (int32_t i = 0; i < janet_v_count(s.fixups); i++) {
+        JitFixup *fixup = s.fixups + i;
+        int32_t dest = (fixup->exit || !offsets[fixup->pc]) ? stubs[fixup->pc] : offsets[fixup->pc];
+        uint32_t rel = (uint32_t)(dest - fixup->at - 4);
+        for (int b = 0; b < 4; b++) s.code[fixup->at + b] = (uint8_t)(rel >> (8 * b));
+    }
+
+    if (compiled) {
+        size_t size = 0;
+        uint8_t *mem = jit_map(s.code, (size_t) janet_v_count(s.code), &size);
+        if (NULL != mem) {
+            JanetJit *jit = janet_malloc(sizeof(JanetJit) + sizeof(int32_t) * (size_t) len);
+            if (NULL == jit) {
+                JANET_OUT_OF_MEMORY;
+            }
+            jit->code = mem;
+            jit->size = size;
+            jit->next = NULL;
+            memcpy(jit->entries, entries, sizeof(int32_t) * (size_t) len);
+            def->jit = jit;
+        }
+    }
+
+    janet_sfree(offsets);
+    janet_sfree(entries);
+    janet_sfree(stubs);
+    janet_v_free(s.code);
+    janet_v_free(s.fixups);
+}
+
+int32_t janet_jit_run(JanetJit *jit, Janet *stack, int32_t pc) {
+    JitFn fn = (JitFn)(void *) jit->code;
+    return fn(stack, jit->code + jit->entries[pc], &janet_vm.auto_suspend, janet_vm.fiber);
+}
+
+void janet_jit_free(JanetFuncDef *def) {
+    JanetJit *jit = def->jit;
+    if (NULL != jit) {
+        jit_unmap(jit->code, jit->size);
+        janet_free(jit);
+        def->jit = NULL;
+    }
+}
+
+/* Go back to interpreting a function, for example because its bytecode has
+ * changed. It may be compiled again once it is hot. The old code can be below
+ * a C function that machine code called, so it is only unmapped on deinit. */
+void janet_jit_invalidate(JanetFuncDef *def) {
+    JanetJit *jit = def->jit;
+    if (NULL != jit) {
+        jit->next = janet_vm.jit_retired;
+        janet_vm.jit_retired = jit;
+        def->jit = NULL;
+    }
+    def->jit_counter = 0;
+}
+
+void janet_jit_deinit(void) {
+    JanetJit *jit = janet_vm.jit_retired;
+    while (NULL != jit) {
+        JanetJit *next = jit->next;
+        jit_unmap(jit->code, jit->size);
+        janet_free(jit);
+        jit = next;
+    }
+    janet_vm.jit_retired = NULL;
+}
+
+#endif
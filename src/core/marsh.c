@@ -28,18 +28,129 @@
 #include "gc.h"
 #include "fiber.h"
 #include "util.h"
+#include "symcache.h"
 #endif
 
+#if defined(JANET_LAZY_IMAGE) && !defined(JANET_WINDOWS)
+#define JANET_IMAGE_MMAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Map from values that were already marshalled to their reference ids.
+ * Reference types are compared by identity, which skips the generic
+ * janet_hash and janet_equals that a JanetTable would use. Numbers, strings,
+ * tuples, structs and abstract types still compare by value, so equal values
+ * share one reference as before. */
+typedef struct {
+    Janet key;
+    int32_t hash;
+    int32_t id; /* -1 for an empty slot */
+} MarshalSeenSlot;
+
+typedef struct {
+    MarshalSeenSlot *slots;
+    int32_t capacity;
+    int32_t count;
+} MarshalSeen;
+
 typedef struct {
     JanetBuffer *buf;
-    JanetTable seen;
+    MarshalSeen seen;
     JanetTable *rreg;
-    JanetFuncEnv **seen_envs;
-    JanetFuncDef **seen_defs;
+    MarshalSeen seen_envs;
+    MarshalSeen seen_defs;
     int32_t nextid;
     int maybe_cycles;
+    int collect_threaded;
+    void **threaded;
 } MarshalState;
 
+static int seen_by_identity(Janet x) {
+    switch (janet_type(x)) {
+        case JANET_NUMBER:
+        case JANET_STRING:
+        case JANET_TUPLE:
+        case JANET_STRUCT:
+        case JANET_ABSTRACT:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static int32_t seen_hash(Janet x) {
+    if (!seen_by_identity(x)) return janet_hash(x);
+    uint64_t h = (uint64_t)(uintptr_t) janet_unwrap_pointer(x);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (int32_t) h;
+}
+
+static void seen_init(MarshalSeen *seen) {
+    seen->slots = NULL;
+    seen->capacity = 0;
+    seen->count = 0;
+}
+
+static void seen_deinit(MarshalSeen *seen) {
+    janet_sfree(seen->slots);
+}
+
+static MarshalSeenSlot *seen_find(MarshalSeenSlot *slots, int32_t capacity, Janet x, int32_t hash) {
+    uint32_t mask = (uint32_t) capacity - 1;
+    uint32_t i = (uint32_t) hash & mask;
+    int identity = seen_by_identity(x);
+    for (;;) {
+        MarshalSeenSlot *slot = slots + i;
+        if (slot->id < 0) return slot;
+        if (slot->hash == hash && janet_type(slot->key) == janet_type(x)) {
+            if (identity
+                    ? janet_unwrap_pointer(slot->key) == janet_unwrap_pointer(x)
+                    : janet_equals(slot->key, x)) {
+                return slot;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+/* Get the reference id of a value, or -1 if not seen */
+static int32_t seen_get(MarshalSeen *seen, Janet x) {
+    if (!seen->count) return -1;
+    return seen_find(seen->slots, seen->capacity, x, seen_hash(x))->id;
+}
+
+static void seen_put(MarshalSeen *seen, Janet x, int32_t id) {
+    /* Like tables, never match NaN */
+    if (janet_checktype(x, JANET_NUMBER) && isnan(janet_unwrap_number(x))) return;
+    if (2 * (seen->count + 1) > seen->capacity) {
+        int32_t newcap = seen->capacity ? 2 * seen->capacity : 64;
+        MarshalSeenSlot *slots = janet_smalloc(sizeof(MarshalSeenSlot) * newcap);
+        for (int32_t i = 0; i < newcap; i++) slots[i].id = -1;
+        for (int32_t i = 0; i < seen->capacity; i++) {
+            MarshalSeenSlot *old = seen->slots + i;
+            if (old->id < 0) continue;
+            *seen_find(slots, newcap, old->key, old->hash) = *old;
+        }
+        janet_sfree(seen->slots);
+        seen->slots = slots;
+        seen->capacity = newcap;
+    }
+    int32_t hash = seen_hash(x);
+    MarshalSeenSlot *slot = seen_find(seen->slots, seen->capacity, x, hash);
+    if (slot->id < 0) {
+        slot->key = x;
+        slot->hash = hash;
+        seen->count++;
+    }
+    slot->id = id;
+}
+
 /* Lead bytes in marshaling protocol */
 enum {
     LB_REAL = 200,
@@ -77,6 +188,9 @@ enum {
     LB_TABLE_WEAKV_PROTO, /* 230 */
     LB_TABLE_WEAKKV_PROTO, /* 231 */
     LB_ARRAY_WEAK, /* 232 */
+    LB_FUNCDEF_LAZY, /* 233 */
+    LB_SYMBOL_POOLED, /* 234 */
+    LB_KEYWORD_POOLED, /* 235 */
 } LeadBytes;
 
 /* Helper to look inside an entry in an environment */
@@ -187,6 +301,7 @@ static void push64(MarshalState *st, uint64_t x) {
 static void marshal_one(MarshalState *st, Janet x, int flags);
 static void marshal_one_fiber(MarshalState *st, JanetFiber *fiber, int flags);
 static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags);
+static void marshal_one_def_lazy(MarshalState *st, JanetFuncDef *def, int flags);
 static void marshal_one_env(MarshalState *st, JanetFuncEnv *env, int flags);
 
 /* Prevent stack overflows */
@@ -208,15 +323,14 @@ static int fiber_cannot_be_marshalled(JanetFiber *fiber) {
 /* Marshal a function env */
 static void marshal_one_env(MarshalState *st, JanetFuncEnv *env, int flags) {
     MARSH_STACKCHECK;
-    for (int32_t i = 0; i < janet_v_count(st->seen_envs); i++) {
-        if (st->seen_envs[i] == env) {
-            pushbyte(st, LB_FUNCENV_REF);
-            pushint(st, i);
-            return;
-        }
+    int32_t index = seen_get(&st->seen_envs, janet_wrap_pointer(env));
+    if (index >= 0) {
+        pushbyte(st, LB_FUNCENV_REF);
+        pushint(st, index);
+        return;
     }
     janet_env_valid(env);
-    janet_v_push(st->seen_envs, env);
+    seen_put(&st->seen_envs, janet_wrap_pointer(env), st->seen_envs.count);
 
     /* Special case for early detachment */
     if (env->offset > 0 && fiber_cannot_be_marshalled(env->as.fiber)) {
@@ -256,18 +370,83 @@ static void janet_marshal_u32s(MarshalState *st, const uint32_t *u32s, int32_t n
     }
 }
 
+/* Marshal a function def so that its bytecode, symbol map, source map and closure
+ * bitset can be decoded on first use. Everything the garbage collector or closure
+ * creation needs is written up front, followed by the byte length of the body. */
+static void marshal_one_def_lazy(MarshalState *st, JanetFuncDef *def, int flags) {
+    pushbyte(st, LB_FUNCDEF_LAZY);
+    pushint(st, def->flags);
+    pushint(st, def->slotcount);
+    pushint(st, def->arity);
+    pushint(st, def->min_arity);
+    pushint(st, def->max_arity);
+    pushint(st, def->constants_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASENVS)
+        pushint(st, def->environments_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
+        pushint(st, def->defs_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASNAME)
+        marshal_one(st, janet_wrap_string(def->name), flags);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCE)
+        marshal_one(st, janet_wrap_string(def->source), flags);
+    for (int32_t i = 0; i < def->constants_length; i++)
+        marshal_one(st, def->constants[i], flags + 1);
+    for (int32_t i = 0; i < def->environments_length; i++)
+        pushint(st, def->environments[i]);
+    for (int32_t i = 0; i < def->defs_length; i++)
+        marshal_one_def(st, def->defs[i], flags + 1);
+
+    /* The body holds no references, so it can be decoded on its own. Symbols
+     * are written inline. */
+    JanetBuffer *outer = st->buf;
+    JanetBuffer body;
+    janet_buffer_init(&body, 4 * def->bytecode_length + 16);
+    st->buf = &body;
+    pushint(st, def->bytecode_length);
+    pushint(st, def->symbolmap_length);
+    for (int32_t i = 0; i < def->symbolmap_length; i++) {
+        const uint8_t *sym = def->symbolmap[i].symbol;
+        pushint(st, (int32_t) def->symbolmap[i].birth_pc);
+        pushint(st, (int32_t) def->symbolmap[i].death_pc);
+        pushint(st, (int32_t) def->symbolmap[i].slot_index);
+        pushint(st, janet_string_length(sym));
+        pushbytes(st, sym, janet_string_length(sym));
+    }
+    janet_marshal_u32s(st, def->bytecode, def->bytecode_length);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
+        int32_t current = 0;
+        for (int32_t i = 0; i < def->bytecode_length; i++) {
+            JanetSourceMapping map = def->sourcemap[i];
+            pushint(st, map.line - current);
+            pushint(st, map.column);
+            current = map.line;
+        }
+    }
+    if (def->flags & JANET_FUNCDEF_FLAG_HASCLOBITSET) {
+        janet_marshal_u32s(st, def->closure_bitset, ((def->slotcount + 31) >> 5));
+    }
+    st->buf = outer;
+    push64(st, (uint64_t) body.count);
+    pushbytes(st, body.data, body.count);
+    janet_buffer_deinit(&body);
+}
+
 /* Marshal a function def */
 static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     MARSH_STACKCHECK;
-    for (int32_t i = 0; i < janet_v_count(st->seen_defs); i++) {
-        if (st->seen_defs[i] == def) {
-            pushbyte(st, LB_FUNCDEF_REF);
-            pushint(st, i);
-            return;
-        }
+    int32_t index = seen_get(&st->seen_defs, janet_wrap_pointer(def));
+    if (index >= 0) {
+        pushbyte(st, LB_FUNCDEF_REF);
+        pushint(st, index);
+        return;
     }
     /* Add to lookup */
-    janet_v_push(st->seen_defs, def);
+    seen_put(&st->seen_defs, janet_wrap_pointer(def), st->seen_defs.count);
+    janet_funcdef_ensure(def);
+    if (flags & JANET_MARSHAL_LAZY) {
+        marshal_one_def_lazy(st, def, flags);
+        return;
+    }
 
     pushint(st, def->flags);
     pushint(st, def->slotcount);
@@ -413,15 +592,14 @@ void janet_marshal_janet(JanetMarshalContext *ctx, Janet x) {
 #ifdef JANET_MARSHAL_DEBUG
 #define MARK_SEEN() \
     do { if (st->maybe_cycles) { \
-        Janet _check = janet_table_get(&st->seen, x); \
-        if (!janet_checktype(_check, JANET_NIL)) janet_eprintf("double MARK_SEEN on %v\n", x); \
+        if (seen_get(&st->seen, x) >= 0) janet_eprintf("double MARK_SEEN on %v\n", x); \
         janet_eprintf("made reference %d (%t) to %v\n", st->nextid, x, x); \
-        janet_table_put(&st->seen, x, janet_wrap_integer(st->nextid++)); \
+        seen_put(&st->seen, x, st->nextid++); \
     } } while (0)
 #else
 #define MARK_SEEN() \
     do { if (st->maybe_cycles) { \
-        janet_table_put(&st->seen, x, janet_wrap_integer(st->nextid++)); \
+        seen_put(&st->seen, x, st->nextid++); \
     } } while (0)
 #endif
 
@@ -442,6 +620,7 @@ static void marshal_one_abstract(MarshalState *st, Janet x, int flags) {
          * where a message is garbage collected while in transit between two threads - i.e., the sending threads
          * loses the reference and runs a garbage collection before the receiving thread gets the message. */
         janet_abstract_incref(abstract);
+        if (st->collect_threaded) janet_v_push(st->threaded, abstract);
         pushbyte(st, LB_THREADED_ABSTRACT);
         pushbytes(st, (uint8_t *) &abstract, sizeof(abstract));
         MARK_SEEN();
@@ -487,17 +666,16 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
 
     /* Check reference and registry value */
     {
-        Janet check;
         if (st->maybe_cycles) {
-            check = janet_table_get(&st->seen, x);
-            if (janet_checkint(check)) {
+            int32_t id = seen_get(&st->seen, x);
+            if (id >= 0) {
                 pushbyte(st, LB_REFERENCE);
-                pushint(st, janet_unwrap_integer(check));
+                pushint(st, id);
                 return;
             }
         }
         if (st->rreg) {
-            check = janet_table_get(st->rreg, x);
+            Janet check = janet_table_get(st->rreg, x);
             if (janet_checktype(check, JANET_SYMBOL)) {
                 MARK_SEEN();
                 const uint8_t *regname = janet_unwrap_symbol(check);
@@ -545,6 +723,19 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
             int32_t length = janet_string_length(str);
             /* Record reference */
             MARK_SEEN();
+#ifdef JANET_SYMBOL_POOL
+            /* Symbols shared by all threads are sent with their slot in the pool */
+            if ((flags & JANET_MARSHAL_UNSAFE) && type != JANET_STRING) {
+                int32_t index = janet_symbol_pool_index(str);
+                if (index >= 0) {
+                    pushbyte(st, (type == JANET_SYMBOL) ? LB_SYMBOL_POOLED : LB_KEYWORD_POOLED);
+                    pushint(st, index);
+                    pushint(st, length);
+                    pushbytes(st, str, length);
+                    return;
+                }
+            }
+#endif
             uint8_t lb = (type == JANET_STRING) ? LB_STRING :
                          (type == JANET_SYMBOL) ? LB_SYMBOL :
                          LB_KEYWORD;
@@ -683,23 +874,54 @@ static void marshal_one(MarshalState *st, Janet x, int flags) {
 #undef MARK_SEEN
 }
 
-void janet_marshal(
+static void marshal_collecting(
     JanetBuffer *buf,
     Janet x,
     JanetTable *rreg,
-    int flags) {
+    int flags,
+    void ***threaded,
+    int32_t *threaded_count) {
     MarshalState st;
     st.buf = buf;
     st.nextid = 0;
-    st.seen_defs = NULL;
-    st.seen_envs = NULL;
     st.rreg = rreg;
     st.maybe_cycles = !(flags & JANET_MARSHAL_NO_CYCLES);
-    janet_table_init(&st.seen, 0);
+    st.collect_threaded = NULL != threaded;
+    st.threaded = NULL;
+    seen_init(&st.seen);
+    seen_init(&st.seen_envs);
+    seen_init(&st.seen_defs);
     marshal_one(&st, x, flags);
-    janet_table_deinit(&st.seen);
-    janet_v_free(st.seen_envs);
-    janet_v_free(st.seen_defs);
+    seen_deinit(&st.seen);
+    seen_deinit(&st.seen_envs);
+    seen_deinit(&st.seen_defs);
+    if (NULL != threaded) {
+        *threaded_count = janet_v_count(st.threaded);
+        *threaded = janet_v_flatten(st.threaded);
+        janet_v_free(st.threaded);
+    }
+}
+
+void janet_marshal(
+    JanetBuffer *buf,
+    Janet x,
+    JanetTable *rreg,
+    int flags) {
+    marshal_collecting(buf, x, rreg, flags, NULL, NULL);
+}
+
+/* Marshal a value and also return the threaded abstract types that were written,
+ * each still holding the reference taken for the marshalled bytes. The returned
+ * array is allocated with janet_malloc, or NULL if there were none. */
+void **janet_marshal_threaded(
+    JanetBuffer *buf,
+    Janet x,
+    JanetTable *rreg,
+    int flags,
+    int32_t *count) {
+    void **threaded = NULL;
+    marshal_collecting(buf, x, rreg, flags, &threaded, count);
+    return threaded;
 }
 
 typedef struct {
@@ -710,6 +932,10 @@ typedef struct {
     JanetFuncDef **lookup_defs;
     const uint8_t *start;
     const uint8_t *end;
+#ifdef JANET_LAZY_IMAGE
+    Janet owner; /* Keeps the bytes alive for deferred funcdef bodies */
+    int lazy;
+#endif
 } UnmarshalState;
 
 #define MARSH_EOS(st, data) do { \
@@ -883,6 +1109,335 @@ static const uint8_t *janet_unmarshal_u32s(UnmarshalState *st, const uint8_t *da
     return data;
 }
 
+#ifdef JANET_LAZY_IMAGE
+
+/* Funcdefs with deferred bodies are kept in a map keyed on the def, with linear
+ * probing so that entries can be removed without tombstones. */
+static uint32_t lazy_defs_hash(JanetFuncDef *def) {
+    uint64_t h = (uint64_t)(uintptr_t) def;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+static JanetLazyDef *lazy_defs_find(JanetLazyDef *slots, uint32_t capacity, JanetFuncDef *def) {
+    uint32_t mask = capacity - 1;
+    uint32_t i = lazy_defs_hash(def) & mask;
+    while (slots[i].def != NULL && slots[i].def != def) {
+        i = (i + 1) & mask;
+    }
+    return slots + i;
+}
+
+static JanetLazyDef *lazy_defs_insert(JanetFuncDef *def) {
+    if (2 * (janet_vm.lazy_defs_count + 1) > janet_vm.lazy_defs_capacity) {
+        uint32_t newcap = janet_vm.lazy_defs_capacity ? 2 * janet_vm.lazy_defs_capacity : 256;
+        JanetLazyDef *slots = janet_malloc(sizeof(JanetLazyDef) * newcap);
+        if (NULL == slots) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (uint32_t i = 0; i < newcap; i++) slots[i].def = NULL;
+        for (uint32_t i = 0; i < janet_vm.lazy_defs_capacity; i++) {
+            JanetLazyDef *old = janet_vm.lazy_defs + i;
+            if (old->def) *lazy_defs_find(slots, newcap, old->def) = *old;
+        }
+        janet_free(janet_vm.lazy_defs);
+        janet_vm.lazy_defs = slots;
+        janet_vm.lazy_defs_capacity = newcap;
+    }
+    JanetLazyDef *slot = lazy_defs_find(janet_vm.lazy_defs, janet_vm.lazy_defs_capacity, def);
+    if (NULL == slot->def) janet_vm.lazy_defs_count++;
+    slot->def = def;
+    slot->owner = janet_wrap_nil();
+    slot->body = NULL;
+    slot->len = 0;
+    return slot;
+}
+
+Janet janet_funcdef_lazy_owner(JanetFuncDef *def) {
+    if (!janet_vm.lazy_defs_count) return janet_wrap_nil();
+    return lazy_defs_find(janet_vm.lazy_defs, janet_vm.lazy_defs_capacity, def)->owner;
+}
+
+void janet_funcdef_lazy_forget(JanetFuncDef *def) {
+    if (!janet_vm.lazy_defs_count) return;
+    JanetLazyDef *slots = janet_vm.lazy_defs;
+    uint32_t mask = janet_vm.lazy_defs_capacity - 1;
+    uint32_t i = (uint32_t)(lazy_defs_find(slots, janet_vm.lazy_defs_capacity, def) - slots);
+    if (NULL == slots[i].def) return;
+    janet_vm.lazy_defs_count--;
+    /* Shift back later entries of the probe sequence into the hole */
+    for (uint32_t j = i;;) {
+        slots[i].def = NULL;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (NULL == slots[j].def) return;
+            uint32_t home = lazy_defs_hash(slots[j].def) & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) break;
+        }
+        slots[i] = slots[j];
+        i = j;
+    }
+}
+
+void janet_lazy_defs_deinit(void) {
+    janet_free(janet_vm.lazy_defs);
+    janet_vm.lazy_defs = NULL;
+    janet_vm.lazy_defs_count = 0;
+    janet_vm.lazy_defs_capacity = 0;
+}
+
+#endif
+
+/* Allocate a funcdef with values that will not break garbage collection
+ * if unmarshalling fails. */
+static JanetFuncDef *unmarshal_def_alloc(UnmarshalState *st) {
+    JanetFuncDef *def = janet_gcalloc(JANET_MEMORY_FUNCDEF, sizeof(JanetFuncDef));
+    def->flags = 0;
+    def->environments_length = 0;
+    def->defs_length = 0;
+    def->constants_length = 0;
+    def->bytecode_length = 0;
+    def->name = NULL;
+    def->source = NULL;
+    def->closure_bitset = NULL;
+    def->defs = NULL;
+    def->environments = NULL;
+    def->constants = NULL;
+    def->bytecode = NULL;
+    def->sourcemap = NULL;
+    def->symbolmap = NULL;
+    def->symbolmap_length = 0;
+#ifdef JANET_JIT
+    def->jit = NULL;
+    def->jit_counter = 0;
+#endif
+    janet_v_push(st->lookup_defs, def);
+    return def;
+}
+
+/* Unmarshal the name, source, constants, environments and sub funcdefs that
+ * follow the fixed fields of a funcdef, in the order of the lazy format. */
+static const uint8_t *unmarshal_def_header(
+    UnmarshalState *st,
+    const uint8_t *data,
+    JanetFuncDef *def,
+    int32_t constants_length,
+    int32_t environments_length,
+    int32_t defs_length,
+    int flags) {
+    if (def->flags & JANET_FUNCDEF_FLAG_HASNAME) {
+        Janet x;
+        data = unmarshal_one(st, data, &x, flags + 1);
+        janet_asserttype(x, JANET_STRING, st);
+        def->name = janet_unwrap_string(x);
+    }
+    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCE) {
+        Janet x;
+        data = unmarshal_one(st, data, &x, flags + 1);
+        janet_asserttype(x, JANET_STRING, st);
+        def->source = janet_unwrap_string(x);
+    }
+    if (constants_length) {
+        def->constants = janet_malloc(sizeof(Janet) * constants_length);
+        if (!def->constants) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < constants_length; i++)
+            data = unmarshal_one(st, data, def->constants + i, flags + 1);
+    }
+    def->constants_length = constants_length;
+    if (def->flags & JANET_FUNCDEF_FLAG_HASENVS) {
+        def->environments = janet_calloc(1, sizeof(int32_t) * (size_t) environments_length);
+        if (!def->environments) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < environments_length; i++) {
+            def->environments[i] = readint(st, &data);
+        }
+    }
+    def->environments_length = environments_length;
+    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS) {
+        def->defs = janet_calloc(1, sizeof(JanetFuncDef *) * (size_t) defs_length);
+        if (!def->defs) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < defs_length; i++) {
+            data = unmarshal_one_def(st, data, def->defs + i, flags + 1);
+        }
+    }
+    def->defs_length = defs_length;
+    return data;
+}
+
+/* Unmarshal the body of a funcdef written by marshal_one_def_lazy. The body
+ * spans all of st, and has no references into the rest of the image. */
+static void unmarshal_def_body(UnmarshalState *st, JanetFuncDef *def) {
+    const uint8_t *data = st->start;
+
+    /* A previous attempt may have failed part way */
+    janet_free(def->bytecode);
+    janet_free(def->symbolmap);
+    janet_free(def->sourcemap);
+    janet_free(def->closure_bitset);
+    def->bytecode = NULL;
+    def->symbolmap = NULL;
+    def->sourcemap = NULL;
+    def->closure_bitset = NULL;
+    def->bytecode_length = 0;
+    def->symbolmap_length = 0;
+
+    int32_t bytecode_length = readnat(st, &data);
+    int32_t symbolmap_length = readnat(st, &data);
+    if (symbolmap_length) {
+        def->symbolmap = janet_malloc(sizeof(JanetSymbolMap) * (size_t) symbolmap_length);
+        if (NULL == def->symbolmap) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < symbolmap_length; i++) {
+            def->symbolmap[i].birth_pc = (uint32_t) readint(st, &data);
+            def->symbolmap[i].death_pc = (uint32_t) readint(st, &data);
+            def->symbolmap[i].slot_index = (uint32_t) readint(st, &data);
+            int32_t len = readnat(st, &data);
+            if (len > st->end - data) janet_panic("unexpected end of source");
+            def->symbolmap[i].symbol = janet_symbol(data, len);
+            def->symbolmap_length = (uint32_t) i + 1;
+            data += len;
+        }
+    }
+    def->bytecode = janet_malloc(sizeof(uint32_t) * (size_t) bytecode_length);
+    if (!def->bytecode) {
+        JANET_OUT_OF_MEMORY;
+    }
+    data = janet_unmarshal_u32s(st, data, def->bytecode, bytecode_length);
+    def->bytecode_length = bytecode_length;
+    if (def->flags & JANET_FUNCDEF_FLAG_HASSOURCEMAP) {
+        int32_t current = 0;
+        def->sourcemap = janet_malloc(sizeof(JanetSourceMapping) * (size_t) bytecode_length);
+        if (!def->sourcemap) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < bytecode_length; i++) {
+            current += readint(st, &data);
+            def->sourcemap[i].line = current;
+            def->sourcemap[i].column = readint(st, &data);
+        }
+    }
+    if (def->flags & JANET_FUNCDEF_FLAG_HASCLOBITSET) {
+        int32_t n = (def->slotcount + 31) >> 5;
+        def->closure_bitset = janet_malloc(sizeof(uint32_t) * (size_t) n);
+        if (NULL == def->closure_bitset) {
+            JANET_OUT_OF_MEMORY;
+        }
+        data = janet_unmarshal_u32s(st, data, def->closure_bitset, n);
+    }
+    if (data != st->end) {
+        janet_panic("funcdef body has trailing bytes");
+    }
+    if (janet_verify(def))
+        janet_panic("funcdef has invalid bytecode");
+}
+
+#if defined(JANET_LAZY_IMAGE) && defined(JANET_SYMBOL_POOL)
+/* Intern the names in the symbol map at the front of a deferred body. While the
+ * core environment is loaded this puts them in the shared symbol pool, which is
+ * frozen by the time the body is decoded. */
+static void unmarshal_def_body_symbols(UnmarshalState *st, const uint8_t *data, const uint8_t *end) {
+    readnat(st, &data);
+    int32_t symbolmap_length = readnat(st, &data);
+    for (int32_t i = 0; i < symbolmap_length; i++) {
+        readint(st, &data);
+        readint(st, &data);
+        readint(st, &data);
+        int32_t len = readnat(st, &data);
+        if (len > end - data) janet_panic("unexpected end of source");
+        janet_symbol(data, len);
+        data += len;
+    }
+}
+#endif
+
+/* Unmarshal a funcdef in the lazy format. The body is decoded right away
+ * unless the unmarshalling was asked to defer it. */
+static const uint8_t *unmarshal_one_def_lazy(
+    UnmarshalState *st,
+    const uint8_t *data,
+    JanetFuncDef **out,
+    int flags) {
+    JanetFuncDef *def = unmarshal_def_alloc(st);
+    int32_t environments_length = 0;
+    int32_t defs_length = 0;
+    def->flags = readint(st, &data) & ~JANET_FUNCDEF_FLAG_LAZY;
+    def->slotcount = readnat(st, &data);
+    def->arity = readnat(st, &data);
+    def->min_arity = readnat(st, &data);
+    def->max_arity = readnat(st, &data);
+    int32_t constants_length = readnat(st, &data);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASENVS)
+        environments_length = readnat(st, &data);
+    if (def->flags & JANET_FUNCDEF_FLAG_HASDEFS)
+        defs_length = readnat(st, &data);
+    data = unmarshal_def_header(st, data, def, constants_length,
+                                environments_length, defs_length, flags);
+    uint64_t len = read64(st, &data);
+    if (len > (uint64_t)(st->end - data)) janet_panic("unexpected end of source");
+#ifdef JANET_LAZY_IMAGE
+    if (st->lazy) {
+        JanetLazyDef *slot = lazy_defs_insert(def);
+        slot->owner = st->owner;
+        slot->body = data;
+        slot->len = (size_t) len;
+        def->flags |= JANET_FUNCDEF_FLAG_LAZY;
+#ifdef JANET_SYMBOL_POOL
+        if (janet_vm.symbol_pool_building) {
+            unmarshal_def_body_symbols(st, data, data + len);
+        }
+#endif
+        *out = def;
+        return data + len;
+    }
+#endif
+    UnmarshalState body;
+    body.start = data;
+    body.end = data + len;
+    body.lookup = NULL;
+    body.lookup_envs = NULL;
+    body.lookup_defs = NULL;
+    body.reg = NULL;
+#ifdef JANET_LAZY_IMAGE
+    body.owner = janet_wrap_nil();
+    body.lazy = 0;
+#endif
+    unmarshal_def_body(&body, def);
+    *out = def;
+    return data + len;
+}
+
+#ifdef JANET_LAZY_IMAGE
+void janet_funcdef_materialize(JanetFuncDef *def) {
+    JanetLazyDef *slot = NULL;
+    if (janet_vm.lazy_defs_count)
+        slot = lazy_defs_find(janet_vm.lazy_defs, janet_vm.lazy_defs_capacity, def);
+    if (NULL == slot || NULL == slot->def)
+        janet_panic("funcdef body is missing");
+    UnmarshalState body;
+    body.start = slot->body;
+    body.end = slot->body + slot->len;
+    body.lookup = NULL;
+    body.lookup_envs = NULL;
+    body.lookup_defs = NULL;
+    body.reg = NULL;
+    body.owner = janet_wrap_nil();
+    body.lazy = 0;
+    unmarshal_def_body(&body, def);
+    def->flags &= ~JANET_FUNCDEF_FLAG_LAZY;
+    janet_funcdef_lazy_forget(def);
+    /* The symbol map may reference new symbols */
+    janet_gc_barrier(def);
+}
+#endif
+
 /* Unmarshal a funcdef */
 static const uint8_t *unmarshal_one_def(
     UnmarshalState *st,
@@ -896,25 +1451,10 @@ static const uint8_t *unmarshal_one_def(
         if (index < 0 || index >= janet_v_count(st->lookup_defs))
             janet_panicf("invalid funcdef reference %d", index);
         *out = st->lookup_defs[index];
+    } else if (*data == LB_FUNCDEF_LAZY) {
+        data = unmarshal_one_def_lazy(st, data + 1, out, flags);
     } else {
-        /* Initialize with values that will not break garbage collection
-         * if unmarshalling fails. */
-        JanetFuncDef *def = janet_gcalloc(JANET_MEMORY_FUNCDEF, sizeof(JanetFuncDef));
-        def->environments_length = 0;
-        def->defs_length = 0;
-        def->constants_length = 0;
-        def->bytecode_length = 0;
-        def->name = NULL;
-        def->source = NULL;
-        def->closure_bitset = NULL;
-        def->defs = NULL;
-        def->environments = NULL;
-        def->constants = NULL;
-        def->bytecode = NULL;
-        def->sourcemap = NULL;
-        def->symbolmap = NULL;
-        def->symbolmap_length = 0;
-        janet_v_push(st->lookup_defs, def);
+        JanetFuncDef *def = unmarshal_def_alloc(st);
 
         /* Set default lengths to zero */
         int32_t bytecode_length = 0;
@@ -924,7 +1464,7 @@ static const uint8_t *unmarshal_one_def(
         int32_t symbolmap_length = 0;
 
         /* Read flags and other fixed values */
-        def->flags = readint(st, &data);
+        def->flags = readint(st, &data) & ~JANET_FUNCDEF_FLAG_LAZY;
         def->slotcount = readnat(st, &data);
         def->arity = readnat(st, &data);
         def->min_arity = readnat(st, &data);
@@ -1085,6 +1625,8 @@ static const uint8_t *unmarshal_one_fiber(
     fiber->ev_state = NULL;
     fiber->ev_callback = NULL;
     fiber->ev_stream = NULL;
+    fiber->ev_timeout = NULL;
+    fiber->ev_request = NULL;
 #endif
 
     /* Push fiber to seen stack */
@@ -1144,6 +1686,7 @@ static const uint8_t *unmarshal_one_fiber(
         }
 
         /* Error checking */
+        janet_funcdef_ensure(def);
         int32_t expected_framesize = def->slotcount;
         if (expected_framesize != stacktop - stack) {
             janet_panic("fiber stackframe size mismatch");
@@ -1541,6 +2084,23 @@ static const uint8_t *unmarshal_one(
             janet_v_push(st->lookup, *out);
             return data;
         }
+        case LB_SYMBOL_POOLED:
+        case LB_KEYWORD_POOLED: {
+            /* The slot is only a hint, the bytes are checked against it */
+            data++;
+            int32_t index = readnat(st, &data);
+            int32_t len = readnat(st, &data);
+            MARSH_EOS(st, data - 1 + len);
+#ifdef JANET_SYMBOL_POOL
+            const uint8_t *str = janet_symbol_pooled(index, data, len);
+#else
+            (void) index;
+            const uint8_t *str = janet_symbol(data, len);
+#endif
+            *out = (lead == LB_SYMBOL_POOLED) ? janet_wrap_symbol(str) : janet_wrap_keyword(str);
+            janet_v_push(st->lookup, *out);
+            return data + len;
+        }
 #ifdef JANET_EV
         case LB_POINTER_BUFFER: {
             data++;
@@ -1598,6 +2158,10 @@ static const uint8_t *unmarshal_one(
             memcpy(u.bytes, data, sizeof(void *));
             data += sizeof(void *);
 
+            if (flags & JANET_MARSHAL_INCREF) {
+                /* The bytes keep their own reference, so take a new one for this heap */
+                janet_abstract_incref(u.ptr);
+            }
             if (flags & JANET_MARSHAL_DECREF) {
                 /* Decrement immediately and don't bother putting into heap */
                 janet_abstract_decref(u.ptr);
@@ -1627,12 +2191,13 @@ static const uint8_t *unmarshal_one(
     }
 }
 
-Janet janet_unmarshal(
+static Janet unmarshal_owned(
     const uint8_t *bytes,
     size_t len,
     int flags,
     JanetTable *reg,
-    const uint8_t **next) {
+    const uint8_t **next,
+    Janet owner) {
     UnmarshalState st;
     st.start = bytes;
     st.end = bytes + len;
@@ -1640,6 +2205,12 @@ Janet janet_unmarshal(
     st.lookup_envs = NULL;
     st.lookup = NULL;
     st.reg = reg;
+#ifdef JANET_LAZY_IMAGE
+    st.owner = owner;
+    st.lazy = !!(flags & JANET_MARSHAL_LAZY);
+#else
+    (void) owner;
+#endif
     Janet out;
     const uint8_t *nextbytes = unmarshal_one(&st, bytes, &out, flags);
     if (next) *next = nextbytes;
@@ -1649,6 +2220,15 @@ Janet janet_unmarshal(
     return out;
 }
 
+Janet janet_unmarshal(
+    const uint8_t *bytes,
+    size_t len,
+    int flags,
+    JanetTable *reg,
+    const uint8_t **next) {
+    return unmarshal_owned(bytes, len, flags, reg, next, janet_wrap_nil());
+}
+
 /* C functions */
 
 JANET_CORE_FN(cfun_env_lookup,
@@ -1662,51 +2242,139 @@ JANET_CORE_FN(cfun_env_lookup,
 }
 
 JANET_CORE_FN(cfun_marshal,
-              "(marshal x &opt reverse-lookup buffer no-cycles)",
+              "(marshal x &opt reverse-lookup buffer no-cycles lazy)",
               "Marshal a value into a buffer and return the buffer. The buffer "
               "can then later be unmarshalled to reconstruct the initial value. "
               "Optionally, one can pass in a reverse lookup table to not marshal "
               "aliased values that are found in the table. Then a forward "
               "lookup table can be used to recover the original value when "
-              "unmarshalling.") {
-    janet_arity(argc, 1, 4);
+              "unmarshalling. If `lazy` is truthy, function bodies are written so "
+              "that a lazy `unmarshal` can skip decoding them until they are first called.") {
+    janet_arity(argc, 1, 5);
     JanetBuffer *buffer;
     JanetTable *rreg = NULL;
     uint32_t flags = 0;
-    if (argc > 1) {
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
         rreg = janet_gettable(argv, 1);
     }
-    if (argc > 2) {
-        buffer = janet_getbuffer(argv, 2);
-    } else {
-        buffer = janet_buffer(10);
-    }
+    buffer = janet_optbuffer(argv, argc, 2, 10);
     if (argc > 3 && janet_truthy(argv[3])) {
         flags |= JANET_MARSHAL_NO_CYCLES;
     }
+    if (argc > 4 && janet_truthy(argv[4])) {
+        flags |= JANET_MARSHAL_LAZY;
+    }
     janet_marshal(buffer, argv[0], rreg, flags);
     return janet_wrap_buffer(buffer);
 }
 
 JANET_CORE_FN(cfun_unmarshal,
-              "(unmarshal buffer &opt lookup)",
+              "(unmarshal buffer &opt lookup lazy)",
               "Unmarshal a value from a buffer. An optional lookup table "
               "can be provided to allow for aliases to be resolved. Returns the value "
-              "unmarshalled from the buffer.") {
-    janet_arity(argc, 1, 2);
+              "unmarshalled from the buffer. If `lazy` is truthy, the bodies of functions "
+              "marshalled with the `lazy` option are decoded and verified when each function "
+              "is first used rather than up front. A mutable buffer is copied first in that case.") {
+    janet_arity(argc, 1, 3);
     JanetByteView view = janet_getbytes(argv, 0);
     JanetTable *reg = NULL;
-    if (argc > 1) {
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
         reg = janet_gettable(argv, 1);
     }
+    if (argc > 2 && janet_truthy(argv[2])) {
+        Janet owner = argv[0];
+        if (janet_checktype(owner, JANET_BUFFER)) {
+            const uint8_t *copy = janet_string(view.bytes, view.len);
+            owner = janet_wrap_string(copy);
+            view.bytes = copy;
+        }
+        return unmarshal_owned(view.bytes, (size_t) view.len, JANET_MARSHAL_LAZY, reg, NULL, owner);
+    }
     return janet_unmarshal(view.bytes, (size_t) view.len, 0, reg, NULL);
 }
 
+#ifdef JANET_IMAGE_MMAP
+
+/* Keeps a file mapped for as long as lazy funcdefs point into it */
+typedef struct {
+    void *addr;
+    size_t len;
+} JanetMappedImage;
+
+static int mapped_image_gc(void *p, size_t size) {
+    (void) size;
+    JanetMappedImage *image = (JanetMappedImage *) p;
+    munmap(image->addr, image->len);
+    return 0;
+}
+
+static const JanetAbstractType janet_mapped_image_type = {
+    "core/mapped-image",
+    mapped_image_gc,
+    JANET_ATEND_GC
+};
+
+#endif
+
+JANET_CORE_FN(cfun_unmarshal_file,
+              "(unmarshal-file path &opt lookup)",
+              "Unmarshal a value from the contents of the file at `path`, like `unmarshal` with "
+              "the `lazy` option. Where supported, the file is mapped into memory rather than read, "
+              "so function bodies are only paged in and decoded when first called. "
+              "The file must not be rewritten, truncated or removed while the unmarshalled value "
+              "is in use; doing so can crash the process when a function that has not been called "
+              "yet is first called.") {
+    janet_arity(argc, 1, 2);
+    janet_sandbox_assert(JANET_SANDBOX_FS_READ);
+    const char *path = janet_getcstring(argv, 0);
+    JanetTable *reg = NULL;
+    if (argc > 1 && !janet_checktype(argv[1], JANET_NIL)) {
+        reg = janet_gettable(argv, 1);
+    }
+#ifdef JANET_IMAGE_MMAP
+    int fd;
+    do {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0) janet_panicf("cannot open %s: %s", path, janet_strerror(errno));
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        size_t len = (size_t) sb.st_size;
+        void *addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) janet_panicf("cannot map %s: %s", path, janet_strerror(errno));
+        JanetMappedImage *image = janet_abstract(&janet_mapped_image_type, sizeof(JanetMappedImage));
+        image->addr = addr;
+        image->len = len;
+        return unmarshal_owned((const uint8_t *) addr, len, JANET_MARSHAL_LAZY, reg, NULL,
+                               janet_wrap_abstract(image));
+    }
+    close(fd);
+#endif
+    /* Read the whole file and let the string own the bytes */
+    FILE *f = fopen(path, "rb");
+    if (NULL == f) janet_panicf("cannot open %s: %s", path, janet_strerror(errno));
+    JanetBuffer *buffer = janet_buffer(0);
+    for (;;) {
+        janet_buffer_extra(buffer, 4096);
+        size_t n = fread(buffer->data + buffer->count, 1, 4096, f);
+        buffer->count += (int32_t) n;
+        if (n < 4096) break;
+    }
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) janet_panicf("cannot read %s", path);
+    const uint8_t *bytes = janet_string(buffer->data, buffer->count);
+    return unmarshal_owned(bytes, (size_t) janet_string_length(bytes), JANET_MARSHAL_LAZY, reg, NULL,
+                           janet_wrap_string(bytes));
+}
+
 /* Module entry point */
 void janet_lib_marsh(JanetTable *env) {
     JanetRegExt marsh_cfuns[] = {
         JANET_CORE_REG("marshal", cfun_marshal),
         JANET_CORE_REG("unmarshal", cfun_unmarshal),
+        JANET_CORE_REG("unmarshal-file", cfun_unmarshal_file),
         JANET_CORE_REG("env-lookup", cfun_env_lookup),
         JANET_REG_END
     };
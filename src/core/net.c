@@ -25,6 +25,7 @@
 #include <janet.h>
 #include "util.h"
 #include "fiber.h"
+#include "gc.h"
 #endif
 
 #ifdef JANET_NET
@@ -52,6 +53,9 @@
 #include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
+#ifdef JANET_EV_IO_URING
+#include <linux/io_uring.h>
+#endif
 #endif
 
 const JanetAbstractType janet_address_type = {
@@ -272,10 +276,55 @@ static int net_sched_accept_impl(NetStateAccept *state, JanetFiber *fiber, Janet
 
 typedef struct {
     JanetFunction *function;
+#ifdef JANET_EV_IO_URING
+    int32_t uring_res;
+#endif
 } NetStateAccept;
 
+#ifdef JANET_EV_IO_URING
+static void net_accept_uring_submit(JanetFiber *fiber, NetStateAccept *state) {
+    struct io_uring_sqe *sqe = janet_ev_uring_prep(fiber, IORING_OP_ACCEPT, fiber->ev_stream->handle, &state->uring_res);
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+#endif
+
+/* Returns 1 if the fiber is done accepting */
+static int net_accepted(JanetFiber *fiber, NetStateAccept *state, JSock connfd) {
+    janet_net_socknoblock(connfd);
+    JanetStream *stream = make_stream(connfd, JANET_STREAM_READABLE | JANET_STREAM_WRITABLE);
+    Janet streamv = janet_wrap_abstract(stream);
+    if (state->function) {
+        JanetFiber *sub_fiber = janet_fiber(state->function, 64, 1, &streamv);
+        sub_fiber->supervisor_channel = fiber->supervisor_channel;
+        janet_schedule(sub_fiber, janet_wrap_nil());
+        return 0;
+    }
+    janet_schedule(fiber, streamv);
+    janet_async_end(fiber);
+    return 1;
+}
+
+/* Accept pending connections until the backlog is empty, so a burst of
+ * connections does not cost one wakeup each. Returns 1 if the fiber is done accepting. */
+#define JANET_NET_ACCEPT_BATCH 64
+static int net_accept_drain(JanetFiber *fiber, NetStateAccept *state) {
+    for (int i = 0; i < JANET_NET_ACCEPT_BATCH; i++) {
+#if defined(JANET_LINUX)
+        JSock connfd = accept4(fiber->ev_stream->handle, NULL, NULL, SOCK_CLOEXEC);
+#else
+        /* On BSDs, CLOEXEC should be inherited from server socket */
+        JSock connfd = accept(fiber->ev_stream->handle, NULL, NULL);
+#endif
+        if (!JSOCKVALID(connfd)) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (net_accepted(fiber, state, connfd)) return 1;
+    }
+    return 0;
+}
+
 void net_callback_accept(JanetFiber *fiber, JanetAsyncEvent event) {
-    JanetStream *stream = fiber->ev_stream;
     NetStateAccept *state = (NetStateAccept *)fiber->ev_state;
     switch (event) {
         default:
@@ -288,30 +337,27 @@ void net_callback_accept(JanetFiber *fiber, JanetAsyncEvent event) {
             janet_schedule(fiber, janet_wrap_nil());
             janet_async_end(fiber);
             return;
-        case JANET_ASYNC_EVENT_INIT:
-        case JANET_ASYNC_EVENT_READ: {
-#if defined(JANET_LINUX)
-            JSock connfd = accept4(stream->handle, NULL, NULL, SOCK_CLOEXEC);
-#else
-            /* On BSDs, CLOEXEC should be inherited from server socket */
-            JSock connfd = accept(stream->handle, NULL, NULL);
+#ifdef JANET_EV_IO_URING
+        case JANET_ASYNC_EVENT_FAILED:
+            /* Fall back to waiting for readiness */
+            break;
+        case JANET_ASYNC_EVENT_COMPLETE:
+            if (!net_accepted(fiber, state, (JSock) state->uring_res) && !net_accept_drain(fiber, state)) {
+                net_accept_uring_submit(fiber, state);
+            }
+            break;
 #endif
-            if (JSOCKVALID(connfd)) {
-                janet_net_socknoblock(connfd);
-                JanetStream *stream = make_stream(connfd, JANET_STREAM_READABLE | JANET_STREAM_WRITABLE);
-                Janet streamv = janet_wrap_abstract(stream);
-                if (state->function) {
-                    JanetFiber *sub_fiber = janet_fiber(state->function, 64, 1, &streamv);
-                    sub_fiber->supervisor_channel = fiber->supervisor_channel;
-                    janet_schedule(sub_fiber, janet_wrap_nil());
-                } else {
-                    janet_schedule(fiber, streamv);
-                    janet_async_end(fiber);
-                    return;
-                }
+        case JANET_ASYNC_EVENT_INIT:
+#ifdef JANET_EV_IO_URING
+            if (janet_ev_uring_enabled()) {
+                net_accept_uring_submit(fiber, state);
+                break;
             }
+#endif
+        /* fallthrough */
+        case JANET_ASYNC_EVENT_READ:
+            net_accept_drain(fiber, state);
             break;
-        }
     }
 }
 
@@ -325,6 +371,293 @@ JANET_NO_RETURN static void janet_sched_accept(JanetStream *stream, JanetFunctio
 
 #endif
 
+/* State machines for receiving and sending many datagrams with one system call.
+ * Uses recvmmsg and sendmmsg on linux, and loops over recvfrom and sendto elsewhere. */
+
+#ifndef JANET_WINDOWS
+
+#define JANET_NET_MANY_MAX 1024
+
+typedef struct {
+    JanetArray *into;
+    int32_t count;
+    int32_t size;
+    struct sockaddr_storage *addrs;
+    socklen_t *addrlens;
+    int32_t *lens;
+    uint8_t *data;
+#ifdef JANET_LINUX
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+#endif
+} NetStateRecvMany;
+
+/* Returns the number of datagrams received, or -1 with errno set */
+static int net_recv_many_impl(JanetStream *stream, NetStateRecvMany *state) {
+    int n;
+#ifdef JANET_LINUX
+    for (int32_t i = 0; i < state->count; i++) {
+        struct msghdr *hdr = &state->msgs[i].msg_hdr;
+        memset(hdr, 0, sizeof(struct msghdr));
+        state->iovs[i].iov_base = state->data + (size_t) i * state->size;
+        state->iovs[i].iov_len = state->size;
+        hdr->msg_name = &state->addrs[i];
+        hdr->msg_namelen = sizeof(struct sockaddr_storage);
+        hdr->msg_iov = &state->iovs[i];
+        hdr->msg_iovlen = 1;
+    }
+    do {
+        n = recvmmsg(stream->handle, state->msgs, state->count, 0, NULL);
+    } while (n == -1 && errno == EINTR);
+    for (int i = 0; i < n; i++) {
+        state->lens[i] = (int32_t) state->msgs[i].msg_len;
+        state->addrlens[i] = state->msgs[i].msg_hdr.msg_namelen;
+    }
+#else
+    for (n = 0; n < state->count; n++) {
+        ssize_t nread;
+        state->addrlens[n] = sizeof(struct sockaddr_storage);
+        do {
+            nread = recvfrom(stream->handle, state->data + (size_t) n * state->size, state->size, 0,
+                             (struct sockaddr *) &state->addrs[n], &state->addrlens[n]);
+        } while (nread == -1 && errno == EINTR);
+        if (nread == -1) {
+            if (n == 0) return -1;
+            break;
+        }
+        state->lens[n] = (int32_t) nread;
+    }
+#endif
+    return n;
+}
+
+/* Reuse the buffer of a previous result if there is one */
+static JanetBuffer *net_recv_many_buffer(JanetArray *into, int32_t i, int32_t len) {
+    if (i < into->count) {
+        const Janet *pair;
+        int32_t pair_len;
+        if (janet_indexed_view(into->data[i], &pair, &pair_len) && pair_len == 2 &&
+                janet_checktype(pair[1], JANET_BUFFER)) {
+            JanetBuffer *buf = janet_unwrap_buffer(pair[1]);
+            buf->count = 0;
+            janet_buffer_ensure(buf, len, 1);
+            return buf;
+        }
+    }
+    return janet_buffer(len);
+}
+
+void net_callback_recv_many(JanetFiber *fiber, JanetAsyncEvent event) {
+    JanetStream *stream = fiber->ev_stream;
+    NetStateRecvMany *state = (NetStateRecvMany *) fiber->ev_state;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            janet_mark(janet_wrap_array(state->into));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_schedule(fiber, janet_wrap_nil());
+            janet_async_end(fiber);
+            break;
+        case JANET_ASYNC_EVENT_INIT:
+        case JANET_ASYNC_EVENT_READ: {
+            int n = net_recv_many_impl(stream, state);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                janet_cancel(fiber, janet_ev_lasterr());
+                janet_async_end(fiber);
+                break;
+            }
+            JanetArray *into = state->into;
+            /* Results are stored into the array directly */
+            janet_gc_barrier(into);
+            for (int32_t i = 0; i < n; i++) {
+                JanetBuffer *buf = net_recv_many_buffer(into, i, state->lens[i]);
+                janet_buffer_push_bytes(buf, state->data + (size_t) i * state->size, state->lens[i]);
+                void *abst = janet_abstract(&janet_address_type, state->addrlens[i]);
+                memcpy(abst, &state->addrs[i], state->addrlens[i]);
+                Janet pair[2] = {janet_wrap_abstract(abst), janet_wrap_buffer(buf)};
+                if (i < into->count) {
+                    into->data[i] = janet_wrap_tuple(janet_tuple_n(pair, 2));
+                } else {
+                    janet_array_push(into, janet_wrap_tuple(janet_tuple_n(pair, 2)));
+                }
+            }
+            into->count = n;
+            janet_schedule(fiber, janet_wrap_array(into));
+            janet_async_end(fiber);
+            break;
+        }
+    }
+}
+
+JANET_NO_RETURN static void net_sched_recv_many(JanetStream *stream, JanetArray *into, int32_t count, int32_t size) {
+    size_t n = (size_t) count;
+    size_t bytes = sizeof(NetStateRecvMany) +
+                   n * (sizeof(struct sockaddr_storage) + sizeof(socklen_t) + sizeof(int32_t) + (size_t) size);
+#ifdef JANET_LINUX
+    bytes += n * (sizeof(struct mmsghdr) + sizeof(struct iovec));
+#endif
+    NetStateRecvMany *state = janet_malloc(bytes);
+    if (NULL == state) {
+        JANET_OUT_OF_MEMORY;
+    }
+    state->into = into;
+    state->count = count;
+    state->size = size;
+    state->addrs = (struct sockaddr_storage *)(state + 1);
+#ifdef JANET_LINUX
+    state->msgs = (struct mmsghdr *)(state->addrs + n);
+    state->iovs = (struct iovec *)(state->msgs + n);
+    state->addrlens = (socklen_t *)(state->iovs + n);
+#else
+    state->addrlens = (socklen_t *)(state->addrs + n);
+#endif
+    state->lens = (int32_t *)(state->addrlens + n);
+    state->data = (uint8_t *)(state->lens + n);
+    janet_async_start(stream, JANET_ASYNC_LISTEN_READ, net_callback_recv_many, state);
+}
+
+typedef struct {
+    int32_t count;
+    int32_t sent;
+    void *dest;
+    Janet *messages;
+#ifdef JANET_LINUX
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+#endif
+} NetStateSendMany;
+
+/* Get the destination and data of a message, which is either bytes or an [address bytes] pair */
+static int net_send_many_message(Janet x, void *dest, void **addr, JanetByteView *bytes) {
+    const Janet *pair;
+    int32_t pair_len;
+    *addr = dest;
+    if (janet_bytes_view(x, &bytes->bytes, &bytes->len)) return 1;
+    if (!janet_indexed_view(x, &pair, &pair_len) || pair_len != 2) return 0;
+    *addr = janet_checkabstract(pair[0], &janet_address_type);
+    if (NULL == *addr) return 0;
+    return janet_bytes_view(pair[1], &bytes->bytes, &bytes->len);
+}
+
+/* Returns the number of datagrams sent, -1 with errno set, or -2 if the next
+ * message is no longer valid (messages can be mutated while we wait) */
+static int net_send_many_impl(JanetStream *stream, NetStateSendMany *state) {
+    int32_t count = state->count - state->sent;
+    if (count > JANET_NET_MANY_MAX) count = JANET_NET_MANY_MAX;
+    int n;
+#ifdef JANET_LINUX
+    for (int32_t i = 0; i < count; i++) {
+        void *addr;
+        JanetByteView bytes;
+        if (!net_send_many_message(state->messages[state->sent + i], state->dest, &addr, &bytes)) {
+            if (i == 0) return -2;
+            count = i;
+            break;
+        }
+        struct msghdr *hdr = &state->msgs[i].msg_hdr;
+        memset(hdr, 0, sizeof(struct msghdr));
+        state->iovs[i].iov_base = (void *) bytes.bytes;
+        state->iovs[i].iov_len = bytes.len;
+        hdr->msg_name = addr;
+        hdr->msg_namelen = addr ? (socklen_t) janet_abstract_size(addr) : 0;
+        hdr->msg_iov = &state->iovs[i];
+        hdr->msg_iovlen = 1;
+    }
+    do {
+        n = sendmmsg(stream->handle, state->msgs, count, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+#else
+    for (n = 0; n < count; n++) {
+        void *addr;
+        JanetByteView bytes;
+        ssize_t nwrote;
+        if (!net_send_many_message(state->messages[state->sent + n], state->dest, &addr, &bytes)) {
+            if (n == 0) return -2;
+            break;
+        }
+        do {
+            nwrote = sendto(stream->handle, bytes.bytes, bytes.len, MSG_NOSIGNAL,
+                            (struct sockaddr *) addr, addr ? (socklen_t) janet_abstract_size(addr) : 0);
+        } while (nwrote == -1 && errno == EINTR);
+        if (nwrote == -1) {
+            if (n == 0) return -1;
+            break;
+        }
+    }
+#endif
+    return n;
+}
+
+void net_callback_send_many(JanetFiber *fiber, JanetAsyncEvent event) {
+    JanetStream *stream = fiber->ev_stream;
+    NetStateSendMany *state = (NetStateSendMany *) fiber->ev_state;
+    switch (event) {
+        default:
+            break;
+        case JANET_ASYNC_EVENT_MARK:
+            for (int32_t i = state->sent; i < state->count; i++) {
+                janet_mark(state->messages[i]);
+            }
+            if (state->dest) janet_mark(janet_wrap_abstract(state->dest));
+            break;
+        case JANET_ASYNC_EVENT_CLOSE:
+            janet_cancel(fiber, janet_cstringv("stream closed"));
+            janet_async_end(fiber);
+            break;
+        case JANET_ASYNC_EVENT_INIT:
+        case JANET_ASYNC_EVENT_WRITE:
+            while (state->sent < state->count) {
+                int n = net_send_many_impl(stream, state);
+                if (n == -2) {
+                    Janet x = state->messages[state->sent];
+                    janet_cancel(fiber, janet_wrap_string(janet_formatc("expected bytes or [address bytes] message, got %v", x)));
+                    janet_async_end(fiber);
+                    return;
+                }
+                if (n == -1) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                    janet_cancel(fiber, janet_ev_lasterr());
+                    janet_async_end(fiber);
+                    return;
+                }
+                state->sent += n;
+            }
+            janet_schedule(fiber, janet_wrap_nil());
+            janet_async_end(fiber);
+            break;
+    }
+}
+
+JANET_NO_RETURN static void net_sched_send_many(JanetStream *stream, JanetView messages, void *dest) {
+    size_t n = (size_t) messages.len;
+    size_t batch = n > JANET_NET_MANY_MAX ? JANET_NET_MANY_MAX : n;
+    size_t bytes = sizeof(NetStateSendMany) + n * sizeof(Janet);
+#ifdef JANET_LINUX
+    bytes += batch * (sizeof(struct mmsghdr) + sizeof(struct iovec));
+#else
+    (void) batch;
+#endif
+    NetStateSendMany *state = janet_malloc(bytes);
+    if (NULL == state) {
+        JANET_OUT_OF_MEMORY;
+    }
+    state->count = messages.len;
+    state->sent = 0;
+    state->dest = dest;
+    state->messages = (Janet *)(state + 1);
+    safe_memcpy(state->messages, messages.items, n * sizeof(Janet));
+#ifdef JANET_LINUX
+    state->msgs = (struct mmsghdr *)(state->messages + n);
+    state->iovs = (struct iovec *)(state->msgs + batch);
+#endif
+    janet_async_start(stream, JANET_ASYNC_LISTEN_WRITE, net_callback_send_many, state);
+}
+
+#endif
+
 /* Address info */
 
 static int janet_get_sockettype(Janet *argv, int32_t argc, int32_t n) {
@@ -903,13 +1236,18 @@ JANET_CORE_FN(cfun_stream_recv_from,
 JANET_CORE_FN(cfun_stream_write,
               "(net/write stream data &opt timeout)",
               "Write data to a stream, suspending the current fiber until the write "
-              "completes. Takes an optional timeout in seconds, after which will raise an error. "
+              "completes. Data can be a string, buffer, or rope. "
+              "Takes an optional timeout in seconds, after which will raise an error. "
               "Returns nil, or raises an error if the write failed.") {
     janet_arity(argc, 2, 3);
     JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
     janet_stream_flags(stream, JANET_STREAM_WRITABLE | JANET_STREAM_SOCKET);
     double to = janet_optnumber(argv, argc, 2, INFINITY);
-    if (janet_checktype(argv[1], JANET_BUFFER)) {
+    JanetRope *rope = janet_checkabstract(argv[1], &janet_rope_type);
+    if (NULL != rope) {
+        if (to != INFINITY) janet_addtimeout(to);
+        janet_ev_send_rope(stream, rope, MSG_NOSIGNAL);
+    } else if (janet_checktype(argv[1], JANET_BUFFER)) {
         if (to != INFINITY) janet_addtimeout(to);
         janet_ev_send_buffer(stream, janet_getbuffer(argv, 1), MSG_NOSIGNAL);
     } else {
@@ -939,6 +1277,52 @@ JANET_CORE_FN(cfun_stream_send_to,
     }
 }
 
+#ifndef JANET_WINDOWS
+JANET_CORE_FN(cfun_stream_recv_many,
+              "(net/recv-many stream count size &opt into timeout)",
+              "Receives up to `count` datagrams of at most `size` bytes each from a datagram socket, waiting until at "
+              "least one is available. Returns an array of `[address buffer]` tuples, or nil if the stream was closed. "
+              "If `into` is given, results are written into that array, and buffers from previous results in it are reused. "
+              "Uses a single system call on linux. Takes an optional timeout in seconds, after which will raise an error.") {
+    janet_arity(argc, 3, 5);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_READABLE | JANET_STREAM_SOCKET);
+    int32_t count = janet_getnat(argv, 1);
+    if (count < 1 || count > JANET_NET_MANY_MAX) {
+        janet_panicf("expected count between 1 and %d, got %d", JANET_NET_MANY_MAX, count);
+    }
+    int32_t size = janet_getnat(argv, 2);
+    if (size > 0x10000) janet_panicf("expected size of at most 65536, got %d", size);
+    JanetArray *into = janet_optarray(argv, argc, 3, count);
+    double to = janet_optnumber(argv, argc, 4, INFINITY);
+    if (to != INFINITY) janet_addtimeout(to);
+    net_sched_recv_many(stream, into, count, size);
+}
+
+JANET_CORE_FN(cfun_stream_send_many,
+              "(net/send-many stream messages &opt dest timeout)",
+              "Writes many datagrams to a socket. Each message is either bytes sent to `dest`, or an "
+              "`[address bytes]` tuple such as those returned by `net/recv-many`. Messages without an address and "
+              "without `dest` are sent to the connected peer. Uses a single system call per batch on linux. "
+              "Takes an optional timeout in seconds, after which will raise an error. Returns nil.") {
+    janet_arity(argc, 2, 4);
+    JanetStream *stream = janet_getabstract(argv, 0, &janet_stream_type);
+    janet_stream_flags(stream, JANET_STREAM_SOCKET);
+    JanetView messages = janet_getindexed(argv, 1);
+    void *dest = janet_optabstract(argv, argc, 2, &janet_address_type, NULL);
+    for (int32_t i = 0; i < messages.len; i++) {
+        void *addr;
+        JanetByteView bytes;
+        if (!net_send_many_message(messages.items[i], dest, &addr, &bytes)) {
+            janet_panicf("expected bytes or [address bytes] message, got %v", messages.items[i]);
+        }
+    }
+    double to = janet_optnumber(argv, argc, 3, INFINITY);
+    if (to != INFINITY) janet_addtimeout(to);
+    net_sched_send_many(stream, messages, dest);
+}
+#endif
+
 JANET_CORE_FN(cfun_stream_flush,
               "(net/flush stream)",
               "Make sure that a stream is not buffering any data. This temporarily disables Nagle's algorithm. "
@@ -1062,6 +1446,10 @@ static const JanetMethod net_stream_methods[] = {
     {"accept-loop", cfun_stream_accept_loop},
     {"send-to", cfun_stream_send_to},
     {"recv-from", cfun_stream_recv_from},
+#ifndef JANET_WINDOWS
+    {"send-many", cfun_stream_send_many},
+    {"recv-many", cfun_stream_recv_many},
+#endif
     {"evread", janet_cfun_stream_read},
     {"evchunk", janet_cfun_stream_chunk},
     {"evwrite", janet_cfun_stream_write},
@@ -1085,6 +1473,10 @@ void janet_lib_net(JanetTable *env) {
         JANET_CORE_REG("net/write", cfun_stream_write),
         JANET_CORE_REG("net/send-to", cfun_stream_send_to),
         JANET_CORE_REG("net/recv-from", cfun_stream_recv_from),
+#ifndef JANET_WINDOWS
+        JANET_CORE_REG("net/send-many", cfun_stream_send_many),
+        JANET_CORE_REG("net/recv-many", cfun_stream_recv_many),
+#endif
         JANET_CORE_REG("net/flush", cfun_stream_flush),
         JANET_CORE_REG("net/connect", cfun_net_connect),
         JANET_CORE_REG("net/shutdown", cfun_net_shutdown),
@@ -35,6 +35,23 @@
  * Runtime
  */
 
+/* Result of a memoized rule at a text position, for packrat matching.
+ * Captures produced by a successful match are kept in the memo_captures
+ * and memo_scratch side tables so they can be replayed on later hits. */
+typedef struct {
+    uint32_t rule;
+    int32_t pos; /* -1 for an empty slot */
+    int32_t end; /* end position, or one of PEG_MEMO_FAIL, PEG_MEMO_PENDING */
+    int32_t mode;
+    int32_t cap_start;
+    int32_t cap_count;
+    int32_t scratch_start;
+    int32_t scratch_count;
+} PegMemo;
+
+#define PEG_MEMO_FAIL (-1)
+#define PEG_MEMO_PENDING (-2)
+
 /* Hold captured patterns and match state */
 typedef struct {
     const uint8_t *text_start;
@@ -51,6 +68,11 @@ typedef struct {
     JanetArray *tagged_captures;
     const Janet *extrav;
     int32_t *linemap;
+    PegMemo *memo;
+    JanetArray *memo_captures;
+    JanetBuffer *memo_scratch;
+    uint32_t memo_capacity;
+    uint32_t memo_count;
     int32_t extrac;
     int32_t depth;
     int32_t linemaplen;
@@ -108,6 +130,77 @@ static void pushcap(PegState *s, Janet capture, uint32_t tag) {
     }
 }
 
+/* Packrat memo table. Open addressing with linear probing, kept in scratch
+ * memory so that it is reclaimed if matching panics. Lookups return the slot
+ * for (rule, pos, mode), which is empty (pos == -1) if not yet memoized. */
+static uint32_t peg_memo_hash(uint32_t rule, int32_t pos, int32_t mode) {
+    uint32_t h = rule * 0x9E3779B1u;
+    h ^= (uint32_t) pos + 0x7F4A7C15u + (h << 6) + (h >> 2);
+    return h ^ (uint32_t) mode;
+}
+
+static PegMemo *peg_memo_slot(PegMemo *memo, uint32_t capacity,
+                              uint32_t rule, int32_t pos, int32_t mode) {
+    uint32_t i = peg_memo_hash(rule, pos, mode) & (capacity - 1);
+    for (;;) {
+        PegMemo *m = memo + i;
+        if (m->pos < 0) return m;
+        if (m->pos == pos && m->rule == rule && m->mode == mode) return m;
+        i = (i + 1) & (capacity - 1);
+    }
+}
+
+static PegMemo *peg_memo_find(PegState *s, uint32_t rule, int32_t pos) {
+    if (2 * (s->memo_count + 1) > s->memo_capacity) {
+        uint32_t newcap = s->memo_capacity ? 2 * s->memo_capacity : 256;
+        PegMemo *newmemo = janet_smalloc(sizeof(PegMemo) * newcap);
+        for (uint32_t i = 0; i < newcap; i++) newmemo[i].pos = -1;
+        for (uint32_t i = 0; i < s->memo_capacity; i++) {
+            PegMemo *old = s->memo + i;
+            if (old->pos < 0) continue;
+            *peg_memo_slot(newmemo, newcap, old->rule, old->pos, old->mode) = *old;
+        }
+        if (s->memo) {
+            janet_sfree(s->memo);
+        } else {
+            s->memo_captures = janet_array(0);
+            s->memo_scratch = janet_buffer(0);
+        }
+        s->memo = newmemo;
+        s->memo_capacity = newcap;
+    }
+    return peg_memo_slot(s->memo, s->memo_capacity, rule, pos, s->mode);
+}
+
+/* Record the outcome of a memoized rule, including the captures it pushed
+ * since cs was saved. */
+static void peg_memo_store(PegState *s, PegMemo *m, CapState cs, const uint8_t *result) {
+    if (!result) {
+        m->end = PEG_MEMO_FAIL;
+        return;
+    }
+    m->end = (int32_t)(result - s->text_start);
+    m->cap_start = s->memo_captures->count;
+    m->cap_count = s->captures->count - cs.cap;
+    m->scratch_start = s->memo_scratch->count;
+    m->scratch_count = s->scratch->count - cs.scratch;
+    janet_array_ensure(s->memo_captures, m->cap_start + m->cap_count, 2);
+    safe_memcpy(s->memo_captures->data + m->cap_start, s->captures->data + cs.cap,
+                sizeof(Janet) * (size_t) m->cap_count);
+    s->memo_captures->count += m->cap_count;
+    janet_buffer_push_bytes(s->memo_scratch, s->scratch->data + cs.scratch, m->scratch_count);
+}
+
+/* Replay the captures of a memoized match */
+static void peg_memo_replay(PegState *s, const PegMemo *m) {
+    int32_t count = s->captures->count;
+    janet_array_ensure(s->captures, count + m->cap_count, 2);
+    safe_memcpy(s->captures->data + count, s->memo_captures->data + m->cap_start,
+                sizeof(Janet) * (size_t) m->cap_count);
+    s->captures->count += m->cap_count;
+    janet_buffer_push_bytes(s->scratch, s->memo_scratch->data + m->scratch_start, m->scratch_count);
+}
+
 /* Lazily generate line map to get line and column information for PegState.
  * line and column are 1-indexed. */
 typedef struct {
@@ -223,6 +316,19 @@ tail:
                    : NULL;
         }
 
+        case RULE_SPAN: {
+            uint32_t lo = rule[1];
+            uint32_t hi = rule[2];
+            const uint32_t *bitmap = rule + 3;
+            uint32_t count = 0;
+            while (count < hi && text < s->text_end &&
+                    (bitmap[text[0] >> 5] & ((uint32_t)1 << (text[0] & 0x1F)))) {
+                text++;
+                count++;
+            }
+            return count < lo ? NULL : text;
+        }
+
         case RULE_LOOK: {
             text += ((int32_t *)rule)[1];
             if (text < s->text_start || text > s->text_end) return NULL;
@@ -252,6 +358,32 @@ tail:
             goto tail;
         }
 
+        case RULE_DISPATCH: {
+            /* Choice that skips alternatives which cannot start with the next byte */
+            uint32_t len = rule[1];
+            const uint32_t *args = rule + 2;
+            const uint32_t *bitmaps = args + len;
+            if (len == 0) return NULL;
+            int at_end = text >= s->text_end;
+            uint32_t word = at_end ? 0 : text[0] >> 5;
+            uint32_t mask = at_end ? 0 : (uint32_t)1 << (text[0] & 0x1F);
+            down1(s);
+            CapState cs = cap_save(s);
+            for (uint32_t i = 0; i < len - 1; i++) {
+                if (!at_end && !(bitmaps[8 * i + word] & mask)) continue;
+                const uint8_t *result = peg_rule(s, s->bytecode + args[i], text);
+                if (result) {
+                    up1(s);
+                    return result;
+                }
+                cap_load(s, cs);
+            }
+            up1(s);
+            if (!at_end && !(bitmaps[8 * (len - 1) + word] & mask)) return NULL;
+            rule = s->bytecode + args[len - 1];
+            goto tail;
+        }
+
         case RULE_SEQUENCE: {
             uint32_t len = rule[1];
             const uint32_t *args = rule + 2;
@@ -475,6 +607,40 @@ tail:
             return result;
         }
 
+        case RULE_MEMO: {
+            const uint32_t *rule_a = s->bytecode + rule[1];
+            /* Results depend on more than the text position when matching
+             * inside a restricted window or against back-references */
+            if (s->has_backref || s->text_end != s->outer_text_end) {
+                rule = rule_a;
+                goto tail;
+            }
+            int32_t pos = (int32_t)(text - s->text_start);
+            PegMemo *m = peg_memo_find(s, rule[1], pos);
+            if (m->pos >= 0) {
+                if (m->end == PEG_MEMO_FAIL) return NULL;
+                if (m->end == PEG_MEMO_PENDING) {
+                    /* Left recursion - match as if not memoized */
+                    rule = rule_a;
+                    goto tail;
+                }
+                peg_memo_replay(s, m);
+                return s->text_start + m->end;
+            }
+            m->rule = rule[1];
+            m->pos = pos;
+            m->mode = s->mode;
+            m->end = PEG_MEMO_PENDING;
+            s->memo_count++;
+            CapState cs = cap_save(s);
+            down1(s);
+            const uint8_t *result = peg_rule(s, rule_a, text);
+            up1(s);
+            /* The table may have grown while matching */
+            peg_memo_store(s, peg_memo_find(s, rule[1], pos), cs, result);
+            return result;
+        }
+
         case RULE_GROUP: {
             uint32_t tag = rule[2];
             int oldmode = s->mode;
@@ -819,6 +985,8 @@ typedef struct {
     int depth;
     uint32_t nexttag;
     int has_backref;
+    int memoize;
+    JanetTable *memo_rules;
 } Builder;
 
 /* Forward declaration to allow recursion */
@@ -1378,11 +1546,36 @@ static const SpecialPair peg_specials[] = {
 };
 
 /* Compile a janet value into a rule and return the rule index. */
+/* Wrap a named grammar rule in a memo rule when compiling for packrat
+ * matching. Primitive patterns are cheaper to rematch than to look up. */
+static uint32_t peg_memo_wrap(Builder *b, Janet peg, uint32_t rule) {
+    if (!b->memoize) return rule;
+    if (janet_checktype(peg, JANET_TUPLE)) {
+        const Janet *tup = janet_unwrap_tuple(peg);
+        if (janet_checktype(tup[0], JANET_SYMBOL)) {
+            const uint8_t *sym = janet_unwrap_symbol(tup[0]);
+            if (!janet_cstrcmp(sym, "range") || !janet_cstrcmp(sym, "set"))
+                return rule;
+        }
+    } else if (!janet_checktype(peg, JANET_TABLE) && !janet_checktype(peg, JANET_STRUCT)) {
+        return rule;
+    }
+    Janet key = janet_wrap_number(rule);
+    Janet check = janet_table_get(b->memo_rules, key);
+    if (!janet_checktype(check, JANET_NIL))
+        return (uint32_t) janet_unwrap_number(check);
+    Reserve r = reserve(b, 2);
+    emit_1(r, RULE_MEMO, rule);
+    janet_table_put(b->memo_rules, key, janet_wrap_number(r.index));
+    return r.index;
+}
+
 static uint32_t peg_compile1(Builder *b, Janet peg) {
 
     /* Keep track of the form being compiled for error purposes */
     Janet old_form = b->form;
     JanetTable *old_grammar = b->grammar;
+    int named = janet_checktype(peg, JANET_KEYWORD);
     b->form = peg;
 
     /* Resolve keyword references */
@@ -1414,7 +1607,8 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
     if (!janet_checktype(check, JANET_NIL)) {
         b->form = old_form;
         b->grammar = old_grammar;
-        return (uint32_t) janet_unwrap_number(check);
+        uint32_t rule = (uint32_t) janet_unwrap_number(check);
+        return named ? peg_memo_wrap(b, peg, rule) : rule;
     }
 
     /* Check depth */
@@ -1532,9 +1726,467 @@ static uint32_t peg_compile1(Builder *b, Janet peg) {
     b->depth++;
     b->form = old_form;
     b->grammar = old_grammar;
+    return named ? peg_memo_wrap(b, peg, rule) : rule;
+}
+
+/*
+ * Optimization
+ */
+
+/* Rewrites the bytecode emitted by peg_compile1. Parents are emitted before
+ * their children, so rules are visited from the end of the bytecode to see
+ * already optimized children. A rewritten rule is appended to the bytecode
+ * and the original rule is forwarded to it. Rules that are no longer
+ * reachable are dropped when the bytecode is compacted. */
+typedef struct {
+    Builder *b;
+    uint32_t *forward;
+    uint32_t len;
+    uint8_t *first_state;
+    uint32_t *first_sets;
+    uint32_t first_cap;
+} PegOpt;
+
+enum {
+    PEG_FIRST_UNVISITED,
+    PEG_FIRST_VISITING,
+    PEG_FIRST_KNOWN,
+    PEG_FIRST_UNKNOWN
+};
+
+/* Get the size in words of a rule, and the position and count of its
+ * rule operands, which are always contiguous. */
+static uint32_t peg_rule_layout(const uint32_t *rule, uint32_t *refs, uint32_t *nrefs) {
+    *refs = 1;
+    *nrefs = 0;
+    switch (rule[0]) {
+        default:
+        case RULE_NCHAR:
+        case RULE_NOTNCHAR:
+        case RULE_RANGE:
+        case RULE_POSITION:
+        case RULE_LINE:
+        case RULE_COLUMN:
+        case RULE_BACKMATCH:
+            return 2;
+        case RULE_LITERAL:
+            return 2 + ((rule[1] + 3) >> 2);
+        case RULE_SET:
+            return 9;
+        case RULE_SPAN:
+            return 11;
+        case RULE_ARGUMENT:
+        case RULE_GETTAG:
+        case RULE_CONSTANT:
+        case RULE_READINT:
+            return 3;
+        case RULE_LOOK:
+            *refs = 2;
+            *nrefs = 1;
+            return 3;
+        case RULE_CHOICE:
+        case RULE_SEQUENCE:
+            *refs = 2;
+            *nrefs = rule[1];
+            return 2 + rule[1];
+        case RULE_DISPATCH:
+            *refs = 2;
+            *nrefs = rule[1];
+            return 2 + 9 * rule[1];
+        case RULE_IF:
+        case RULE_IFNOT:
+        case RULE_LENPREFIX:
+        case RULE_SUB:
+        case RULE_TIL:
+        case RULE_SPLIT:
+            *nrefs = 2;
+            return 3;
+        case RULE_BETWEEN:
+            *refs = 3;
+            *nrefs = 1;
+            return 4;
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_CAPTURE:
+        case RULE_UNREF:
+            *nrefs = 1;
+            return 3;
+        case RULE_CAPTURE_NUM:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+            *nrefs = 1;
+            return 4;
+        case RULE_NTH:
+            *refs = 2;
+            *nrefs = 1;
+            return 4;
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_ONLY_TAGS:
+        case RULE_MEMO:
+        case RULE_NOT:
+        case RULE_TO:
+        case RULE_THRU:
+            *nrefs = 1;
+            return 2;
+    }
+}
+
+static uint32_t opt_resolve(PegOpt *o, uint32_t rule) {
+    while (rule < o->len && o->forward[rule] != rule)
+        rule = o->forward[rule];
     return rule;
 }
 
+static void opt_forward(PegOpt *o, uint32_t from, uint32_t to) {
+    if (opt_resolve(o, to) != from) o->forward[from] = to;
+}
+
+/* If a rule matches exactly one byte from a set and captures nothing,
+ * get that set as a bitmap. */
+static int opt_charclass(const uint32_t *rule, uint32_t *bitmap) {
+    memset(bitmap, 0, 8 * sizeof(uint32_t));
+    switch (rule[0]) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+            if (rule[1] != 1) return 0;
+            bitmap_set(bitmap, ((const uint8_t *)(rule + 2))[0]);
+            return 1;
+        case RULE_NCHAR:
+            if (rule[1] != 1) return 0;
+            memset(bitmap, 0xFF, 8 * sizeof(uint32_t));
+            return 1;
+        case RULE_RANGE: {
+            uint32_t lo = rule[1] & 0xFF;
+            uint32_t hi = (rule[1] >> 16) & 0xFF;
+            for (uint32_t c = lo; c <= hi; c++)
+                bitmap_set(bitmap, (uint8_t) c);
+            return 1;
+        }
+        case RULE_SET:
+            memcpy(bitmap, rule + 1, 8 * sizeof(uint32_t));
+            return 1;
+    }
+}
+
+static int opt_first(PegOpt *o, uint32_t index, uint32_t *bitmap);
+
+static int opt_first1(PegOpt *o, uint32_t index, uint32_t *bitmap) {
+    const uint32_t *rule = o->b->bytecode + index;
+    if (opt_charclass(rule, bitmap)) return 1;
+    switch (rule[0]) {
+        default:
+            return 0;
+        case RULE_LITERAL:
+            if (rule[1] == 0) return 0;
+            bitmap_set(bitmap, ((const uint8_t *)(rule + 2))[0]);
+            return 1;
+        case RULE_SPAN:
+            if (rule[1] == 0) return 0;
+            memcpy(bitmap, rule + 3, 8 * sizeof(uint32_t));
+            return 1;
+        case RULE_BETWEEN:
+            if (rule[1] == 0) return 0;
+            return opt_first(o, opt_resolve(o, rule[3]), bitmap);
+        case RULE_SEQUENCE:
+            if (rule[1] == 0) return 0;
+            return opt_first(o, opt_resolve(o, rule[2]), bitmap);
+        case RULE_NTH:
+            return opt_first(o, opt_resolve(o, rule[2]), bitmap);
+        case RULE_IF:
+        case RULE_CAPTURE:
+        case RULE_CAPTURE_NUM:
+        case RULE_ACCUMULATE:
+        case RULE_GROUP:
+        case RULE_REPLACE:
+        case RULE_MATCHTIME:
+        case RULE_ERROR:
+        case RULE_DROP:
+        case RULE_ONLY_TAGS:
+        case RULE_UNREF:
+        case RULE_MEMO:
+            return opt_first(o, opt_resolve(o, rule[1]), bitmap);
+        case RULE_CHOICE:
+        case RULE_DISPATCH: {
+            uint32_t len = rule[1];
+            uint32_t sub[8];
+            for (uint32_t i = 0; i < len; i++) {
+                /* Recursion may move the bytecode */
+                uint32_t alt = o->b->bytecode[index + 2 + i];
+                if (!opt_first(o, opt_resolve(o, alt), sub)) return 0;
+                for (int j = 0; j < 8; j++) bitmap[j] |= sub[j];
+            }
+            return 1;
+        }
+    }
+}
+
+/* Get the set of bytes that a match of a rule can start with. Returns 0 if
+ * the rule might match without consuming input, or might do more than fail
+ * when the next byte is not in the set. Results are cached per rule, and
+ * recursive rules are treated as unknown. */
+static int opt_first(PegOpt *o, uint32_t index, uint32_t *bitmap) {
+    if (index >= o->first_cap) {
+        uint32_t newcap = janet_v_count(o->b->bytecode);
+        o->first_state = janet_srealloc(o->first_state, newcap);
+        o->first_sets = janet_srealloc(o->first_sets, sizeof(uint32_t) * 8 * newcap);
+        memset(o->first_state + o->first_cap, PEG_FIRST_UNVISITED, newcap - o->first_cap);
+        o->first_cap = newcap;
+    }
+    uint32_t *cached = o->first_sets + 8 * (size_t) index;
+    switch (o->first_state[index]) {
+        case PEG_FIRST_KNOWN:
+            memcpy(bitmap, cached, 8 * sizeof(uint32_t));
+            return 1;
+        case PEG_FIRST_VISITING:
+        case PEG_FIRST_UNKNOWN:
+            return 0;
+        default:
+            break;
+    }
+    o->first_state[index] = PEG_FIRST_VISITING;
+    int known = opt_first1(o, index, bitmap);
+    /* The cache may have moved */
+    cached = o->first_sets + 8 * (size_t) index;
+    if (known) memcpy(cached, bitmap, 8 * sizeof(uint32_t));
+    o->first_state[index] = known ? PEG_FIRST_KNOWN : PEG_FIRST_UNKNOWN;
+    return known;
+}
+
+static uint32_t opt_emit_set(Builder *b, const uint32_t *bitmap) {
+    Reserve r = reserve(b, 9);
+    emit_rule(r, RULE_SET, 8, bitmap);
+    return r.index;
+}
+
+/* Get the resolved operands of a sequence or choice, splicing in the
+ * operands of children with the same operator. */
+static uint32_t *opt_flatten(PegOpt *o, uint32_t index, int *changed) {
+    uint32_t *out = NULL;
+    uint32_t op = o->b->bytecode[index];
+    uint32_t len = o->b->bytecode[index + 1];
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t child = opt_resolve(o, o->b->bytecode[index + 2 + i]);
+        const uint32_t *crule = o->b->bytecode + child;
+        int same = crule[0] == op || (op == RULE_CHOICE && crule[0] == RULE_DISPATCH);
+        if (child != index && same) {
+            for (uint32_t j = 0; j < crule[1]; j++)
+                janet_v_push(out, opt_resolve(o, crule[2 + j]));
+            *changed = 1;
+        } else {
+            if (child != o->b->bytecode[index + 2 + i]) *changed = 1;
+            janet_v_push(out, child);
+        }
+    }
+    return out;
+}
+
+static uint32_t opt_emit_variadic(Builder *b, uint32_t op, uint32_t *rules) {
+    uint32_t index = janet_v_count(b->bytecode);
+    janet_v_push(b->bytecode, op);
+    janet_v_push(b->bytecode, janet_v_count(rules));
+    for (int32_t i = 0; i < janet_v_count(rules); i++)
+        janet_v_push(b->bytecode, rules[i]);
+    return index;
+}
+
+/* Flatten nested sequences and merge adjacent literals */
+static void opt_sequence(PegOpt *o, uint32_t index) {
+    Builder *b = o->b;
+    int changed = 0;
+    uint32_t *rules = opt_flatten(o, index, &changed);
+    uint32_t *merged = NULL;
+    int32_t count = janet_v_count(rules);
+    for (int32_t i = 0; i < count;) {
+        int32_t j = i;
+        while (j < count && b->bytecode[rules[j]] == RULE_LITERAL) j++;
+        if (j - i >= 2) {
+            JanetBuffer buf;
+            janet_buffer_init(&buf, 16);
+            for (int32_t k = i; k < j; k++) {
+                const uint32_t *lit = b->bytecode + rules[k];
+                janet_buffer_push_bytes(&buf, (const uint8_t *)(lit + 2), lit[1]);
+            }
+            janet_v_push(merged, janet_v_count(b->bytecode));
+            emit_bytes(b, RULE_LITERAL, buf.count, buf.data);
+            janet_buffer_deinit(&buf);
+            changed = 1;
+            i = j;
+        } else {
+            janet_v_push(merged, rules[i]);
+            i++;
+        }
+    }
+    if (janet_v_count(merged) == 1) {
+        opt_forward(o, index, merged[0]);
+    } else if (changed) {
+        opt_forward(o, index, opt_emit_variadic(b, RULE_SEQUENCE, merged));
+    }
+    janet_v_free(rules);
+    janet_v_free(merged);
+}
+
+/* Flatten nested choices, merge adjacent single byte alternatives into
+ * sets, and skip alternatives by their first byte where it is known. */
+static void opt_choice(PegOpt *o, uint32_t index) {
+    Builder *b = o->b;
+    int changed = 0;
+    uint32_t *rules = opt_flatten(o, index, &changed);
+    uint32_t *merged = NULL;
+    int32_t count = janet_v_count(rules);
+    uint32_t bitmap[8], sub[8];
+    for (int32_t i = 0; i < count;) {
+        int32_t j = i;
+        memset(bitmap, 0, sizeof(bitmap));
+        while (j < count && opt_charclass(b->bytecode + rules[j], sub)) {
+            for (int k = 0; k < 8; k++) bitmap[k] |= sub[k];
+            j++;
+        }
+        if (j - i >= 2) {
+            janet_v_push(merged, opt_emit_set(b, bitmap));
+            changed = 1;
+            i = j;
+        } else {
+            janet_v_push(merged, rules[i]);
+            i++;
+        }
+    }
+    count = janet_v_count(merged);
+    if (count == 1) {
+        opt_forward(o, index, merged[0]);
+    } else {
+        int useful = 0;
+        uint32_t *bitmaps = janet_smalloc(sizeof(uint32_t) * 8 * (count ? count : 1));
+        for (int32_t i = 0; i < count; i++) {
+            uint32_t *bm = bitmaps + 8 * i;
+            if (!opt_first(o, merged[i], bm)) {
+                memset(bm, 0xFF, 8 * sizeof(uint32_t));
+            }
+            for (int k = 0; k < 8; k++) {
+                if (bm[k] != UINT32_MAX) useful = 1;
+            }
+        }
+        if (useful) {
+            uint32_t rule = opt_emit_variadic(b, RULE_DISPATCH, merged);
+            for (int32_t i = 0; i < 8 * count; i++)
+                janet_v_push(b->bytecode, bitmaps[i]);
+            opt_forward(o, index, rule);
+        } else if (changed) {
+            opt_forward(o, index, opt_emit_variadic(b, RULE_CHOICE, merged));
+        }
+        janet_sfree(bitmaps);
+    }
+    janet_v_free(rules);
+    janet_v_free(merged);
+}
+
+/* (if-not (set ...) 1) is a set of the other bytes */
+static void opt_ifnot(PegOpt *o, uint32_t index) {
+    Builder *b = o->b;
+    uint32_t rule_a = opt_resolve(o, b->bytecode[index + 1]);
+    uint32_t rule_b = opt_resolve(o, b->bytecode[index + 2]);
+    uint32_t bitmap[8];
+    if (b->bytecode[rule_b] != RULE_NCHAR || b->bytecode[rule_b + 1] != 1) return;
+    if (!opt_charclass(b->bytecode + rule_a, bitmap)) return;
+    for (int i = 0; i < 8; i++) bitmap[i] = ~bitmap[i];
+    opt_forward(o, index, opt_emit_set(b, bitmap));
+}
+
+/* Repetitions of a single byte pattern scan a span of bytes */
+static void opt_between(PegOpt *o, uint32_t index) {
+    Builder *b = o->b;
+    uint32_t rule_a = opt_resolve(o, b->bytecode[index + 3]);
+    uint32_t body[10];
+    if (!opt_charclass(b->bytecode + rule_a, body + 2)) return;
+    body[0] = b->bytecode[index + 1];
+    body[1] = b->bytecode[index + 2];
+    Reserve r = reserve(b, 11);
+    emit_rule(r, RULE_SPAN, 10, body);
+    opt_forward(o, index, r.index);
+}
+
+/* Copy the rules reachable from the main rule into new bytecode */
+static void opt_compact(PegOpt *o) {
+    Builder *b = o->b;
+    uint32_t total = janet_v_count(b->bytecode);
+    uint32_t *newpos = janet_smalloc(sizeof(uint32_t) * total);
+    for (uint32_t i = 0; i < total; i++) newpos[i] = UINT32_MAX;
+    uint32_t *stack = NULL;
+    uint32_t *order = NULL;
+    uint32_t next = 0;
+    janet_v_push(stack, opt_resolve(o, 0));
+    while (janet_v_count(stack)) {
+        uint32_t index = janet_v_last(stack);
+        janet_v_pop(stack);
+        if (newpos[index] != UINT32_MAX) continue;
+        uint32_t refs, nrefs;
+        newpos[index] = next;
+        next += peg_rule_layout(b->bytecode + index, &refs, &nrefs);
+        janet_v_push(order, index);
+        for (uint32_t i = nrefs; i > 0; i--)
+            janet_v_push(stack, opt_resolve(o, b->bytecode[index + refs + i - 1]));
+    }
+    uint32_t *bytecode = NULL;
+    for (int32_t k = 0; k < janet_v_count(order); k++) {
+        uint32_t index = order[k];
+        uint32_t refs, nrefs;
+        uint32_t size = peg_rule_layout(b->bytecode + index, &refs, &nrefs);
+        for (uint32_t i = 0; i < size; i++) {
+            uint32_t word = b->bytecode[index + i];
+            if (i >= refs && i < refs + nrefs)
+                word = newpos[opt_resolve(o, word)];
+            janet_v_push(bytecode, word);
+        }
+    }
+    janet_v_free(b->bytecode);
+    b->bytecode = bytecode;
+    janet_v_free(stack);
+    janet_v_free(order);
+    janet_sfree(newpos);
+}
+
+static void peg_optimize(Builder *b) {
+    PegOpt o;
+    o.b = b;
+    o.len = janet_v_count(b->bytecode);
+    o.forward = janet_smalloc(sizeof(uint32_t) * (o.len ? o.len : 1));
+    o.first_state = NULL;
+    o.first_sets = NULL;
+    o.first_cap = 0;
+    uint32_t *starts = NULL;
+    for (uint32_t i = 0; i < o.len;) {
+        uint32_t refs, nrefs;
+        o.forward[i] = i;
+        janet_v_push(starts, i);
+        i += peg_rule_layout(b->bytecode + i, &refs, &nrefs);
+    }
+    for (int32_t k = janet_v_count(starts) - 1; k >= 0; k--) {
+        uint32_t index = starts[k];
+        switch (b->bytecode[index]) {
+            default:
+                break;
+            case RULE_SEQUENCE:
+                opt_sequence(&o, index);
+                break;
+            case RULE_CHOICE:
+                opt_choice(&o, index);
+                break;
+            case RULE_IFNOT:
+                opt_ifnot(&o, index);
+                break;
+            case RULE_BETWEEN:
+                opt_between(&o, index);
+                break;
+        }
+    }
+    opt_compact(&o);
+    janet_v_free(starts);
+    janet_sfree(o.forward);
+    janet_sfree(o.first_state);
+    janet_sfree(o.first_sets);
+}
+
 /*
  * Post-Compilation
  */
@@ -1638,6 +2290,10 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
                 /* [8 words] */
                 i += 9;
                 break;
+            case RULE_SPAN:
+                /* [lo, hi, 8 words] */
+                i += 11;
+                break;
             case RULE_LOOK:
                 /* [offset, rule] */
                 if (rule[2] >= blen) goto bad;
@@ -1656,6 +2312,18 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
                 i += 2 + len;
             }
             break;
+            case RULE_DISPATCH:
+                /* [len, rules..., bitmaps...] */
+            {
+                uint32_t len = rule[1];
+                if (len > (blen - i) / 9) goto bad;
+                for (uint32_t j = 0; j < len; j++) {
+                    if (rule[2 + j] >= blen) goto bad;
+                    op_flags[rule[2 + j]] |= 0x1;
+                }
+                i += 2 + 9 * len;
+            }
+            break;
             case RULE_IF:
             case RULE_IFNOT:
             case RULE_LENPREFIX:
@@ -1722,6 +2390,7 @@ static void *peg_unmarshal(JanetMarshalContext *ctx) {
             case RULE_ERROR:
             case RULE_DROP:
             case RULE_ONLY_TAGS:
+            case RULE_MEMO:
             case RULE_NOT:
             case RULE_TO:
             case RULE_THRU:
@@ -1804,7 +2473,7 @@ static JanetPeg *make_peg(Builder *b) {
 }
 
 /* Compiler entry point */
-static JanetPeg *compile_peg(Janet x) {
+static JanetPeg *compile_peg(Janet x, int memoize) {
     Builder builder;
     builder.grammar = janet_table(0);
     builder.default_grammar = NULL;
@@ -1821,7 +2490,10 @@ static JanetPeg *compile_peg(Janet x) {
     builder.form = x;
     builder.depth = JANET_RECURSION_GUARD;
     builder.has_backref = 0;
+    builder.memoize = memoize;
+    builder.memo_rules = memoize ? janet_table(0) : NULL;
     peg_compile1(&builder, x);
+    peg_optimize(&builder);
     JanetPeg *peg = make_peg(&builder);
     builder_cleanup(&builder);
     return peg;
@@ -1832,12 +2504,20 @@ static JanetPeg *compile_peg(Janet x) {
  */
 
 JANET_CORE_FN(cfun_peg_compile,
-              "(peg/compile peg)",
+              "(peg/compile peg &opt memoize)",
               "Compiles a peg source data structure into a <core/peg>. This will speed up matching "
               "if the same peg will be used multiple times. Will also use `(dyn :peg-grammar)` to supplement "
-              "the grammar of the peg for otherwise undefined peg keywords.") {
-    janet_fixarity(argc, 1);
-    JanetPeg *peg = compile_peg(argv[0]);
+              "the grammar of the peg for otherwise undefined peg keywords. If `memoize` is truthy, "
+              "matching memoizes the result of each named grammar rule at each position (packrat parsing), "
+              "which bounds the time spent on heavily backtracking grammars at the cost of memory. "
+              "Memoization is skipped for grammars with back-references and inside `sub`, `split` and `til`, "
+              "and functions in `cmt` and `replace` may be called fewer times. `memoize` defaults to "
+              "`(dyn :peg-memoize)`.") {
+    janet_arity(argc, 1, 2);
+    int memoize = (argc > 1 && !janet_checktype(argv[1], JANET_NIL))
+                  ? janet_truthy(argv[1])
+                  : janet_truthy(janet_dyn("peg-memoize"));
+    JanetPeg *peg = compile_peg(argv[0], memoize);
     return janet_wrap_abstract(peg);
 }
 
@@ -1859,7 +2539,7 @@ static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
             janet_abstract_type(janet_unwrap_abstract(argv[0])) == &janet_peg_type) {
         ret.peg = janet_unwrap_abstract(argv[0]);
     } else {
-        ret.peg = compile_peg(argv[0]);
+        ret.peg = compile_peg(argv[0], janet_truthy(janet_dyn("peg-memoize")));
     }
     if (get_replace) {
         ret.subst = argv[1];
@@ -1889,6 +2569,11 @@ static PegCall peg_cfun_init(int32_t argc, Janet *argv, int get_replace) {
     ret.s.bytecode = ret.peg->bytecode;
     ret.s.linemap = NULL;
     ret.s.linemaplen = -1;
+    ret.s.memo = NULL;
+    ret.s.memo_captures = NULL;
+    ret.s.memo_scratch = NULL;
+    ret.s.memo_capacity = 0;
+    ret.s.memo_count = 0;
     ret.s.has_backref = ret.peg->has_backref;
     return ret;
 }
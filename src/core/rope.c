@@ -0,0 +1,266 @@
+/*
+* Copyright (c) 2025 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "gc.h"
+#include "util.h"
+#include "state.h"
+#endif
+
+#include <string.h>
+
+/* A rope is a list of strings and buffers that are written out together.
+ * Pieces are referenced instead of copied, so appending is constant time
+ * however large the pieces are. Strings, symbols, and keywords smaller than
+ * JANET_ROPE_SMALL are copied into a buffer owned by the rope, which keeps the
+ * number of chunks, and so the number of iovecs needed to write the rope,
+ * small. They never change, so copying them is not visible. Buffers are always
+ * referenced, whatever their size. */
+
+#define JANET_ROPE_SMALL 256
+#define JANET_ROPE_TAIL 4096
+
+static int rope_gc(void *p, size_t size) {
+    (void) size;
+    JanetRope *rope = (JanetRope *) p;
+    janet_free(rope->chunks);
+    return 0;
+}
+
+static int rope_mark(void *p, size_t size) {
+    (void) size;
+    JanetRope *rope = (JanetRope *) p;
+    for (int32_t i = 0; i < rope->count; i++) {
+        janet_mark(rope->chunks[i]);
+    }
+    return 0;
+}
+
+static void rope_tostring(void *p, JanetBuffer *buffer) {
+    janet_rope_flatten((JanetRope *) p, buffer);
+}
+
+static size_t rope_length(void *p, size_t size) {
+    (void) size;
+    return janet_rope_length((JanetRope *) p);
+}
+
+static void rope_marshal(void *p, JanetMarshalContext *ctx) {
+    JanetRope *rope = (JanetRope *) p;
+    janet_marshal_abstract(ctx, p);
+    janet_marshal_int(ctx, rope->count);
+    for (int32_t i = 0; i < rope->count; i++) {
+        janet_marshal_janet(ctx, rope->chunks[i]);
+    }
+}
+
+static void *rope_unmarshal(JanetMarshalContext *ctx) {
+    JanetRope *rope = janet_unmarshal_abstract(ctx, sizeof(JanetRope));
+    rope->chunks = NULL;
+    rope->count = 0;
+    rope->capacity = 0;
+    rope->tail = -1;
+    int32_t count = janet_unmarshal_int(ctx);
+    if (count < 0) janet_panic("invalid rope");
+    for (int32_t i = 0; i < count; i++) {
+        janet_rope_push(rope, janet_unmarshal_janet(ctx));
+    }
+    return rope;
+}
+
+const JanetAbstractType janet_rope_type = {
+    "core/rope",
+    rope_gc,
+    rope_mark,
+    NULL, /* get */
+    NULL, /* put */
+    rope_marshal,
+    rope_unmarshal,
+    rope_tostring,
+    NULL, /* compare */
+    NULL, /* hash */
+    NULL, /* next */
+    NULL, /* call */
+    rope_length,
+    JANET_ATEND_LENGTH
+};
+
+static JanetRope *janet_rope(void) {
+    JanetRope *rope = janet_abstract(&janet_rope_type, sizeof(JanetRope));
+    rope->chunks = NULL;
+    rope->count = 0;
+    rope->capacity = 0;
+    rope->tail = -1;
+    return rope;
+}
+
+static void janet_rope_append(JanetRope *rope, Janet chunk) {
+    if (rope->count == rope->capacity) {
+        if (rope->capacity > INT32_MAX / 2) janet_panic("rope overflow");
+        int32_t capacity = rope->capacity ? 2 * rope->capacity : 8;
+        Janet *chunks = janet_realloc(rope->chunks, (size_t) capacity * sizeof(Janet));
+        if (NULL == chunks) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_gcpressure((size_t)(capacity - rope->capacity) * sizeof(Janet));
+        rope->chunks = chunks;
+        rope->capacity = capacity;
+    }
+    rope->chunks[rope->count++] = chunk;
+}
+
+/* Add a string, buffer, or rope to the end of a rope. Buffers are not copied,
+ * so changes to them after they are pushed show up in the rope. */
+void janet_rope_push(JanetRope *rope, Janet x) {
+    JanetRope *other = janet_checkabstract(x, &janet_rope_type);
+    if (NULL != other) {
+        /* Later small pieces pushed to either rope must not go into a shared buffer */
+        other->tail = -1;
+        rope->tail = -1;
+        int32_t count = other->count;
+        for (int32_t i = 0; i < count; i++) {
+            janet_rope_append(rope, other->chunks[i]);
+        }
+        return;
+    }
+    const uint8_t *bytes;
+    int32_t len;
+    if (!janet_bytes_view(x, &bytes, &len)) {
+        janet_panicf("expected string, buffer, or rope, got %v", x);
+    }
+    if (!janet_checktypes(x, JANET_TFLAG_STRING | JANET_TFLAG_SYMBOL | JANET_TFLAG_KEYWORD)) {
+        janet_rope_append(rope, x);
+        return;
+    }
+    if (len == 0) return;
+    if (len >= JANET_ROPE_SMALL) {
+        janet_rope_append(rope, x);
+        return;
+    }
+    JanetBuffer *tail = NULL;
+    if (rope->tail >= 0 && rope->tail == rope->count - 1) {
+        tail = janet_unwrap_buffer(rope->chunks[rope->tail]);
+        if (tail->count + len > tail->capacity) tail = NULL;
+    }
+    if (NULL == tail) {
+        tail = janet_buffer(JANET_ROPE_TAIL);
+        janet_rope_append(rope, janet_wrap_buffer(tail));
+        rope->tail = rope->count - 1;
+    }
+    memcpy(tail->data + tail->count, bytes, len);
+    tail->count += len;
+}
+
+/* Get the number of bytes in a rope */
+size_t janet_rope_length(JanetRope *rope) {
+    size_t total = 0;
+    for (int32_t i = 0; i < rope->count; i++) {
+        const uint8_t *bytes = NULL;
+        int32_t len = 0;
+        janet_bytes_view(rope->chunks[i], &bytes, &len);
+        total += (size_t) len;
+    }
+    return total;
+}
+
+/* Copy the contents of a rope to the end of a buffer */
+void janet_rope_flatten(JanetRope *rope, JanetBuffer *buffer) {
+    for (int32_t i = 0; i < rope->count; i++) {
+        if (janet_checktype(rope->chunks[i], JANET_BUFFER) &&
+                janet_unwrap_buffer(rope->chunks[i]) == buffer) {
+            /* The buffer would grow while it is being copied */
+            JanetBuffer *copy = janet_buffer(0);
+            janet_rope_flatten(rope, copy);
+            janet_buffer_push_bytes(buffer, copy->data, copy->count);
+            return;
+        }
+    }
+    size_t total = janet_rope_length(rope);
+    if (total + (size_t) buffer->count > INT32_MAX) janet_panic("buffer overflow");
+    janet_buffer_ensure(buffer, buffer->count + (int32_t) total, 1);
+    for (int32_t i = 0; i < rope->count; i++) {
+        const uint8_t *bytes = NULL;
+        int32_t len = 0;
+        janet_bytes_view(rope->chunks[i], &bytes, &len);
+        janet_buffer_push_bytes(buffer, bytes, len);
+    }
+}
+
+JANET_CORE_FN(cfun_rope_new,
+              "(rope/new & xs)",
+              "Create a rope, which holds strings and buffers to be written out together "
+              "without copying them into one buffer. Pushes each x in xs to the new rope, as in "
+              "`rope/push`. Use `string` or `buffer` to get the contents of a rope, or write it "
+              "to a stream with `ev/write` or `net/write`.") {
+    JanetRope *rope = janet_rope();
+    for (int32_t i = 0; i < argc; i++) {
+        janet_rope_push(rope, argv[i]);
+    }
+    return janet_wrap_abstract(rope);
+}
+
+JANET_CORE_FN(cfun_rope_push,
+              "(rope/push rope & xs)",
+              "Push strings, buffers, or the contents of other ropes to the end of a rope. "
+              "Buffers are never copied, so a buffer that changes after it is pushed also "
+              "changes the rope. Returns the modified rope.") {
+    janet_arity(argc, 1, -1);
+    JanetRope *rope = janet_getabstract(argv, 0, &janet_rope_type);
+    for (int32_t i = 1; i < argc; i++) {
+        janet_rope_push(rope, argv[i]);
+    }
+    return argv[0];
+}
+
+JANET_CORE_FN(cfun_rope_length,
+              "(rope/length rope)",
+              "Get the number of bytes in a rope. Unlike `length`, works for ropes larger "
+              "than the largest buffer.") {
+    janet_fixarity(argc, 1);
+    JanetRope *rope = janet_getabstract(argv, 0, &janet_rope_type);
+    return janet_wrap_number((double) janet_rope_length(rope));
+}
+
+JANET_CORE_FN(cfun_rope_clear,
+              "(rope/clear rope)",
+              "Remove everything from a rope. Returns the modified rope.") {
+    janet_fixarity(argc, 1);
+    JanetRope *rope = janet_getabstract(argv, 0, &janet_rope_type);
+    rope->count = 0;
+    rope->tail = -1;
+    return argv[0];
+}
+
+void janet_lib_rope(JanetTable *env) {
+    JanetRegExt rope_cfuns[] = {
+        JANET_CORE_REG("rope/new", cfun_rope_new),
+        JANET_CORE_REG("rope/push", cfun_rope_push),
+        JANET_CORE_REG("rope/length", cfun_rope_length),
+        JANET_CORE_REG("rope/clear", cfun_rope_clear),
+        JANET_REG_END
+    };
+    janet_core_cfuns_ext(env, NULL, rope_cfuns);
+    janet_register_abstract_type(&janet_rope_type);
+}
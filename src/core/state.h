@@ -48,6 +48,47 @@ typedef struct {
     int32_t index2;
 } JanetTraversalNode;
 
+#ifdef JANET_GC_SLAB
+/* Number of size classes for small gc objects */
+#define JANET_SLAB_CLASSES 16
+typedef struct JanetSlabPage JanetSlabPage;
+typedef struct JanetSlabChunk JanetSlabChunk;
+#endif
+
+#ifdef JANET_LAZY_IMAGE
+/* A funcdef from an image whose body has not been decoded yet. The owner keeps
+ * the image bytes alive, and is nil for images with static storage. */
+typedef struct {
+    JanetFuncDef *def;
+    Janet owner;
+    const uint8_t *body;
+    size_t len;
+} JanetLazyDef;
+#endif
+
+#ifdef JANET_METHOD_CACHE
+/* The method cache for the call sites of a funcdef, see vm.c */
+typedef struct JanetMethodCache JanetMethodCache;
+typedef struct {
+    JanetFuncDef *def;
+    JanetMethodCache *cache;
+} JanetMethodCacheSlot;
+#endif
+
+/* A cached dynamic binding lookup. Valid while env is the environment being
+ * looked up and lookup_epoch has not changed. cname is the C string the entry
+ * was filled from by janet_dyn, or NULL. The value is not marked, it is kept
+ * alive by the table that holds it. The name is not marked either, entries are
+ * cleared when their keyword is freed. */
+#define JANET_DYN_CACHE_SIZE 64
+typedef struct {
+    JanetTable *env;
+    const uint8_t *name;
+    const char *cname;
+    uint64_t epoch;
+    Janet value;
+} JanetDynCacheEntry;
+
 typedef struct {
     int32_t capacity;
     int32_t head;
@@ -56,19 +97,29 @@ typedef struct {
 } JanetQueue;
 
 #ifdef JANET_EV
-typedef struct {
+typedef struct JanetTimeout JanetTimeout;
+struct JanetTimeout {
     JanetTimestamp when;
     JanetFiber *fiber;
     JanetFiber *curr_fiber;
     uint32_t sched_id;
     int is_error;
-    int has_worker;
-#ifdef JANET_WINDOWS
-    HANDLE worker;
-#else
-    pthread_t worker;
-#endif
-} JanetTimeout;
+    int32_t wheel_index; /* level * JANET_WHEEL_SLOTS + slot, or -1 if not in the wheel */
+    void *watchdog; /* Entry with the shared watchdog thread for interrupting deadlines */
+    JanetTimeout *next;
+    JanetTimeout *prev;
+};
+
+/* Hierarchical timing wheel with millisecond ticks. Level n slots are
+ * JANET_WHEEL_SLOTS^n milliseconds wide, enough levels to cover any timestamp. */
+#define JANET_WHEEL_BITS 6
+#define JANET_WHEEL_SLOTS (1 << JANET_WHEEL_BITS)
+#define JANET_WHEEL_LEVELS 11
+typedef struct {
+    JanetTimestamp elapsed;
+    uint64_t occupied[JANET_WHEEL_LEVELS];
+    JanetTimeout *slots[JANET_WHEEL_LEVELS][JANET_WHEEL_SLOTS];
+} JanetTimerWheel;
 #endif
 
 /* Registry table for C functions - contains metadata that can
@@ -129,15 +180,66 @@ struct JanetVM {
     uint32_t cache_count;
     uint32_t cache_deleted;
     uint8_t gensym_counter[8];
+#ifdef JANET_SYMBOL_POOL
+    struct JanetSymbolPool *symbol_pool;
+    int symbol_pool_building;
+#endif
 
     /* Garbage collection */
     void *blocks;
+    void *old_blocks;
     void *weak_blocks;
     size_t gc_interval;
     size_t next_collection;
     size_t block_count;
     int gc_suspend;
     int gc_mark_phase;
+    int gc_generational;
+    size_t gc_old_count;
+    size_t gc_old_limit;
+    JanetGCObject **gc_remembered;
+    size_t gc_remembered_count;
+    size_t gc_remembered_capacity;
+    int gc_cycle; /* Phase of an incremental collection in progress */
+    uint32_t gc_budget; /* Pause budget for incremental collection in microseconds, 0 to stop the world */
+    int32_t gc_barrier_mask;
+    int32_t gc_barrier_match;
+    Janet *gc_gray;
+    size_t gc_gray_count;
+    size_t gc_gray_capacity;
+    JanetGCObject **gc_rescan;
+    size_t gc_rescan_count;
+    size_t gc_rescan_capacity;
+    void *sweep_blocks; /* Blocks waiting for an incremental sweep */
+    void *sweep_old_blocks;
+#ifdef JANET_GC_SLAB
+    JanetSlabPage *slab_pages[JANET_SLAB_CLASSES]; /* Pages with free slots, per size class */
+    JanetSlabPage *slab_free_pages;
+    JanetSlabChunk *slab_chunks;
+#endif
+
+#ifdef JANET_LAZY_IMAGE
+    /* Funcdefs waiting for their bodies, an open addressing map keyed on the def */
+    JanetLazyDef *lazy_defs;
+    uint32_t lazy_defs_count;
+    uint32_t lazy_defs_capacity;
+#endif
+
+#ifdef JANET_METHOD_CACHE
+    /* Method caches of funcdefs, an open addressing map keyed on the def */
+    JanetMethodCacheSlot *method_caches;
+    uint32_t method_caches_count;
+    uint32_t method_caches_capacity;
+#endif
+
+#ifdef JANET_JIT
+    /* Machine code of invalidated funcdefs, which may still be running */
+    JanetJit *jit_retired;
+#endif
+
+    /* Bumped whenever a table on a cached lookup path changes */
+    uint64_t lookup_epoch;
+    JanetDynCacheEntry dyn_cache[JANET_DYN_CACHE_SIZE];
 
     /* GC roots */
     Janet *roots;
@@ -168,14 +270,18 @@ struct JanetVM {
     /* Event loop and scheduler globals */
 #ifdef JANET_EV
     size_t tq_count;
-    size_t tq_capacity;
     JanetQueue spawn;
-    JanetTimeout *tq;
+    JanetTimerWheel *tq;
+    JanetTimeout *tq_free;
     JanetRNG ev_rng;
     volatile JanetAtomicInt listener_count; /* used in signal handler, must be volatile */
     JanetTable threaded_abstracts; /* All abstract types that can be shared between threads (used in this thread) */
     JanetTable active_tasks; /* All possibly live task fibers - used just for tracking */
     JanetTable signal_handlers;
+#ifndef JANET_WINDOWS
+    struct JanetRingQueue *posted; /* Events posted from any thread, drained on one self pipe wakeup */
+    JanetAtomicInt posted_signaled;
+#endif
 #ifdef JANET_WINDOWS
     void **iocp;
 #elif defined(JANET_EV_EPOLL)
@@ -184,6 +290,9 @@ struct JanetVM {
     int epoll;
     int timerfd;
     int timer_enabled;
+#ifdef JANET_EV_IO_URING
+    struct JanetRing *ring; /* NULL when using epoll */
+#endif
 #elif defined(JANET_EV_KQUEUE)
     pthread_attr_t new_thread_attr;
     JanetHandle selfpipe[2];
@@ -30,9 +30,10 @@
 
 /* Begin creation of a struct */
 JanetKV *janet_struct_begin(int32_t count) {
-    /* Calculate capacity as power of 2 after 2 * count. */
-    int32_t capacity = janet_tablen(2 * count);
-    if (capacity < 0) capacity = janet_tablen(count + 1);
+    /* Calculate capacity as power of 2 after 1.5 * count. Robinhood hashing
+     * keeps probes short at that load, and records are half the size. */
+    int32_t capacity = janet_tablen(count + (count >> 1));
+    if (capacity <= 0) capacity = janet_tablen(count + 1);
 
     size_t size = sizeof(JanetStructHead) + (size_t) capacity * sizeof(JanetKV);
     JanetStructHead *head = janet_gcalloc(JANET_MEMORY_STRUCT, size);
@@ -61,6 +62,20 @@ const JanetKV *janet_struct_find(const JanetKV *st, Janet key) {
     return NULL;
 }
 
+/* Like janet_struct_find, for a keyword or symbol key */
+static const JanetKV *janet_struct_find_interned(const JanetKV *st, Janet key) {
+    int32_t cap = janet_struct_capacity(st);
+    int32_t index = janet_maphash(cap, janet_string_hash(janet_unwrap_string(key)));
+    int32_t i;
+    for (i = index; i < cap; i++)
+        if (janet_checktype(st[i].key, JANET_NIL) || janet_interned_equals(st[i].key, key))
+            return st + i;
+    for (i = 0; i < index; i++)
+        if (janet_checktype(st[i].key, JANET_NIL) || janet_interned_equals(st[i].key, key))
+            return st + i;
+    return NULL;
+}
+
 /* Put a kv pair into a struct that has not yet been fully constructed.
  * Nil keys and values are ignored, extra keys are ignore, and duplicate keys are
  * ignored.
@@ -177,6 +192,17 @@ Janet janet_struct_get(const JanetKV *st, Janet key) {
     return janet_wrap_nil();
 }
 
+/* Get an item from a struct for a keyword or symbol key */
+Janet janet_struct_get_interned(const JanetKV *st, Janet key) {
+    for (int i = JANET_MAX_PROTO_DEPTH; st && i; --i, st = janet_struct_proto(st)) {
+        const JanetKV *kv = janet_struct_find_interned(st, key);
+        if (NULL != kv && !janet_checktype(kv->key, JANET_NIL)) {
+            return kv->value;
+        }
+    }
+    return janet_wrap_nil();
+}
+
 /* Get an item from a struct, and record which prototype the item came from. */
 Janet janet_struct_get_ex(const JanetKV *st, Janet key, JanetStruct *which) {
     for (int i = JANET_MAX_PROTO_DEPTH; st && i; --i, st = janet_struct_proto(st)) {
@@ -36,6 +36,166 @@
 
 #include <string.h>
 
+#ifdef JANET_SYMBOL_POOL
+
+/* The symbols interned while the first vm loads the core environment go in a
+ * pool shared by every vm in the process. Once that environment is loaded the
+ * pool is frozen, so other vms can look in it without locking. Pooled symbols
+ * are allocated outside of any vm's heap and are always marked as reachable, so
+ * the garbage collectors never write to them. The lock only guards taking and
+ * releasing references to the pool, which is freed with the last vm using it. */
+struct JanetSymbolPool {
+    const uint8_t **slots;
+    uint32_t capacity;
+    uint32_t count;
+    int32_t refcount;
+};
+
+static JanetSymbolPool *janet_symbol_pool = NULL;
+static int janet_symbol_pool_ready = 0;
+
+#ifdef JANET_WINDOWS
+static SRWLOCK janet_symbol_pool_lock = SRWLOCK_INIT;
+#define janet_symbol_pool_acquire() AcquireSRWLockExclusive(&janet_symbol_pool_lock)
+#define janet_symbol_pool_release() ReleaseSRWLockExclusive(&janet_symbol_pool_lock)
+#else
+static pthread_mutex_t janet_symbol_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define janet_symbol_pool_acquire() pthread_mutex_lock(&janet_symbol_pool_lock)
+#define janet_symbol_pool_release() pthread_mutex_unlock(&janet_symbol_pool_lock)
+#endif
+
+/* Find a symbol in the pool, or the empty slot where it would go. */
+static const uint8_t **janet_symbol_pool_findmem(
+    JanetSymbolPool *pool,
+    const uint8_t *str,
+    int32_t len,
+    int32_t hash) {
+    uint32_t mask = pool->capacity - 1;
+    uint32_t i = (uint32_t) hash & mask;
+    for (;;) {
+        const uint8_t *test = pool->slots[i];
+        if (NULL == test || janet_string_equalconst(test, str, len, hash)) {
+            return pool->slots + i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static void janet_symbol_pool_resize(JanetSymbolPool *pool, uint32_t capacity) {
+    const uint8_t **old = pool->slots;
+    uint32_t old_capacity = pool->capacity;
+    pool->slots = janet_calloc(1, (size_t) capacity * sizeof(const uint8_t *));
+    if (NULL == pool->slots) {
+        JANET_OUT_OF_MEMORY;
+    }
+    pool->capacity = capacity;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        const uint8_t *x = old[i];
+        if (NULL != x) {
+            *janet_symbol_pool_findmem(pool, x, janet_string_length(x), janet_string_hash(x)) = x;
+        }
+    }
+    janet_free((void *) old);
+}
+
+/* Add a new symbol to the pool. Only the vm building the pool calls this. */
+static const uint8_t *janet_symbol_pool_put(
+    JanetSymbolPool *pool,
+    const uint8_t *str,
+    int32_t len,
+    int32_t hash,
+    const uint8_t **slot) {
+    if ((pool->count + 1) * 2 > pool->capacity) {
+        janet_symbol_pool_resize(pool, pool->capacity * 2);
+        slot = janet_symbol_pool_findmem(pool, str, len, hash);
+    }
+    JanetStringHead *head = janet_malloc(sizeof(JanetStringHead) + (size_t) len + 1);
+    if (NULL == head) {
+        JANET_OUT_OF_MEMORY;
+    }
+    head->gc.flags = JANET_MEMORY_SYMBOL | JANET_MEM_REACHABLE | JANET_MEM_SHARED;
+    head->gc.data.next = NULL;
+    head->hash = hash;
+    head->length = len;
+    uint8_t *newstr = (uint8_t *)(head->data);
+    safe_memcpy(newstr, str, len);
+    newstr[len] = 0;
+    pool->count++;
+    *slot = newstr;
+    return newstr;
+}
+
+static void janet_symbol_pool_free(JanetSymbolPool *pool) {
+    for (uint32_t i = 0; i < pool->capacity; i++) {
+        if (NULL != pool->slots[i]) {
+            janet_free(janet_string_head(pool->slots[i]));
+        }
+    }
+    janet_free((void *) pool->slots);
+    janet_free(pool);
+}
+
+/* Start building the pool if no other vm has. */
+void janet_symbol_pool_begin(void) {
+    if (NULL != janet_vm.symbol_pool) return;
+    janet_symbol_pool_acquire();
+    if (NULL == janet_symbol_pool) {
+        JanetSymbolPool *pool = janet_malloc(sizeof(JanetSymbolPool));
+        if (NULL == pool) {
+            JANET_OUT_OF_MEMORY;
+        }
+        pool->capacity = 4096;
+        pool->count = 0;
+        pool->refcount = 1;
+        pool->slots = janet_calloc(1, (size_t) pool->capacity * sizeof(const uint8_t *));
+        if (NULL == pool->slots) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_symbol_pool = pool;
+        janet_vm.symbol_pool = pool;
+        janet_vm.symbol_pool_building = 1;
+    }
+    janet_symbol_pool_release();
+}
+
+/* Freeze the pool and let new vms use it. */
+void janet_symbol_pool_end(void) {
+    if (!janet_vm.symbol_pool_building) return;
+    janet_vm.symbol_pool_building = 0;
+    janet_symbol_pool_acquire();
+    janet_symbol_pool_ready = 1;
+    janet_symbol_pool_release();
+}
+
+/* Get the slot of a pooled symbol, used to refer to it when marshalling
+ * between threads. Returns -1 if the symbol is not pooled. */
+int32_t janet_symbol_pool_index(const uint8_t *sym) {
+    JanetSymbolPool *pool = janet_vm.symbol_pool;
+    if (NULL == pool || !(janet_string_head(sym)->gc.flags & JANET_MEM_SHARED)) return -1;
+    uint32_t mask = pool->capacity - 1;
+    uint32_t i = (uint32_t) janet_string_hash(sym) & mask;
+    while (NULL != pool->slots[i]) {
+        if (pool->slots[i] == sym) return (int32_t) i;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+/* Get a symbol from its slot in the pool. The bytes are checked, as the sender may
+ * have used a different pool, and then the symbol is interned as usual. */
+const uint8_t *janet_symbol_pooled(int32_t index, const uint8_t *str, int32_t len) {
+    JanetSymbolPool *pool = janet_vm.symbol_pool;
+    if (NULL != pool && index >= 0 && (uint32_t) index < pool->capacity) {
+        const uint8_t *sym = pool->slots[index];
+        if (NULL != sym && janet_string_length(sym) == len && !memcmp(sym, str, len)) {
+            return sym;
+        }
+    }
+    return janet_symbol(str, len);
+}
+
+#endif
+
 /* Initialize the cache (allocate cache memory) */
 void janet_symcache_init() {
     janet_vm.cache_capacity = 1024;
@@ -47,6 +207,16 @@ void janet_symcache_init() {
     janet_vm.gensym_counter[0] = '_';
     janet_vm.cache_count = 0;
     janet_vm.cache_deleted = 0;
+#ifdef JANET_SYMBOL_POOL
+    janet_vm.symbol_pool = NULL;
+    janet_vm.symbol_pool_building = 0;
+    janet_symbol_pool_acquire();
+    if (janet_symbol_pool_ready) {
+        janet_symbol_pool->refcount++;
+        janet_vm.symbol_pool = janet_symbol_pool;
+    }
+    janet_symbol_pool_release();
+#endif
 }
 
 /* Deinitialize the cache (free the cache memory) */
@@ -56,6 +226,22 @@ void janet_symcache_deinit() {
     janet_vm.cache_capacity = 0;
     janet_vm.cache_count = 0;
     janet_vm.cache_deleted = 0;
+#ifdef JANET_SYMBOL_POOL
+    JanetSymbolPool *pool = janet_vm.symbol_pool;
+    if (NULL != pool) {
+        janet_symbol_pool_acquire();
+        if (--pool->refcount == 0) {
+            janet_symbol_pool = NULL;
+            janet_symbol_pool_ready = 0;
+        } else {
+            pool = NULL;
+        }
+        janet_symbol_pool_release();
+        if (NULL != pool) janet_symbol_pool_free(pool);
+        janet_vm.symbol_pool = NULL;
+        janet_vm.symbol_pool_building = 0;
+    }
+#endif
 }
 
 /* Mark an entry in the table as deleted. */
@@ -166,6 +352,16 @@ void janet_symbol_deinit(const uint8_t *sym) {
         janet_vm.cache_deleted++;
         *bucket = JANET_SYMCACHE_DELETED;
     }
+    /* The dynamic binding cache does not keep its keywords alive, and
+     * janet_dyn compares an entry's name by contents. */
+    for (int i = 0; i < JANET_DYN_CACHE_SIZE; i++) {
+        JanetDynCacheEntry *e = janet_vm.dyn_cache + i;
+        if (e->name == sym) {
+            e->env = NULL;
+            e->name = NULL;
+            e->cname = NULL;
+        }
+    }
 }
 
 /* Create a symbol from a byte string */
@@ -173,9 +369,26 @@ const uint8_t *janet_symbol(const uint8_t *str, int32_t len) {
     int32_t hash = janet_string_calchash(str, len);
     uint8_t *newstr;
     int success = 0;
+#ifdef JANET_SYMBOL_POOL
+    JanetSymbolPool *pool = janet_vm.symbol_pool;
+    const uint8_t **slot = NULL;
+    if (NULL != pool) {
+        slot = janet_symbol_pool_findmem(pool, str, len, hash);
+        if (NULL != *slot) return *slot;
+    }
+#endif
     const uint8_t **bucket = janet_symcache_findmem(str, len, hash, &success);
-    if (success)
+    if (success) {
+        /* During an incremental collection, the symbol may be unreachable
+         * and waiting to be swept, so keep it alive now that it is used again. */
+        if (janet_vm.gc_cycle) janet_gc_mark(janet_string_head(*bucket));
         return *bucket;
+    }
+#ifdef JANET_SYMBOL_POOL
+    if (janet_vm.symbol_pool_building) {
+        return janet_symbol_pool_put(pool, str, len, hash, slot);
+    }
+#endif
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_SYMBOL, sizeof(JanetStringHead) + (size_t) len + 1);
     head->hash = hash;
     head->length = len;
@@ -228,6 +441,15 @@ const uint8_t *janet_symbol_gen(void) {
                      sizeof(janet_vm.gensym_counter) - 1,
                      hash,
                      &status);
+#ifdef JANET_SYMBOL_POOL
+        if (!status && NULL != janet_vm.symbol_pool) {
+            status = NULL != *janet_symbol_pool_findmem(
+                         janet_vm.symbol_pool,
+                         janet_vm.gensym_counter,
+                         sizeof(janet_vm.gensym_counter) - 1,
+                         hash);
+        }
+#endif
     } while (status && (inc_gensym(), 1));
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_SYMBOL, sizeof(JanetStringHead) + sizeof(janet_vm.gensym_counter));
     head->length = sizeof(janet_vm.gensym_counter) - 1;
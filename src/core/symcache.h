@@ -33,4 +33,17 @@ void janet_symcache_init(void);
 void janet_symcache_deinit(void);
 void janet_symbol_deinit(const uint8_t *sym);
 
+/* Symbols interned between janet_symbol_pool_begin and janet_symbol_pool_end
+ * by the first vm to load the core environment are shared with other vms. */
+#ifdef JANET_SYMBOL_POOL
+typedef struct JanetSymbolPool JanetSymbolPool;
+void janet_symbol_pool_begin(void);
+void janet_symbol_pool_end(void);
+int32_t janet_symbol_pool_index(const uint8_t *sym);
+const uint8_t *janet_symbol_pooled(int32_t index, const uint8_t *str, int32_t len);
+#else
+#define janet_symbol_pool_begin() ((void) 0)
+#define janet_symbol_pool_end() ((void) 0)
+#endif
+
 #endif
@@ -28,34 +28,163 @@
 #include <math.h>
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JANET_TABLE_SSE2
+#endif
+
 #define JANET_TABLE_FLAG_STACK 0x10000
 
-static void *janet_memalloc_empty_local(int32_t count) {
-    int32_t i;
-    void *mem = janet_smalloc((size_t) count * sizeof(JanetKV));
-    JanetKV *mmem = (JanetKV *)mem;
-    for (i = 0; i < count; i++) {
-        JanetKV *kv = mmem + i;
-        kv->key = janet_wrap_nil();
-        kv->value = janet_wrap_nil();
+/* After its buckets, a table keeps one control byte per bucket. A full bucket
+ * stores the top 7 bits of its key's hash, so a lookup can test a whole group
+ * of buckets at once and only calls janet_equals on likely matches. Buckets
+ * are still placed by linear probing, so janet_dict_find and
+ * janet_dictionary_get keep working on table data. The control bytes past the
+ * capacity repeat the first ones, so that a group never has to wrap around. */
+#define JANET_CTRL_EMPTY 0x80
+#define JANET_CTRL_DELETED 0xFE
+#define janet_ctrl_h2(hash) ((uint8_t)((hash) >> 25))
+#define janet_table_ctrl(t) ((uint8_t *)((t)->data + (t)->capacity))
+#ifdef JANET_TABLE_SSE2
+#define JANET_GROUP_WIDTH 16
+#else
+#define JANET_GROUP_WIDTH 8
+#endif
+
+/* Load the bucket a lookup will most likely end at alongside its control
+ * bytes, which live in a different cache line. */
+#ifdef __GNUC__
+#define janet_table_prefetch(p) __builtin_prefetch(p)
+#else
+#define janet_table_prefetch(p) ((void) 0)
+#endif
+
+/* Fallback for when ctz not available */
+#ifdef __GNUC__
+#define janet_group_ctz(x) __builtin_ctz(x)
+#else
+static int janet_group_ctz(uint32_t x) {
+    int ret = 0;
+    while (!(x & 1)) {
+        ret++;
+        x >>= 1;
     }
-    return mem;
+    return ret;
 }
+#endif
 
-static JanetTable *janet_table_init_impl(JanetTable *table, int32_t capacity, int stackalloc) {
+/* Find buckets in the group starting at ctrl whose control byte is h2, and
+ * empty buckets. Bit i of each mask is set for the ith bucket of the group. */
+static void janet_group_match(const uint8_t *ctrl, uint8_t h2, uint32_t *match, uint32_t *empty) {
+#ifdef JANET_TABLE_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+    *match = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) h2)));
+    *empty = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) JANET_CTRL_EMPTY)));
+#else
+    uint32_t m = 0, e = 0;
+    for (int i = 0; i < JANET_GROUP_WIDTH; i++) {
+        if (ctrl[i] == h2) m |= (uint32_t) 1 << i;
+        if (ctrl[i] == JANET_CTRL_EMPTY) e |= (uint32_t) 1 << i;
+    }
+    *match = m;
+    *empty = e;
+#endif
+}
+
+static size_t janet_table_datasize(int32_t capacity) {
+    if (!capacity) return 0;
+    return (size_t) capacity * (sizeof(JanetKV) + 1) + JANET_GROUP_WIDTH;
+}
+
+static JanetKV *janet_table_alloc(int32_t capacity, int islocal) {
+    size_t size = janet_table_datasize(capacity);
     JanetKV *data;
+    if (islocal) {
+        data = janet_smalloc(size);
+    } else {
+        data = janet_malloc(size);
+        if (NULL == data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.next_collection += size;
+    }
+    janet_memempty(data, capacity);
+    memset(data + capacity, JANET_CTRL_EMPTY, (size_t) capacity + JANET_GROUP_WIDTH);
+    return data;
+}
+
+/* Set the control byte of a bucket and its copies */
+static void janet_table_setctrl(JanetTable *t, int32_t index, uint8_t c) {
+    uint8_t *ctrl = janet_table_ctrl(t);
+    for (int32_t i = index; i < t->capacity + JANET_GROUP_WIDTH; i += t->capacity) {
+        ctrl[i] = c;
+    }
+}
+
+/* Recompute all control bytes, for tables whose buckets were written
+ * directly instead of through janet_table_put. */
+static void janet_table_syncctrl(JanetTable *t) {
+    for (int32_t i = 0; i < t->capacity; i++) {
+        JanetKV *kv = t->data + i;
+        uint8_t c;
+        if (!janet_checktype(kv->key, JANET_NIL)) {
+            c = janet_ctrl_h2((uint32_t) janet_hash(kv->key));
+        } else if (janet_checktype(kv->value, JANET_NIL)) {
+            c = JANET_CTRL_EMPTY;
+        } else {
+            c = JANET_CTRL_DELETED;
+        }
+        janet_table_setctrl(t, i, c);
+    }
+}
+
+/* Find the bucket with the given key, or the empty bucket it would go in.
+ * Returns NULL if there is neither. Interned keys are compared by identity. */
+static JanetKV *janet_table_find_impl(JanetTable *t, Janet key, uint32_t hash, int interned) {
+    int32_t cap = t->capacity;
+    if (!cap) return NULL;
+    uint32_t mask = (uint32_t) cap - 1;
+    uint32_t index = hash & mask;
+    uint8_t h2 = janet_ctrl_h2(hash);
+    const uint8_t *ctrl = janet_table_ctrl(t);
+    janet_table_prefetch(t->data + index);
+    for (int32_t scanned = 0; scanned < cap; scanned += JANET_GROUP_WIDTH) {
+        uint32_t match, empty;
+        janet_group_match(ctrl + index, h2, &match, &empty);
+        /* Only buckets before the first empty one are part of the probe */
+        if (empty) match &= (empty & (0u - empty)) - 1;
+        while (match) {
+            JanetKV *kv = t->data + ((index + (uint32_t) janet_group_ctz(match)) & mask);
+            if (interned ? janet_interned_equals(kv->key, key) : janet_equals(kv->key, key)) return kv;
+            match &= match - 1;
+        }
+        if (empty) {
+            JanetKV *kv = t->data + ((index + (uint32_t) janet_group_ctz(empty)) & mask);
+            if (janet_checktype(kv->key, JANET_NIL)) return kv;
+            janet_table_syncctrl(t);
+            return janet_table_find_impl(t, key, hash, interned);
+        }
+        index = (index + JANET_GROUP_WIDTH) & mask;
+    }
+    return NULL;
+}
+
+#define janet_table_find_hash(t, key, hash) janet_table_find_impl((t), (key), (hash), 0)
+
+/* Turn a bucket into a tombstone without searching for it */
+void janet_table_tombstone(JanetTable *t, JanetKV *kv) {
+    t->count--;
+    t->deleted++;
+    kv->key = janet_wrap_nil();
+    kv->value = janet_wrap_false();
+    janet_table_setctrl(t, (int32_t)(kv - t->data), JANET_CTRL_DELETED);
+}
+
+static JanetTable *janet_table_init_impl(JanetTable *table, int32_t capacity, int stackalloc) {
     capacity = janet_tablen(capacity);
     if (stackalloc) table->gc.flags = JANET_TABLE_FLAG_STACK;
     if (capacity) {
-        if (stackalloc) {
-            data = janet_memalloc_empty_local(capacity);
-        } else {
-            data = (JanetKV *) janet_memalloc_empty(capacity);
-            if (NULL == data) {
-                JANET_OUT_OF_MEMORY;
-            }
-        }
-        table->data = data;
+        table->data = janet_table_alloc(capacity, stackalloc);
         table->capacity = capacity;
     } else {
         table->data = NULL;
@@ -74,6 +203,7 @@ JanetTable *janet_table_init(JanetTable *table, int32_t capacity) {
 
 /* Initialize a table without using scratch memory */
 JanetTable *janet_table_init_raw(JanetTable *table, int32_t capacity) {
+    table->gc.flags = 0;
     return janet_table_init_impl(table, capacity, 0);
 }
 
@@ -111,31 +241,34 @@ JanetTable *janet_table_weakkv(int32_t capacity) {
 /* Find the bucket that contains the given key. Will also return
  * bucket where key should go if not in the table. */
 JanetKV *janet_table_find(JanetTable *t, Janet key) {
-    return (JanetKV *) janet_dict_find(t->data, t->capacity, key);
+    return janet_table_find_hash(t, key, (uint32_t) janet_hash(key));
+}
+
+/* Fill an empty bucket */
+static void janet_table_fill(JanetTable *t, JanetKV *bucket, Janet key, Janet value, uint32_t hash) {
+    if (janet_checktype(bucket->value, JANET_BOOLEAN))
+        --t->deleted;
+    bucket->key = key;
+    bucket->value = value;
+    janet_table_setctrl(t, (int32_t)(bucket - t->data), janet_ctrl_h2(hash));
+    ++t->count;
 }
 
 /* Resize the dictionary table. */
 static void janet_table_rehash(JanetTable *t, int32_t size) {
     JanetKV *olddata = t->data;
-    JanetKV *newdata;
     int islocal = t->gc.flags & JANET_TABLE_FLAG_STACK;
-    if (islocal) {
-        newdata = (JanetKV *) janet_memalloc_empty_local(size);
-    } else {
-        newdata = (JanetKV *) janet_memalloc_empty(size);
-        if (NULL == newdata) {
-            JANET_OUT_OF_MEMORY;
-        }
-    }
     int32_t oldcapacity = t->capacity;
-    t->data = newdata;
+    t->data = janet_table_alloc(size, islocal);
     t->capacity = size;
     t->deleted = 0;
     for (int32_t i = 0; i < oldcapacity; i++) {
         JanetKV *kv = olddata + i;
         if (!janet_checktype(kv->key, JANET_NIL)) {
-            JanetKV *newkv = janet_table_find(t, kv->key);
+            uint32_t hash = (uint32_t) janet_hash(kv->key);
+            JanetKV *newkv = janet_table_find_hash(t, kv->key, hash);
             *newkv = *kv;
+            janet_table_setctrl(t, (int32_t)(newkv - t->data), janet_ctrl_h2(hash));
         }
     }
     if (islocal) {
@@ -147,8 +280,20 @@ static void janet_table_rehash(JanetTable *t, int32_t size) {
 
 /* Get a value out of the table */
 Janet janet_table_get(JanetTable *t, Janet key) {
+    uint32_t hash = (uint32_t) janet_hash(key);
+    for (int i = JANET_MAX_PROTO_DEPTH; t && i; t = t->proto, --i) {
+        JanetKV *bucket = janet_table_find_hash(t, key, hash);
+        if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL))
+            return bucket->value;
+    }
+    return janet_wrap_nil();
+}
+
+/* Get a value out of the table for a keyword or symbol key */
+Janet janet_table_get_interned(JanetTable *t, Janet key) {
+    uint32_t hash = (uint32_t) janet_string_hash(janet_unwrap_string(key));
     for (int i = JANET_MAX_PROTO_DEPTH; t && i; t = t->proto, --i) {
-        JanetKV *bucket = janet_table_find(t, key);
+        JanetKV *bucket = janet_table_find_impl(t, key, hash, 1);
         if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL))
             return bucket->value;
     }
@@ -157,8 +302,9 @@ Janet janet_table_get(JanetTable *t, Janet key) {
 
 /* Get a value out of the table, and record which prototype it was from. */
 Janet janet_table_get_ex(JanetTable *t, Janet key, JanetTable **which) {
+    uint32_t hash = (uint32_t) janet_hash(key);
     for (int i = JANET_MAX_PROTO_DEPTH; t && i; t = t->proto, --i) {
-        JanetKV *bucket = janet_table_find(t, key);
+        JanetKV *bucket = janet_table_find_hash(t, key, hash);
         if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
             *which = t;
             return bucket->value;
@@ -176,16 +322,32 @@ Janet janet_table_rawget(JanetTable *t, Janet key) {
         return janet_wrap_nil();
 }
 
+/* Watch the tables on the prototype chain from t up to and including last, or
+ * the whole chain if last is NULL, so that changing or freeing any of them
+ * invalidates cached lookups. Returns 0 and watches nothing if the chain
+ * passes through a weak table. */
+int janet_table_watch(JanetTable *t, JanetTable *last) {
+    JanetTable *start = t;
+    for (int i = JANET_MAX_PROTO_DEPTH; t && i; t = t->proto, --i) {
+        if (janet_gc_type(t) != JANET_MEMORY_TABLE) return 0;
+        if (t == last) break;
+    }
+    t = start;
+    for (int i = JANET_MAX_PROTO_DEPTH; t && i; t = t->proto, --i) {
+        t->gc.flags |= JANET_TABLE_FLAG_WATCHED;
+        if (t == last) break;
+    }
+    return 1;
+}
+
 /* Remove an entry from the dictionary. Return the value that
  * was removed. */
 Janet janet_table_remove(JanetTable *t, Janet key) {
     JanetKV *bucket = janet_table_find(t, key);
     if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
         Janet ret = bucket->value;
-        t->count--;
-        t->deleted++;
-        bucket->key = janet_wrap_nil();
-        bucket->value = janet_wrap_false();
+        janet_table_touch(t);
+        janet_table_tombstone(t, bucket);
         return ret;
     } else {
         return janet_wrap_nil();
@@ -199,19 +361,18 @@ void janet_table_put(JanetTable *t, Janet key, Janet value) {
     if (janet_checktype(value, JANET_NIL)) {
         janet_table_remove(t, key);
     } else {
-        JanetKV *bucket = janet_table_find(t, key);
+        janet_gc_barrier(t);
+        janet_table_touch(t);
+        uint32_t hash = (uint32_t) janet_hash(key);
+        JanetKV *bucket = janet_table_find_hash(t, key, hash);
         if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL)) {
             bucket->value = value;
         } else {
             if (NULL == bucket || 2 * (t->count + t->deleted + 1) > t->capacity) {
                 janet_table_rehash(t, janet_tablen(2 * t->count + 2));
+                bucket = janet_table_find_hash(t, key, hash);
             }
-            bucket = janet_table_find(t, key);
-            if (janet_checktype(bucket->value, JANET_BOOLEAN))
-                --t->deleted;
-            bucket->key = key;
-            bucket->value = value;
-            ++t->count;
+            janet_table_fill(t, bucket, key, value, hash);
         }
     }
 }
@@ -219,25 +380,27 @@ void janet_table_put(JanetTable *t, Janet key, Janet value) {
 /* Used internally so don't check arguments
  * Put into a table, but if the key already exists do nothing. */
 static void janet_table_put_no_overwrite(JanetTable *t, Janet key, Janet value) {
-    JanetKV *bucket = janet_table_find(t, key);
+    uint32_t hash = (uint32_t) janet_hash(key);
+    JanetKV *bucket = janet_table_find_hash(t, key, hash);
     if (NULL != bucket && !janet_checktype(bucket->key, JANET_NIL))
         return;
+    janet_table_touch(t);
     if (NULL == bucket || 2 * (t->count + t->deleted + 1) > t->capacity) {
         janet_table_rehash(t, janet_tablen(2 * t->count + 2));
+        bucket = janet_table_find_hash(t, key, hash);
     }
-    bucket = janet_table_find(t, key);
-    if (janet_checktype(bucket->value, JANET_BOOLEAN))
-        --t->deleted;
-    bucket->key = key;
-    bucket->value = value;
-    ++t->count;
+    janet_table_fill(t, bucket, key, value, hash);
 }
 
 /* Clear a table */
 void janet_table_clear(JanetTable *t) {
     int32_t capacity = t->capacity;
     JanetKV *data = t->data;
-    janet_memempty(data, capacity);
+    janet_table_touch(t);
+    if (capacity) {
+        janet_memempty(data, capacity);
+        memset(data + capacity, JANET_CTRL_EMPTY, (size_t) capacity + JANET_GROUP_WIDTH);
+    }
     t->count = 0;
     t->deleted = 0;
 }
@@ -249,14 +412,35 @@ JanetTable *janet_table_clone(JanetTable *table) {
     newTable->capacity = table->capacity;
     newTable->deleted = table->deleted;
     newTable->proto = table->proto;
-    newTable->data = janet_malloc(newTable->capacity * sizeof(JanetKV));
+    size_t size = janet_table_datasize(table->capacity);
+    newTable->data = janet_malloc(size);
     if (NULL == newTable->data) {
         JANET_OUT_OF_MEMORY;
     }
-    memcpy(newTable->data, table->data, (size_t) table->capacity * sizeof(JanetKV));
+    safe_memcpy(newTable->data, table->data, size);
     return newTable;
 }
 
+/* Make a table a copy of another, like janet_table_clone but keeping the table
+ * and reusing its memory when the capacities match. */
+void janet_table_reset(JanetTable *t, JanetTable *other) {
+    size_t size = janet_table_datasize(other->capacity);
+    janet_gc_barrier(t);
+    janet_table_touch(t);
+    if (t->capacity != other->capacity) {
+        JanetKV *data = janet_realloc(t->data, size ? size : 1);
+        if (NULL == data) {
+            JANET_OUT_OF_MEMORY;
+        }
+        t->data = data;
+        t->capacity = other->capacity;
+    }
+    safe_memcpy(t->data, other->data, size);
+    t->count = other->count;
+    t->deleted = other->deleted;
+    t->proto = other->proto;
+}
+
 /* Merge a table or struct into a table */
 static void janet_table_mergekv(JanetTable *table, const JanetKV *kvs, int32_t cap) {
     int32_t i;
@@ -367,6 +551,8 @@ JANET_CORE_FN(cfun_table_setproto,
     if (!janet_checktype(argv[1], JANET_NIL)) {
         proto = janet_gettable(argv, 1);
     }
+    janet_gc_barrier(table);
+    janet_table_touch(table);
     table->proto = proto;
     return argv[0];
 }
@@ -59,11 +59,60 @@
 #endif
 
 #define JANET_MARSHAL_DECREF 0x40000
+#define JANET_MARSHAL_INCREF 0x100000
+void **janet_marshal_threaded(JanetBuffer *buf, Janet x, JanetTable *rreg, int flags, int32_t *count);
 
 #define janet_assert(c, m) do { \
     if (!(c)) JANET_EXIT((m)); \
 } while (0)
 
+/* Funcdefs loaded from a lazy image decode their bytecode, source map and symbol map
+ * on first use. Anything that reads those must call janet_funcdef_ensure first. */
+#ifdef JANET_LAZY_IMAGE
+#define janet_funcdef_ensure(def) do { \
+    if ((def)->flags & JANET_FUNCDEF_FLAG_LAZY) janet_funcdef_materialize(def); \
+} while (0)
+void janet_funcdef_materialize(JanetFuncDef *def);
+Janet janet_funcdef_lazy_owner(JanetFuncDef *def);
+void janet_funcdef_lazy_forget(JanetFuncDef *def);
+void janet_lazy_defs_deinit(void);
+#else
+#define janet_funcdef_ensure(def) ((void) 0)
+#endif
+
+/* Method caches of call sites, kept in a map keyed on the funcdef */
+#ifdef JANET_METHOD_CACHE
+void janet_method_cache_forget(JanetFuncDef *def);
+void janet_method_caches_deinit(void);
+#endif
+
+/* Functions are compiled to machine code after they have been called or gone
+ * around a loop JANET_JIT_THRESHOLD times. The machine code runs from any
+ * instruction it supports and returns the index of the first instruction the
+ * interpreter needs to run. */
+#ifdef JANET_JIT
+#ifndef JANET_JIT_THRESHOLD
+#define JANET_JIT_THRESHOLD 1000
+#endif
+struct JanetJit {
+    uint8_t *code;
+    size_t size;
+    JanetJit *next; /* Next retired code, see janet_jit_invalidate */
+    int32_t entries[]; /* Offset into code of each instruction, or 0 if not compiled */
+};
+#define janet_jit_tick(def) do { \
+    if ((def)->jit_counter >= 0 && ++(def)->jit_counter >= JANET_JIT_THRESHOLD) janet_jit_compile(def); \
+} while (0)
+void janet_jit_compile(JanetFuncDef *def);
+void janet_jit_invalidate(JanetFuncDef *def);
+void janet_jit_free(JanetFuncDef *def);
+void janet_jit_deinit(void);
+int32_t janet_jit_run(JanetJit *jit, Janet *stack, int32_t pc);
+#else
+#define janet_jit_tick(def) ((void) 0)
+#define janet_jit_invalidate(def) ((void) 0)
+#endif
+
 /* Utils */
 uint32_t janet_hash_mix(uint32_t input, uint32_t more);
 #define janet_maphash(cap, hash) ((uint32_t)(hash) & (cap - 1))
@@ -74,6 +123,23 @@ int32_t janet_array_calchash(const Janet *array, int32_t len);
 int32_t janet_kv_calchash(const JanetKV *kvs, int32_t len);
 int32_t janet_string_calchash(const uint8_t *str, int32_t len);
 int32_t janet_tablen(int32_t n);
+int janet_table_watch(JanetTable *t, JanetTable *last);
+void janet_table_tombstone(JanetTable *t, JanetKV *kv);
+void janet_table_reset(JanetTable *t, JanetTable *other);
+
+/* Keywords and symbols are interned, so they are equal only if they are the
+ * same object, and their hash is stored with them. */
+#define janet_checkinterned(x) (janet_checktype((x), JANET_KEYWORD) || janet_checktype((x), JANET_SYMBOL))
+#define janet_interned_equals(x, y) (janet_type(x) == janet_type(y) && \
+    janet_unwrap_pointer(x) == janet_unwrap_pointer(y))
+Janet janet_table_get_interned(JanetTable *t, Janet key);
+Janet janet_struct_get_interned(const JanetKV *st, Janet key);
+Janet janet_dyn_get(JanetTable *env, Janet key);
+JanetAtomicInt janet_atomic_add(JanetAtomicInt volatile *x, JanetAtomicInt delta);
+JanetAtomicInt janet_atomic_exchange(JanetAtomicInt volatile *x, JanetAtomicInt value);
+int janet_atomic_cas(JanetAtomicInt volatile *x, JanetAtomicInt expected, JanetAtomicInt desired);
+void janet_atomic_store(JanetAtomicInt volatile *x, JanetAtomicInt value);
+void janet_atomic_fence(void);
 void safe_memcpy(void *dest, const void *src, size_t len);
 void janet_buffer_push_types(JanetBuffer *buffer, int types);
 const JanetKV *janet_dict_find(const JanetKV *buckets, int32_t cap, Janet key);
@@ -102,6 +168,19 @@ JanetByteView janet_text_substitution(
     uint32_t len,
     JanetArray *extra_args);
 
+/* Ropes hold strings and buffers that are written out together. Chunks are
+ * strings, symbols, keywords, or buffers. */
+typedef struct {
+    Janet *chunks;
+    int32_t count;
+    int32_t capacity;
+    int32_t tail; /* Last chunk if small pieces can be copied into it, or -1 */
+} JanetRope;
+extern const JanetAbstractType janet_rope_type;
+void janet_rope_push(JanetRope *rope, Janet x);
+size_t janet_rope_length(JanetRope *rope);
+void janet_rope_flatten(JanetRope *rope, JanetBuffer *buffer);
+
 /* Registry functions */
 void janet_registry_put(
     JanetCFunction key,
@@ -182,6 +261,7 @@ void janet_lib_os(JanetTable *env);
 void janet_lib_string(JanetTable *env);
 void janet_lib_marsh(JanetTable *env);
 void janet_lib_parse(JanetTable *env);
+void janet_lib_rope(JanetTable *env);
 #ifdef JANET_ASSEMBLER
 void janet_lib_asm(JanetTable *env);
 #endif
@@ -202,6 +282,16 @@ void janet_lib_ev(JanetTable *env);
 void janet_ev_mark(void);
 void janet_async_start_fiber(JanetFiber *fiber, JanetStream *stream, JanetAsyncMode mode, JanetEVCallback callback, void *state);
 int janet_make_pipe(JanetHandle handles[2], int mode);
+JANET_NO_RETURN void janet_ev_write_rope(JanetStream *stream, JanetRope *rope);
+#ifdef JANET_NET
+JANET_NO_RETURN void janet_ev_send_rope(JanetStream *stream, JanetRope *rope, int flags);
+#endif
+#ifdef JANET_EV_IO_URING
+struct io_uring_sqe;
+int janet_ev_uring_enabled(void);
+void janet_ev_uring_detach(JanetFiber *fiber);
+struct io_uring_sqe *janet_ev_uring_prep(JanetFiber *fiber, uint8_t opcode, int fd, int32_t *res);
+#endif
 #ifdef JANET_FILEWATCH
 void janet_lib_filewatch(JanetTable *env);
 #endif
@@ -146,9 +146,14 @@ Janet janet_next_impl(Janet ds, Janet key, int is_interpreter) {
                 start = st;
             }
             const JanetKV *end = start + cap;
-            const JanetKV *kv = janet_checktype(key, JANET_NIL)
-                                ? start
-                                : janet_dict_find(start, cap, key) + 1;
+            const JanetKV *kv;
+            if (janet_checktype(key, JANET_NIL)) {
+                kv = start;
+            } else if (t == JANET_TABLE) {
+                kv = janet_table_find(janet_unwrap_table(ds), key) + 1;
+            } else {
+                kv = janet_dict_find(start, cap, key) + 1;
+            }
             while (kv < end) {
                 if (!janet_checktype(kv->key, JANET_NIL)) return kv->key;
                 kv++;
@@ -334,10 +339,8 @@ int32_t janet_hash(Janet x) {
             } as;
             as.d = janet_unwrap_number(x);
             as.d += 0.0; /* normalize negative 0 */
-            uint32_t lo = (uint32_t)(as.u & 0xFFFFFFFF);
-            uint32_t hi = (uint32_t)(as.u >> 32);
-            uint32_t hilo = (hi ^ lo) * 2654435769u;
-            hash = (int32_t)((hilo << 16) | (hilo >> 16));
+            /* Integers have no low mantissa bits set, so mix all of them */
+            hash = (int32_t)(murmur64(as.u) >> 32);
             break;
         }
         case JANET_ABSTRACT: {
@@ -458,10 +461,14 @@ Janet janet_in(Janet ds, Janet key) {
             janet_panicf("expected %T, got %v", JANET_TFLAG_LENGTHABLE, ds);
             break;
         case JANET_STRUCT:
-            value = janet_struct_get(janet_unwrap_struct(ds), key);
+            value = janet_checkinterned(key)
+                    ? janet_struct_get_interned(janet_unwrap_struct(ds), key)
+                    : janet_struct_get(janet_unwrap_struct(ds), key);
             break;
         case JANET_TABLE:
-            value = janet_table_get(janet_unwrap_table(ds), key);
+            value = janet_checkinterned(key)
+                    ? janet_table_get_interned(janet_unwrap_table(ds), key)
+                    : janet_table_get(janet_unwrap_table(ds), key);
             break;
         case JANET_ARRAY: {
             JanetArray *array = janet_unwrap_array(ds);
@@ -556,10 +563,14 @@ Janet janet_get(Janet ds, Janet key) {
             }
         }
         case JANET_TABLE: {
+            if (janet_checkinterned(key))
+                return janet_table_get_interned(janet_unwrap_table(ds), key);
             return janet_table_get(janet_unwrap_table(ds), key);
         }
         case JANET_STRUCT: {
             const JanetKV *st = janet_unwrap_struct(ds);
+            if (janet_checkinterned(key))
+                return janet_struct_get_interned(st, key);
             return janet_struct_get(st, key);
         }
         case JANET_FIBER: {
@@ -726,6 +737,7 @@ void janet_putindex(Janet ds, int32_t index, Janet value) {
                 janet_array_ensure(array, index + 1, 2);
                 array->count = index + 1;
             }
+            janet_gc_barrier(array);
             array->data[index] = value;
             break;
         }
@@ -769,6 +781,7 @@ void janet_put(Janet ds, Janet key, Janet value) {
             if (index >= array->count) {
                 janet_array_setcount(array, index + 1);
             }
+            janet_gc_barrier(array);
             array->data[index] = value;
             break;
         }
@@ -91,11 +91,59 @@
 
 /* Next instruction variations */
 #define maybe_collect() do {\
-    if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect(); } while (0)
+    if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect_auto(); } while (0)
 #define vm_checkgc_next() maybe_collect(); vm_next()
 #define vm_pcnext() pc++; vm_next()
 #define vm_checkgc_pcnext() maybe_collect(); vm_pcnext()
 
+/* Run the machine code for the instruction at pc, if the function has been
+ * compiled, and continue in the interpreter where it stops. Used where hot
+ * code is likely to start: function entry, loop back edges, and after calls.
+ * Machine code that made calls of its own may stop in another frame, or with
+ * the stack moved. Then it returns -1 and the state is in the fiber. */
+#ifdef JANET_JIT
+#define vm_jit_enter() do { \
+    JanetJit *_jit = func->def->jit; \
+    if (NULL != _jit) { \
+        int32_t _index = (int32_t)(pc - func->def->bytecode); \
+        if (_jit->entries[_index]) { \
+            int32_t _next = janet_jit_run(_jit, stack, _index); \
+            if (_next < 0) { \
+                vm_restore(); \
+            } else { \
+                pc = func->def->bytecode + _next; \
+            } \
+        } \
+    } \
+} while (0)
+#define vm_jit_loop() do { \
+    if (NULL == func->def->jit) janet_jit_tick(func->def); \
+    vm_jit_enter(); \
+} while (0)
+#else
+#define vm_jit_enter()
+#define vm_jit_loop()
+#endif
+#define vm_checkgc_jit_next() maybe_collect(); vm_jit_enter(); vm_next()
+#define vm_jit_pcnext() pc++; vm_jit_enter(); vm_next()
+#define vm_checkgc_jit_pcnext() maybe_collect(); vm_jit_pcnext()
+
+/* Look up a keyword or symbol key in a table or struct without going through
+ * janet_get. Uses a plain block since vm_pcnext may expand to continue. */
+#define vm_get_interned() { \
+    Janet _ds = stack[B]; \
+    Janet _key = stack[C]; \
+    if (janet_checkinterned(_key)) { \
+        if (janet_checktype(_ds, JANET_TABLE)) { \
+            stack[A] = janet_table_get_interned(janet_unwrap_table(_ds), _key); \
+            vm_pcnext(); \
+        } else if (janet_checktype(_ds, JANET_STRUCT)) { \
+            stack[A] = janet_struct_get_interned(janet_unwrap_struct(_ds), _key); \
+            vm_pcnext(); \
+        } \
+    } \
+}
+
 /* Handle certain errors in main vm loop */
 #define vm_throw(e) do { vm_commit(); janet_panic(e); } while (0)
 #define vm_assert(cond, e) do {if (!(cond)) vm_throw((e)); } while (0)
@@ -222,6 +270,68 @@
         }\
     }
 
+/* Finish a comparison fused with the JOP_JUMP_IF or JOP_JUMP_IF_NOT that
+ * follows it. The result is still stored, so a breakpoint on the branch just
+ * runs the branch on its own. */
+#define vm_branch(cond) \
+    {\
+        int _cond = (cond);\
+        stack[A] = janet_wrap_boolean(_cond);\
+        uint32_t _next = *++pc;\
+        if (_next & 0x80) {\
+            vm_next();\
+        }\
+        if (_cond ^ ((_next & 0x7F) != JOP_JUMP_IF)) {\
+            int32_t _offset = (int32_t) _next >> 16;\
+            vm_maybe_auto_suspend(_offset <= 0);\
+            pc += _offset;\
+        } else {\
+            pc++;\
+        }\
+        vm_next();\
+    }
+#define vm_compop_branch(op) \
+    {\
+        Janet op1 = stack[B];\
+        Janet op2 = stack[C];\
+        int _c;\
+        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
+            _c = janet_unwrap_number(op1) op janet_unwrap_number(op2);\
+        } else {\
+            vm_commit();\
+            _c = janet_compare(op1, op2) op 0;\
+            maybe_collect();\
+        }\
+        vm_branch(_c);\
+    }
+#define vm_compop_imm_branch(op) \
+    {\
+        Janet op1 = stack[B];\
+        int _c;\
+        if (janet_checktype(op1, JANET_NUMBER)) {\
+            _c = janet_unwrap_number(op1) op (double) CS;\
+        } else {\
+            vm_commit();\
+            _c = janet_compare(op1, janet_wrap_integer(CS)) op 0;\
+            maybe_collect();\
+        }\
+        vm_branch(_c);\
+    }
+
+/* Go on to the instruction after a superinstruction without dispatching,
+ * unless that instruction has a breakpoint. */
+#ifdef JANET_USE_COMPUTED_GOTOS
+#define vm_fused_next(op) { pc++; if (*pc & 0x80) { vm_next(); } goto label_##op; }
+#else
+#define vm_fused_next(op) { pc++; vm_next(); }
+#endif
+
+#define vm_load_constant() do { \
+    int32_t cindex = (int32_t)E; \
+    vm_assert(cindex < func->def->constants_length, "invalid constant"); \
+    stack[A] = func->def->constants[cindex]; \
+} while (0)
+
 /* Trace a function call */
 static void vm_do_trace(JanetFunction *func, int32_t argc, const Janet *argv) {
     if (func->def->name) {
@@ -285,11 +395,197 @@ static Janet method_to_fun(Janet method, Janet obj) {
     return janet_get(obj, method);
 }
 
-/* Get a callable from a keyword method name and ensure that it is valid. */
-static Janet resolve_method(Janet name, JanetFiber *fiber) {
+#ifdef JANET_METHOD_CACHE
+
+/* Each call site gets a small set of entries keyed on the prototype of the
+ * receiving table. An entry is only valid while janet_vm.lookup_epoch is
+ * unchanged; every table between the prototype and the table holding the
+ * method is watched so that changing or freeing it bumps the epoch. Entries
+ * hold no references, so a stale prototype pointer is never followed. */
+#define JANET_METHOD_CACHE_WAYS 4
+#define JANET_METHOD_CACHE_EVICT_RATE 16
+
+typedef struct {
+    int32_t offset;
+    uint64_t epoch;
+    JanetTable *proto;
+    const uint8_t *name;
+    Janet method;
+} JanetMethodCacheEntry;
+
+struct JanetMethodCache {
+    int32_t mask;
+    uint32_t misses;
+    JanetMethodCacheEntry entries[];
+};
+
+/* Caches are kept in a map keyed on the funcdef rather than in the funcdef itself,
+ * with linear probing so that entries can be removed without tombstones. */
+static uint32_t method_cache_hash(JanetFuncDef *def) {
+    uint64_t h = (uint64_t)(uintptr_t) def;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+static JanetMethodCacheSlot *method_cache_find(JanetMethodCacheSlot *slots, uint32_t capacity, JanetFuncDef *def) {
+    uint32_t mask = capacity - 1;
+    uint32_t i = method_cache_hash(def) & mask;
+    while (slots[i].def != NULL && slots[i].def != def) {
+        i = (i + 1) & mask;
+    }
+    return slots + i;
+}
+
+static void method_cache_insert(JanetFuncDef *def, JanetMethodCache *cache) {
+    if (2 * (janet_vm.method_caches_count + 1) > janet_vm.method_caches_capacity) {
+        uint32_t newcap = janet_vm.method_caches_capacity ? 2 * janet_vm.method_caches_capacity : 64;
+        JanetMethodCacheSlot *slots = janet_malloc(sizeof(JanetMethodCacheSlot) * newcap);
+        if (NULL == slots) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (uint32_t i = 0; i < newcap; i++) slots[i].def = NULL;
+        for (uint32_t i = 0; i < janet_vm.method_caches_capacity; i++) {
+            JanetMethodCacheSlot *old = janet_vm.method_caches + i;
+            if (old->def) *method_cache_find(slots, newcap, old->def) = *old;
+        }
+        janet_free(janet_vm.method_caches);
+        janet_vm.method_caches = slots;
+        janet_vm.method_caches_capacity = newcap;
+    }
+    JanetMethodCacheSlot *slot = method_cache_find(janet_vm.method_caches, janet_vm.method_caches_capacity, def);
+    janet_vm.method_caches_count++;
+    slot->def = def;
+    slot->cache = cache;
+}
+
+/* Free the method cache of a funcdef that is being freed, if it has one */
+void janet_method_cache_forget(JanetFuncDef *def) {
+    if (!janet_vm.method_caches_count) return;
+    JanetMethodCacheSlot *slots = janet_vm.method_caches;
+    uint32_t mask = janet_vm.method_caches_capacity - 1;
+    uint32_t i = (uint32_t)(method_cache_find(slots, janet_vm.method_caches_capacity, def) - slots);
+    if (NULL == slots[i].def) return;
+    janet_free(slots[i].cache);
+    janet_vm.method_caches_count--;
+    /* Shift back later entries of the probe sequence into the hole */
+    for (uint32_t j = i;;) {
+        slots[i].def = NULL;
+        for (;;) {
+            j = (j + 1) & mask;
+            if (NULL == slots[j].def) return;
+            uint32_t home = method_cache_hash(slots[j].def) & mask;
+            if (((j - home) & mask) >= ((j - i) & mask)) break;
+        }
+        slots[i] = slots[j];
+        i = j;
+    }
+}
+
+void janet_method_caches_deinit(void) {
+    for (uint32_t i = 0; i < janet_vm.method_caches_capacity; i++) {
+        if (NULL != janet_vm.method_caches[i].def) janet_free(janet_vm.method_caches[i].cache);
+    }
+    janet_free(janet_vm.method_caches);
+    janet_vm.method_caches = NULL;
+    janet_vm.method_caches_count = 0;
+    janet_vm.method_caches_capacity = 0;
+}
+
+static JanetMethodCache *method_cache_new(JanetFuncDef *def) {
+    int32_t sites = 0;
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        uint32_t op = def->bytecode[i] & 0x7F;
+        if (op == JOP_CALL || op == JOP_TAILCALL) sites++;
+    }
+    int32_t sets = janet_tablen(sites);
+    if (sets < 1) sets = 1;
+    size_t count = (size_t) sets * JANET_METHOD_CACHE_WAYS;
+    JanetMethodCache *cache = janet_malloc(sizeof(JanetMethodCache) + count * sizeof(JanetMethodCacheEntry));
+    if (NULL == cache) {
+        JANET_OUT_OF_MEMORY;
+    }
+    cache->mask = sets - 1;
+    cache->misses = 0;
+    for (size_t i = 0; i < count; i++) {
+        cache->entries[i].offset = -1;
+        cache->entries[i].proto = NULL;
+    }
+    method_cache_insert(def, cache);
+    return cache;
+}
+
+/* Look up a method on a table with a prototype, going through the cache of
+ * the call site at offset in def. Methods found on the receiver itself, and
+ * lookups that pass through weak tables, are not cached. */
+static Janet method_cache_lookup(JanetFuncDef *def, int32_t offset, Janet name, JanetTable *self) {
+    JanetMethodCache *cache = NULL;
+    if (janet_vm.method_caches_count) {
+        JanetMethodCacheSlot *slot = method_cache_find(janet_vm.method_caches, janet_vm.method_caches_capacity, def);
+        if (NULL != slot->def) cache = slot->cache;
+    }
+    if (NULL == cache) cache = method_cache_new(def);
+    JanetMethodCacheEntry *set = cache->entries + (size_t)(offset & cache->mask) * JANET_METHOD_CACHE_WAYS;
+    const uint8_t *key = janet_unwrap_keyword(name);
+    uint64_t epoch = janet_vm.lookup_epoch;
+    for (int i = 0; i < JANET_METHOD_CACHE_WAYS; i++) {
+        JanetMethodCacheEntry *e = set + i;
+        if (e->offset == offset && e->proto == self->proto && e->name == key && e->epoch == epoch) {
+            if (self->count) {
+                Janet own = janet_table_rawget(self, name);
+                if (!janet_checktype(own, JANET_NIL)) return own;
+            }
+            return e->method;
+        }
+    }
+    JanetTable *which = NULL;
+    Janet method = janet_table_get_ex(self, name, &which);
+    if (NULL == which || which == self) return method;
+    /* Prefer a free or stale way. Once every way is in use the site is
+     * likely megamorphic, so only evict on a fraction of the misses. */
+    JanetMethodCacheEntry *victim = NULL;
+    for (int i = 0; i < JANET_METHOD_CACHE_WAYS; i++) {
+        if (set[i].offset == -1 || set[i].epoch != epoch) {
+            victim = set + i;
+            break;
+        }
+    }
+    if (NULL == victim) {
+        uint32_t misses = cache->misses++;
+        if (misses % JANET_METHOD_CACHE_EVICT_RATE) return method;
+        victim = set + (misses / JANET_METHOD_CACHE_EVICT_RATE) % JANET_METHOD_CACHE_WAYS;
+    }
+    if (!janet_table_watch(self->proto, which)) return method;
+    victim->offset = offset;
+    victim->epoch = epoch;
+    victim->proto = self->proto;
+    victim->name = key;
+    victim->method = method;
+    return method;
+}
+
+#endif
+
+/* Get a callable from a keyword method name and ensure that it is valid.
+ * The call instruction at pc in func is used to cache the lookup. */
+static Janet resolve_method(Janet name, JanetFiber *fiber, JanetFunction *func, const uint32_t *pc) {
     int32_t argc = fiber->stacktop - fiber->stackstart;
     if (argc < 1) janet_panicf("method call (%v) takes at least 1 argument, got 0", name);
-    Janet callee = method_to_fun(name, fiber->data[fiber->stackstart]);
+    Janet self = fiber->data[fiber->stackstart];
+    Janet callee;
+#ifdef JANET_METHOD_CACHE
+    if (janet_checktype(self, JANET_TABLE) && NULL != janet_unwrap_table(self)->proto) {
+        callee = method_cache_lookup(func->def, (int32_t)(pc - func->def->bytecode), name,
+                                     janet_unwrap_table(self));
+    } else {
+        callee = method_to_fun(name, self);
+    }
+#else
+    (void) func;
+    (void) pc;
+    callee = method_to_fun(name, self);
+#endif
     if (janet_checktype(callee, JANET_NIL))
         janet_panicf("unknown method %v invoked on %v", name, fiber->data[fiber->stackstart]);
     return callee;
@@ -416,21 +712,21 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         &&label_JOP_NOT_EQUALS,
         &&label_JOP_NOT_EQUALS_IMMEDIATE,
         &&label_JOP_CANCEL,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
+        &&label_JOP_GET_IMMEDIATE,
+        &&label_JOP_IN_IMMEDIATE,
+        &&label_JOP_LESS_THAN_BRANCH,
+        &&label_JOP_LESS_THAN_EQUAL_BRANCH,
+        &&label_JOP_LESS_THAN_IMMEDIATE_BRANCH,
+        &&label_JOP_GREATER_THAN_BRANCH,
+        &&label_JOP_GREATER_THAN_EQUAL_BRANCH,
+        &&label_JOP_GREATER_THAN_IMMEDIATE_BRANCH,
+        &&label_JOP_EQUALS_BRANCH,
+        &&label_JOP_EQUALS_IMMEDIATE_BRANCH,
+        &&label_JOP_NOT_EQUALS_BRANCH,
+        &&label_JOP_NOT_EQUALS_IMMEDIATE_BRANCH,
+        &&label_JOP_LOAD_CONSTANT_PUSH,
+        &&label_JOP_LOAD_CONSTANT_CALL,
+        &&label_JOP_LOAD_CONSTANT_TAILCALL,
         &&label_unknown_op,
         &&label_unknown_op,
         &&label_unknown_op,
@@ -663,7 +959,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
         stack[A] = retval;
-        vm_checkgc_pcnext();
+        vm_checkgc_jit_pcnext();
     }
 
     VM_OP(JOP_RETURN_NIL) {
@@ -673,7 +969,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
         stack[A] = retval;
-        vm_checkgc_pcnext();
+        vm_checkgc_jit_pcnext();
     }
 
     VM_OP(JOP_ADD_IMMEDIATE)
@@ -798,8 +1094,13 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     vm_pcnext();
 
     VM_OP(JOP_JUMP)
-    vm_maybe_auto_suspend(DS <= 0);
-    pc += DS;
+    if (DS <= 0) {
+        vm_maybe_auto_suspend(1);
+        pc += DS;
+        vm_jit_loop();
+    } else {
+        pc += DS;
+    }
     vm_next();
 
     VM_OP(JOP_JUMP_IF)
@@ -872,6 +1173,36 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     stack[A] = janet_wrap_boolean(!janet_checktype(stack[B], JANET_NUMBER) || (janet_unwrap_number(stack[B]) != (double) CS));
     vm_pcnext();
 
+    VM_OP(JOP_LESS_THAN_BRANCH)
+    vm_compop_branch( <);
+
+    VM_OP(JOP_LESS_THAN_EQUAL_BRANCH)
+    vm_compop_branch( <=);
+
+    VM_OP(JOP_LESS_THAN_IMMEDIATE_BRANCH)
+    vm_compop_imm_branch( <);
+
+    VM_OP(JOP_GREATER_THAN_BRANCH)
+    vm_compop_branch( >);
+
+    VM_OP(JOP_GREATER_THAN_EQUAL_BRANCH)
+    vm_compop_branch( >=);
+
+    VM_OP(JOP_GREATER_THAN_IMMEDIATE_BRANCH)
+    vm_compop_imm_branch( >);
+
+    VM_OP(JOP_EQUALS_BRANCH)
+    vm_branch(janet_equals(stack[B], stack[C]));
+
+    VM_OP(JOP_EQUALS_IMMEDIATE_BRANCH)
+    vm_branch(janet_checktype(stack[B], JANET_NUMBER) && (janet_unwrap_number(stack[B]) == (double) CS));
+
+    VM_OP(JOP_NOT_EQUALS_BRANCH)
+    vm_branch(!janet_equals(stack[B], stack[C]));
+
+    VM_OP(JOP_NOT_EQUALS_IMMEDIATE_BRANCH)
+    vm_branch(!janet_checktype(stack[B], JANET_NUMBER) || (janet_unwrap_number(stack[B]) != (double) CS));
+
     VM_OP(JOP_COMPARE)
     stack[A] = janet_wrap_integer(janet_compare(stack[B], stack[C]));
     vm_pcnext();
@@ -901,12 +1232,21 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     stack[A] = janet_wrap_integer(ES);
     vm_pcnext();
 
-    VM_OP(JOP_LOAD_CONSTANT) {
-        int32_t cindex = (int32_t)E;
-        vm_assert(cindex < func->def->constants_length, "invalid constant");
-        stack[A] = func->def->constants[cindex];
-        vm_pcnext();
-    }
+    VM_OP(JOP_LOAD_CONSTANT)
+    vm_load_constant();
+    vm_pcnext();
+
+    VM_OP(JOP_LOAD_CONSTANT_PUSH)
+    vm_load_constant();
+    vm_fused_next(JOP_PUSH);
+
+    VM_OP(JOP_LOAD_CONSTANT_CALL)
+    vm_load_constant();
+    vm_fused_next(JOP_CALL);
+
+    VM_OP(JOP_LOAD_CONSTANT_TAILCALL)
+    vm_load_constant();
+    vm_fused_next(JOP_TAILCALL);
 
     VM_OP(JOP_LOAD_SELF)
     stack[D] = janet_wrap_function(func);
@@ -941,6 +1281,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         if (env->offset > 0) {
             env->as.fiber->data[env->offset + vindex] = stack[A];
         } else {
+            janet_gc_barrier(env);
             env->as.values[vindex] = stack[A];
         }
         vm_pcnext();
@@ -1015,7 +1356,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
         if (janet_checktype(callee, JANET_KEYWORD)) {
             vm_commit();
-            callee = resolve_method(callee, fiber);
+            callee = resolve_method(callee, fiber, func, pc);
         }
         if (janet_checktype(callee, JANET_FUNCTION)) {
             func = janet_unwrap_function(callee);
@@ -1030,7 +1371,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             }
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
-            vm_checkgc_next();
+            vm_checkgc_jit_next();
         } else if (janet_checktype(callee, JANET_CFUNCTION)) {
             vm_commit();
             int32_t argc = fiber->stacktop - fiber->stackstart;
@@ -1039,11 +1380,11 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             janet_fiber_popframe(fiber);
             stack = fiber->data + fiber->frame;
             stack[A] = ret;
-            vm_checkgc_pcnext();
+            vm_checkgc_jit_pcnext();
         } else {
             vm_commit();
             stack[A] = call_nonfn(fiber, callee);
-            vm_pcnext();
+            vm_jit_pcnext();
         }
     }
 
@@ -1055,7 +1396,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
         if (janet_checktype(callee, JANET_KEYWORD)) {
             vm_commit();
-            callee = resolve_method(callee, fiber);
+            callee = resolve_method(callee, fiber, func, pc);
         }
         if (janet_checktype(callee, JANET_FUNCTION)) {
             func = janet_unwrap_function(callee);
@@ -1070,7 +1411,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             }
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
-            vm_checkgc_next();
+            vm_checkgc_jit_next();
         } else {
             Janet retreg;
             int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
@@ -1089,7 +1430,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             }
             vm_restore();
             stack[A] = retreg;
-            vm_checkgc_pcnext();
+            vm_checkgc_jit_pcnext();
         }
     }
 
@@ -1168,11 +1509,13 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     vm_checkgc_pcnext();
 
     VM_OP(JOP_IN)
+    vm_get_interned();
     vm_commit();
     stack[A] = janet_in(stack[B], stack[C]);
     vm_pcnext();
 
     VM_OP(JOP_GET)
+    vm_get_interned();
     vm_commit();
     stack[A] = janet_get(stack[B], stack[C]);
     vm_pcnext();
@@ -1182,6 +1525,34 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     stack[A] = janet_getindex(stack[B], C);
     vm_pcnext();
 
+    VM_OP(JOP_GET_IMMEDIATE) {
+        Janet ds = stack[B];
+        int32_t index = CS;
+        if (janet_checktype(ds, JANET_ARRAY) && index >= 0 && index < janet_unwrap_array(ds)->count) {
+            stack[A] = janet_unwrap_array(ds)->data[index];
+        } else if (janet_checktype(ds, JANET_TUPLE) && index >= 0 && index < janet_tuple_length(janet_unwrap_tuple(ds))) {
+            stack[A] = janet_unwrap_tuple(ds)[index];
+        } else {
+            vm_commit();
+            stack[A] = janet_get(ds, janet_wrap_integer(index));
+        }
+        vm_pcnext();
+    }
+
+    VM_OP(JOP_IN_IMMEDIATE) {
+        Janet ds = stack[B];
+        int32_t index = CS;
+        if (janet_checktype(ds, JANET_ARRAY) && index >= 0 && index < janet_unwrap_array(ds)->count) {
+            stack[A] = janet_unwrap_array(ds)->data[index];
+        } else if (janet_checktype(ds, JANET_TUPLE) && index >= 0 && index < janet_tuple_length(janet_unwrap_tuple(ds))) {
+            stack[A] = janet_unwrap_tuple(ds)[index];
+        } else {
+            vm_commit();
+            stack[A] = janet_in(ds, janet_wrap_integer(index));
+        }
+        vm_pcnext();
+    }
+
     VM_OP(JOP_LENGTH)
     vm_commit();
     stack[A] = janet_lengthv(stack[E]);
@@ -1279,8 +1650,10 @@ JanetSignal janet_step(JanetFiber *fiber, Janet in, Janet *out) {
         janet_panicf("cannot step fiber with status :%s", janet_status_names[status]);
     }
 
-    /* Get PC for setting breakpoints */
-    uint32_t *pc = janet_stack_frame(fiber->data + fiber->frame)->pc;
+    /* Get PC for setting breakpoints. Machine code would run past them. */
+    JanetStackFrame *frame = janet_stack_frame(fiber->data + fiber->frame);
+    uint32_t *pc = frame->pc;
+    if (NULL != frame->func) janet_jit_invalidate(frame->func->def);
 
     /* Check current opcode (sans debug flag). This tells us where the next or next two candidate
      * instructions will be. Usually it's the next instruction in memory,
@@ -1600,11 +1973,55 @@ int janet_init(void) {
 
     /* Garbage collection */
     janet_vm.blocks = NULL;
+    janet_vm.old_blocks = NULL;
     janet_vm.weak_blocks = NULL;
     janet_vm.next_collection = 0;
     janet_vm.gc_interval = 0x400000;
     janet_vm.block_count = 0;
     janet_vm.gc_mark_phase = 0;
+    janet_vm.gc_generational = 0;
+    janet_vm.gc_old_count = 0;
+    janet_vm.gc_old_limit = 0;
+    janet_vm.gc_remembered = NULL;
+    janet_vm.gc_remembered_count = 0;
+    janet_vm.gc_remembered_capacity = 0;
+    janet_vm.gc_cycle = 0;
+    janet_vm.gc_budget = 0;
+    janet_vm.gc_barrier_mask = 0;
+    janet_vm.gc_barrier_match = 1;
+    janet_vm.gc_gray = NULL;
+    janet_vm.gc_gray_count = 0;
+    janet_vm.gc_gray_capacity = 0;
+    janet_vm.gc_rescan = NULL;
+    janet_vm.gc_rescan_count = 0;
+    janet_vm.gc_rescan_capacity = 0;
+    janet_vm.sweep_blocks = NULL;
+    janet_vm.sweep_old_blocks = NULL;
+#ifdef JANET_GC_SLAB
+    for (int i = 0; i < JANET_SLAB_CLASSES; i++) {
+        janet_vm.slab_pages[i] = NULL;
+    }
+    janet_vm.slab_free_pages = NULL;
+    janet_vm.slab_chunks = NULL;
+#endif
+#ifdef JANET_LAZY_IMAGE
+    janet_vm.lazy_defs = NULL;
+    janet_vm.lazy_defs_count = 0;
+    janet_vm.lazy_defs_capacity = 0;
+#endif
+#ifdef JANET_METHOD_CACHE
+    janet_vm.method_caches = NULL;
+    janet_vm.method_caches_count = 0;
+    janet_vm.method_caches_capacity = 0;
+#endif
+#ifdef JANET_JIT
+    janet_vm.jit_retired = NULL;
+#endif
+    janet_vm.lookup_epoch = 0;
+    for (int i = 0; i < JANET_DYN_CACHE_SIZE; i++) {
+        janet_vm.dyn_cache[i].env = NULL;
+        janet_vm.dyn_cache[i].cname = NULL;
+    }
 
     janet_symcache_init();
 
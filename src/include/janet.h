@@ -223,6 +223,27 @@ extern "C" {
 #define JANET_NET
 #endif
 
+/* Enable or disable the slab allocator for small gc objects */
+#ifndef JANET_NO_GC_SLAB
+#define JANET_GC_SLAB
+#endif
+
+/* Enable or disable deferred loading of function bodies from images */
+#ifndef JANET_NO_LAZY_IMAGE
+#define JANET_LAZY_IMAGE
+#endif
+
+/* Enable or disable per call site caches of method lookups */
+#ifndef JANET_NO_METHOD_CACHE
+#define JANET_METHOD_CACHE
+#endif
+
+/* Enable or disable sharing the symbols interned by the core environment
+ * between all vms in the process */
+#if !defined(JANET_NO_SYMBOL_POOL) && defined(JANET_EV) && !defined(JANET_SINGLE_THREADED)
+#define JANET_SYMBOL_POOL
+#endif
+
 /* Enable or disable large int types (for now 64 bit, maybe 128 / 256 bit integer types) */
 #ifndef JANET_NO_INT_TYPES
 #define JANET_INT_TYPES
@@ -233,6 +254,14 @@ extern "C" {
 #define JANET_EV_EPOLL
 #endif
 
+/* Enable or disable io_uring on Linux. Needs kernel headers from Linux 5.11 or later,
+ * and falls back to epoll at runtime if the kernel does not support it. */
+#if defined(JANET_EV) && defined(JANET_EV_EPOLL) && !defined(JANET_EV_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define JANET_EV_IO_URING
+#endif
+#endif
+
 /* Enable or disable kqueue on BSD */
 #if defined(JANET_BSD) && !defined(JANET_EV_NO_KQUEUE)
 #define JANET_EV_KQUEUE
@@ -316,6 +345,12 @@ extern "C" {
 #endif
 #endif
 
+/* Compiling hot functions to machine code is off unless JANET_JIT is defined. The
+ * baseline JIT only supports x86-64 with nanboxed values. */
+#if defined(JANET_JIT) && !(defined(JANET_NANBOX_64) && (defined(__x86_64__) || defined(_M_X64)))
+#undef JANET_JIT
+#endif
+
 /* Runtime config constants */
 #ifdef JANET_NO_NANBOX
 #define JANET_NANBOX_BIT 0
@@ -467,6 +502,7 @@ typedef struct JanetAbstractHead JanetAbstractHead;
 
 /* Other structs */
 typedef struct JanetFuncDef JanetFuncDef;
+typedef struct JanetJit JanetJit;
 typedef struct JanetFuncEnv JanetFuncEnv;
 typedef struct JanetKV JanetKV;
 typedef struct JanetStackFrame JanetStackFrame;
@@ -964,6 +1000,8 @@ struct JanetFiber {
     JanetStream *ev_stream; /* which stream we are waiting on */
     void *ev_state; /* Extra data for ev callback state. On windows, first element must be OVERLAPPED. */
     void *supervisor_channel; /* Channel to push self to when complete */
+    void *ev_timeout; /* Pending timeout for the current event, removed when the fiber is rescheduled */
+    void *ev_request; /* Request submitted to the io_uring event loop for this fiber */
 #endif
 };
 
@@ -1065,6 +1103,7 @@ struct JanetAbstractHead {
 #define JANET_FUNCDEF_FLAG_HASSOURCEMAP 0x800000
 #define JANET_FUNCDEF_FLAG_STRUCTARG 0x1000000
 #define JANET_FUNCDEF_FLAG_HASCLOBITSET 0x2000000
+#define JANET_FUNCDEF_FLAG_LAZY 0x4000000
 #define JANET_FUNCDEF_FLAG_TAG 0xFFFF
 
 /* Source mapping structure for a bytecode instruction */
@@ -1106,6 +1145,10 @@ struct JanetFuncDef {
     int32_t environments_length;
     int32_t defs_length;
     int32_t symbolmap_length;
+#ifdef JANET_JIT
+    int32_t jit_counter; /* Calls and loop iterations until compiling to machine code */
+    JanetJit *jit; /* Machine code for hot functions */
+#endif
 };
 
 /* A function environment */
@@ -1382,6 +1425,23 @@ enum JanetOpCode {
     JOP_NOT_EQUALS,
     JOP_NOT_EQUALS_IMMEDIATE,
     JOP_CANCEL,
+    JOP_GET_IMMEDIATE,
+    JOP_IN_IMMEDIATE,
+    /* Superinstructions. These run as the instruction they are named after,
+     * then go straight on to the instruction that must follow them. */
+    JOP_LESS_THAN_BRANCH,
+    JOP_LESS_THAN_EQUAL_BRANCH,
+    JOP_LESS_THAN_IMMEDIATE_BRANCH,
+    JOP_GREATER_THAN_BRANCH,
+    JOP_GREATER_THAN_EQUAL_BRANCH,
+    JOP_GREATER_THAN_IMMEDIATE_BRANCH,
+    JOP_EQUALS_BRANCH,
+    JOP_EQUALS_IMMEDIATE_BRANCH,
+    JOP_NOT_EQUALS_BRANCH,
+    JOP_NOT_EQUALS_IMMEDIATE_BRANCH,
+    JOP_LOAD_CONSTANT_PUSH,
+    JOP_LOAD_CONSTANT_CALL,
+    JOP_LOAD_CONSTANT_TAILCALL,
     JOP_INSTRUCTION_COUNT
 };
 
@@ -1785,6 +1845,9 @@ JANET_API JanetModule janet_native(const char *name, JanetString *error);
 /* Marshaling */
 #define JANET_MARSHAL_UNSAFE 0x20000
 #define JANET_MARSHAL_NO_CYCLES 0x40000
+/* Write funcdef bodies so they can be decoded on first use. When passed to
+ * janet_unmarshal, the bytes must stay valid for the lifetime of the VM. */
+#define JANET_MARSHAL_LAZY 0x80000
 
 JANET_API void janet_marshal(
     JanetBuffer *buf,
@@ -1811,6 +1874,11 @@ JANET_API int janet_gcunrootall(Janet root);
 JANET_API int janet_gclock(void);
 JANET_API void janet_gcunlock(int handle);
 JANET_API void janet_gcpressure(size_t s);
+JANET_API void janet_gcsetgenerational(int enable);
+JANET_API void janet_gcsetbudget(uint32_t budget);
+/* Call before writing references directly into the memory of a gc object
+ * (such as array->data) when generational or incremental collection may be enabled. */
+JANET_API void janet_gcbarrier(void *mem);
 
 /* Functions */
 JANET_API JanetFuncDef *janet_funcdef_alloc(void);
@@ -2191,6 +2259,9 @@ typedef enum {
     RULE_SPLIT,        /* [rule, rule] */
     RULE_NTH,          /* [nth, rule, tag] */
     RULE_ONLY_TAGS,    /* [rule] */
+    RULE_MEMO,         /* [rule] */
+    RULE_SPAN,         /* [lo, hi, bitmap (8 words)] */
+    RULE_DISPATCH,     /* [len, rules..., bitmaps (8 words per rule)] */
 } JanetPegOpcod;
 
 typedef struct {